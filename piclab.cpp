@@ -5,26 +5,45 @@
 //  - Asks to Overwrite (Yes) or Save a Copy (No -> "<name>_labeled.png").
 //  - Translucent black scrim + white text.
 //  - Strong diagnostics and Explorer refresh.
+//  - Headless mode when any "--" option is given (see piclab_cli.cpp): no dialogs,
+//    exit codes and stderr only.
+//  - Hands the job to a running "piclab --service" when there is one (piclab_service.*).
+//  - One prompt for a whole selection even when Explorer starts a process per file
+//    (piclab_instance.*).
+//
+// Image work lives in the portable core (piclab_core.*); this file is only the Win32 front end.
 //
 // Build:
-//   cl /EHsc /W4 piclab.cpp gdiplus.lib user32.lib gdi32.lib comdlg32.lib shlwapi.lib shell32.lib
+//   cl /EHsc /W4 /std:c++17 piclab.cpp piclab_cli.cpp piclab_core.cpp piclab_png.cpp
+//      piclab_font.cpp piclab_io.cpp piclab_pool.cpp piclab_inflate.cpp piclab_deflate.cpp
+//      piclab_checksum.cpp piclab_kernels.cpp piclab_filters.cpp piclab_bench.cpp piclab_cpu.cpp
+//      piclab_codecs.cpp piclab_qoi.cpp piclab_pam.cpp piclab_ipc.cpp piclab_service.cpp piclab_lanes.cpp
+//      piclab_instance.cpp piclab_cache.cpp piclab_watch.cpp piclab_gdiplus.cpp
+//      zlib.lib gdiplus.lib user32.lib gdi32.lib comdlg32.lib shlwapi.lib shell32.lib
+//   Optional lossless JPEG labeling: add /DPICLAB_HAVE_LIBJPEG piclab_jpeg.cpp jpeg.lib
 
 #define NOMINMAX
 #include <algorithm>
 #include <windows.h>
-#include <gdiplus.h>
 #include <shlwapi.h>
 #include <shellapi.h> // CommandLineToArgvW
 #include <shlobj.h>   // SHChangeNotify
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <cstdio>
 
-#pragma comment(lib, "gdiplus.lib")
+#include "piclab_cli.h"
+#include "piclab_core.h"
+#include "piclab_instance.h"
+#include "piclab_service.h"
+
 #pragma comment(lib, "shlwapi.lib")
 #pragma comment(lib, "shell32.lib")
 
-using namespace Gdiplus;
+// Compression time allowed per image when saving from the dialog.
+static const uint32_t kInteractiveBudgetMs = 1000;
 
 // ----------------------------- Helpers -----------------------------
 
@@ -39,57 +58,18 @@ static void MsgBox(HWND parent, const std::wstring& text, UINT type = MB_OK | MB
     MessageBoxW(parent, text.c_str(), L"PNG Labeler", type);
 }
 
-static std::wstring LastErrorText(DWORD err = GetLastError()) {
-    LPWSTR buf = nullptr;
-    DWORD flags = FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS;
-    FormatMessageW(flags, nullptr, err, 0, (LPWSTR)&buf, 0, nullptr);
-    std::wstring s = buf ? buf : L"";
-    if (buf) LocalFree(buf);
-    return s;
-}
-
-static int GetEncoderClsid(const WCHAR* format, CLSID* pClsid) {
-    UINT num = 0, size = 0;
-    GetImageEncodersSize(&num, &size);
-    if (size == 0) return -1;
-    std::vector<BYTE> mem(size);
-    ImageCodecInfo* enc = reinterpret_cast<ImageCodecInfo*>(mem.data());
-    if (GetImageEncoders(num, size, enc) != Ok) return -1;
-    for (UINT j = 0; j < num; ++j) {
-        if (wcscmp(enc[j].MimeType, format) == 0) {
-            *pClsid = enc[j].Clsid;
-            return (int)j;
-        }
-    }
-    return -1;
-}
-
-static std::wstring PathWithSuffixBeforeExt(const std::wstring& path, const std::wstring& suffix) {
-    size_t dot = path.find_last_of(L'.');
-    size_t slash = path.find_last_of(L"\\/");
-
-    if (dot == std::wstring::npos || (slash != std::wstring::npos && dot < slash)) {
-        return path + suffix; // no extension
-    }
-    std::wstring out = path;
-    out.insert(dot, suffix);
-    return out;
-}
-
-static std::wstring GetTempSiblingPath(const std::wstring& original) {
-    WCHAR drive[_MAX_DRIVE]{}, dir[_MAX_DIR]{}, fname[_MAX_FNAME]{}, ext[_MAX_EXT]{};
-    _wsplitpath_s(original.c_str(), drive, _MAX_DRIVE, dir, _MAX_DIR, fname, _MAX_FNAME, ext, _MAX_EXT);
-    WCHAR folder[MAX_PATH]{};
-    _wmakepath_s(folder, drive, dir, L"", L"");
-    WCHAR tmp[MAX_PATH];
-    swprintf_s(tmp, L"%s%s_label_tmp_%u.png", folder, fname, GetTickCount());
-    return std::wstring(tmp);
-}
-
 static void RefreshShellFor(const std::wstring& path) {
     SHChangeNotify(SHCNE_UPDATEITEM, SHCNF_PATHW, path.c_str(), nullptr);
 }
 
+// GUI-subsystem processes have no console; borrow the caller's so stderr reaches it.
+static void AttachParentConsole() {
+    if (!AttachConsole(ATTACH_PARENT_PROCESS)) return;
+    FILE* f = nullptr;
+    freopen_s(&f, "CONOUT$", "w", stderr);
+    SetConsoleOutputCP(CP_UTF8);
+}
+
 // ----------------------------- Label Prompt -----------------------------
 
 struct InputState {
@@ -200,128 +180,41 @@ static bool PromptForText(HINSTANCE hInst, std::wstring& out) {
     return st.accepted;
 }
 
-// ----------------------------- Image Processing -----------------------------
-
-static bool ProcessAndSave(const std::wstring& srcPath,
-                           const std::wstring& label,
-                           bool overwrite,
-                           std::wstring& outSavedPath,
-                           std::wstring& outError) {
-    GdiplusStartupInput gsi;
-    ULONG_PTR token;
-    if (GdiplusStartup(&token, &gsi, nullptr) != Ok) {
-        outError = L"GDI+ startup failed.";
-        return false;
-    }
-
-    bool ok = false;
-    Bitmap* bmp = Bitmap::FromFile(srcPath.c_str(), FALSE);
-    if (!bmp || bmp->GetLastStatus() != Ok) {
-        outError = L"Failed to load image. Is it a valid PNG?";
-        delete bmp;
-        GdiplusShutdown(token);
-        return false;
-    }
-
-    UINT w = bmp->GetWidth(), h = bmp->GetHeight();
-    Graphics g(bmp);
-    g.SetSmoothingMode(SmoothingModeHighQuality);
-    g.SetInterpolationMode(InterpolationModeHighQualityBicubic);
-    g.SetTextRenderingHint(TextRenderingHintClearTypeGridFit);
-
-    REAL pad    = (REAL)std::max<double>(8.0,  (double)h * 0.012);
-    REAL fontPt = (REAL)std::max<double>(10.0, (double)h * 0.042); // ~4.2% of height
-
-    const WCHAR* family = L"Segoe UI";
-    {
-        FontFamily test(L"Segoe UI");
-        if (!test.IsAvailable()) family = L"Arial";
-    }
-    Font font(family, fontPt, FontStyleBold, UnitPoint);
-
-    StringFormat sf(StringFormatFlagsNoClip);
-    sf.SetAlignment(StringAlignmentNear);
-    sf.SetLineAlignment(StringAlignmentCenter);
-    sf.SetTrimming(StringTrimmingEllipsisCharacter);
-
-    RectF layoutRect(0, 0, (REAL)w - 2 * pad, 1000);
-    RectF bounds{};
-    g.MeasureString(label.c_str(), (INT)label.size(), &font, layoutRect, &sf, &bounds);
-
-    REAL scrimH = bounds.Height + 2 * pad;
-    scrimH = (REAL)std::max<double>(scrimH, std::max<double>(h * 0.05, 18.0)); // min ~5% or 18px
-    scrimH = (REAL)std::min<double>(scrimH, h * 0.15); 
-   SolidBrush scrim(Color(120, 0, 0, 0)); // ~47% black
-    RectF scrimRect(0, (REAL)h - scrimH, (REAL)w, scrimH);
-    g.FillRectangle(&scrim, scrimRect);
-
-    SolidBrush white(Color(255, 255, 255, 255));
-    SolidBrush shadow(Color(160, 0, 0, 0));
-
-    RectF textRect(pad, (REAL)h - scrimH + pad, (REAL)w - 2 * pad, scrimH - 2 * pad);
-    RectF shadowRect = textRect; shadowRect.X += 1; shadowRect.Y += 1;
-    g.DrawString(label.c_str(), (INT)label.size(), &font, shadowRect, &sf, &shadow);
-    g.DrawString(label.c_str(), (INT)label.size(), &font, textRect,   &sf, &white);
-
-    CLSID pngClsid{};
-    if (GetEncoderClsid(L"image/png", &pngClsid) == -1) {
-        outError = L"PNG encoder not found (GDI+).";
-        delete bmp;
-        GdiplusShutdown(token);
-        return false;
-    }
-
-    if (overwrite) {
-        // Save to temp then atomically replace original
-        std::wstring tmp = GetTempSiblingPath(srcPath);
-        Status s = bmp->Save(tmp.c_str(), &pngClsid, nullptr);
-        if (s != Ok) {
-            outError = L"Save to temp failed (status " + std::to_wstring(s) + L").";
-        } else {
-            if (MoveFileExW(tmp.c_str(), srcPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED)) {
-                ok = true;
-                outSavedPath = srcPath;
-            } else {
-                DWORD e = GetLastError();
-                DeleteFileW(tmp.c_str());
-                outError = L"Replace original failed. Win32 error " + std::to_wstring(e) + L": " + LastErrorText(e);
-            }
-        }
-    } else {
-        // Save as a side-by-side copy
-        std::wstring dst = PathWithSuffixBeforeExt(srcPath, L"_labeled");
-        Status s = bmp->Save(dst.c_str(), &pngClsid, nullptr);
-        if (s == Ok) {
-            ok = true;
-            outSavedPath = dst;
-        } else {
-            outError = L"Save copy failed (status " + std::to_wstring(s) + L").";
-        }
-    }
-
-    delete bmp;
-    GdiplusShutdown(token);
-    return ok;
-}
-
 // ----------------------------- Entry -----------------------------
 
 int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int) {
     int argc = 0;
     LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
-    if (argc < 2) {
-        MsgBox(nullptr, L"Usage:\n  piclab.exe <image.png>");
-        return 1;
+    std::vector<std::wstring> args(argv + (argc > 0 ? 1 : 0), argv + argc);
+    LocalFree(argv);
+
+    if (piclab::IsHeadlessCommandLine(args)) {
+        AttachParentConsole();
+        return piclab::RunHeadless(args, RefreshShellFor);
     }
 
-    std::wstring path = argv[1];
-    LocalFree(argv);
+    if (args.empty()) {
+        MsgBox(nullptr, L"Usage:\n  piclab.exe <image.png>...\n  piclab.exe --help");
+        return 1;
+    }
 
-    if (!PathFileExistsW(path.c_str())) {
-        MsgBox(nullptr, L"File not found:\n" + path, MB_OK | MB_ICONERROR);
-        return 2;
+    // Explorer passes one path per selected file when the verb uses %*.
+    for (const std::wstring& path : args) {
+        if (!PathFileExistsW(path.c_str())) {
+            MsgBox(nullptr, L"File not found:\n" + path, MB_OK | MB_ICONERROR);
+            return 2;
+        }
     }
 
+    // With %1 Explorer starts one piclab per selected file instead. The first becomes the leader
+    // and keeps taking the others' paths while its dialogs are open; the rest stop here.
+    piclab::LaunchGatherer group;
+    std::vector<piclab::BatchItem> own;
+    for (const std::wstring& path : args) own.push_back({ path, L"" });
+    std::wstring groupErr;
+    const bool leading = group.Join(L"explorer", own, groupErr);
+    if (!leading && groupErr.empty()) return 0;
+
     std::wstring label;
     if (!PromptForText(hInst, label)) {
         // User cancelled or empty label
@@ -340,14 +233,67 @@ int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int) {
     if (choice == IDCANCEL) return 0;
     bool overwrite = (choice == IDYES);
 
-    std::wstring savedPath, err;
-    bool ok = ProcessAndSave(path, label, overwrite, savedPath, err);
-    if (!ok) {
+    std::vector<std::wstring> paths = args;
+    if (leading) {
+        paths.clear();
+        for (const piclab::BatchItem& it : group.Finish()) paths.push_back(it.path);
+    }
+
+    // A running service (piclab --service) already has GDI+ and its encoders up: hand it the same
+    // job as a command line. With --quiet only failures come back as report lines.
+    std::vector<std::wstring> request = { L"--label", label, overwrite ? L"--overwrite" : L"--copy", L"--quiet",
+                                          L"--latency-budget-ms", std::to_wstring(kInteractiveBudgetMs) };
+    if (overwrite) request.push_back(L"--verify");
+    request.push_back(L"--");
+    request.insert(request.end(), paths.begin(), paths.end());
+    std::wstring saved, failed;
+    piclab::HeadlessContext remote;
+    remote.report = [&](const std::wstring& line) { failed += line + L"\n"; };
+    remote.saved = [&](const std::wstring& path) {
+        RefreshShellFor(path);
+        saved += path + L"\n";
+    };
+    int rc = 0;
+    if (piclab::ForwardToService(request, remote, rc)) {
+        if (rc != 0 || !failed.empty()) {
+            MsgBox(nullptr, L"Failed to write image:\n" + failed, MB_OK | MB_ICONERROR);
+            return 3;
+        }
+        MsgBox(nullptr, L"Saved:\n" + saved, MB_OK | MB_ICONINFORMATION);
+        return 0;
+    }
+
+    std::wstring err;
+    std::unique_ptr<piclab::Backend> backend = piclab::CreateDefaultBackend(err);
+    if (!backend) {
         MsgBox(nullptr, L"Failed to write image:\n" + err, MB_OK | MB_ICONERROR);
         return 3;
     }
+    piclab::SaveOptions save;
+    save.overwrite = overwrite;
+    // Someone is waiting on the dialog: trade compression for a quick save on huge images.
+    save.compress.latencyBudgetMs = kInteractiveBudgetMs;
+    // Never let a short or damaged write replace the user's only copy.
+    save.verify = overwrite;
+
+    std::vector<piclab::BatchItem> items;
+    for (const std::wstring& path : paths) items.push_back({ path, label });
+
+    std::mutex mu;
+    piclab::ProcessBatch(*backend, items, save, 0, [&](size_t index, const piclab::BatchResult& r) {
+        std::lock_guard<std::mutex> lk(mu);
+        if (!r.ok) {
+            failed += items[index].path + L": " + r.error + L"\n";
+            return;
+        }
+        RefreshShellFor(r.savedPath);
+        saved += r.savedPath + L"\n";
+    });
 
-    RefreshShellFor(savedPath);
-    MsgBox(nullptr, L"Saved:\n" + savedPath, MB_OK | MB_ICONINFORMATION);
+    if (!failed.empty()) {
+        MsgBox(nullptr, L"Failed to write image:\n" + failed, MB_OK | MB_ICONERROR);
+        return 3;
+    }
+    MsgBox(nullptr, L"Saved:\n" + saved, MB_OK | MB_ICONINFORMATION);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,459 @@
+// piclab_bench.cpp
+// Codec microbenchmarks. Only the kernel is timed: inflating and copying the input happen
+// outside the measured loop.
+
+#include "piclab_bench.h"
+#include "piclab_checksum.h"
+#include "piclab_deflate.h"
+#include "piclab_filters.h"
+#include "piclab_inflate.h"
+#include "piclab_io.h"
+#include "piclab_png.h"
+#include "piclab_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <zlib.h>
+
+namespace piclab {
+
+typedef bool (*UnfilterFn)(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t len, size_t bpp);
+
+// Unfilters every row of work in place and returns the elapsed time in milliseconds.
+static bool TimeUnfilter(UnfilterFn fn, const PngScanlines& src, std::vector<uint8_t>& work,
+                         double& outMs, std::wstring& outError) {
+    const size_t stride = 1 + src.rowBytes;
+    work.assign(src.data.begin(), src.data.end());
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t y = 0; y < src.height; ++y) {
+        uint8_t* cur = work.data() + y * stride;
+        const uint8_t* prev = y ? cur - stride + 1 : nullptr;
+        if (!fn(cur[0], cur + 1, prev, src.rowBytes, src.bpp)) {
+            outError = L"PNG row has an invalid filter type.";
+            return false;
+        }
+    }
+    outMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+bool BenchUnfilter(const std::wstring& path, unsigned rounds, UnfilterBenchResult& out, std::wstring& outError) {
+    PngScanlines src;
+    {
+        MappedFile file;
+        if (!file.Open(path, outError)) return false;
+        if (!InflatePngScanlines(file.Data(), file.Size(), src, outError)) return false;
+    }
+
+    out = UnfilterBenchResult();
+    out.width = src.width;
+    out.height = src.height;
+    out.bpp = src.bpp;
+    out.bytes = (uint64_t)src.height * src.rowBytes;
+    for (uint32_t y = 0; y < src.height; ++y) {
+        uint8_t filter = src.data[y * (1 + src.rowBytes)];
+        if (filter < 5) ++out.filterRows[filter];
+    }
+
+    std::vector<uint8_t> reference, kernel;
+    for (unsigned r = 0; r < (rounds ? rounds : 1); ++r) {
+        double ms = 0;
+        if (!TimeUnfilter(UnfilterRowReference, src, reference, ms, outError)) return false;
+        if (r == 0 || ms < out.referenceMs) out.referenceMs = ms;
+        if (!TimeUnfilter(UnfilterRow, src, kernel, ms, outError)) return false;
+        if (r == 0 || ms < out.kernelMs) out.kernelMs = ms;
+    }
+
+    if (reference != kernel) {
+        const size_t stride = 1 + src.rowBytes;
+        size_t y = 0;
+        while (memcmp(reference.data() + y * stride, kernel.data() + y * stride, stride) == 0) ++y;
+        outError = std::wstring(L"The ") + FromUtf8(FilterKernelName()) +
+                   L" unfilter kernel differs from the scalar reference in row " + std::to_wstring(y) + L".";
+        return false;
+    }
+    return true;
+}
+
+typedef uint8_t (*SelectFn)(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp);
+
+static double TimeSelect(SelectFn fn, const Image& img, std::vector<uint8_t>& choices) {
+    choices.resize(img.height);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t y = 0; y < img.height; ++y) {
+        choices[y] = fn(img.Row(y), y ? img.Row(y - 1) : nullptr, img.Stride(), img.channels);
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Encodes img to path, taking filter types from reuse when it is set.
+static bool TimeEncode(const Image& img, const RowReader* reuse, const std::wstring& path, uint64_t& outBytes,
+                       double& outMs, std::wstring& outError) {
+    auto start = std::chrono::steady_clock::now();
+    {
+        // Photo filtering throughout, so that the adaptive choice is what gets measured.
+        CompressOptions compress;
+        compress.content = ContentClass::kPhoto;
+        std::unique_ptr<RowWriter> w =
+            CreatePngRowWriter(path, img.width, img.height, img.channels, compress, outError);
+        if (!w) return false;
+        if (reuse) w->ReuseFilters(*reuse, img.height);
+        for (uint32_t y = 0; y < img.height; ++y) {
+            if (!w->WriteRow(img.Row(y), outError)) return false;
+        }
+        if (!w->Finish(outError)) return false;
+    }
+    outMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    outBytes = FileSizeOf(path);
+    return true;
+}
+
+bool BenchFilter(const std::wstring& path, unsigned rounds, FilterBenchResult& out, std::wstring& outError) {
+    std::unique_ptr<RowReader> reader = OpenPngRowReader(path, outError);
+    if (!reader) {
+        if (outError.empty()) outError = L"Interlaced PNGs have no row order to bench.";
+        return false;
+    }
+    Image img;
+    img.width = reader->Width();
+    img.height = reader->Height();
+    img.channels = reader->Channels();
+    img.pixels.resize(img.Stride() * img.height);
+    for (uint32_t y = 0; y < img.height; ++y) {
+        if (!reader->ReadRow(img.Row(y), outError)) return false;
+    }
+
+    out = FilterBenchResult();
+    out.width = img.width;
+    out.height = img.height;
+    out.channels = img.channels;
+    out.sourceFilters = img.height > 0 && reader->SourceFilter(0) >= 0;
+
+    std::vector<uint8_t> reference, kernel;
+    for (unsigned r = 0; r < (rounds ? rounds : 1); ++r) {
+        double ms = TimeSelect(SelectFilterReference, img, reference);
+        if (r == 0 || ms < out.referenceMs) out.referenceMs = ms;
+        ms = TimeSelect(SelectFilter, img, kernel);
+        if (r == 0 || ms < out.kernelMs) out.kernelMs = ms;
+    }
+    for (uint32_t y = 0; y < img.height; ++y) {
+        if (reference[y] != kernel[y]) {
+            outError = std::wstring(L"The ") + FromUtf8(FilterKernelName()) +
+                       L" filter heuristic differs from the scalar reference in row " + std::to_wstring(y) + L".";
+            return false;
+        }
+        ++out.chosenRows[kernel[y]];
+    }
+
+    const std::wstring tmp = GetTempSiblingPath(path);
+    bool ok = TimeEncode(img, nullptr, tmp, out.adaptiveBytes, out.adaptiveMs, outError) &&
+              TimeEncode(img, out.sourceFilters ? reader.get() : nullptr, tmp, out.reuseBytes, out.reuseMs,
+                         outError);
+    DeleteFilePath(tmp);
+    return ok;
+}
+
+typedef uint32_t (*ChecksumFn)(uint32_t state, const uint8_t* data, size_t n);
+
+static double TimeChecksum(ChecksumFn fn, uint32_t init, const uint8_t* data, size_t n, uint32_t& outValue) {
+    auto start = std::chrono::steady_clock::now();
+    outValue = fn(init, data, n);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool BenchChecksum(const std::wstring& path, unsigned rounds, ChecksumBenchResult& out, std::wstring& outError) {
+    MappedFile file;
+    if (!file.Open(path, outError)) return false;
+    if (file.Size() == 0) {
+        outError = L"The file is empty.";
+        return false;
+    }
+    out = ChecksumBenchResult();
+    out.bytes = file.Size();
+
+    uint32_t crcReference = 0, crcKernel = 0, adlerReference = 0, adlerKernel = 0;
+    for (unsigned r = 0; r < (rounds ? rounds : 1); ++r) {
+        double ms = TimeChecksum(Crc32Reference, 0, file.Data(), file.Size(), crcReference);
+        if (r == 0 || ms < out.crcReferenceMs) out.crcReferenceMs = ms;
+        ms = TimeChecksum(Crc32, 0, file.Data(), file.Size(), crcKernel);
+        if (r == 0 || ms < out.crcKernelMs) out.crcKernelMs = ms;
+        ms = TimeChecksum(Adler32Reference, 1, file.Data(), file.Size(), adlerReference);
+        if (r == 0 || ms < out.adlerReferenceMs) out.adlerReferenceMs = ms;
+        ms = TimeChecksum(Adler32, 1, file.Data(), file.Size(), adlerKernel);
+        if (r == 0 || ms < out.adlerKernelMs) out.adlerKernelMs = ms;
+    }
+    if (crcReference != crcKernel || adlerReference != adlerKernel) {
+        outError = std::wstring(L"The ") + FromUtf8(ChecksumKernelName()) + L" checksum kernels differ from the " +
+                   L"bytewise reference.";
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------- Deflate -----------------------------
+
+// The PNG writer's parallel chunk size.
+static const size_t kBenchDeflateChunk = (size_t)1 << 20;
+
+// Bits appended LSB first, as deflate packs them.
+static void PutBits(std::vector<uint8_t>& out, unsigned& bitCount, uint32_t value, unsigned bits) {
+    for (unsigned i = 0; i < bits; ++i, ++bitCount) {
+        if ((bitCount & 7) == 0) out.push_back(0);
+        out.back() |= (uint8_t)(((value >> i) & 1) << (bitCount & 7));
+    }
+}
+
+// The start of a stream that ends primeBits into a byte: a non-final fixed-Huffman block of
+// literal 144s (9-bit codes, so each one moves the end by a bit) and its end-of-block code. The
+// partial byte is taken off and returned through primeBits/primeValue, as the PNG writer does when
+// it continues a source stream. Returns the bytes the block inflates to.
+static std::vector<uint8_t> StreamPrefix(int primeBits, std::vector<uint8_t>& out, int& primeValue) {
+    std::vector<uint8_t> literals;
+    if (!primeBits) {
+        primeValue = 0;
+        return literals;
+    }
+    unsigned bitCount = 0;
+    PutBits(out, bitCount, 0x2, 3); // BFINAL 0, BTYPE 01
+    const unsigned count = (unsigned)(primeBits + 6) % 8; // 10 + 9 * count bits in all
+    for (unsigned i = 0; i < count; ++i) {
+        // Huffman codes go out most significant bit first.
+        for (int b = 8; b >= 0; --b) PutBits(out, bitCount, (0x190 >> b) & 1, 1);
+        literals.push_back(144);
+    }
+    PutBits(out, bitCount, 0, 7);
+    primeValue = out.back() & ((1 << primeBits) - 1);
+    out.pop_back();
+    return literals;
+}
+
+// Deflates in[0, n) behind the prefix for primeBits in chunks of at most `chunk` bytes, each with
+// the 32 KB before it as its window, into one raw stream. expected receives what it inflates to.
+static bool DeflateChunked(const CompressOptions& opts, const uint8_t* in, size_t n, size_t chunk, int primeBits,
+                           std::vector<uint8_t>& out, std::vector<uint8_t>& expected) {
+    out.clear();
+    int primeValue = 0;
+    expected = StreamPrefix(primeBits, out, primeValue);
+    expected.insert(expected.end(), in, in + n);
+    size_t pos = 0;
+    do {
+        const size_t len = std::min(chunk, n - pos);
+        const size_t dictLen = std::min<size_t>(pos, 32768);
+        if (!DeflateChunk(opts, in + pos, len, in + pos - dictLen, dictLen, primeBits, primeValue, pos + len == n,
+                          out)) {
+            return false;
+        }
+        primeBits = primeValue = 0;
+        pos += len;
+    } while (pos < n);
+    return true;
+}
+
+// Whether the raw deflate stream inflates to exactly expected, with nothing left over.
+static bool InflatesTo(const std::vector<uint8_t>& stream, const std::vector<uint8_t>& expected) {
+    z_stream zs{};
+    if (inflateInit2(&zs, -15) != Z_OK) return false;
+    std::vector<uint8_t> got(expected.size() + 1);
+    zs.next_in = const_cast<uint8_t*>(stream.data());
+    zs.avail_in = (uInt)stream.size();
+    zs.next_out = got.data();
+    zs.avail_out = (uInt)got.size();
+    const int zr = inflate(&zs, Z_FINISH);
+    const bool ok = zr == Z_STREAM_END && zs.avail_in == 0 && zs.total_out == expected.size() &&
+                    std::equal(expected.begin(), expected.end(), got.begin());
+    inflateEnd(&zs);
+    return ok;
+}
+
+static std::wstring EngineLabel(const CompressOptions& opts) {
+    std::wstring name = DeflateEngineName(opts.engine);
+    return opts.engine == DeflateEngine::kZlib ? name + L" " + std::to_wstring(opts.level) : name;
+}
+
+bool CheckDeflateRoundTrips(unsigned& outCases, std::wstring& outError) {
+    struct Input {
+        const wchar_t* name;
+        std::vector<uint8_t> bytes;
+    };
+    std::vector<Input> inputs = { { L"empty", {} }, { L"one byte", { 0x5a } },
+                                  { L"all-equal", std::vector<uint8_t>(300000, 7) } };
+    Input period = { L"period 3", std::vector<uint8_t>(200000) };
+    for (size_t i = 0; i < period.bytes.size(); ++i) period.bytes[i] = (uint8_t)("abc"[i % 3]);
+    Input random = { L"random", std::vector<uint8_t>(300000) };
+    Input text = { L"text", std::vector<uint8_t>(300000) };
+    uint32_t x = 0x9e3779b9u;
+    for (size_t i = 0; i < random.bytes.size(); ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        random.bytes[i] = (uint8_t)(x >> 24);
+        // Runs of a few letters and words that recur, so matches of every length show up.
+        text.bytes[i] = (x & 0x300) ? (uint8_t)("piclab labels images "[(i / 7 + (x >> 28)) % 21])
+                                    : (uint8_t)('a' + (x >> 27));
+    }
+    inputs.push_back(std::move(period));
+    inputs.push_back(std::move(random));
+    inputs.push_back(std::move(text));
+
+    std::vector<CompressOptions> engines(4);
+    engines[0].level = 1;
+    engines[2].engine = DeflateEngine::kOneShot;
+    engines[3].engine = DeflateEngine::kStore;
+    const size_t chunks[] = { SIZE_MAX, 65536, 100003, 4099 };
+    const int primes[] = { 0, 5 };
+
+    outCases = 0;
+    std::vector<uint8_t> stream, expected;
+    for (const Input& in : inputs) {
+        for (const CompressOptions& opts : engines) {
+            for (size_t chunk : chunks) {
+                for (int primeBits : primes) {
+                    ++outCases;
+                    if (DeflateChunked(opts, in.bytes.data(), in.bytes.size(), chunk, primeBits, stream, expected) &&
+                        InflatesTo(stream, expected)) {
+                        continue;
+                    }
+                    const std::wstring split =
+                        chunk == SIZE_MAX ? L"one chunk" : std::to_wstring(chunk) + L"-byte chunks";
+                    outError = L"Deflate round trip failed: " + EngineLabel(opts) + L", " + in.name + L" input, " +
+                               split + L", " + std::to_wstring(primeBits) + L" prime bits.";
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool BenchDeflate(const std::wstring& path, unsigned rounds, DeflateBenchResult& out, std::wstring& outError) {
+    MappedFile file;
+    if (!file.Open(path, outError)) return false;
+    out = DeflateBenchResult();
+    out.bytes = file.Size();
+
+    CompressOptions engines[3];
+    engines[1].engine = DeflateEngine::kOneShot;
+    engines[2].engine = DeflateEngine::kStore;
+    uint64_t* sizes[3] = { &out.zlibBytes, &out.oneshotBytes, &out.storeBytes };
+    double* times[3] = { &out.zlibMs, &out.oneshotMs, &out.storeMs };
+    std::vector<uint8_t> stream, expected;
+    for (int e = 0; e < 3; ++e) {
+        for (unsigned r = 0; r < (rounds ? rounds : 1); ++r) {
+            auto start = std::chrono::steady_clock::now();
+            const bool ok = DeflateChunked(engines[e], file.Data(), file.Size(), kBenchDeflateChunk, 0, stream,
+                                           expected);
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+                                  .count();
+            if (!ok) {
+                outError = L"The " + EngineLabel(engines[e]) + L" engine failed.";
+                return false;
+            }
+            if (r == 0 || ms < *times[e]) *times[e] = ms;
+        }
+        *sizes[e] = stream.size();
+        if (!InflatesTo(stream, expected)) {
+            outError = L"The " + EngineLabel(engines[e]) + L" stream does not inflate back to the file.";
+            return false;
+        }
+    }
+    return true;
+}
+
+// ----------------------------- Inflate -----------------------------
+
+// IDAT-sized ranges, so the parallel inflater reads across segment ends as it does on real files.
+static const uint32_t kBenchIdatBytes = 65536;
+
+static bool CompareParallel(const std::vector<uint8_t>& stream, const std::vector<uint8_t>& expected, WorkPool& pool,
+                            InflateBenchStream& out, std::wstring& outError) {
+    DeflateSource src(stream.data());
+    for (size_t pos = 0; pos < stream.size(); pos += kBenchIdatBytes) {
+        src.Add(pos, (uint32_t)std::min<size_t>(kBenchIdatBytes, stream.size() - pos));
+    }
+    auto start = std::chrono::steady_clock::now();
+    ParallelInflater inflater(src, pool);
+    InflatedPiece piece;
+    uint64_t at = 0;
+    do {
+        if (!inflater.Next(piece, outError)) return false;
+        if (piece.data.size() > expected.size() - at ||
+            memcmp(piece.data.data(), expected.data() + at, piece.data.size()) != 0) {
+            size_t k = 0;
+            while (k < piece.data.size() && at + k < expected.size() && piece.data[k] == expected[at + k]) ++k;
+            outError = L"Parallel inflate differs from zlib at output byte " + std::to_wstring(at + k) + L".";
+            return false;
+        }
+        at += piece.data.size();
+        ++out.pieces;
+    } while (!piece.last);
+    out.parallelMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    out.redecoded = inflater.Redecoded();
+    if (at != expected.size()) {
+        outError = L"Parallel inflate stopped at byte " + std::to_wstring(at) + L" of " +
+                   std::to_wstring(expected.size()) + L".";
+        return false;
+    }
+    return true;
+}
+
+bool BenchInflate(const std::wstring& path, InflateBenchResult& out, std::wstring& outError) {
+    PngScanlines src;
+    {
+        MappedFile file;
+        if (!file.Open(path, outError)) return false;
+        if (!InflatePngScanlines(file.Data(), file.Size(), src, outError)) return false;
+    }
+    out = InflateBenchResult();
+    out.bytes = src.data.size();
+    // Two workers at least, so the speculative path runs on a single core too.
+    WorkPool pool(std::max(2u, WorkPool::HardwareThreads()));
+    out.threads = pool.Size();
+
+    // Incompressible input comes out of zlib as stored blocks at any level, whose headers are the
+    // hardest for the speculative search to pin down.
+    std::vector<uint8_t> noise(src.data.size());
+    uint32_t x = 0x2545f491u;
+    for (uint8_t& b : noise) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        b = (uint8_t)(x >> 24);
+    }
+
+    const int levels[4] = { 0, 1, 6, 6 };
+    std::vector<uint8_t> stream, serial;
+    for (int i = 0; i < 4; ++i) {
+        InflateBenchStream& s = out.streams[i];
+        s.level = levels[i];
+        s.random = i == 3;
+        const std::vector<uint8_t>& input = s.random ? noise : src.data;
+        uLongf len = compressBound((uLong)input.size());
+        stream.resize(len);
+        if (compress2(stream.data(), &len, input.data(), (uLong)input.size(), s.level) != Z_OK) {
+            outError = L"zlib compress failed.";
+            return false;
+        }
+        stream.resize(len);
+        s.compressed = len;
+
+        serial.assign(input.size(), 0);
+        uLongf got = (uLongf)serial.size();
+        auto start = std::chrono::steady_clock::now();
+        const int zr = uncompress(serial.data(), &got, stream.data(), (uLong)stream.size());
+        s.serialMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (zr != Z_OK || got != serial.size() || serial != input) {
+            outError = L"zlib does not inflate its own level-" + std::to_wstring(s.level) + L" stream back.";
+            return false;
+        }
+        if (!CompareParallel(stream, serial, pool, s, outError)) {
+            outError = (s.random ? L"Random, level " : L"Level ") + std::to_wstring(s.level) + L": " + outError;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace piclab
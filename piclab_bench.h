@@ -0,0 +1,102 @@
+// piclab_bench.h
+// Codec microbenchmarks behind the headless --bench-* options. They time one kernel in isolation
+// on real files and check it against its scalar reference while doing so; the filter bench also
+// reports what the choice of filters does to the encoded file, and the deflate and inflate benches
+// check every engine's output against zlib.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace piclab {
+
+struct UnfilterBenchResult {
+    uint32_t width{};
+    uint32_t height{};
+    size_t bpp{};
+    uint64_t bytes{};          // scanline bytes unfiltered per round
+    uint32_t filterRows[5]{};  // rows using None, Sub, Up, Average, Paeth
+    double referenceMs{};      // fastest round of UnfilterRowReference
+    double kernelMs{};         // fastest round of the dispatched UnfilterRow
+};
+
+// Inflates the PNG at path once, then unfilters all of its scanlines `rounds` times with each
+// implementation. Fails when the two outputs differ or the file has no plain scanlines.
+bool BenchUnfilter(const std::wstring& path, unsigned rounds, UnfilterBenchResult& out, std::wstring& outError);
+
+struct FilterBenchResult {
+    uint32_t width{};
+    uint32_t height{};
+    uint32_t channels{};
+    uint32_t chosenRows[5]{};   // rows the adaptive heuristic gives None, Sub, Up, Average, Paeth
+    double referenceMs{};       // fastest round of SelectFilterReference over every row
+    double kernelMs{};          // fastest round of the dispatched SelectFilter
+    bool sourceFilters{false};  // the file's own filter types were available to the reuse mode
+    uint64_t adaptiveBytes{};   // encoded size and time with FilterMode::kAdaptive
+    double adaptiveMs{};
+    uint64_t reuseBytes{};      // ... and with every row keeping its source filter (kReuse)
+    double reuseMs{};
+};
+
+// Decodes the PNG at path, times filter selection for all rows `rounds` times with each
+// implementation, then encodes the image once per filter mode to a temp file next to it, which is
+// removed again. Fails when the two selections differ.
+bool BenchFilter(const std::wstring& path, unsigned rounds, FilterBenchResult& out, std::wstring& outError);
+
+struct ChecksumBenchResult {
+    uint64_t bytes{};
+    double crcReferenceMs{};   // fastest round of Crc32Reference
+    double crcKernelMs{};      // fastest round of the dispatched Crc32
+    double adlerReferenceMs{}; // ... and of Adler32Reference and Adler32
+    double adlerKernelMs{};
+};
+
+// Maps the file at path and checksums all of its bytes `rounds` times with each implementation.
+// Fails when they disagree or the file is empty.
+bool BenchChecksum(const std::wstring& path, unsigned rounds, ChecksumBenchResult& out, std::wstring& outError);
+
+// Round-trips fixed inputs through every deflate engine: empty, one byte, all-equal (a one-symbol
+// distance tree), a single repeat distance, random (the stored fallback) and mixed text. Each is
+// compressed as one chunk and as several chunks, continuing a stream that ends mid-byte or not,
+// and inflated again with zlib. outCases counts the streams checked; fails on the first mismatch.
+bool CheckDeflateRoundTrips(unsigned& outCases, std::wstring& outError);
+
+struct DeflateBenchResult {
+    uint64_t bytes{};
+    uint64_t zlibBytes{};    // compressed size and fastest round per engine
+    double zlibMs{};
+    uint64_t oneshotBytes{};
+    double oneshotMs{};
+    uint64_t storeBytes{};
+    double storeMs{};
+};
+
+// Maps the file at path and deflates all of its bytes `rounds` times with each engine, in chunks
+// the size the PNG writer hands out. Every stream is inflated with zlib and compared with the file.
+bool BenchDeflate(const std::wstring& path, unsigned rounds, DeflateBenchResult& out, std::wstring& outError);
+
+// One zlib stream in the inflate bench.
+struct InflateBenchStream {
+    int level{};              // zlib level it was compressed with
+    bool random{};            // random bytes instead of the scanlines, which zlib keeps stored
+    uint64_t compressed{};
+    uint64_t pieces{};        // pieces the parallel inflater handed out
+    uint64_t redecoded{};     // ... of which the speculative decode missed and was redone
+    double serialMs{};        // zlib inflate
+    double parallelMs{};      // ParallelInflater
+};
+
+struct InflateBenchResult {
+    uint64_t bytes{};         // scanline bytes
+    unsigned threads{};
+    InflateBenchStream streams[4]; // levels 0, 1 and 6, then random bytes at level 6
+};
+
+// Inflates the PNG at path, compresses its scanlines again at zlib levels 0, 1 and 6, and as many
+// random bytes at level 6, and inflates each stream both with zlib and with the speculative
+// ParallelInflater on a pool of at least two threads, whatever the stream's size. Fails when the
+// outputs differ in any byte.
+bool BenchInflate(const std::wstring& path, InflateBenchResult& out, std::wstring& outError);
+
+} // namespace piclab
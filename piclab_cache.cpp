@@ -0,0 +1,53 @@
+// piclab_cache.cpp
+// Decoded-image cache: a map from path to entry plus a recency list of paths.
+
+#include "piclab_cache.h"
+
+namespace piclab {
+
+static uint64_t PixelBytes(const Image& img) {
+    return img.pixels.size();
+}
+
+std::shared_ptr<const Image> DecodedImageCache::Find(const std::wstring& path, const FileStamp& stamp) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = entries_.find(path);
+    if (it == entries_.end() || it->second.stamp != stamp) {
+        if (it != entries_.end()) Drop(it); // the file changed; its pixels are of no further use
+        ++stats_.misses;
+        return nullptr;
+    }
+    uses_.splice(uses_.begin(), uses_, it->second.use);
+    ++stats_.hits;
+    return it->second.img;
+}
+
+void DecodedImageCache::Insert(const std::wstring& path, const FileStamp& stamp, std::shared_ptr<const Image> img) {
+    if (!img || !Fits(PixelBytes(*img))) return;
+    std::lock_guard<std::mutex> lk(mu_);
+    auto old = entries_.find(path);
+    if (old != entries_.end()) Drop(old);
+    while (!uses_.empty() && stats_.bytes + PixelBytes(*img) > budget_) {
+        Drop(entries_.find(uses_.back()));
+        ++stats_.evictions;
+    }
+    uses_.push_front(path);
+    stats_.bytes += PixelBytes(*img);
+    entries_[path] = Entry{ stamp, std::move(img), uses_.begin() };
+}
+
+void DecodedImageCache::Drop(std::map<std::wstring, Entry>::iterator it) {
+    stats_.bytes -= PixelBytes(*it->second.img);
+    uses_.erase(it->second.use);
+    entries_.erase(it);
+}
+
+CacheStats DecodedImageCache::Stats() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    CacheStats st = stats_;
+    st.entries = entries_.size();
+    st.budget = budget_;
+    return st;
+}
+
+} // namespace piclab
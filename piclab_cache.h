@@ -0,0 +1,65 @@
+// piclab_cache.h
+// Decoded source pixels kept between saves, for relabeling the same picture again (label, look,
+// relabel with "save a copy"). Entries are keyed by path and checked against the file's size and
+// last-write time on every lookup, so an edited or replaced file is decoded afresh.
+
+#pragma once
+
+#include "piclab_core.h"
+#include "piclab_io.h"
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace piclab {
+
+// Default budget of the service's cache.
+const uint64_t kDefaultCacheBytes = 512ull << 20;
+
+struct CacheStats {
+    uint64_t hits{};
+    uint64_t misses{};
+    uint64_t evictions{};
+    uint64_t entries{};
+    uint64_t bytes{};  // pixel bytes held now
+    uint64_t budget{};
+};
+
+// Least recently used images go first once the pixels held pass the budget. Images are shared and
+// never changed after Insert, so a save may keep reading one that has been evicted meanwhile.
+// Safe to use from many threads.
+class DecodedImageCache {
+public:
+    explicit DecodedImageCache(uint64_t budgetBytes) : budget_(budgetBytes) {}
+
+    // Whether an image of this many pixel bytes would be kept at all.
+    bool Fits(uint64_t bytes) const { return bytes <= budget_; }
+
+    // The image decoded from path when the file still has that stamp; null (a miss) otherwise.
+    std::shared_ptr<const Image> Find(const std::wstring& path, const FileStamp& stamp);
+    // Keeps img as path's pixels for stamp, replacing an older entry.
+    void Insert(const std::wstring& path, const FileStamp& stamp, std::shared_ptr<const Image> img);
+
+    CacheStats Stats() const;
+
+private:
+    struct Entry {
+        FileStamp stamp;
+        std::shared_ptr<const Image> img;
+        std::list<std::wstring>::iterator use;
+    };
+
+    void Drop(std::map<std::wstring, Entry>::iterator it);
+
+    uint64_t budget_;
+    mutable std::mutex mu_;
+    std::map<std::wstring, Entry> entries_;
+    std::list<std::wstring> uses_; // most recently used first
+    CacheStats stats_;
+};
+
+} // namespace piclab
@@ -0,0 +1,330 @@
+// piclab_checksum.cpp
+// CRC-32 folds 64 bytes per step with carry-less multiplies into four 128-bit lanes, then folds the
+// lanes into one and Barrett-reduces it to 32 bits (Intel, "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ"). On ARMv8 the CRC32X instruction takes 8 bytes at a time. The
+// fallback slices by 8 with tables built by constexpr functions.
+//
+// Adler-32 sums 32 bytes per step: s1 grows by the byte sum (SAD against zero, or pairwise adds),
+// s2 by the bytes weighted 32..1 plus 32 times s1 before the step. Steps are grouped so that no
+// lane can overflow before the modulo, as zlib's NMAX does for the scalar loop.
+
+#include "piclab_checksum.h"
+#include "piclab_cpu.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PICLAB_HAVE_SSE2 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define PICLAB_TARGET_PCLMUL
+#else
+#define PICLAB_TARGET_PCLMUL __attribute__((target("pclmul,sse2")))
+#endif
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define PICLAB_HAVE_NEON 1
+#include <arm_neon.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define PICLAB_TARGET_CRC
+#else
+#include <arm_acle.h>
+#if defined(__clang__)
+#define PICLAB_TARGET_CRC __attribute__((target("crc")))
+#else
+#define PICLAB_TARGET_CRC __attribute__((target("+crc")))
+#endif
+#endif
+#endif
+
+namespace piclab {
+
+// ----------------------------- Tables -----------------------------
+
+static const uint32_t kCrcPolynomial = 0xEDB88320u; // reflected 0x04C11DB7
+static const uint32_t kAdlerBase = 65521;
+static const size_t kAdlerMaxRun = 5552; // bytes before s2 could overflow 32 bits
+
+struct CrcTables {
+    uint32_t t[8][256];
+};
+
+// t[0] is the bytewise table; t[k][i] advances t[0][i] by k more zero bytes.
+static constexpr CrcTables MakeCrcTables() {
+    CrcTables c{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t v = i;
+        for (int k = 0; k < 8; ++k) v = v & 1 ? kCrcPolynomial ^ (v >> 1) : v >> 1;
+        c.t[0][i] = v;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k) c.t[k][i] = (c.t[k - 1][i] >> 8) ^ c.t[0][c.t[k - 1][i] & 0xFF];
+    }
+    return c;
+}
+
+static constexpr CrcTables kCrc = MakeCrcTables();
+
+static inline uint32_t Load32(const uint8_t* p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+uint32_t Crc32Reference(uint32_t crc, const uint8_t* data, size_t n) {
+    crc = ~crc;
+    while (n--) crc = kCrc.t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t Crc32Table(uint32_t crc, const uint8_t* p, size_t n) {
+    crc = ~crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        const uint32_t lo = crc ^ Load32(p), hi = Load32(p + 4);
+        crc = kCrc.t[7][lo & 0xFF] ^ kCrc.t[6][(lo >> 8) & 0xFF] ^ kCrc.t[5][(lo >> 16) & 0xFF] ^
+              kCrc.t[4][lo >> 24] ^ kCrc.t[3][hi & 0xFF] ^ kCrc.t[2][(hi >> 8) & 0xFF] ^
+              kCrc.t[1][(hi >> 16) & 0xFF] ^ kCrc.t[0][hi >> 24];
+    }
+    while (n--) crc = kCrc.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t Adler32Reference(uint32_t adler, const uint8_t* data, size_t n) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (n) {
+        size_t k = std::min(n, kAdlerMaxRun);
+        n -= k;
+        while (k--) {
+            a += *data++;
+            b += a;
+        }
+        a %= kAdlerBase;
+        b %= kAdlerBase;
+    }
+    return b << 16 | a;
+}
+
+// ----------------------------- x86 -----------------------------
+
+#ifdef PICLAB_HAVE_SSE2
+
+// Folding constants for the reflected polynomial: x^(4*128+64), x^(4*128), x^(128+64), x^128,
+// x^64 mod P, then P and floor(x^64 / P) for the Barrett step.
+alignas(16) static const uint64_t kFold4[2] = { 0x0154442bd4ull, 0x01c6e41596ull };
+alignas(16) static const uint64_t kFold1[2] = { 0x01751997d0ull, 0x00ccaa009eull };
+alignas(16) static const uint64_t kFold64[2] = { 0x0163cd6124ull, 0 };
+alignas(16) static const uint64_t kBarrett[2] = { 0x01db710641ull, 0x01f7011641ull };
+
+// a * k.lo ^ a.hi * k.hi ^ next: folds a 128-bit lane forward over the distance k encodes.
+PICLAB_TARGET_PCLMUL static inline __m128i Fold(__m128i a, __m128i k, __m128i next) {
+    __m128i lo = _mm_clmulepi64_si128(a, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(a, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+// n is a multiple of 16 and at least 64; crc and the result are not inverted.
+PICLAB_TARGET_PCLMUL static uint32_t Crc32Fold(uint32_t crc, const uint8_t* p, size_t n) {
+    __m128i x0 = _mm_loadu_si128((const __m128i*)p);
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(p + 16));
+    __m128i x2 = _mm_loadu_si128((const __m128i*)(p + 32));
+    __m128i x3 = _mm_loadu_si128((const __m128i*)(p + 48));
+    x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128((int)crc));
+    p += 64;
+    n -= 64;
+
+    __m128i k = _mm_load_si128((const __m128i*)kFold4);
+    for (; n >= 64; p += 64, n -= 64) {
+        x0 = Fold(x0, k, _mm_loadu_si128((const __m128i*)p));
+        x1 = Fold(x1, k, _mm_loadu_si128((const __m128i*)(p + 16)));
+        x2 = Fold(x2, k, _mm_loadu_si128((const __m128i*)(p + 32)));
+        x3 = Fold(x3, k, _mm_loadu_si128((const __m128i*)(p + 48)));
+    }
+    k = _mm_load_si128((const __m128i*)kFold1);
+    x0 = Fold(x0, k, x1);
+    x0 = Fold(x0, k, x2);
+    x0 = Fold(x0, k, x3);
+    for (; n >= 16; p += 16, n -= 16) x0 = Fold(x0, k, _mm_loadu_si128((const __m128i*)p));
+
+    // 128 -> 64 bits, then Barrett reduction to 32.
+    const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+    __m128i t = _mm_clmulepi64_si128(x0, k, 0x10);
+    x0 = _mm_xor_si128(_mm_srli_si128(x0, 8), t);
+    k = _mm_loadl_epi64((const __m128i*)kFold64);
+    t = _mm_srli_si128(x0, 4);
+    x0 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k, 0x00), t);
+    k = _mm_load_si128((const __m128i*)kBarrett);
+    t = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), k, 0x00);
+    x0 = _mm_xor_si128(x0, t);
+    return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x0, 4));
+}
+
+static uint32_t Crc32Pclmul(uint32_t crc, const uint8_t* p, size_t n) {
+    if (n >= 64) {
+        const size_t bulk = n & ~(size_t)15;
+        crc = ~Crc32Fold(~crc, p, bulk);
+        p += bulk;
+        n -= bulk;
+    }
+    return Crc32Table(crc, p, n);
+}
+
+static inline uint32_t SumLanes(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+static uint32_t Adler32Sse2(uint32_t adler, const uint8_t* p, size_t n) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    size_t blocks = n / 32;
+    n -= blocks * 32;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w0 = _mm_setr_epi16(32, 31, 30, 29, 28, 27, 26, 25);
+    const __m128i w1 = _mm_setr_epi16(24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i w2 = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i w3 = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    while (blocks) {
+        size_t k = std::min(blocks, kAdlerMaxRun / 32);
+        blocks -= k;
+        __m128i before = _mm_cvtsi32_si128((int)(a * k)); // s1 at the start of each step, summed
+        __m128i s1 = zero, s2 = _mm_cvtsi32_si128((int)b);
+        do {
+            const __m128i x = _mm_loadu_si128((const __m128i*)p);
+            const __m128i y = _mm_loadu_si128((const __m128i*)(p + 16));
+            before = _mm_add_epi32(before, s1);
+            s1 = _mm_add_epi32(s1, _mm_add_epi32(_mm_sad_epu8(x, zero), _mm_sad_epu8(y, zero)));
+            __m128i m = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(x, zero), w0),
+                                      _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), w1));
+            m = _mm_add_epi32(m, _mm_madd_epi16(_mm_unpacklo_epi8(y, zero), w2));
+            m = _mm_add_epi32(m, _mm_madd_epi16(_mm_unpackhi_epi8(y, zero), w3));
+            s2 = _mm_add_epi32(s2, m);
+            p += 32;
+        } while (--k);
+        s2 = _mm_add_epi32(s2, _mm_slli_epi32(before, 5));
+        a = (a + SumLanes(s1)) % kAdlerBase;
+        b = SumLanes(s2) % kAdlerBase;
+    }
+    return Adler32Reference(b << 16 | a, p, n);
+}
+
+#endif // PICLAB_HAVE_SSE2
+
+// ----------------------------- ARM -----------------------------
+
+#ifdef PICLAB_HAVE_NEON
+
+PICLAB_TARGET_CRC static uint32_t Crc32Arm(uint32_t crc, const uint8_t* p, size_t n) {
+    crc = ~crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32d(crc, v);
+    }
+    while (n--) crc = __crc32b(crc, *p++);
+    return ~crc;
+}
+
+static uint32_t Adler32Neon(uint32_t adler, const uint8_t* p, size_t n) {
+    static const uint16_t kWeights[32] = { 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                           16, 15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  3,  2,  1 };
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    size_t blocks = n / 32;
+    n -= blocks * 32;
+    while (blocks) {
+        size_t k = std::min(blocks, kAdlerMaxRun / 32);
+        blocks -= k;
+        uint32x4_t before = vsetq_lane_u32((uint32_t)(a * k), vdupq_n_u32(0), 0);
+        uint32x4_t s1 = vdupq_n_u32(0);
+        // Per-column byte sums; at most 173 steps of 255 fit 16 bits.
+        uint16x8_t c0 = vdupq_n_u16(0), c1 = c0, c2 = c0, c3 = c0;
+        do {
+            const uint8x16_t x = vld1q_u8(p);
+            const uint8x16_t y = vld1q_u8(p + 16);
+            before = vaddq_u32(before, s1);
+            s1 = vpadalq_u16(s1, vpadalq_u8(vpaddlq_u8(x), y));
+            c0 = vaddw_u8(c0, vget_low_u8(x));
+            c1 = vaddw_u8(c1, vget_high_u8(x));
+            c2 = vaddw_u8(c2, vget_low_u8(y));
+            c3 = vaddw_u8(c3, vget_high_u8(y));
+            p += 32;
+        } while (--k);
+        uint32x4_t s2 = vshlq_n_u32(before, 5);
+        s2 = vmlal_u16(s2, vget_low_u16(c0), vld1_u16(kWeights));
+        s2 = vmlal_u16(s2, vget_high_u16(c0), vld1_u16(kWeights + 4));
+        s2 = vmlal_u16(s2, vget_low_u16(c1), vld1_u16(kWeights + 8));
+        s2 = vmlal_u16(s2, vget_high_u16(c1), vld1_u16(kWeights + 12));
+        s2 = vmlal_u16(s2, vget_low_u16(c2), vld1_u16(kWeights + 16));
+        s2 = vmlal_u16(s2, vget_high_u16(c2), vld1_u16(kWeights + 20));
+        s2 = vmlal_u16(s2, vget_low_u16(c3), vld1_u16(kWeights + 24));
+        s2 = vmlal_u16(s2, vget_high_u16(c3), vld1_u16(kWeights + 28));
+        const uint32x2_t sum1 = vpadd_u32(vget_low_u32(s1), vget_high_u32(s1));
+        const uint32x2_t sum2 = vpadd_u32(vget_low_u32(s2), vget_high_u32(s2));
+        const uint32x2_t both = vpadd_u32(sum1, sum2);
+        a = (a + vget_lane_u32(both, 0)) % kAdlerBase;
+        b = (b + vget_lane_u32(both, 1)) % kAdlerBase;
+    }
+    return Adler32Reference(b << 16 | a, p, n);
+}
+
+#endif // PICLAB_HAVE_NEON
+
+// ----------------------------- Dispatch -----------------------------
+
+typedef uint32_t (*ChecksumFn)(uint32_t state, const uint8_t* data, size_t n);
+
+struct ChecksumKernels {
+    ChecksumFn crc;
+    ChecksumFn adler;
+    std::string name;
+};
+
+static ChecksumKernels SelectKernels() {
+    const CpuFeatures& cpu = GetCpuFeatures();
+    (void)cpu;
+    ChecksumKernels k{ Crc32Table, Adler32Reference, "" };
+    const char* crcName = "table";
+    const char* adlerName = "scalar";
+#ifdef PICLAB_HAVE_SSE2
+    if (cpu.sse2 && cpu.pclmul) {
+        k.crc = Crc32Pclmul;
+        crcName = "pclmul";
+    }
+    if (cpu.sse2) {
+        k.adler = Adler32Sse2;
+        adlerName = "sse2";
+    }
+#endif
+#ifdef PICLAB_HAVE_NEON
+    if (cpu.armCrc32) {
+        k.crc = Crc32Arm;
+        crcName = "armcrc";
+    }
+    if (cpu.neon) {
+        k.adler = Adler32Neon;
+        adlerName = "neon";
+    }
+#endif
+    k.name = std::string(crcName) + "+" + adlerName;
+    return k;
+}
+
+static const ChecksumKernels& Kernels() {
+    static const ChecksumKernels kernels = SelectKernels();
+    return kernels;
+}
+
+uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t n) {
+    return Kernels().crc(crc, data, n);
+}
+
+uint32_t Adler32(uint32_t adler, const uint8_t* data, size_t n) {
+    return Kernels().adler(adler, data, n);
+}
+
+const char* ChecksumKernelName() {
+    return Kernels().name.c_str();
+}
+
+} // namespace piclab
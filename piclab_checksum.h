@@ -0,0 +1,25 @@
+// piclab_checksum.h
+// CRC-32 (PNG chunks) and Adler-32 (zlib streams) with runtime-selected kernels: PCLMULQDQ folding
+// or the ARMv8 CRC instructions for CRC-32, SSE2 or NEON for Adler-32, and table-driven fallbacks
+// whose tables are generated at compile time. Results match zlib's crc32() and adler32().
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace piclab {
+
+// Continues crc over data; Crc32(0, p, n) is the CRC-32 of p.
+uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t n);
+// Continues adler over data; Adler32(1, p, n) is the Adler-32 of p.
+uint32_t Adler32(uint32_t adler, const uint8_t* data, size_t n);
+
+// One byte at a time, for checking the kernels.
+uint32_t Crc32Reference(uint32_t crc, const uint8_t* data, size_t n);
+uint32_t Adler32Reference(uint32_t adler, const uint8_t* data, size_t n);
+
+// "<crc kernel>+<adler kernel>", e.g. "pclmul+sse2", "armcrc+neon" or "table+scalar".
+const char* ChecksumKernelName();
+
+} // namespace piclab
@@ -0,0 +1,838 @@
+// piclab_cli.cpp
+// Headless command line:
+//   piclab --label <text> [--overwrite | --copy] [--out <path>] [--quiet] [--backend <name>] <image>...
+// Any number of images and @listfiles may be given; the backend (GDI+ runtime, codecs, fonts)
+// is created once and reused for every file, and files are spread over --jobs worker threads.
+
+#include "piclab_cli.h"
+#include "piclab_bench.h"
+#include "piclab_cache.h"
+#include "piclab_checksum.h"
+#include "piclab_codecs.h"
+#include "piclab_core.h"
+#include "piclab_filters.h"
+#include "piclab_instance.h"
+#include "piclab_io.h"
+#include "piclab_lanes.h"
+#include "piclab_service.h"
+#include "piclab_watch.h"
+
+#include <cstdio>
+#include <cwchar>
+#include <memory>
+#include <mutex>
+
+namespace piclab {
+
+static const wchar_t* kUsage =
+    L"Usage:\n"
+    L"  piclab --label <text> [--overwrite | --copy] [--out <path>] [--jobs <n>] [--verify] [--quiet]\n"
+    L"         [--reencode | --metadata-only] [--filter <mode>] [--content <class>] [--deflate <engine>]\n"
+    L"         [--level <n>] [--latency-budget-ms <ms>] [--format <fmt>] [--backend <name>] <image>...\n"
+    L"\n"
+    L"  <image>           an image path, or @<listfile> with one path per line; a line of the form\n"
+    L"                    \"<path><TAB><label>\" gives that file its own label\n"
+    L"  --label <text>    label to burn into the bottom of the image (required unless every\n"
+    L"                    listfile entry has its own)\n"
+    L"  --copy            write \"<name>_labeled.<ext>\" next to the input (default)\n"
+    L"  --overwrite       replace the input via a temp file\n"
+    L"  --out <path>      write the labeled copy to <path> (single image only)\n"
+    L"  --jobs <n>        worker threads for images and compression (default: all cores)\n"
+    L"  --verify          check the written PNG's chunks and image stream before it replaces the\n"
+    L"                    input or is kept as the copy; a damaged file is deleted instead\n"
+    L"  --reencode        compress every row again instead of reusing the input's compressed rows\n"
+    L"  --metadata-only   store the label as PNG text (\"Description\") instead of drawing it\n"
+    L"  --filter <mode>   PNG filter choice for re-encoded rows: adaptive (default) scores all five\n"
+    L"                    per row; reuse keeps the input's filter for rows above the label\n"
+    L"  --content <class> auto (default) samples each image; flat (screenshots, drawings) leaves\n"
+    L"                    rows unfiltered; photo filters every row adaptively\n"
+    L"  --deflate <engine> zlib (default), oneshot (one fast pass per 1 MB, libdeflate style) or\n"
+    L"                    store (no compression)\n"
+    L"  --level <n>       zlib level 0-9 (default 6)\n"
+    L"  --latency-budget-ms <ms>\n"
+    L"                    weaken --deflate/--level as far as needed for compression to finish in\n"
+    L"                    about <ms> per image, judged from its size and measured throughput\n"
+    L"  --format <fmt>    auto (default: JPEG stays JPEG where libjpeg is built in, else PNG), png,\n"
+    L"                    qoi or pam; qoi and pam write much faster and larger files for other tools\n"
+    L"  --quiet           no messages on success\n"
+    L"  --backend <name>  portable or gdiplus (Windows only)\n"
+    L"  --no-service      label in this process even when a service is running\n"
+    L"  --lane <class>    priority of the run in the service: interactive (default) goes first,\n"
+    L"                    batch yields to it between stages, background yields to both\n"
+    L"  --coalesce        merge with piclab launches of the same options that start within about\n"
+    L"                    0.3 s of each other: the first labels every image in one batch, the\n"
+    L"                    others hand their images to it and exit with 0\n"
+    L"\n"
+    L"  piclab --watch <folder> [--label <text>] [--label-pattern <regex>] [--label-sidecar <ext>]\n"
+    L"         [--settle-ms <ms>] [labeling options]\n"
+    L"\n"
+    L"  Labels every image written into <folder> from then on, until killed. A file is taken once its\n"
+    L"  writer closes it (Linux) or it has not changed for --settle-ms (default 1000). Its label is the\n"
+    L"  first line of \"<name>.<ext>\" when there is such a sidecar (waited for up to 5 s), else the\n"
+    L"  first group (or the match) of --label-pattern in the file name, else --label. Our own outputs\n"
+    L"  and files already in the folder are left alone.\n"
+    L"\n"
+    L"  piclab --service [--backend <name>] [--cache-mb <n>] [--quiet]\n"
+    L"\n"
+    L"  Stays resident with the backend (GDI+ runtime, fonts, codecs) started, and labels the command\n"
+    L"  lines of later piclab invocations, which then only forward their arguments and wait.\n"
+    L"  --cache-mb <n>    keep up to <n> MB of decoded source pixels (default 512, 0 = none), so\n"
+    L"                    relabeling a file that has not changed skips decoding it; used by saves\n"
+    L"                    that compress every row again (non-PNG input, --reencode, qoi or pam)\n"
+    L"\n"
+    L"  piclab --service-stats\n"
+    L"\n"
+    L"  Prints the running service's queue depth, yields and admission wait histogram per lane, and\n"
+    L"  how often its decoded-image cache was hit.\n"
+    L"\n"
+    L"  piclab --bench-unfilter <png>...\n"
+    L"\n"
+    L"  Times PNG unfiltering with the SIMD kernels against the scalar reference and checks that\n"
+    L"  both agree. Nothing is written.\n"
+    L"\n"
+    L"  piclab --bench-filter <png>...\n"
+    L"\n"
+    L"  Times the adaptive filter heuristic with the SIMD kernels against the scalar reference, then\n"
+    L"  encodes each image once per --filter mode and reports size and time. The encoded copies go\n"
+    L"  to temp files that are deleted again.\n"
+    L"\n"
+    L"  piclab --bench-checksum <file>...\n"
+    L"\n"
+    L"  Times CRC-32 and Adler-32 over each file's bytes with the dispatched kernels against the\n"
+    L"  bytewise reference and checks that both agree. Nothing is written.\n"
+    L"\n"
+    L"  piclab --bench-deflate <file>...\n"
+    L"\n"
+    L"  Checks that every deflate engine's streams inflate back with zlib on fixed edge cases, then\n"
+    L"  times zlib, oneshot and store over each file's bytes and checks those streams too. Nothing\n"
+    L"  is written.\n"
+    L"\n"
+    L"  piclab --bench-inflate <png>...\n"
+    L"\n"
+    L"  Compresses each image's scanlines again at zlib levels 0, 1 and 6, and as many random bytes\n"
+    L"  (stored blocks), and inflates every stream both with zlib and with the speculative parallel\n"
+    L"  inflater, whatever its size, checking that the two agree byte for byte. Nothing is written.\n"
+    L"\n"
+    L"Exit codes: 0 ok, 1 usage, 2 file not found, 3 processing failed.\n"
+    L"With several images: 3 if any failed, else 2 if any was missing.\n";
+
+struct CliOptions {
+    std::vector<std::wstring> inputs; // as given, before @listfile expansion
+    std::vector<BatchItem> items;
+    std::wstring label;
+    bool haveLabel{false};
+    bool overwrite{false};
+    bool copy{false};
+    bool quiet{false};
+    bool verify{false};
+    bool reencode{false};
+    bool metadataOnly{false};
+    bool benchUnfilter{false};
+    bool benchFilter{false};
+    bool benchChecksum{false};
+    bool benchDeflate{false};
+    bool benchInflate{false};
+    bool service{false};
+    bool noService{false};
+    bool coalesce{false};
+    bool serviceStats{false};
+    Lane lane{Lane::kInteractive};
+    uint64_t cacheBytes{kDefaultCacheBytes};
+    bool haveCacheBytes{false};
+    std::wstring watchDir;
+    LabelRule rule; // --label-pattern and --label-sidecar; rule.fixed is filled from --label
+    unsigned settleMs{kDefaultSettleMs};
+    bool haveSettleMs{false};
+    FilterMode filter{FilterMode::kAdaptive};
+    ImageFormat format{ImageFormat::kUnknown};
+    CompressOptions compress;
+    std::wstring outPath;
+    std::wstring backend;
+    unsigned jobs{0};
+};
+
+// The --bench-* runs take files but no label, and stay in this process.
+static bool AnyBench(const CliOptions& o) {
+    return o.benchUnfilter || o.benchFilter || o.benchChecksum || o.benchDeflate || o.benchInflate;
+}
+
+static std::mutex reportMu;
+
+static void ReportLine(const std::wstring& text) {
+    std::lock_guard<std::mutex> lk(reportMu);
+    fputs((ToUtf8(text) + "\n").c_str(), stderr);
+}
+
+bool IsHeadlessCommandLine(const std::vector<std::wstring>& args) {
+    for (const std::wstring& a : args) {
+        if (a.compare(0, 2, L"--") == 0) return true;
+    }
+    return false;
+}
+
+// Accepts "--name value" and "--name=value".
+static bool TakeValue(const std::vector<std::wstring>& args, size_t& i, const std::wstring& name,
+                      std::wstring& value, bool& matched, std::wstring& outError) {
+    const std::wstring& a = args[i];
+    matched = false;
+    if (a == name) {
+        matched = true;
+        if (i + 1 >= args.size()) {
+            outError = name + L" needs a value.";
+            return false;
+        }
+        value = args[++i];
+        return true;
+    }
+    if (a.size() > name.size() && a.compare(0, name.size(), name) == 0 && a[name.size()] == L'=') {
+        matched = true;
+        value = a.substr(name.size() + 1);
+    }
+    return true;
+}
+
+static std::wstring TrimSpace(const std::wstring& s) {
+    size_t a = 0, b = s.size();
+    while (a < b && (s[a] == L' ' || s[a] == L'\t' || s[a] == L'\r')) ++a;
+    while (b > a && (s[b - 1] == L' ' || s[b - 1] == L'\t' || s[b - 1] == L'\r')) --b;
+    return s.substr(a, b - a);
+}
+
+// One image per line, optionally "<path><TAB><label>". Blank lines and '#' comments are skipped.
+static bool ReadListFile(const std::wstring& listPath, std::vector<BatchItem>& items, std::wstring& outError) {
+    std::vector<uint8_t> bytes;
+    std::wstring err;
+    if (!ReadFileBytes(listPath, bytes, err)) {
+        outError = L"Cannot read list file " + listPath + L": " + err;
+        return false;
+    }
+    size_t start = bytes.size() >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF ? 3 : 0;
+    std::wstring text = FromUtf8(std::string(bytes.begin() + start, bytes.end()));
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find(L'\n', pos);
+        if (nl == std::wstring::npos) nl = text.size();
+        std::wstring line = text.substr(pos, nl - pos);
+        pos = nl + 1;
+        if (!line.empty() && line.back() == L'\r') line.pop_back();
+        if (TrimSpace(line).empty() || TrimSpace(line)[0] == L'#') continue;
+
+        BatchItem it;
+        size_t tab = line.find(L'\t');
+        if (tab == std::wstring::npos) {
+            it.path = TrimSpace(line);
+        } else {
+            it.path = TrimSpace(line.substr(0, tab));
+            it.label = TrimSpace(line.substr(tab + 1));
+        }
+        if (!it.path.empty()) items.push_back(it);
+    }
+    return true;
+}
+
+// Relative paths (images, @listfiles and their entries, --out) are resolved against baseDir.
+static bool ParseCommandLine(const std::vector<std::wstring>& args, const std::wstring& baseDir, CliOptions& o,
+                             std::wstring& outError) {
+    bool endOfOptions = false;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::wstring& a = args[i];
+        if (endOfOptions || a.empty() || a[0] != L'-' || a == L"-") {
+            o.inputs.push_back(a);
+            continue;
+        }
+        if (a == L"--") { endOfOptions = true; continue; }
+        if (a == L"--overwrite") { o.overwrite = true; continue; }
+        if (a == L"--copy")      { o.copy = true; continue; }
+        if (a == L"--quiet")     { o.quiet = true; continue; }
+        if (a == L"--verify")    { o.verify = true; continue; }
+        if (a == L"--reencode")  { o.reencode = true; continue; }
+        if (a == L"--metadata-only") { o.metadataOnly = true; continue; }
+        if (a == L"--bench-unfilter") { o.benchUnfilter = true; continue; }
+        if (a == L"--bench-filter") { o.benchFilter = true; continue; }
+        if (a == L"--bench-checksum") { o.benchChecksum = true; continue; }
+        if (a == L"--bench-deflate") { o.benchDeflate = true; continue; }
+        if (a == L"--bench-inflate") { o.benchInflate = true; continue; }
+        if (a == L"--service")   { o.service = true; continue; }
+        if (a == L"--no-service") { o.noService = true; continue; }
+        if (a == L"--coalesce")  { o.coalesce = true; continue; }
+        if (a == L"--service-stats") { o.serviceStats = true; continue; }
+
+        bool matched = false;
+        if (!TakeValue(args, i, L"--label", o.label, matched, outError)) return false;
+        if (matched) { o.haveLabel = true; continue; }
+        if (!TakeValue(args, i, L"--out", o.outPath, matched, outError)) return false;
+        if (matched) continue;
+        if (!TakeValue(args, i, L"--backend", o.backend, matched, outError)) return false;
+        if (matched) continue;
+        if (!TakeValue(args, i, L"--watch", o.watchDir, matched, outError)) return false;
+        if (matched) continue;
+        if (!TakeValue(args, i, L"--label-pattern", o.rule.pattern, matched, outError)) return false;
+        if (matched) continue;
+        if (!TakeValue(args, i, L"--label-sidecar", o.rule.sidecarExt, matched, outError)) return false;
+        if (matched) {
+            if (!o.rule.sidecarExt.empty() && o.rule.sidecarExt[0] == L'.') o.rule.sidecarExt.erase(0, 1);
+            continue;
+        }
+        std::wstring settle;
+        if (!TakeValue(args, i, L"--settle-ms", settle, matched, outError)) return false;
+        if (matched) {
+            wchar_t* end = nullptr;
+            unsigned long n = wcstoul(settle.c_str(), &end, 10);
+            if (settle.empty() || *end || n > 3600000) {
+                outError = L"--settle-ms needs a time between 0 and 3600000 ms.";
+                return false;
+            }
+            o.settleMs = (unsigned)n;
+            o.haveSettleMs = true;
+            continue;
+        }
+        std::wstring filter;
+        if (!TakeValue(args, i, L"--filter", filter, matched, outError)) return false;
+        if (matched) {
+            if (filter == L"adaptive") {
+                o.filter = FilterMode::kAdaptive;
+            } else if (filter == L"reuse") {
+                o.filter = FilterMode::kReuse;
+            } else {
+                outError = L"--filter must be adaptive or reuse.";
+                return false;
+            }
+            continue;
+        }
+        std::wstring lane;
+        if (!TakeValue(args, i, L"--lane", lane, matched, outError)) return false;
+        if (matched) {
+            if (!ParseLane(lane, o.lane)) {
+                outError = L"--lane must be interactive, batch or background.";
+                return false;
+            }
+            continue;
+        }
+        std::wstring cacheMb;
+        if (!TakeValue(args, i, L"--cache-mb", cacheMb, matched, outError)) return false;
+        if (matched) {
+            wchar_t* end = nullptr;
+            unsigned long n = wcstoul(cacheMb.c_str(), &end, 10);
+            if (cacheMb.empty() || *end || n > 1048576) {
+                outError = L"--cache-mb needs a size between 0 and 1048576 MB.";
+                return false;
+            }
+            o.cacheBytes = (uint64_t)n << 20;
+            o.haveCacheBytes = true;
+            continue;
+        }
+        std::wstring content;
+        if (!TakeValue(args, i, L"--content", content, matched, outError)) return false;
+        if (matched) {
+            if (content == L"auto") {
+                o.compress.content = ContentClass::kAuto;
+            } else if (content == L"photo") {
+                o.compress.content = ContentClass::kPhoto;
+            } else if (content == L"flat") {
+                o.compress.content = ContentClass::kFlat;
+            } else {
+                outError = L"--content must be auto, photo or flat.";
+                return false;
+            }
+            continue;
+        }
+        std::wstring format;
+        if (!TakeValue(args, i, L"--format", format, matched, outError)) return false;
+        if (matched) {
+            const CodecInfo* codec = format == L"auto" ? nullptr : FindCodecByName(format);
+            if (format != L"auto" && (!codec || !codec->writable)) {
+                outError = L"--format must be auto, png, qoi, pam or jpeg (JPEG input, libjpeg builds only).";
+                return false;
+            }
+            o.format = codec ? codec->format : ImageFormat::kUnknown;
+            continue;
+        }
+        std::wstring deflate;
+        if (!TakeValue(args, i, L"--deflate", deflate, matched, outError)) return false;
+        if (matched) {
+            if (deflate == L"zlib") {
+                o.compress.engine = DeflateEngine::kZlib;
+            } else if (deflate == L"oneshot") {
+                o.compress.engine = DeflateEngine::kOneShot;
+            } else if (deflate == L"store") {
+                o.compress.engine = DeflateEngine::kStore;
+            } else {
+                outError = L"--deflate must be zlib, oneshot or store.";
+                return false;
+            }
+            continue;
+        }
+        std::wstring level;
+        if (!TakeValue(args, i, L"--level", level, matched, outError)) return false;
+        if (matched) {
+            wchar_t* end = nullptr;
+            unsigned long n = wcstoul(level.c_str(), &end, 10);
+            if (level.empty() || *end || n > 9) {
+                outError = L"--level needs a zlib level between 0 and 9.";
+                return false;
+            }
+            o.compress.level = (int)n;
+            continue;
+        }
+        std::wstring budget;
+        if (!TakeValue(args, i, L"--latency-budget-ms", budget, matched, outError)) return false;
+        if (matched) {
+            wchar_t* end = nullptr;
+            unsigned long n = wcstoul(budget.c_str(), &end, 10);
+            if (budget.empty() || *end || n == 0 || n > 3600000) {
+                outError = L"--latency-budget-ms needs a time between 1 and 3600000 ms.";
+                return false;
+            }
+            o.compress.latencyBudgetMs = (uint32_t)n;
+            continue;
+        }
+        std::wstring jobs;
+        if (!TakeValue(args, i, L"--jobs", jobs, matched, outError)) return false;
+        if (matched) {
+            wchar_t* end = nullptr;
+            unsigned long n = wcstoul(jobs.c_str(), &end, 10);
+            if (jobs.empty() || *end || n > 1024) {
+                outError = L"--jobs needs a thread count between 0 and 1024.";
+                return false;
+            }
+            o.jobs = (unsigned)n;
+            continue;
+        }
+
+        outError = L"Unknown option: " + a;
+        return false;
+    }
+
+    if (o.overwrite && (o.copy || !o.outPath.empty())) {
+        outError = L"--overwrite cannot be combined with --copy or --out.";
+        return false;
+    }
+    if (o.coalesce && !o.outPath.empty()) {
+        outError = L"--coalesce cannot be combined with --out.";
+        return false;
+    }
+    if (o.haveCacheBytes && !o.service) {
+        outError = L"--cache-mb only applies to --service.";
+        return false;
+    }
+    if (o.watchDir.empty() && (!o.rule.pattern.empty() || !o.rule.sidecarExt.empty() || o.haveSettleMs)) {
+        outError = L"--label-pattern, --label-sidecar and --settle-ms only apply to --watch.";
+        return false;
+    }
+    if (o.haveLabel && o.label.empty()) {
+        outError = L"--label must not be empty.";
+        return false;
+    }
+    if (!o.watchDir.empty()) {
+        if (!o.inputs.empty() || !o.outPath.empty() || o.coalesce) {
+            outError = L"--watch takes no images, --out or --coalesce.";
+            return false;
+        }
+        if (!o.haveLabel && o.rule.pattern.empty() && o.rule.sidecarExt.empty()) {
+            outError = L"--watch needs --label, --label-pattern or --label-sidecar.";
+            return false;
+        }
+        o.watchDir = ResolvePath(baseDir, o.watchDir);
+        o.rule.fixed = o.label;
+        return CheckLabelRule(o.rule, outError);
+    }
+    if (o.service || o.serviceStats) {
+        if (!o.inputs.empty()) {
+            outError = o.service ? L"--service takes no images." : L"--service-stats takes no images.";
+            return false;
+        }
+        return true;
+    }
+    if (o.inputs.empty()) {
+        outError = L"No input image given.";
+        return false;
+    }
+
+    for (const std::wstring& in : o.inputs) {
+        if (in.size() > 1 && in[0] == L'@') {
+            if (!ReadListFile(ResolvePath(baseDir, in.substr(1)), o.items, outError)) return false;
+        } else {
+            o.items.push_back({ in, L"" });
+        }
+    }
+    for (BatchItem& it : o.items) it.path = ResolvePath(baseDir, it.path);
+    o.outPath = ResolvePath(baseDir, o.outPath);
+    if (o.items.empty()) {
+        outError = L"No input image given.";
+        return false;
+    }
+    for (const BatchItem& it : o.items) {
+        if (it.label.empty() && !o.haveLabel && !AnyBench(o)) {
+            outError = L"--label is required (no label for " + it.path + L").";
+            return false;
+        }
+    }
+    if (!o.outPath.empty() && o.items.size() > 1) {
+        outError = L"--out can only be used with a single image.";
+        return false;
+    }
+    return true;
+}
+
+static std::wstring FormatMs(double ms) {
+    wchar_t buf[32];
+    swprintf(buf, 32, L"%.2f ms", ms);
+    return buf;
+}
+
+static std::wstring FormatSpeedup(double referenceMs, double kernelMs) {
+    wchar_t buf[32];
+    swprintf(buf, 32, L"%.1fx", kernelMs > 0 ? referenceMs / kernelMs : 0.0);
+    return buf;
+}
+
+// One line per file, then a total over all of them.
+static int RunUnfilterBench(const CliOptions& o) {
+    const unsigned kRounds = 5;
+    const std::wstring kernel = FromUtf8(FilterKernelName());
+    const wchar_t* const kFilterNames[5] = { L"none", L"sub", L"up", L"avg", L"paeth" };
+    uint64_t totalBytes = 0;
+    double totalReference = 0, totalKernel = 0;
+    size_t failed = 0;
+    for (const BatchItem& it : o.items) {
+        UnfilterBenchResult r;
+        std::wstring err;
+        if (!BenchUnfilter(it.path, kRounds, r, err)) {
+            ReportLine(it.path + L": " + err);
+            ++failed;
+            continue;
+        }
+        totalBytes += r.bytes;
+        totalReference += r.referenceMs;
+        totalKernel += r.kernelMs;
+
+        std::wstring mix;
+        for (int f = 0; f < 5; ++f) {
+            if (!r.filterRows[f]) continue;
+            if (!mix.empty()) mix += L" ";
+            mix += kFilterNames[f] + (L" " + std::to_wstring(r.filterRows[f] * 100ull / r.height) + L"%");
+        }
+        ReportLine(it.path + L": " + std::to_wstring(r.width) + L"x" + std::to_wstring(r.height) + L", " +
+                   std::to_wstring(r.bpp) + L" B/px, " + mix + L"; scalar " + FormatMs(r.referenceMs) +
+                   L", " + kernel + L" " + FormatMs(r.kernelMs) + L" (" +
+                   FormatSpeedup(r.referenceMs, r.kernelMs) + L")");
+    }
+    if (o.items.size() > 1 && totalBytes) {
+        ReportLine(L"Total " + std::to_wstring(totalBytes >> 20) + L" MB: scalar " + FormatMs(totalReference) +
+                   L", " + kernel + L" " + FormatMs(totalKernel) + L" (" +
+                   FormatSpeedup(totalReference, totalKernel) + L")");
+    }
+    return failed ? kExitFailed : kExitOk;
+}
+
+// One line per file: the heuristic's speed and choices, then the encoded size per filter mode.
+static int RunFilterBench(const CliOptions& o) {
+    const unsigned kRounds = 5;
+    const std::wstring kernel = FromUtf8(FilterKernelName());
+    const wchar_t* const kFilterNames[5] = { L"none", L"sub", L"up", L"avg", L"paeth" };
+    size_t failed = 0;
+    for (const BatchItem& it : o.items) {
+        FilterBenchResult r;
+        std::wstring err;
+        if (!BenchFilter(it.path, kRounds, r, err)) {
+            ReportLine(it.path + L": " + err);
+            ++failed;
+            continue;
+        }
+
+        std::wstring mix;
+        for (int f = 0; f < 5; ++f) {
+            if (!r.chosenRows[f]) continue;
+            if (!mix.empty()) mix += L" ";
+            mix += kFilterNames[f] + (L" " + std::to_wstring(r.chosenRows[f] * 100ull / r.height) + L"%");
+        }
+        std::wstring reuse = r.sourceFilters
+            ? L"reuse " + std::to_wstring(r.reuseBytes) + L" B in " + FormatMs(r.reuseMs)
+            : std::wstring(L"reuse n/a (input rows are not RGB8/RGBA8)");
+        ReportLine(it.path + L": " + std::to_wstring(r.width) + L"x" + std::to_wstring(r.height) + L"x" +
+                   std::to_wstring(r.channels) + L", " + mix + L"; choose scalar " + FormatMs(r.referenceMs) +
+                   L", " + kernel + L" " + FormatMs(r.kernelMs) + L" (" +
+                   FormatSpeedup(r.referenceMs, r.kernelMs) + L"); adaptive " +
+                   std::to_wstring(r.adaptiveBytes) + L" B in " + FormatMs(r.adaptiveMs) + L", " + reuse);
+    }
+    return failed ? kExitFailed : kExitOk;
+}
+
+// Encoded images of one content class in a batch.
+struct ClassTotals {
+    size_t images{};
+    uint64_t pixels{};
+    uint64_t bytes{};
+    double encodeMs{};
+};
+
+// "Flat: 12 images, 40.1 MP encoded in 850.00 ms (47.2 MP/s), 9.8 MB (0.24 B/px)"
+static void ReportClassTotals(const HeadlessContext& ctx, const wchar_t* name, const ClassTotals& t) {
+    if (!t.images) return;
+    const double mp = t.pixels / 1e6;
+    wchar_t buf[160];
+    swprintf(buf, 160, L"%ls: %zu image%ls, %.1f MP encoded in %ls (%.1f MP/s), %.1f MB (%.2f B/px)", name,
+             t.images, t.images == 1 ? L"" : L"s", mp, FormatMs(t.encodeMs).c_str(),
+             t.encodeMs > 0 ? mp * 1000 / t.encodeMs : 0.0, t.bytes / 1048576.0,
+             t.pixels ? (double)t.bytes / t.pixels : 0.0);
+    ctx.report(buf);
+}
+
+// One line per file: the fastest round of each checksum, bytewise and with the dispatched kernels.
+static int RunChecksumBench(const CliOptions& o) {
+    const unsigned kRounds = 5;
+    const std::wstring kernel = FromUtf8(ChecksumKernelName());
+    size_t failed = 0;
+    for (const BatchItem& it : o.items) {
+        ChecksumBenchResult r;
+        std::wstring err;
+        if (!BenchChecksum(it.path, kRounds, r, err)) {
+            ReportLine(it.path + L": " + err);
+            ++failed;
+            continue;
+        }
+        ReportLine(it.path + L": " + std::to_wstring(r.bytes >> 20) + L" MB; CRC-32 bytewise " +
+                   FormatMs(r.crcReferenceMs) + L", " + kernel + L" " + FormatMs(r.crcKernelMs) + L" (" +
+                   FormatSpeedup(r.crcReferenceMs, r.crcKernelMs) + L"); Adler-32 bytewise " +
+                   FormatMs(r.adlerReferenceMs) + L", " + kernel + L" " + FormatMs(r.adlerKernelMs) + L" (" +
+                   FormatSpeedup(r.adlerReferenceMs, r.adlerKernelMs) + L")");
+    }
+    return failed ? kExitFailed : kExitOk;
+}
+
+// The fixed round trips once, then one line per file: size and fastest round of each engine.
+static int RunDeflateBench(const CliOptions& o) {
+    const unsigned kRounds = 3;
+    unsigned cases = 0;
+    std::wstring err;
+    if (!CheckDeflateRoundTrips(cases, err)) {
+        ReportLine(err);
+        return kExitFailed;
+    }
+    ReportLine(L"Deflate round trips: " + std::to_wstring(cases) + L" streams inflate back.");
+    size_t failed = 0;
+    for (const BatchItem& it : o.items) {
+        DeflateBenchResult r;
+        if (!BenchDeflate(it.path, kRounds, r, err)) {
+            ReportLine(it.path + L": " + err);
+            ++failed;
+            continue;
+        }
+        ReportLine(it.path + L": " + std::to_wstring(r.bytes) + L" B; zlib " + std::to_wstring(r.zlibBytes) +
+                   L" B in " + FormatMs(r.zlibMs) + L", oneshot " + std::to_wstring(r.oneshotBytes) + L" B in " +
+                   FormatMs(r.oneshotMs) + L", store " + std::to_wstring(r.storeBytes) + L" B in " +
+                   FormatMs(r.storeMs));
+    }
+    return failed ? kExitFailed : kExitOk;
+}
+
+// One line per file: per zlib level, serial and parallel time and how often speculation missed.
+static int RunInflateBench(const CliOptions& o) {
+    size_t failed = 0;
+    for (const BatchItem& it : o.items) {
+        InflateBenchResult r;
+        std::wstring err;
+        if (!BenchInflate(it.path, r, err)) {
+            ReportLine(it.path + L": " + err);
+            ++failed;
+            continue;
+        }
+        std::wstring line = it.path + L": " + std::to_wstring(r.bytes >> 20) + L" MB, " + std::to_wstring(r.threads) +
+                            L" threads";
+        for (const InflateBenchStream& s : r.streams) {
+            line += (s.random ? L"; random level " : L"; level ") + std::to_wstring(s.level) + L" " +
+                    std::to_wstring(s.compressed >> 10) +
+                    L" KB, zlib " + FormatMs(s.serialMs) + L", parallel " + FormatMs(s.parallelMs) + L" (" +
+                    std::to_wstring(s.pieces) + L" pieces, " + std::to_wstring(s.redecoded) + L" decoded again)";
+        }
+        ReportLine(line);
+    }
+    return failed ? kExitFailed : kExitOk;
+}
+
+// Launches are only merged when everything but their images matches, so the group's options are
+// the leader's. The role is a hash of those options.
+static std::wstring CoalesceRole(const CliOptions& o) {
+    wchar_t flags[160];
+    swprintf(flags, 160, L"%d%d%d%d%d|%d|%d|%d|%d|%u|%d|%u|", o.overwrite, o.copy, o.verify, o.reencode,
+             o.metadataOnly, (int)o.filter, (int)o.format, (int)o.compress.engine, o.compress.level,
+             o.compress.latencyBudgetMs, (int)o.compress.content, o.jobs);
+    const std::string key = ToUtf8(flags + o.backend + L"|" + o.label);
+    uint64_t h = 1469598103934665603ull; // FNV-1a
+    for (unsigned char c : key) h = (h ^ c) * 1099511628211ull;
+    wchar_t hex[24];
+    swprintf(hex, 24, L"%016llx", (unsigned long long)h);
+    return L"gather-" + std::wstring(hex);
+}
+
+static SaveOptions SaveOptionsFor(const CliOptions& o) {
+    SaveOptions save;
+    save.overwrite = o.overwrite;
+    save.outPath = o.outPath;
+    save.reencode = o.reencode;
+    save.metadataOnly = o.metadataOnly;
+    save.verify = o.verify;
+    save.filter = o.filter;
+    save.format = o.format;
+    save.compress = o.compress;
+    return save;
+}
+
+// Labels o.items; messages go to ctx.report.
+static int RunLabel(CliOptions& o, const HeadlessContext& ctx) {
+    std::wstring err;
+    std::unique_ptr<Backend> owned;
+    Backend* backend = nullptr;
+    if (ctx.backend) {
+        backend = ctx.backend(o.backend, err);
+    } else {
+        owned = o.backend.empty() ? CreateDefaultBackend(err) : CreateBackendByName(o.backend, err);
+        backend = owned.get();
+    }
+    if (!backend) {
+        ctx.report(err);
+        return o.backend.empty() ? kExitFailed : kExitUsage;
+    }
+
+    SaveOptions save = SaveOptionsFor(o);
+    std::unique_ptr<LaneGate> gate;
+    if (ctx.lanes) {
+        gate.reset(new LaneGate(*ctx.lanes, o.lane));
+        save.gate = gate.get();
+    }
+    save.cache = ctx.cache;
+
+    // Items without their own label take --label.
+    for (BatchItem& it : o.items) {
+        if (it.label.empty()) it.label = o.label;
+    }
+
+    size_t saved = 0, missing = 0, failed = 0;
+    ClassTotals flat, photo;
+    ProcessBatch(*backend, o.items, save, o.jobs, [&](size_t index, const BatchResult& r) {
+        const BatchItem& it = o.items[index];
+        if (r.missing) {
+            ctx.report(L"File not found: " + it.path);
+        } else if (!r.ok) {
+            ctx.report(L"Failed to write image: " + it.path + L": " + r.error);
+        } else {
+            if (ctx.saved) ctx.saved(r.savedPath);
+            if (!o.quiet) ctx.report(L"Saved: " + r.savedPath);
+        }
+        std::lock_guard<std::mutex> lk(reportMu);
+        if (r.missing) ++missing;
+        else if (!r.ok) ++failed;
+        else ++saved;
+        if (r.ok && r.stats.content != ContentClass::kAuto) {
+            ClassTotals& t = r.stats.content == ContentClass::kFlat ? flat : photo;
+            ++t.images;
+            t.pixels += r.stats.pixels;
+            t.bytes += r.stats.bytes;
+            t.encodeMs += r.stats.encodeMs;
+        }
+    });
+
+    if (!o.quiet && o.items.size() > 1) {
+        ctx.report(L"Labeled " + std::to_wstring(saved) + L" of " + std::to_wstring(o.items.size()) + L" images.");
+        ReportClassTotals(ctx, L"Flat", flat);
+        ReportClassTotals(ctx, L"Photo", photo);
+    }
+    if (failed) return kExitFailed;
+    if (missing) return kExitNotFound;
+    return kExitOk;
+}
+
+// Labels what lands in o.watchDir until the process is killed.
+static int RunWatchFolder(const CliOptions& o) {
+    std::wstring err;
+    std::unique_ptr<Backend> backend =
+        o.backend.empty() ? CreateDefaultBackend(err) : CreateBackendByName(o.backend, err);
+    if (!backend) {
+        ReportLine(err);
+        return o.backend.empty() ? kExitFailed : kExitUsage;
+    }
+    WatchOptions watch;
+    watch.dir = o.watchDir;
+    watch.rule = o.rule;
+    watch.settleMs = o.settleMs;
+    watch.jobs = o.jobs;
+    watch.quiet = o.quiet;
+    return RunWatch(*backend, watch, SaveOptionsFor(o), ReportLine);
+}
+
+int RunLabelCommand(const std::vector<std::wstring>& args, const HeadlessContext& ctx) {
+    CliOptions o;
+    std::wstring err;
+    if (!ParseCommandLine(args, ctx.baseDir, o, err)) {
+        ctx.report(err);
+        ctx.report(kUsage);
+        return kExitUsage;
+    }
+    if (o.service || o.serviceStats || !o.watchDir.empty() || AnyBench(o)) {
+        ctx.report(L"Only labeling runs can be handed to the service.");
+        return kExitUsage;
+    }
+    return RunLabel(o, ctx);
+}
+
+int RunHeadless(const std::vector<std::wstring>& args, void (*onSaved)(const std::wstring& path)) {
+    for (const std::wstring& a : args) {
+        if (a == L"--help" || a == L"-h") {
+            ReportLine(kUsage);
+            return kExitOk;
+        }
+    }
+
+    CliOptions o;
+    std::wstring err;
+    if (!ParseCommandLine(args, L"", o, err)) {
+        ReportLine(err);
+        ReportLine(kUsage);
+        return kExitUsage;
+    }
+    if (AnyBench(o)) {
+        int rc = o.benchUnfilter ? RunUnfilterBench(o) : kExitOk;
+        if (o.benchFilter && RunFilterBench(o) != kExitOk) rc = kExitFailed;
+        if (o.benchChecksum && RunChecksumBench(o) != kExitOk) rc = kExitFailed;
+        if (o.benchDeflate && RunDeflateBench(o) != kExitOk) rc = kExitFailed;
+        if (o.benchInflate && RunInflateBench(o) != kExitOk) rc = kExitFailed;
+        return rc;
+    }
+    if (o.service) return RunService(o.backend, o.cacheBytes, o.quiet);
+    if (!o.watchDir.empty()) return RunWatchFolder(o);
+    if (o.serviceStats) {
+        HeadlessContext ctx;
+        ctx.report = ReportLine;
+        int rc = kExitOk;
+        if (QueryServiceStats(ctx, rc)) return rc;
+        ReportLine(L"No labeling service is running.");
+        return kExitFailed;
+    }
+
+    if (o.coalesce) {
+        LaunchGatherer group;
+        if (!group.Join(CoalesceRole(o), o.items, err)) {
+            if (!err.empty()) {
+                ReportLine(err);
+                return kExitFailed;
+            }
+            if (!o.quiet) {
+                ReportLine(L"Handed " + std::to_wstring(o.items.size()) + L" image(s) to the piclab process " +
+                           L"labeling this group.");
+            }
+            return kExitOk;
+        }
+        o.items = group.Finish();
+    }
+
+    HeadlessContext ctx;
+    ctx.report = ReportLine;
+    if (onSaved) ctx.saved = onSaved;
+    int rc = kExitOk;
+    // A merged group is more than the arguments say, so it is labeled here.
+    if (!o.noService && !o.coalesce && ForwardToService(args, ctx, rc)) return rc;
+    return RunLabel(o, ctx);
+}
+
+} // namespace piclab
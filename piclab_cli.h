@@ -0,0 +1,49 @@
+// piclab_cli.h
+// Headless command line shared by the Win32 and POSIX entry points. Never shows a dialog:
+// results are reported through the exit code and stderr only.
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace piclab {
+
+class Backend;
+class DecodedImageCache;
+class LaneScheduler;
+
+enum ExitCode {
+    kExitOk       = 0,
+    kExitUsage    = 1,
+    kExitNotFound = 2,
+    kExitFailed   = 3,
+};
+
+// True when the arguments (without argv[0]) contain any "--" option.
+bool IsHeadlessCommandLine(const std::vector<std::wstring>& args);
+
+// Parses and runs a headless invocation. onSaved (may be null) is called for every written file.
+// Labeling runs are handed to a running service (--service) when one answers, unless --no-service.
+int RunHeadless(const std::vector<std::wstring>& args, void (*onSaved)(const std::wstring& path));
+
+// Where a labeling run reports to and which backend it uses, so the service can run clients'
+// command lines in its own process.
+struct HeadlessContext {
+    std::wstring baseDir; // relative image, @listfile and --out paths are resolved against it
+    std::function<void(const std::wstring& text)> report; // one message line; called from workers
+    std::function<void(const std::wstring& path)> saved;  // optional; called from workers
+    // Optional: a backend for a --backend name ("" = default) that outlives the run. When unset,
+    // the run creates its own.
+    std::function<Backend*(const std::wstring& name, std::wstring& outError)> backend;
+    // Optional: images are admitted through this scheduler in the run's --lane.
+    LaneScheduler* lanes{nullptr};
+    // Optional: decoded sources are kept here for the next run that relabels them.
+    DecodedImageCache* cache{nullptr};
+};
+
+// Runs a labeling command line in this process. Benchmarks, --service and --help are not handled.
+int RunLabelCommand(const std::vector<std::wstring>& args, const HeadlessContext& ctx);
+
+} // namespace piclab
@@ -0,0 +1,68 @@
+// piclab_codecs.cpp
+// The codec table and magic-byte detection.
+
+#include "piclab_codecs.h"
+#include "piclab_io.h"
+#include "piclab_pam.h"
+#include "piclab_png.h"
+#include "piclab_qoi.h"
+#ifdef PICLAB_HAVE_LIBJPEG
+#include "piclab_jpeg.h"
+#endif
+
+#include <cstring>
+#include <cwctype>
+#include <vector>
+
+namespace piclab {
+
+#ifdef PICLAB_HAVE_LIBJPEG
+#define PICLAB_JPEG_CODEC true, DecodeJpeg, nullptr, VerifyJpegFile
+#else
+#define PICLAB_JPEG_CODEC false, nullptr, nullptr, nullptr
+#endif
+
+// In ImageFormat order, starting after kUnknown.
+static const CodecInfo kCodecs[] = {
+    { ImageFormat::kPng,  L"png",  L"png",  L"image/png",  true,  DecodePng, nullptr, VerifyPngFile },
+    { ImageFormat::kJpeg, L"jpeg", L"jpg",  L"image/jpeg", PICLAB_JPEG_CODEC },
+    { ImageFormat::kGif,  L"gif",  L"gif",  L"image/gif",  false, nullptr, nullptr, nullptr },
+    { ImageFormat::kBmp,  L"bmp",  L"bmp",  L"image/bmp",  false, nullptr, nullptr, nullptr },
+    { ImageFormat::kTiff, L"tiff", L"tif",  L"image/tiff", false, nullptr, nullptr, nullptr },
+    { ImageFormat::kQoi,  L"qoi",  L"qoi",  L"image/qoi",  true,  DecodeQoi, CreateQoiRowWriter, VerifyQoiFile },
+    { ImageFormat::kPam,  L"pam",  L"pam",  L"image/x-portable-arbitrarymap", true, DecodePam, CreatePamRowWriter,
+      VerifyPamFile },
+};
+
+ImageFormat DetectFormat(const uint8_t* data, size_t size) {
+    if (IsPng(data, size)) return ImageFormat::kPng;
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) return ImageFormat::kJpeg;
+    if (size >= 6 && (memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0)) return ImageFormat::kGif;
+    if (size >= 2 && data[0] == 'B' && data[1] == 'M') return ImageFormat::kBmp;
+    if (size >= 4 && (memcmp(data, "II*\0", 4) == 0 || memcmp(data, "MM\0*", 4) == 0)) return ImageFormat::kTiff;
+    if (IsQoi(data, size)) return ImageFormat::kQoi;
+    if (IsPam(data, size)) return ImageFormat::kPam;
+    return ImageFormat::kUnknown;
+}
+
+ImageFormat DetectFileFormat(const std::wstring& path) {
+    std::vector<uint8_t> head;
+    if (!ReadFileHead(path, 16, head)) return ImageFormat::kUnknown;
+    return DetectFormat(head.data(), head.size());
+}
+
+const CodecInfo* FindCodec(ImageFormat format) {
+    if (format == ImageFormat::kUnknown) return nullptr;
+    return &kCodecs[(int)format - 1];
+}
+
+const CodecInfo* FindCodecByName(const std::wstring& name) {
+    std::wstring lower;
+    for (wchar_t c : name) lower += (wchar_t)towlower(c);
+    for (const CodecInfo& c : kCodecs) {
+        if (lower == c.name || lower == c.extension) return &c;
+    }
+    return nullptr;
+}
+
+} // namespace piclab
@@ -0,0 +1,40 @@
+// piclab_codecs.h
+// Codec registry: which format a file is in, judged from its first bytes, and what the core can do
+// with each format. The table is static, so a lookup is an array index for the life of the process.
+// PNG is encoded by the backend (streaming, splicing, GDI+); JPEG output is the lossless strip path
+// of piclab_jpeg.h; QOI and PAM are portable fast outputs for pipelines that want speed over size.
+
+#pragma once
+
+#include "piclab_core.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace piclab {
+
+struct CodecInfo {
+    ImageFormat format;
+    const wchar_t* name;      // as given to --format
+    const wchar_t* extension; // of files written in this format, without the dot
+    const wchar_t* mime;      // for backends that look their encoders up by MIME type
+    bool writable;            // can be chosen as output format
+    // Portable parts, null where a backend or a special path does the work or nothing can.
+    bool (*decode)(const uint8_t* data, size_t size, Image& out, std::wstring& outError);
+    std::unique_ptr<RowWriter> (*createWriter)(const std::wstring& path, uint32_t width, uint32_t height,
+                                               uint32_t channels, std::wstring& outError);
+    bool (*verify)(const std::wstring& path, std::wstring& outError);
+};
+
+// kUnknown when no registered signature matches.
+ImageFormat DetectFormat(const uint8_t* data, size_t size);
+// Reads only the first few bytes of the file.
+ImageFormat DetectFileFormat(const std::wstring& path);
+// Null only for kUnknown.
+const CodecInfo* FindCodec(ImageFormat format);
+// By name, extension or "jpg"; case-insensitive. Null when nothing matches.
+const CodecInfo* FindCodecByName(const std::wstring& name);
+
+} // namespace piclab
@@ -0,0 +1,625 @@
+// piclab_core.cpp
+// Layout, scrim and text compositing on plain RGB(A) buffers, plus the portable backend.
+
+#include "piclab_core.h"
+#include "piclab_cache.h"
+#include "piclab_codecs.h"
+#include "piclab_font.h"
+#include "piclab_io.h"
+#ifdef PICLAB_HAVE_LIBJPEG
+#include "piclab_jpeg.h"
+#endif
+#include "piclab_kernels.h"
+#include "piclab_png.h"
+#include "piclab_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+namespace piclab {
+
+// ----------------------------- Blending -----------------------------
+
+void ApplyScrim(Image& img, uint32_t top, uint32_t rows, uint8_t alpha) {
+    if (top >= img.height) return;
+    rows = std::min(rows, img.height - top);
+    for (uint32_t y = top; y < top + rows; ++y) ScrimRow(img.Row(y), img.width, img.channels, alpha);
+}
+
+void CompositeMask(Image& img, const CoverageMask& mask, int x, int y,
+                   uint8_t r, uint8_t g, uint8_t b, uint8_t alpha) {
+    int x0 = std::max(0, x), y0 = std::max(0, y);
+    int x1 = std::min<int>((int)img.width,  x + (int)mask.width);
+    int y1 = std::min<int>((int)img.height, y + (int)mask.height);
+    for (int yy = y0; yy < y1; ++yy) {
+        const uint8_t* cov = mask.data.data() + (size_t)(yy - y) * mask.width + (x0 - x);
+        uint8_t* px = img.Row((uint32_t)yy) + (size_t)x0 * img.channels;
+        for (int xx = x0; xx < x1; ++xx, ++cov, px += img.channels) {
+            if (*cov) BlendPixel(px, img.channels, r, g, b, Div255((uint32_t)*cov * alpha));
+        }
+    }
+}
+
+void CompositeLabel(Image& img, const CoverageMask& mask, int x, int y) {
+    if (mask.width == 0 || mask.height == 0) return;
+    // Union of the fill box at (x, y) and the shadow box at (x+1, y+1).
+    const int bw = (int)mask.width + 1, bh = (int)mask.height + 1;
+    int x0 = std::max(0, x), y0 = std::max(0, y);
+    int x1 = std::min<int>((int)img.width,  x + bw);
+    int y1 = std::min<int>((int)img.height, y + bh);
+    if (x0 >= x1) return;
+
+    std::vector<uint8_t> fill(bw, 0), shadow(bw, 0);
+    for (int yy = y0; yy < y1; ++yy) {
+        int r = yy - y;
+        if (r < (int)mask.height) {
+            memcpy(fill.data(), mask.data.data() + (size_t)r * mask.width, mask.width);
+        } else {
+            std::fill(fill.begin(), fill.end(), 0);
+        }
+        if (r >= 1) {
+            memcpy(shadow.data() + 1, mask.data.data() + (size_t)(r - 1) * mask.width, mask.width);
+        } else {
+            std::fill(shadow.begin(), shadow.end(), 0);
+        }
+        LabelRow(img.Row((uint32_t)yy) + (size_t)x0 * img.channels, (uint32_t)(x1 - x0), img.channels,
+                 fill.data() + (x0 - x), shadow.data() + (x0 - x), kShadowAlpha);
+    }
+}
+
+// ----------------------------- Content -----------------------------
+
+static const uint32_t kColorBits = 1u << 16;
+static const uint32_t kFlatMaxColors = 16384;
+
+void SampleContentRow(ContentSample& sample, const uint8_t* row, uint32_t width, uint32_t channels) {
+    if (sample.colorBits.empty()) sample.colorBits.assign(kColorBits / 64, 0);
+    uint32_t prev = 0;
+    for (uint32_t x = 0; x < width; ++x, row += channels) {
+        uint32_t c = row[0] | (uint32_t)row[1] << 8 | (uint32_t)row[2] << 16;
+        if (channels == 4) c |= (uint32_t)row[3] << 24;
+        if (x && c == prev) {
+            ++sample.runPixels;
+        } else {
+            // A run repeats a colour already counted, so only its first pixel is hashed.
+            const uint32_t h = (c * 2654435761u) >> 16;
+            const uint64_t bit = 1ull << (h & 63);
+            if (!(sample.colorBits[h >> 6] & bit)) {
+                sample.colorBits[h >> 6] |= bit;
+                ++sample.colorBitsSet;
+            }
+        }
+        prev = c;
+    }
+    sample.pixels += width;
+}
+
+uint32_t EstimateColors(const ContentSample& sample) {
+    const uint32_t zeros = kColorBits - sample.colorBitsSet;
+    if (sample.colorBitsSet == 0) return 0;
+    if (zeros == 0) return UINT32_MAX;
+    return (uint32_t)std::lround(-(double)kColorBits * std::log((double)zeros / kColorBits));
+}
+
+ContentClass ClassifyContent(const ContentSample& sample) {
+    if (sample.pixels == 0) return ContentClass::kPhoto;
+    const bool runs = sample.runPixels * 2 >= sample.pixels;
+    return runs && EstimateColors(sample) <= kFlatMaxColors ? ContentClass::kFlat : ContentClass::kPhoto;
+}
+
+ContentClass ClassifyImage(const Image& img) {
+    ContentSample sample;
+    const uint32_t step = std::max<uint32_t>(1, img.height / 256);
+    for (uint32_t y = step / 2; y < img.height; y += step) {
+        SampleContentRow(sample, img.Row(y), img.width, img.channels);
+    }
+    return ClassifyContent(sample);
+}
+
+// ----------------------------- Layout -----------------------------
+
+LabelLayout LayoutForImage(uint32_t width, uint32_t height) {
+    LabelLayout L;
+    L.pad = (float)std::max<double>(8.0, (double)height * 0.012);
+    double fontPt = std::max<double>(10.0, (double)height * 0.042); // ~4.2% of height
+    L.fontPx = (float)(fontPt * 96.0 / 72.0);
+    double avail = (double)width - 2.0 * L.pad;
+    L.maxTextWidth = avail >= 1.0 ? (uint32_t)avail : 1u;
+    return L;
+}
+
+void PlaceLabel(LabelLayout& L, uint32_t width, uint32_t height, uint32_t textHeight) {
+    (void)width;
+    double scrimH = (double)textHeight + 2.0 * L.pad;
+    scrimH = std::max<double>(scrimH, std::max<double>(height * 0.05, 18.0)); // min ~5% or 18px
+    scrimH = std::min<double>(scrimH, height * 0.15);
+    L.scrimRows = std::min<uint32_t>(height, (uint32_t)std::max(1L, std::lround(scrimH)));
+    L.scrimTop  = height - L.scrimRows;
+    // Text is vertically centered in the padded box inside the scrim and may overflow it when clamped.
+    double boxTop = (double)L.scrimTop + L.pad;
+    double boxH   = (double)L.scrimRows - 2.0 * L.pad;
+    L.textX = (int)std::lround(L.pad);
+    L.textY = (int)std::lround(boxTop + (boxH - (double)textHeight) / 2.0);
+}
+
+// ----------------------------- Pipeline -----------------------------
+
+void LabelStrip(Image& strip, uint32_t stripTop, const LabelLayout& L, const CoverageMask& mask) {
+    ApplyScrim(strip, L.scrimTop - stripTop, L.scrimRows, kScrimAlpha);
+    CompositeLabel(strip, mask, L.textX, L.textY - (int)stripTop);
+}
+
+bool LabelImage(Backend& backend, Image& img, const std::wstring& label, std::wstring& outError) {
+    LabelLayout L = LayoutForImage(img.width, img.height);
+
+    CoverageMask mask;
+    if (!backend.RasterizeText(label, L.fontPx, L.maxTextWidth, mask, outError)) return false;
+    PlaceLabel(L, img.width, img.height, mask.height);
+
+    LabelStrip(img, 0, L, mask);
+    return true;
+}
+
+// Streamed rows between SaveStage::kRows checkpoints.
+static const uint32_t kRowsPerCheckpoint = 256;
+
+static void Checkpoint(const SaveOptions& opts, SaveStage stage) {
+    if (opts.gate) opts.gate->Checkpoint(stage);
+}
+
+// Copies the rows above the label from in to a new file at dst and labels only the bottom strip,
+// so peak memory is width x strip height rather than the whole image.
+static bool StreamLabel(Backend& backend, std::unique_ptr<RowReader> in, const std::wstring& label,
+                        const SaveOptions& opts, const CodecInfo& format, const std::wstring& dst, SaveStats& stats,
+                        std::wstring& outError) {
+    const uint32_t width = in->Width(), height = in->Height();
+    LabelLayout L = LayoutForImage(width, height);
+    CoverageMask mask;
+    if (!backend.RasterizeText(label, L.fontPx, L.maxTextWidth, mask, outError)) return false;
+    PlaceLabel(L, width, height, mask.height);
+
+    // A clamped scrim can leave the text poking out above it, so buffer from whichever starts first.
+    Image strip;
+    const uint32_t top = std::min<uint32_t>(L.scrimTop, (uint32_t)std::max(0, L.textY));
+    strip.width = width;
+    strip.height = height - top;
+    strip.channels = in->Channels();
+    strip.pixels.resize(strip.Stride() * strip.height);
+
+    std::unique_ptr<RowWriter> out;
+    if (format.createWriter) {
+        out = format.createWriter(dst, width, height, strip.channels, outError);
+    } else {
+        // Rows above the strip come out of the decoder unchanged, so their compressed bytes can be kept.
+        if (!opts.reencode && top > 0) out = backend.CreateSpliceWriter(*in, top, dst, opts.compress, outError);
+        if (!out) out = backend.CreateRowWriter(dst, width, height, strip.channels, opts.compress, outError);
+    }
+    if (!out) return false;
+    if (opts.filter == FilterMode::kReuse) out->ReuseFilters(*in, top);
+
+    std::chrono::steady_clock::duration encodeTime{};
+    std::vector<uint8_t> row(strip.Stride());
+    for (uint32_t y = 0; y < top; ++y) {
+        if (!in->ReadRow(row.data(), outError)) return false;
+        auto start = std::chrono::steady_clock::now();
+        if (!out->WriteRow(row.data(), outError)) return false;
+        encodeTime += std::chrono::steady_clock::now() - start;
+        // Decode and encode are interleaved here, so bands of rows stand in for stage boundaries.
+        if ((y + 1) % kRowsPerCheckpoint == 0) Checkpoint(opts, SaveStage::kRows);
+    }
+    for (uint32_t y = 0; y < strip.height; ++y) {
+        if (!in->ReadRow(strip.Row(y), outError)) return false;
+    }
+    in.reset(); // release the source before the caller may replace it
+    Checkpoint(opts, SaveStage::kDecoded);
+
+    LabelStrip(strip, top, L, mask);
+    Checkpoint(opts, SaveStage::kComposited);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t y = 0; y < strip.height; ++y) {
+        if (!out->WriteRow(strip.Row(y), outError)) return false;
+    }
+    if (!out->Finish(outError)) return false;
+    encodeTime += std::chrono::steady_clock::now() - start;
+
+    stats.content = out->Content();
+    stats.pixels = (uint64_t)width * height;
+    stats.encodeMs = std::chrono::duration<double, std::milli>(encodeTime).count();
+    return true;
+}
+
+#ifdef PICLAB_HAVE_LIBJPEG
+// Labels a JPEG as a JPEG: the MCU rows above the label keep their coefficients and only the
+// bottom ones are decoded, labeled and encoded again.
+static bool LabelJpeg(Backend& backend, const std::wstring& src, const std::wstring& label, const SaveOptions& opts,
+                      const std::wstring& dst, SaveStats& stats, std::wstring& outError) {
+    LabelLayout L;
+    CoverageMask mask;
+    auto plan = [&](uint32_t width, uint32_t height, uint32_t& top, std::wstring& err) {
+        L = LayoutForImage(width, height);
+        if (!backend.RasterizeText(label, L.fontPx, L.maxTextWidth, mask, err)) return false;
+        PlaceLabel(L, width, height, mask.height);
+        top = std::min<uint32_t>(L.scrimTop, (uint32_t)std::max(0, L.textY));
+        stats.pixels = (uint64_t)width * height;
+        return true;
+    };
+    auto edit = [&](Image& strip, uint32_t stripTop) {
+        Checkpoint(opts, SaveStage::kDecoded);
+        LabelStrip(strip, stripTop, L, mask);
+        Checkpoint(opts, SaveStage::kComposited);
+    };
+
+    // Decoding the strip is counted too; it is a small part next to re-coding the coefficients.
+    auto start = std::chrono::steady_clock::now();
+    if (!LabelJpegStrip(src, dst, plan, edit, outError)) return false;
+    stats.encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+#endif
+
+// Hands out the rows of an already decoded image, so a cached source goes through StreamLabel too:
+// only the strip is copied and labeled, and nothing is decoded.
+class ImageRowReader : public RowReader {
+public:
+    explicit ImageRowReader(std::shared_ptr<const Image> img) : img_(std::move(img)) {}
+    uint32_t Width() const override { return img_->width; }
+    uint32_t Height() const override { return img_->height; }
+    uint32_t Channels() const override { return img_->channels; }
+    bool ReadRow(uint8_t* dst, std::wstring& outError) override {
+        if (y_ >= img_->height) {
+            outError = L"Read past the last row.";
+            return false;
+        }
+        memcpy(dst, img_->Row(y_++), img_->Stride());
+        return true;
+    }
+
+private:
+    std::shared_ptr<const Image> img_;
+    uint32_t y_{0};
+};
+
+// Rows of srcPath from cache, decoding the whole image and keeping it there on a miss. Null with
+// outError empty when the picture is larger than the cache and should be streamed instead.
+static std::unique_ptr<RowReader> CachedRows(Backend& backend, const std::wstring& srcPath, ImageFormat srcFormat,
+                                             DecodedImageCache& cache, const SaveOptions& opts,
+                                             std::wstring& outError) {
+    FileStamp stamp;
+    if (!GetFileStamp(srcPath, stamp)) return nullptr; // the regular path reports what is wrong
+    std::shared_ptr<const Image> img = cache.Find(srcPath, stamp);
+    if (!img) {
+        // Other formats are decoded whole in any case; a PNG that will not be kept is better streamed.
+        if (srcFormat == ImageFormat::kPng && !cache.Fits(EstimateImageCost(srcPath) * 4)) return nullptr;
+        auto fresh = std::make_shared<Image>();
+        if (!backend.Decode(srcPath, *fresh, outError)) return nullptr;
+        Checkpoint(opts, SaveStage::kDecoded);
+        // Stamped before decoding: a file rewritten meanwhile misses next time instead of going stale.
+        cache.Insert(srcPath, stamp, fresh);
+        img = std::move(fresh);
+    }
+    return std::unique_ptr<RowReader>(new ImageRowReader(std::move(img)));
+}
+
+// Encodes a decoded image in format: PNG through the backend, the others with their portable writer.
+static bool EncodeImage(Backend& backend, const Image& img, const CodecInfo& format, const CompressOptions& compress,
+                        const std::wstring& path, std::wstring& outError) {
+    if (!format.createWriter) return backend.Encode(img, path, compress, outError);
+    std::unique_ptr<RowWriter> out = format.createWriter(path, img.width, img.height, img.channels, outError);
+    if (!out) return false;
+    for (uint32_t y = 0; y < img.height; ++y) {
+        if (!out->WriteRow(img.Row(y), outError)) return false;
+    }
+    return out->Finish(outError);
+}
+
+// The format a save writes: the one asked for, else JPEG for JPEGs where the strip path exists, else PNG.
+static const CodecInfo* ChooseOutputFormat(const SaveOptions& opts, ImageFormat srcFormat, std::wstring& outError) {
+    ImageFormat chosen = opts.format;
+    if (chosen == ImageFormat::kUnknown) {
+        chosen = srcFormat == ImageFormat::kJpeg && FindCodec(ImageFormat::kJpeg)->writable ? ImageFormat::kJpeg
+                                                                                          : ImageFormat::kPng;
+    }
+    const CodecInfo* format = FindCodec(chosen);
+    if (!format->writable) {
+        outError = std::wstring(format->name) + L" output is not supported by this build.";
+        return nullptr;
+    }
+    // JPEG is only written by re-encoding the label rows of a JPEG source.
+    if (chosen == ImageFormat::kJpeg && srcFormat != ImageFormat::kJpeg) {
+        outError = L"jpeg output needs a JPEG input.";
+        return nullptr;
+    }
+    if (opts.metadataOnly && chosen != ImageFormat::kPng) {
+        outError = L"Metadata-only labels are PNG text chunks; the output must be png.";
+        return nullptr;
+    }
+    // The name stays when a file is replaced, so it must not end up holding another format.
+    if (opts.overwrite && opts.format != ImageFormat::kUnknown && chosen != srcFormat) {
+        outError = std::wstring(L"Cannot overwrite the input with ") + format->name + L" data; write a copy instead.";
+        return nullptr;
+    }
+    return format;
+}
+
+// "<name>_labeled.<ext>" next to the source, with the extension of the format written when it differs.
+static std::wstring CopyPathFor(const std::wstring& srcPath, ImageFormat srcFormat, const CodecInfo& format) {
+    std::wstring dst = PathWithSuffixBeforeExt(srcPath, L"_labeled");
+    if (srcFormat != ImageFormat::kUnknown && format.format != srcFormat) {
+        dst = PathWithExtension(dst, format.extension);
+    }
+    return dst;
+}
+
+std::wstring PlannedSavePath(const std::wstring& srcPath, const SaveOptions& opts) {
+    const ImageFormat srcFormat = DetectFileFormat(srcPath);
+    std::wstring err;
+    const CodecInfo* format = ChooseOutputFormat(opts, srcFormat, err);
+    if (!format) return L"";
+    if (opts.overwrite) return srcPath;
+    return opts.outPath.empty() ? CopyPathFor(srcPath, srcFormat, *format) : opts.outPath;
+}
+
+bool ProcessAndSave(Backend& backend,
+                    const std::wstring& srcPath,
+                    const std::wstring& label,
+                    const SaveOptions& opts,
+                    std::wstring& outSavedPath,
+                    std::wstring& outError,
+                    SaveStats* outStats) {
+    const ImageFormat srcFormat = DetectFileFormat(srcPath);
+    const CodecInfo* format = ChooseOutputFormat(opts, srcFormat, outError);
+    if (!format) return false;
+
+    SaveStats stats;
+    std::unique_ptr<RowReader> rows;
+    Image img;
+    std::function<bool(const std::wstring&, std::wstring&)> save;
+    if (opts.metadataOnly) {
+        // No decode and no recompression: the file is only re-chunked.
+        save = [&](const std::wstring& path, std::wstring& err) {
+            return WritePngText(srcPath, path, kLabelTextKeyword, ToUtf8(label), err);
+        };
+#ifdef PICLAB_HAVE_LIBJPEG
+    } else if (format->format == ImageFormat::kJpeg) {
+        // JPEGs stay JPEGs, and only the MCU rows under the label lose a generation.
+        save = [&](const std::wstring& path, std::wstring& err) {
+            return LabelJpeg(backend, srcPath, label, opts, path, stats, err);
+        };
+#endif
+    } else {
+        // PNG rows that are spliced or whose filters are reused have to come from the file itself.
+        const bool fromFile = srcFormat == ImageFormat::kPng &&
+                              (opts.filter == FilterMode::kReuse ||
+                               (format->format == ImageFormat::kPng && !opts.reencode));
+        if (opts.cache && !fromFile) rows = CachedRows(backend, srcPath, srcFormat, *opts.cache, opts, outError);
+        if (!rows && !outError.empty()) return false;
+        if (!rows && srcFormat == ImageFormat::kPng) rows = backend.OpenRowReader(srcPath, outError);
+        if (!rows && !outError.empty()) return false;
+        if (!rows) {
+            if (!backend.Decode(srcPath, img, outError)) return false;
+            Checkpoint(opts, SaveStage::kDecoded);
+            if (!LabelImage(backend, img, label, outError)) return false;
+            Checkpoint(opts, SaveStage::kComposited);
+            save = [&](const std::wstring& path, std::wstring& err) {
+                CompressOptions compress = opts.compress;
+                const bool png = format->format == ImageFormat::kPng;
+                if (png && compress.content == ContentClass::kAuto) compress.content = ClassifyImage(img);
+                auto start = std::chrono::steady_clock::now();
+                if (!EncodeImage(backend, img, *format, compress, path, err)) return false;
+                if (png) stats.content = compress.content;
+                stats.pixels = (uint64_t)img.width * img.height;
+                stats.encodeMs =
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                return true;
+            };
+        } else {
+            save = [&](const std::wstring& path, std::wstring& err) {
+                return StreamLabel(backend, std::move(rows), label, opts, *format, path, stats, err);
+            };
+        }
+    }
+    const bool progressive = img.pixels.empty(); // streamed or re-chunked, written as it goes
+
+    // A copy aimed at the source itself must not truncate it while it is still being read.
+    if (opts.overwrite || (!opts.outPath.empty() && opts.outPath == srcPath)) {
+        // Save to temp then atomically replace original
+        std::wstring tmp = GetTempSiblingPath(srcPath);
+        std::wstring err;
+        if (!save(tmp, err)) {
+            DeleteFilePath(tmp);
+            outError = L"Save to temp failed (" + err + L").";
+            return false;
+        }
+        Checkpoint(opts, SaveStage::kEncoded);
+        if (opts.verify && format->verify && !format->verify(tmp, err)) {
+            DeleteFilePath(tmp);
+            outError = L"Verify failed, original left unchanged (" + err + L").";
+            return false;
+        }
+        if (!ReplaceFileWith(tmp, srcPath, outError)) return false;
+        outSavedPath = srcPath;
+    } else {
+        // Save as a side-by-side copy
+        const std::wstring dst = opts.outPath.empty() ? CopyPathFor(srcPath, srcFormat, *format) : opts.outPath;
+        std::wstring err;
+        if (!save(dst, err)) {
+            if (progressive) DeleteFilePath(dst); // do not leave a half-written file behind
+            outError = L"Save copy failed (" + err + L").";
+            return false;
+        }
+        Checkpoint(opts, SaveStage::kEncoded);
+        if (opts.verify && format->verify && !format->verify(dst, err)) {
+            DeleteFilePath(dst);
+            outError = L"Verify failed, copy deleted (" + err + L").";
+            return false;
+        }
+        outSavedPath = dst;
+    }
+    if (outStats) {
+        stats.bytes = FileSizeOf(outSavedPath);
+        *outStats = stats;
+    }
+    return true;
+}
+
+// ----------------------------- Batch -----------------------------
+
+uint64_t EstimateImageCost(const std::wstring& path) {
+    std::vector<uint8_t> head;
+    uint32_t w = 0, h = 0;
+    if (ReadFileHead(path, 32, head) && ReadPngSize(head.data(), head.size(), w, h)) {
+        return (uint64_t)w * h;
+    }
+    return FileSizeOf(path);
+}
+
+// Holds opts.gate for the life of one image.
+class GateScope {
+public:
+    explicit GateScope(SaveGate* gate) : gate_(gate) {
+        if (gate_) gate_->Enter();
+    }
+    ~GateScope() {
+        if (gate_) gate_->Leave();
+    }
+    GateScope(const GateScope&) = delete;
+    GateScope& operator=(const GateScope&) = delete;
+
+private:
+    SaveGate* gate_;
+};
+
+static BatchResult ProcessOne(Backend& backend, const BatchItem& item, const SaveOptions& opts) {
+    BatchResult r;
+    if (!FileExists(item.path)) {
+        r.missing = true;
+        r.error = L"File not found.";
+        return r;
+    }
+    GateScope scope(opts.gate);
+    try {
+        r.ok = ProcessAndSave(backend, item.path, item.label, opts, r.savedPath, r.error, &r.stats);
+    } catch (const std::bad_alloc&) {
+        r.error = L"Out of memory.";
+    }
+    return r;
+}
+
+void ProcessBatch(Backend& backend,
+                  const std::vector<BatchItem>& items,
+                  const SaveOptions& opts,
+                  unsigned jobs,
+                  const std::function<void(size_t index, const BatchResult& result)>& onDone) {
+    // The pool is kept even for fewer images than threads: workers without an image of their own
+    // help compress the large ones.
+    if (jobs == 0) jobs = WorkPool::HardwareThreads();
+    if (jobs <= 1 || items.empty()) {
+        for (size_t i = 0; i < items.size(); ++i) onDone(i, ProcessOne(backend, items[i], opts));
+        return;
+    }
+
+    // Largest first: the pool keeps each deque sorted and balances by queued cost.
+    std::vector<std::pair<uint64_t, size_t>> order;
+    order.reserve(items.size());
+    for (size_t i = 0; i < items.size(); ++i) order.push_back({ EstimateImageCost(items[i].path), i });
+    std::stable_sort(order.begin(), order.end(),
+                     [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) {
+                         return a.first > b.first;
+                     });
+
+    WorkPool pool(jobs);
+    for (const auto& o : order) {
+        size_t i = o.second;
+        pool.Submit([&, i] { onDone(i, ProcessOne(backend, items[i], opts)); }, o.first + 1);
+    }
+    pool.Wait();
+}
+
+LabelQueue::LabelQueue(Backend& backend, const SaveOptions& opts, unsigned jobs,
+                       std::function<void(const BatchItem& item, const BatchResult& result)> onDone)
+    : backend_(backend), opts_(opts), onDone_(std::move(onDone)), pool_(new WorkPool(jobs)) {}
+
+LabelQueue::~LabelQueue() {
+    pool_->Wait();
+}
+
+void LabelQueue::Submit(BatchItem item) {
+    const uint64_t cost = EstimateImageCost(item.path) + 1;
+    pool_->Submit([this, item] { onDone_(item, ProcessOne(backend_, item, opts_)); }, cost);
+}
+
+// ----------------------------- Portable backend -----------------------------
+
+class PortableBackend : public Backend {
+public:
+    const wchar_t* Name() const override { return L"portable"; }
+
+    bool Decode(const std::wstring& path, Image& out, std::wstring& outError) override {
+        MappedFile file;
+        if (!file.Open(path, outError)) return false;
+        const CodecInfo* codec = FindCodec(DetectFormat(file.Data(), file.Size()));
+        if (!codec) {
+            outError = L"Failed to load image. Is it a valid PNG?";
+            return false;
+        }
+        if (!codec->decode) {
+            outError = std::wstring(L"Cannot read ") + codec->name + L" files with the portable backend.";
+            return false;
+        }
+        return codec->decode(file.Data(), file.Size(), out, outError);
+    }
+
+    std::unique_ptr<RowReader> OpenRowReader(const std::wstring& path, std::wstring& outError) override {
+        return OpenPngRowReader(path, outError);
+    }
+
+    std::unique_ptr<RowWriter> CreateRowWriter(const std::wstring& path, uint32_t width, uint32_t height,
+                                               uint32_t channels, const CompressOptions& compress,
+                                               std::wstring& outError) override {
+        return CreatePngRowWriter(path, width, height, channels, compress, outError);
+    }
+
+    std::unique_ptr<RowWriter> CreateSpliceWriter(RowReader& src, uint32_t keepRows, const std::wstring& path,
+                                                  const CompressOptions& compress, std::wstring& outError) override {
+        return CreatePngSpliceWriter(src, keepRows, path, compress, outError);
+    }
+
+    bool Encode(const Image& img, const std::wstring& path, const CompressOptions& compress,
+                std::wstring& outError) override {
+        return EncodePng(img, path, compress, outError);
+    }
+
+    bool RasterizeText(const std::wstring& text, float fontPx, uint32_t maxWidth,
+                       CoverageMask& out, std::wstring& outError) override {
+        (void)outError;
+        RasterizeBuiltinText(text, fontPx, maxWidth, out);
+        return true;
+    }
+};
+
+std::unique_ptr<Backend> CreatePortableBackend() {
+    return std::unique_ptr<Backend>(new PortableBackend());
+}
+
+std::unique_ptr<Backend> CreateDefaultBackend(std::wstring& outError) {
+#ifdef _WIN32
+    return CreateGdiplusBackend(outError);
+#else
+    (void)outError;
+    return CreatePortableBackend();
+#endif
+}
+
+std::unique_ptr<Backend> CreateBackendByName(const std::wstring& name, std::wstring& outError) {
+    if (name == L"portable") return CreatePortableBackend();
+#ifdef _WIN32
+    if (name == L"gdiplus") return CreateGdiplusBackend(outError);
+#endif
+    outError = L"Unknown or unavailable backend: " + name;
+    return nullptr;
+}
+
+} // namespace piclab
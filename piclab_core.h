@@ -0,0 +1,314 @@
+// piclab_core.h
+// Platform-independent labeling core: decode -> layout -> scrim -> text -> encode.
+// Pixel work happens here on plain buffers; a Backend supplies decode, encode and glyph rasterization.
+// The portable backend (own PNG codec + built-in font) builds anywhere; GDI+ is an optional Windows backend.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace piclab {
+
+// 8-bit straight-alpha pixels, rows packed top to bottom. channels is 3 (RGB) or 4 (RGBA).
+struct Image {
+    uint32_t width{};
+    uint32_t height{};
+    uint32_t channels{4};
+    std::vector<uint8_t> pixels;
+
+    size_t Stride() const { return (size_t)width * channels; }
+    uint8_t* Row(uint32_t y) { return pixels.data() + y * Stride(); }
+    const uint8_t* Row(uint32_t y) const { return pixels.data() + y * Stride(); }
+};
+
+// 8-bit coverage of a rasterized label. Row 0 is the top of the text line box.
+struct CoverageMask {
+    uint32_t width{};
+    uint32_t height{};
+    std::vector<uint8_t> data;
+};
+
+// Where the scrim and label go. Sizes follow the original GDI+ tool:
+// pad ~1.2% of height, font ~4.2% of height in points at 96 DPI, scrim clamped to 5%..15%.
+struct LabelLayout {
+    float pad{};
+    float fontPx{};
+    uint32_t maxTextWidth{};
+    uint32_t scrimTop{};
+    uint32_t scrimRows{};
+    int textX{};
+    int textY{};
+};
+
+const uint8_t kScrimAlpha  = 120; // ~47% black
+const uint8_t kShadowAlpha = 160;
+// PNG text keyword that metadata-only labels are stored under.
+const char* const kLabelTextKeyword = "Description";
+
+// What an image looks like to the encoder. It decides the PNG filters; both classes compress best
+// with the default deflate strategy.
+enum class ContentClass {
+    kAuto,  // classify each image from a sample of its rows
+    kPhoto, // noisy, many colours: adaptive filter per row
+    kFlat,  // screenshots and drawings, long runs of few colours: rows stay unfiltered
+};
+
+// Row-at-a-time image access for pictures too large to hold decoded. Rows run top to bottom and use
+// the same RGB8/RGBA8 layout as Image.
+class RowReader {
+public:
+    virtual ~RowReader() = default;
+    virtual uint32_t Width() const = 0;
+    virtual uint32_t Height() const = 0;
+    virtual uint32_t Channels() const = 0;
+    virtual bool ReadRow(uint8_t* dst, std::wstring& outError) = 0;
+    // Filter type (0-4) the file stored row y with, for rows already read whose raw bytes are laid
+    // out like the output; -1 when unknown.
+    virtual int SourceFilter(uint32_t y) const {
+        (void)y;
+        return -1;
+    }
+};
+
+class RowWriter {
+public:
+    virtual ~RowWriter() = default;
+    virtual bool WriteRow(const uint8_t* row, std::wstring& outError) = 0;
+    // Flushes and closes the file; required after the last row.
+    virtual bool Finish(std::wstring& outError) = 0;
+    // Optional: filter rows [0, rows) the way src stored them instead of choosing again. src must
+    // outlive the writes of those rows and have read each one before it is written.
+    virtual void ReuseFilters(const RowReader& src, uint32_t rows) {
+        (void)src; (void)rows;
+    }
+    // The class the rows are compressed as; kAuto while the writer has not decided, or never does.
+    virtual ContentClass Content() const { return ContentClass::kAuto; }
+};
+
+// File formats the codec registry knows (piclab_codecs.h). Some are only detected, so that a backend
+// that can read them gets the file; kUnknown also means "pick for me" where an output is chosen.
+enum class ImageFormat {
+    kUnknown,
+    kPng,
+    kJpeg,
+    kGif,
+    kBmp,
+    kTiff,
+    kQoi, // "Quite OK Image": byte-wise run/index/delta coding, several times faster to write than PNG
+    kPam, // Netpbm P7: a text header and raw RGB(A) rows
+};
+
+enum class DeflateEngine {
+    kZlib,    // zlib at the given level
+    kOneShot, // one greedy pass per 1 MB chunk with dynamic Huffman blocks, in the manner of libdeflate
+    kStore,   // stored blocks only
+};
+
+// How PNG image data is compressed.
+struct CompressOptions {
+    DeflateEngine engine{DeflateEngine::kZlib};
+    int level{6};                // zlib level, 0-9; the other engines have none
+    uint32_t latencyBudgetMs{0}; // when set, weaken the setting above as needed to finish in time
+    ContentClass content{ContentClass::kAuto};
+
+    // Settings any PNG encoder honours; an encoder that does not classify treats kAuto as kPhoto.
+    bool IsDefault() const {
+        return engine == DeflateEngine::kZlib && level == 6 && !latencyBudgetMs && content != ContentClass::kFlat;
+    }
+};
+
+// Sampled statistics that tell flat content from photos: how many pixels repeat their left
+// neighbour, and a linear-counting estimate of distinct colours.
+struct ContentSample {
+    uint64_t pixels{};
+    uint64_t runPixels{};
+    std::vector<uint64_t> colorBits; // one bit per colour hash
+    uint32_t colorBitsSet{};
+};
+
+void SampleContentRow(ContentSample& sample, const uint8_t* row, uint32_t width, uint32_t channels);
+uint32_t EstimateColors(const ContentSample& sample);
+// kFlat when at least half the pixels continue a run and the colours fit a small palette.
+ContentClass ClassifyContent(const ContentSample& sample);
+// Classifies from up to 256 rows spread over the image.
+ContentClass ClassifyImage(const Image& img);
+
+// Backends are called concurrently from batch workers and must not share mutable state per call.
+class Backend {
+public:
+    virtual ~Backend() = default;
+    virtual const wchar_t* Name() const = 0;
+    virtual bool Decode(const std::wstring& path, Image& out, std::wstring& outError) = 0;
+    virtual bool Encode(const Image& img, const std::wstring& path, const CompressOptions& compress,
+                        std::wstring& outError) = 0;
+    // Renders one line of text at fontPx (em size in pixels), ellipsis-trimmed to maxWidth.
+    virtual bool RasterizeText(const std::wstring& text, float fontPx, uint32_t maxWidth,
+                               CoverageMask& out, std::wstring& outError) = 0;
+
+    // Optional streaming. A null reader with outError empty means "use Decode for this file";
+    // a backend that returns readers must also return writers.
+    virtual std::unique_ptr<RowReader> OpenRowReader(const std::wstring& path, std::wstring& outError) {
+        (void)path; (void)outError;
+        return nullptr;
+    }
+    virtual std::unique_ptr<RowWriter> CreateRowWriter(const std::wstring& path, uint32_t width, uint32_t height,
+                                                       uint32_t channels, const CompressOptions& compress,
+                                                       std::wstring& outError) {
+        (void)path; (void)width; (void)height; (void)channels; (void)compress;
+        outError = L"Streaming encode is not supported by this backend.";
+        return nullptr;
+    }
+    // Optional: a writer that keeps src's compressed data for rows [0, keepRows) instead of encoding
+    // them again. Create it before reading any row from src, and still pass it every row in order.
+    // Null means splicing is not possible for this file; use CreateRowWriter.
+    virtual std::unique_ptr<RowWriter> CreateSpliceWriter(RowReader& src, uint32_t keepRows, const std::wstring& path,
+                                                          const CompressOptions& compress, std::wstring& outError) {
+        (void)src; (void)keepRows; (void)path; (void)compress; (void)outError;
+        return nullptr;
+    }
+};
+
+std::unique_ptr<Backend> CreatePortableBackend();
+#ifdef _WIN32
+std::unique_ptr<Backend> CreateGdiplusBackend(std::wstring& outError);
+#endif
+// GDI+ on Windows, portable elsewhere.
+std::unique_ptr<Backend> CreateDefaultBackend(std::wstring& outError);
+// "portable" or "gdiplus"; null with outError set for unknown or unavailable names.
+std::unique_ptr<Backend> CreateBackendByName(const std::wstring& name, std::wstring& outError);
+
+// Pad, font size and text width budget for an image; scrim and text position are filled by PlaceLabel.
+LabelLayout LayoutForImage(uint32_t width, uint32_t height);
+void PlaceLabel(LabelLayout& layout, uint32_t width, uint32_t height, uint32_t textHeight);
+
+void ApplyScrim(Image& img, uint32_t top, uint32_t rows, uint8_t alpha);
+void CompositeMask(Image& img, const CoverageMask& mask, int x, int y,
+                   uint8_t r, uint8_t g, uint8_t b, uint8_t alpha);
+// White label at (x, y) with its kShadowAlpha drop shadow at (x+1, y+1), composited in one pass
+// from a single coverage mask.
+void CompositeLabel(Image& img, const CoverageMask& mask, int x, int y);
+
+// Scrim + label over strip, which holds the image rows from stripTop down to the bottom.
+// L must be placed for the full image; the whole image is the strip with stripTop 0.
+void LabelStrip(Image& strip, uint32_t stripTop, const LabelLayout& L, const CoverageMask& mask);
+
+// Scrim + shadowed white label over the bottom strip of img.
+bool LabelImage(Backend& backend, Image& img, const std::wstring& label, std::wstring& outError);
+
+enum class FilterMode {
+    kAdaptive, // per-row minimum sum of absolute differences
+    kReuse,    // rows above the label keep the filter type they had in the source
+};
+
+// Stage boundaries of a save, where a SaveGate may hold a running image back.
+enum class SaveStage {
+    kRows,       // streamed PNGs only: another band of rows above the label copied to the output
+    kDecoded,    // source pixels are in memory (for streamed PNGs: every row has been read)
+    kComposited, // label drawn
+    kEncoded,    // output file written, before it is verified and put in place
+};
+
+// Cooperative scheduling of saves, e.g. priority lanes in the service (piclab_lanes.h).
+// ProcessBatch calls Enter before an image and Leave after it, whatever the outcome;
+// ProcessAndSave calls Checkpoint after each stage it goes through. Any of them may block.
+class SaveGate {
+public:
+    virtual ~SaveGate() = default;
+    virtual void Enter() = 0;
+    virtual void Checkpoint(SaveStage stage) = 0;
+    virtual void Leave() = 0;
+};
+
+class DecodedImageCache; // piclab_cache.h
+
+struct SaveOptions {
+    bool overwrite{false};  // replace the original via a temp sibling
+    std::wstring outPath;   // explicit destination for a copy; empty = "<name>_labeled.<ext>"
+    bool reencode{false};   // compress every row again instead of reusing the original's compressed rows
+    bool metadataOnly{false}; // store the label as a PNG text chunk; pixels are copied untouched
+    bool verify{false};     // check the written file's structure (VerifyPngFile/VerifyJpegFile) before it is kept
+    FilterMode filter{FilterMode::kAdaptive}; // how re-encoded rows pick their PNG filter
+    // Output format; kUnknown keeps JPEGs as JPEG where that is lossless and writes PNG otherwise.
+    ImageFormat format{ImageFormat::kUnknown};
+    CompressOptions compress;
+    SaveGate* gate{nullptr}; // optional, not owned
+    // Optional, not owned: decoded sources are taken from and kept in it when a save compresses
+    // every row again anyway. Spliced PNG copies never decode the whole image and do not use it.
+    DecodedImageCache* cache{nullptr};
+};
+
+// What a save encoded, for throughput and size per content class.
+struct SaveStats {
+    ContentClass content{ContentClass::kAuto}; // kAuto when no pixels were encoded
+    uint64_t pixels{};
+    uint64_t bytes{};  // size of the file written
+    double encodeMs{}; // filtering and compression; decoding is not counted
+};
+
+// Decode srcPath, label it and save according to opts. When the backend can stream the file, rows
+// above the label are copied straight to the encoder and only the bottom strip is held in memory.
+bool ProcessAndSave(Backend& backend,
+                    const std::wstring& srcPath,
+                    const std::wstring& label,
+                    const SaveOptions& opts,
+                    std::wstring& outSavedPath,
+                    std::wstring& outError,
+                    SaveStats* outStats = nullptr);
+
+// The file ProcessAndSave(srcPath, opts) writes when it succeeds; empty when opts cannot be used
+// for srcPath.
+std::wstring PlannedSavePath(const std::wstring& srcPath, const SaveOptions& opts);
+
+struct BatchItem {
+    std::wstring path;
+    std::wstring label;
+};
+
+struct BatchResult {
+    bool ok{false};
+    bool missing{false};
+    std::wstring savedPath;
+    std::wstring error;
+    SaveStats stats;
+};
+
+// Relative cost used to schedule batches: pixel count when the header can be read cheaply,
+// file size otherwise.
+uint64_t EstimateImageCost(const std::wstring& path);
+
+// Labels every item on a work-stealing pool of `jobs` threads (0 = all cores), largest first.
+// onDone is called once per item, from the worker that finished it. Threads without an image of
+// their own inflate and compress pieces of the large ones, so a single big PNG still uses every
+// thread.
+void ProcessBatch(Backend& backend,
+                  const std::vector<BatchItem>& items,
+                  const SaveOptions& opts,
+                  unsigned jobs,
+                  const std::function<void(size_t index, const BatchResult& result)>& onDone);
+
+class WorkPool;
+
+// Labels items as they are handed in, for callers that learn of images one at a time (a watched
+// folder). Runs on a pool of `jobs` threads (0 = all cores) that lives as long as the queue, so
+// one large image never holds back the ones submitted after it. onDone is called once per item,
+// from the worker that finished it.
+class LabelQueue {
+public:
+    LabelQueue(Backend& backend, const SaveOptions& opts, unsigned jobs,
+               std::function<void(const BatchItem& item, const BatchResult& result)> onDone);
+    ~LabelQueue(); // waits for everything submitted
+
+    void Submit(BatchItem item);
+
+private:
+    Backend& backend_;
+    SaveOptions opts_;
+    std::function<void(const BatchItem&, const BatchResult&)> onDone_;
+    std::unique_ptr<WorkPool> pool_;
+};
+
+} // namespace piclab
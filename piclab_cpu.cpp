@@ -0,0 +1,90 @@
+// piclab_cpu.cpp
+// CPUID / xgetbv on x86, compile-time and auxv checks on ARM.
+
+#include "piclab_cpu.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PICLAB_X86 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+namespace piclab {
+
+#ifdef PICLAB_X86
+
+static void Cpuid(int leaf, int sub, unsigned regs[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int r[4];
+    __cpuidex(r, leaf, sub);
+    for (int i = 0; i < 4; ++i) regs[i] = (unsigned)r[i];
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long Xgetbv() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+#endif
+
+static CpuFeatures Detect() {
+    CpuFeatures f;
+#ifdef PICLAB_X86
+    unsigned r[4];
+    Cpuid(0, 0, r);
+    unsigned maxLeaf = r[0];
+    Cpuid(1, 0, r);
+    f.sse2   = (r[3] >> 26) & 1;
+    f.ssse3  = (r[2] >> 9) & 1;
+    f.sse41  = (r[2] >> 19) & 1;
+    f.pclmul = (r[2] >> 1) & 1;
+    bool osxsave = (r[2] >> 27) & 1;
+    bool avx = (r[2] >> 28) & 1;
+    if (maxLeaf >= 7 && osxsave && avx && (Xgetbv() & 6) == 6) {
+        Cpuid(7, 0, r);
+        f.avx2 = (r[1] >> 5) & 1;
+    }
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+    f.neon = true;
+#endif
+#if defined(__ARM_FEATURE_CRC32) || defined(_M_ARM64)
+    f.armCrc32 = true;
+#elif defined(__aarch64__) && defined(__linux__) && defined(HWCAP_CRC32)
+    f.armCrc32 = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+
+    if (const char* cap = getenv("PICLAB_SIMD")) {
+        if (strcmp(cap, "scalar") == 0) {
+            f = CpuFeatures();
+        } else if (strcmp(cap, "sse2") == 0) {
+            f.ssse3 = f.sse41 = f.avx2 = f.pclmul = false;
+        }
+    }
+    return f;
+}
+
+const CpuFeatures& GetCpuFeatures() {
+    static const CpuFeatures features = Detect();
+    return features;
+}
+
+} // namespace piclab
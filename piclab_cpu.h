@@ -0,0 +1,21 @@
+// piclab_cpu.h
+// Runtime CPU feature detection for the SIMD kernels.
+// PICLAB_SIMD=scalar|sse2|avx2 in the environment caps the level (benchmarks, bit-exactness checks).
+
+#pragma once
+
+namespace piclab {
+
+struct CpuFeatures {
+    bool sse2{false};
+    bool ssse3{false};
+    bool sse41{false};
+    bool avx2{false};    // includes OS support for YMM state
+    bool pclmul{false};
+    bool neon{false};
+    bool armCrc32{false};
+};
+
+const CpuFeatures& GetCpuFeatures();
+
+} // namespace piclab
@@ -0,0 +1,564 @@
+// piclab_deflate.cpp
+// Deflate engines. zlib runs as a raw deflater per chunk, primed with the leftover bits and the
+// window. The one-shot engine makes a single greedy pass: a hash of the next four bytes gives one
+// candidate match, and every 32K symbols become a dynamic Huffman block, or a stored one when that
+// is smaller. Store writes stored blocks. Non-final chunks end on an empty stored block, which is
+// what zlib's sync flush writes as well.
+
+#include "piclab_deflate.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <queue>
+#include <zlib.h>
+
+namespace piclab {
+
+static const size_t kWindow = 32768;
+static const size_t kStoredMax = 65535;
+static const size_t kBlockSymbols = 32768;
+static const unsigned kHashBits = 15;
+static const unsigned kMinMatch = 4;
+static const unsigned kMaxMatch = 258;
+static const unsigned kHashedEnds = 8;
+
+// ----------------------------- Bits -----------------------------
+
+namespace {
+
+// LSB-first bit writer appending to a byte vector. Bits are handed over 32 at a time; Align
+// writes out the rest.
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out_(out) {}
+
+    // value must fit in bits, at most 32.
+    void Put(uint32_t value, unsigned bits) {
+        acc_ |= (uint64_t)value << count_;
+        count_ += bits;
+        if (count_ >= 32) {
+            uint8_t b[4] = { (uint8_t)acc_, (uint8_t)(acc_ >> 8), (uint8_t)(acc_ >> 16), (uint8_t)(acc_ >> 24) };
+            out_.insert(out_.end(), b, b + 4);
+            acc_ >>= 32;
+            count_ -= 32;
+        }
+    }
+    void Align() {
+        for (count_ = (count_ + 7) & ~7u; count_; count_ -= 8, acc_ >>= 8) out_.push_back((uint8_t)acc_);
+    }
+    // Raw bytes; the writer must be aligned.
+    void Bytes(const uint8_t* p, size_t n) { out_.insert(out_.end(), p, p + n); }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint64_t acc_{0};
+    unsigned count_{0};
+};
+
+// Stored blocks for p[0, n); BFINAL on the last one when final. n == 0 writes one empty block.
+void PutStored(BitWriter& bw, const uint8_t* p, size_t n, bool final) {
+    size_t pos = 0;
+    do {
+        size_t k = std::min(n - pos, kStoredMax);
+        bw.Put(final && pos + k == n ? 1 : 0, 1);
+        bw.Put(0, 2);
+        bw.Align();
+        bw.Put((uint32_t)k, 16);
+        bw.Put((uint32_t)~k & 0xFFFF, 16);
+        bw.Bytes(p + pos, k);
+        pos += k;
+    } while (pos < n);
+}
+
+// ----------------------------- Huffman -----------------------------
+
+// Length codes 257..285 and distance codes 0..29 (RFC 1951, 3.2.5).
+const uint16_t kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                   67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                   4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t kDistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                                 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t kDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+                                 11, 11, 12, 12, 13, 13 };
+const uint8_t kCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+struct CodeTables {
+    uint8_t lengthCode[kMaxMatch + 1]; // match length -> code - 257
+    uint8_t distCode[512];             // zlib's split: distance - 1 below 256, else 256 + ((distance - 1) >> 7)
+
+    CodeTables() {
+        for (unsigned c = 0; c < 29; ++c) {
+            for (unsigned len = kLengthBase[c]; len < kLengthBase[c] + (1u << kLengthExtra[c]) && len <= kMaxMatch;
+                 ++len) {
+                lengthCode[len] = (uint8_t)c;
+            }
+        }
+        lengthCode[kMaxMatch] = 28;
+        for (unsigned c = 0; c < 30; ++c) {
+            for (unsigned d = kDistBase[c]; d < kDistBase[c] + (1u << kDistExtra[c]); ++d) {
+                unsigned v = d - 1;
+                distCode[v < 256 ? v : 256 + (v >> 7)] = (uint8_t)c;
+            }
+        }
+    }
+
+    unsigned DistCode(unsigned dist) const {
+        unsigned v = dist - 1;
+        return distCode[v < 256 ? v : 256 + (v >> 7)];
+    }
+};
+
+const CodeTables& Tables() {
+    static const CodeTables tables;
+    return tables;
+}
+
+// Huffman code lengths for freq[0, n), none longer than maxLen. At least two symbols get a code,
+// so the code is always complete, which every inflater accepts.
+void BuildLengths(const uint32_t* freq, unsigned n, unsigned maxLen, uint8_t* lens) {
+    std::vector<unsigned> used;
+    for (unsigned i = 0; i < n; ++i) {
+        lens[i] = 0;
+        if (freq[i]) used.push_back(i);
+    }
+    if (used.size() < 2) {
+        const unsigned only = used.empty() ? 0 : used[0];
+        lens[only] = lens[only ? 0 : 1] = 1;
+        return;
+    }
+
+    // Plain Huffman tree first; nodes past the leaves are the merged ones.
+    typedef std::pair<uint64_t, unsigned> Node;
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap;
+    std::vector<unsigned> parent(2 * used.size(), 0);
+    for (unsigned i = 0; i < used.size(); ++i) heap.push({ freq[used[i]], i });
+    unsigned next = (unsigned)used.size();
+    while (heap.size() > 1) {
+        Node a = heap.top();
+        heap.pop();
+        Node b = heap.top();
+        heap.pop();
+        parent[a.second] = parent[b.second] = next;
+        heap.push({ a.first + b.first, next++ });
+    }
+    std::vector<unsigned> depth(next, 0);
+    for (unsigned i = next - 1; i-- > 0;) depth[i] = depth[parent[i]] + 1;
+
+    // Clamp to maxLen, then restore the Kraft sum: lengthen the rarest of the longest codes that can
+    // still grow while the code is over-full, shorten the commonest of the longest ones while it is
+    // not full.
+    const uint64_t full = 1ull << maxLen;
+    uint64_t kraft = 0;
+    std::vector<std::pair<unsigned, unsigned>> leaves(used.size()); // symbol, length
+    for (unsigned i = 0; i < used.size(); ++i) {
+        leaves[i] = { used[i], std::min(depth[i], maxLen) };
+        kraft += full >> leaves[i].second;
+    }
+    std::sort(leaves.begin(), leaves.end(), [&](const std::pair<unsigned, unsigned>& a,
+                                                const std::pair<unsigned, unsigned>& b) {
+        return freq[a.first] > freq[b.first];
+    });
+    const size_t none = leaves.size();
+    while (kraft > full) {
+        size_t pick = none;
+        for (size_t i = leaves.size(); i-- > 0;) {
+            unsigned len = leaves[i].second;
+            if (len < maxLen && (pick == none || len > leaves[pick].second)) pick = i;
+        }
+        assert(pick != none); // over-full with every code at maxLen cannot happen for n <= 2^maxLen
+        kraft -= full >> (leaves[pick].second + 1);
+        ++leaves[pick].second;
+    }
+    while (kraft < full) {
+        size_t pick = none;
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            unsigned len = leaves[i].second;
+            if (len > 1 && (full >> len) <= full - kraft && (pick == none || len > leaves[pick].second)) pick = i;
+        }
+        assert(pick != none); // a longest code fits the gap: the gap is a multiple of its weight
+        kraft += full >> leaves[pick].second;
+        --leaves[pick].second;
+    }
+    for (const std::pair<unsigned, unsigned>& leaf : leaves) lens[leaf.first] = (uint8_t)leaf.second;
+}
+
+// Canonical codes for lens, bit-reversed for an LSB-first writer.
+void BuildCodes(const uint8_t* lens, unsigned n, uint16_t* codes) {
+    unsigned count[16] = {}, nextCode[16] = {};
+    for (unsigned i = 0; i < n; ++i) ++count[lens[i]];
+    count[0] = 0;
+    unsigned code = 0;
+    for (unsigned len = 1; len < 16; ++len) {
+        code = (code + count[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        unsigned len = lens[i], c = len ? nextCode[len]++ : 0, rev = 0;
+        for (unsigned b = 0; b < len; ++b) rev |= ((c >> b) & 1) << (len - 1 - b);
+        codes[i] = (uint16_t)rev;
+    }
+}
+
+// ----------------------------- One-shot -----------------------------
+
+struct Symbol {
+    uint16_t litlen; // literal byte, or match length when dist is set
+    uint16_t dist;
+};
+
+// One block of syms, which encode raw[0, rawLen). Dynamic Huffman unless stored is smaller.
+void PutBlock(BitWriter& bw, const Symbol* syms, size_t count, const uint8_t* raw, size_t rawLen, bool final) {
+    const CodeTables& t = Tables();
+    uint32_t litFreq[286] = {}, distFreq[30] = {};
+    for (size_t i = 0; i < count; ++i) {
+        if (syms[i].dist) {
+            ++litFreq[257 + t.lengthCode[syms[i].litlen]];
+            ++distFreq[t.DistCode(syms[i].dist)];
+        } else {
+            ++litFreq[syms[i].litlen];
+        }
+    }
+    litFreq[256] = 1;
+
+    uint8_t litLens[286], distLens[30];
+    BuildLengths(litFreq, 286, 15, litLens);
+    BuildLengths(distFreq, 30, 15, distLens);
+    unsigned nlit = 286, ndist = 30;
+    while (nlit > 257 && !litLens[nlit - 1]) --nlit;
+    while (ndist > 1 && !distLens[ndist - 1]) --ndist;
+    uint8_t lens[286 + 30]; // both sets back to back, as the block header lists them
+    memcpy(lens, litLens, nlit);
+    memcpy(lens + nlit, distLens, ndist);
+
+    // Run-length code the lengths: 16 repeats the previous one 3-6 times, 17 and 18 are zero runs.
+    struct Run {
+        uint8_t sym, extra;
+    };
+    std::vector<Run> runs;
+    uint32_t clFreq[19] = {};
+    const unsigned total = nlit + ndist;
+    for (unsigned i = 0; i < total;) {
+        unsigned j = i + 1;
+        while (j < total && lens[j] == lens[i]) ++j;
+        unsigned left = j - i;
+        if (lens[i] == 0) {
+            while (left >= 11) {
+                unsigned k = std::min(left, 138u);
+                runs.push_back({ 18, (uint8_t)(k - 11) });
+                left -= k;
+            }
+            if (left >= 3) {
+                runs.push_back({ 17, (uint8_t)(left - 3) });
+                left = 0;
+            }
+        } else {
+            runs.push_back({ lens[i], 0 });
+            --left;
+            while (left >= 3) {
+                unsigned k = std::min(left, 6u);
+                runs.push_back({ 16, (uint8_t)(k - 3) });
+                left -= k;
+            }
+        }
+        for (; left; --left) runs.push_back({ lens[i], 0 });
+        i = j;
+    }
+    for (const Run& r : runs) ++clFreq[r.sym];
+    uint8_t clLens[19];
+    BuildLengths(clFreq, 19, 7, clLens);
+    unsigned nclen = 19;
+    while (nclen > 4 && !clLens[kCodeLengthOrder[nclen - 1]]) --nclen;
+
+    // Cost in bits of both forms.
+    uint64_t bits = 3 + 5 + 5 + 4 + 3 * nclen;
+    for (const Run& r : runs) bits += clLens[r.sym] + (r.sym == 16 ? 2 : r.sym == 17 ? 3 : r.sym == 18 ? 7 : 0);
+    for (unsigned s = 0; s < 286; ++s) {
+        bits += (uint64_t)litFreq[s] * (litLens[s] + (s >= 257 ? kLengthExtra[s - 257] : 0));
+    }
+    for (unsigned s = 0; s < 30; ++s) bits += (uint64_t)distFreq[s] * (distLens[s] + kDistExtra[s]);
+    const uint64_t storedBits = ((rawLen + kStoredMax - 1) / kStoredMax + (rawLen == 0)) * (3 + 7 + 32) + 8 * rawLen;
+    if (storedBits < bits) {
+        PutStored(bw, raw, rawLen, final);
+        return;
+    }
+
+    uint16_t litCodes[286], distCodes[30], clCodes[19];
+    BuildCodes(litLens, 286, litCodes);
+    BuildCodes(distLens, 30, distCodes);
+    BuildCodes(clLens, 19, clCodes);
+
+    bw.Put(final ? 1 : 0, 1);
+    bw.Put(2, 2);
+    bw.Put(nlit - 257, 5);
+    bw.Put(ndist - 1, 5);
+    bw.Put(nclen - 4, 4);
+    for (unsigned i = 0; i < nclen; ++i) bw.Put(clLens[kCodeLengthOrder[i]], 3);
+    for (const Run& r : runs) {
+        bw.Put(clCodes[r.sym], clLens[r.sym]);
+        if (r.sym == 16) bw.Put(r.extra, 2);
+        if (r.sym == 17) bw.Put(r.extra, 3);
+        if (r.sym == 18) bw.Put(r.extra, 7);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const Symbol& s = syms[i];
+        if (!s.dist) {
+            bw.Put(litCodes[s.litlen], litLens[s.litlen]);
+            continue;
+        }
+        unsigned lc = t.lengthCode[s.litlen], dc = t.DistCode(s.dist);
+        bw.Put(litCodes[257 + lc], litLens[257 + lc]);
+        if (kLengthExtra[lc]) bw.Put(s.litlen - kLengthBase[lc], kLengthExtra[lc]);
+        bw.Put(distCodes[dc], distLens[dc]);
+        if (kDistExtra[dc]) bw.Put(s.dist - kDistBase[dc], kDistExtra[dc]);
+    }
+    bw.Put(litCodes[256], litLens[256]);
+}
+
+inline uint32_t Load32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint32_t Hash4(const uint8_t* p) {
+    return (Load32(p) * 2654435761u) >> (32 - kHashBits);
+}
+
+// Length of the common prefix of a and b, at most limit, compared eight bytes at a time.
+inline unsigned MatchLength(const uint8_t* a, const uint8_t* b, unsigned len, unsigned limit) {
+    while (len + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + len, 8);
+        memcpy(&y, b + len, 8);
+        if (x != y) break;
+        len += 8;
+    }
+    while (len < limit && a[len] == b[len]) ++len;
+    return len;
+}
+
+bool DeflateOneShot(const uint8_t* in, size_t n, const uint8_t* dict, size_t dictLen, BitWriter& bw, bool last) {
+    if (n == 0) {
+        if (last) PutStored(bw, nullptr, 0, true);
+        return true;
+    }
+    // The window and the chunk side by side, so matches may reach back into the window.
+    dictLen = std::min(dictLen, kWindow);
+    std::vector<uint8_t> buf(dictLen + n);
+    if (dictLen) memcpy(buf.data(), dict, dictLen);
+    memcpy(buf.data() + dictLen, in, n);
+    const uint8_t* data = buf.data();
+    const size_t end = buf.size();
+
+    std::vector<int32_t> head((size_t)1 << kHashBits, -1);
+    for (size_t p = 0; p + kMinMatch <= dictLen; ++p) head[Hash4(data + p)] = (int32_t)p;
+
+    std::vector<Symbol> syms;
+    syms.reserve(kBlockSymbols);
+    size_t blockStart = dictLen;
+    size_t p = dictLen;
+    while (p < end) {
+        unsigned len = 0;
+        size_t dist = 0;
+        if (p + kMinMatch <= end) {
+            uint32_t h = Hash4(data + p);
+            int32_t cand = head[h];
+            head[h] = (int32_t)p;
+            if (cand >= 0 && p - (size_t)cand <= kWindow && Load32(data + cand) == Load32(data + p)) {
+                len = MatchLength(data + cand, data + p, kMinMatch, (unsigned)std::min<size_t>(kMaxMatch, end - p));
+                dist = p - (size_t)cand;
+            }
+        }
+        if (len) {
+            syms.push_back({ (uint16_t)len, (uint16_t)dist });
+            // Inside a long match only its two ends are hashed; the middle rarely starts a better one.
+            const size_t stop = std::min<size_t>(p + len, end - kMinMatch + 1);
+            size_t q = p + 1;
+            if (len > 2 * kHashedEnds) {
+                for (; q < p + kHashedEnds; ++q) head[Hash4(data + q)] = (int32_t)q;
+                q = p + len - kHashedEnds;
+            }
+            for (; q < stop; ++q) head[Hash4(data + q)] = (int32_t)q;
+            p += len;
+        } else {
+            syms.push_back({ data[p], 0 });
+            ++p;
+        }
+        if (syms.size() == kBlockSymbols || p == end) {
+            PutBlock(bw, syms.data(), syms.size(), data + blockStart, p - blockStart, last && p == end);
+            syms.clear();
+            blockStart = p;
+        }
+    }
+    return true;
+}
+
+bool DeflateZlib(int level, const uint8_t* in, size_t n, const uint8_t* dict, size_t dictLen, int primeBits,
+                 int primeValue, bool last, std::vector<uint8_t>& out) {
+    z_stream zs{};
+    if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    if (primeBits) deflatePrime(&zs, primeBits, primeValue);
+    if (dictLen) deflateSetDictionary(&zs, dict, (uInt)dictLen);
+
+    const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    const size_t start = out.size();
+    out.resize(start + deflateBound(&zs, (uLong)n) + 64);
+    zs.next_in = const_cast<uint8_t*>(in);
+    zs.avail_in = (uInt)n;
+    size_t produced = 0;
+    int zr;
+    for (;;) {
+        zs.next_out = out.data() + start + produced;
+        zs.avail_out = (uInt)(out.size() - start - produced);
+        zr = deflate(&zs, flush);
+        produced = out.size() - start - zs.avail_out;
+        if (zr == Z_STREAM_ERROR || zr == Z_STREAM_END || (!last && zs.avail_out != 0)) break;
+        out.resize(start + (out.size() - start) * 2);
+    }
+    deflateEnd(&zs);
+    out.resize(start + produced);
+    return zr == (last ? Z_STREAM_END : Z_OK);
+}
+
+} // namespace
+
+bool DeflateChunk(const CompressOptions& opts, const uint8_t* in, size_t n, const uint8_t* dict, size_t dictLen,
+                  int primeBits, int primeValue, bool last, std::vector<uint8_t>& out) {
+    if (opts.engine == DeflateEngine::kZlib) {
+        return DeflateZlib(opts.level, in, n, dict, dictLen, primeBits, primeValue, last, out);
+    }
+    out.reserve(out.size() + n + n / kStoredMax * 5 + 64); // neither engine ends up much larger than stored
+    BitWriter bw(out);
+    if (primeBits) bw.Put((uint32_t)primeValue, (unsigned)primeBits);
+    if (opts.engine == DeflateEngine::kStore) {
+        PutStored(bw, in, n, last);
+        return true;
+    }
+    if (!DeflateOneShot(in, n, dict, dictLen, bw, last)) return false;
+    if (!last) PutStored(bw, nullptr, 0, false); // the sync flush marker: back on a byte boundary
+    bw.Align();
+    return true;
+}
+
+void ZlibHeader(const CompressOptions& opts, uint8_t out[2]) {
+    // CMF 0x78 (deflate, 32 KB window); FLEVEL is informative only. Each value keeps FCHECK valid.
+    const int level = opts.engine == DeflateEngine::kZlib ? opts.level : 0;
+    out[0] = 0x78;
+    out[1] = level < 2 ? 0x01 : level < 6 ? 0x5E : level == 6 ? 0x9C : 0xDA;
+}
+
+const wchar_t* DeflateEngineName(DeflateEngine engine) {
+    switch (engine) {
+    case DeflateEngine::kZlib: return L"zlib";
+    case DeflateEngine::kOneShot: return L"oneshot";
+    case DeflateEngine::kStore: return L"store";
+    }
+    return L"?";
+}
+
+// ----------------------------- Latency budget -----------------------------
+
+// Settings from strongest to weakest. Only the ones tried are ever measured.
+static const CompressOptions kLadder[] = {
+    { DeflateEngine::kZlib, 9, 0 }, { DeflateEngine::kZlib, 8, 0 }, { DeflateEngine::kZlib, 7, 0 },
+    { DeflateEngine::kZlib, 6, 0 }, { DeflateEngine::kZlib, 5, 0 }, { DeflateEngine::kZlib, 4, 0 },
+    { DeflateEngine::kZlib, 3, 0 }, { DeflateEngine::kZlib, 2, 0 }, { DeflateEngine::kZlib, 1, 0 },
+    { DeflateEngine::kOneShot, 0, 0 }, { DeflateEngine::kStore, 0, 0 },
+};
+static const size_t kLadderSize = sizeof(kLadder) / sizeof(kLadder[0]);
+
+// A filtered photo-like sample: Paeth rows of residuals whose magnitude falls off geometrically.
+static std::vector<uint8_t> CalibrationSample() {
+    const size_t kRowBytes = 1 + 3 * 1024, kRows = 128;
+    std::vector<uint8_t> sample(kRowBytes * kRows);
+    uint32_t seed = 0x9E3779B9u;
+    for (size_t y = 0; y < kRows; ++y) {
+        uint8_t* row = sample.data() + y * kRowBytes;
+        row[0] = 4;
+        for (size_t i = 1; i < kRowBytes; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            int v = (seed >> 4) & 1;
+            for (uint32_t u = seed >> 8; (u & 3) && v < 40; u >>= 2) v += 2;
+            row[i] = (uint8_t)((seed >> 7) & 1 ? v : -v);
+        }
+    }
+    return sample;
+}
+
+static std::mutex g_throughputMutex;
+static double g_throughput[kLadderSize]; // bytes per millisecond of one thread; 0 until known
+
+// Throughput of kLadder[i], calibrated on first use and refined by Learn.
+static double Throughput(size_t i) {
+    std::lock_guard<std::mutex> lk(g_throughputMutex);
+    if (g_throughput[i] == 0) {
+        static const std::vector<uint8_t> sample = CalibrationSample();
+        std::vector<uint8_t> out;
+        out.reserve(sample.size() + 1024);
+        auto start = std::chrono::steady_clock::now();
+        DeflateChunk(kLadder[i], sample.data(), sample.size(), nullptr, 0, 0, 0, true, out);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        g_throughput[i] = sample.size() / std::max(ms, 0.01);
+    }
+    return g_throughput[i];
+}
+
+// Blends a real measurement into the estimate, so later images start from what this one showed.
+static void Learn(size_t i, double bytes, double ms) {
+    std::lock_guard<std::mutex> lk(g_throughputMutex);
+    const double tp = bytes / std::max(ms, 0.01);
+    g_throughput[i] = g_throughput[i] == 0 ? tp : (g_throughput[i] + tp) / 2;
+}
+
+static bool SameSetting(const CompressOptions& a, const CompressOptions& b) {
+    return a.engine == b.engine && (a.engine != DeflateEngine::kZlib || a.level == b.level);
+}
+
+void LatencyBudget::Start(const CompressOptions& opts, uint64_t rawBytes, unsigned threads) {
+    current_ = opts;
+    active_ = opts.latencyBudgetMs && !(opts.engine == DeflateEngine::kZlib && opts.level == 0);
+    if (!active_) return;
+    budgetMs_ = opts.latencyBudgetMs;
+    threads_ = std::max(threads, 1u);
+    left_ = rawBytes;
+    spentMs_ = 0;
+    rung_ = kLadderSize - 1;
+    for (size_t i = 0; i < kLadderSize - 1; ++i) {
+        const CompressOptions& c = kLadder[i];
+        // Nothing stronger than what was asked for.
+        if (c.engine == opts.engine ? c.level > opts.level : c.engine < opts.engine) continue;
+        if (rawBytes / (Throughput(i) * threads_) <= budgetMs_) {
+            rung_ = i;
+            break;
+        }
+    }
+    Step(rung_);
+}
+
+void LatencyBudget::Step(size_t rung) {
+    rung_ = rung;
+    current_ = kLadder[rung];
+    current_.latencyBudgetMs = budgetMs_;
+    rungBytes_ = rungMs_ = 0;
+}
+
+void LatencyBudget::Record(const CompressOptions& used, size_t bytes, double ms) {
+    if (!active_) return;
+    left_ -= std::min<uint64_t>(left_, bytes);
+    spentMs_ += ms / threads_;
+    for (size_t i = 0; i < kLadderSize; ++i) {
+        if (SameSetting(used, kLadder[i])) Learn(i, (double)bytes, ms);
+    }
+    if (!SameSetting(used, current_) || rung_ == kLadderSize - 1) return;
+    rungBytes_ += bytes;
+    rungMs_ += ms;
+    // Step down while the rest, at the pace this image actually compresses, would overrun.
+    const double rest = left_ * rungMs_ / (std::max(rungBytes_, 1.0) * threads_);
+    if (spentMs_ + rest > budgetMs_) Step(rung_ + 1);
+}
+
+} // namespace piclab
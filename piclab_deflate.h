@@ -0,0 +1,58 @@
+// piclab_deflate.h
+// Interchangeable deflate engines for PNG image data, and the latency budget that picks one.
+//
+// Every engine compresses a chunk of a raw deflate stream at a time. A chunk continues a stream
+// that stopped some bits into a byte, may refer back into the 32 KB before it, and ends on a byte
+// boundary (or with the final block), so chunks compressed separately, even by different engines,
+// concatenate into one valid stream. The streaming writer in piclab_png.cpp uses zlib directly.
+
+#pragma once
+
+#include "piclab_core.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace piclab {
+
+// Compresses in[0, n) as the next chunk of a raw deflate stream and appends it to out.
+// The stream so far ends primeBits into a byte whose low bits are primeValue; dict holds the up to
+// 32 KB of uncompressed data before in. The chunk ends with the final block when last.
+bool DeflateChunk(const CompressOptions& opts, const uint8_t* in, size_t n, const uint8_t* dict, size_t dictLen,
+                  int primeBits, int primeValue, bool last, std::vector<uint8_t>& out);
+
+// The two header bytes of a zlib stream compressed with opts.
+void ZlibHeader(const CompressOptions& opts, uint8_t out[2]);
+
+// Picks the deflate setting for each chunk of one image under opts.latencyBudgetMs. Start takes the
+// strongest setting, no stronger than opts, whose estimated time for rawBytes spread over `threads`
+// threads fits the budget (store-only when nothing does); Record then steps down a setting whenever
+// the chunks so far show the rest would overrun. Estimates start from a synthetic filtered image,
+// timed once per process, and follow what real images measure. They cover deflate only, not
+// decoding or filtering. Without a budget the setting is opts throughout.
+class LatencyBudget {
+public:
+    void Start(const CompressOptions& opts, uint64_t rawBytes, unsigned threads);
+    const CompressOptions& Current() const { return current_; }
+    // A chunk of `bytes` raw bytes took ms on one thread with `used`. Call in stream order.
+    void Record(const CompressOptions& used, size_t bytes, double ms);
+
+private:
+    void Step(size_t rung);
+
+    CompressOptions current_;
+    bool active_{false};
+    uint32_t budgetMs_{0};
+    unsigned threads_{1};
+    size_t rung_{0};
+    uint64_t left_{0};    // raw bytes not recorded yet
+    double spentMs_{0};   // recorded deflate time, per thread
+    double rungBytes_{0}; // recorded at the current setting
+    double rungMs_{0};
+};
+
+// "zlib", "oneshot" or "store".
+const wchar_t* DeflateEngineName(DeflateEngine engine);
+
+} // namespace piclab
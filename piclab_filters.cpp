@@ -0,0 +1,579 @@
+// piclab_filters.cpp
+// Unfilter kernels. Up is a plain 16-byte add. Sub, Average and Paeth depend on the pixel just
+// reconstructed to the left, so they walk one pixel per step with the pixel's bytes side by side
+// in a vector register; Sub on whole registers uses a shifted prefix sum instead.
+// Paeth is evaluated 16-bit wide: pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|.
+//
+// Filter kernels only read the original row, so they take 16 independent bytes per step. There pa
+// and pb fit a byte and pc is saturated to 255, which changes none of the comparisons since pa and
+// pb never exceed 255. A byte's cost is min(v, -v) as unsigned bytes, summed with SAD or pairwise
+// adds.
+
+#include "piclab_filters.h"
+#include "piclab_cpu.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PICLAB_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define PICLAB_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace piclab {
+
+typedef bool (*UnfilterFn)(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t len, size_t bpp);
+typedef void (*FilterFn)(uint8_t filter, const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp,
+                         uint8_t* out);
+typedef uint8_t (*SelectFn)(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp);
+
+static bool UnfilterRowScalar(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    return UnfilterRowReference(filter, row, prev, len, bpp);
+}
+
+static void FilterRowScalar(uint8_t filter, const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp,
+                            uint8_t* out) {
+    FilterRowReference(filter, row, prev, len, bpp, out);
+}
+
+static uint8_t SelectFilterScalar(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    return SelectFilterReference(row, prev, len, bpp);
+}
+
+// Bytes [from, to) of a filtered row one at a time: the first pixel, whose left neighbour is zero,
+// and whatever is left after the last whole vector. prev is never null here.
+static inline void FilterBytes(uint8_t filter, const uint8_t* row, const uint8_t* prev, size_t from, size_t to,
+                               size_t bpp, uint8_t* o) {
+    for (size_t i = from; i < to; ++i) {
+        uint8_t a = i >= bpp ? row[i - bpp] : 0;
+        uint8_t b = prev[i];
+        uint8_t c = i >= bpp ? prev[i - bpp] : 0;
+        uint8_t pred = filter == 1 ? a : filter == 2 ? b : filter == 3 ? (uint8_t)((a + b) >> 1) : Paeth(a, b, c);
+        o[i] = (uint8_t)(row[i] - pred);
+    }
+}
+
+static inline void AddCosts(const uint8_t* row, const uint8_t* prev, size_t from, size_t to, size_t bpp,
+                            uint64_t cost[5]) {
+    for (size_t i = from; i < to; ++i) {
+        uint8_t a = i >= bpp ? row[i - bpp] : 0;
+        uint8_t b = prev[i];
+        uint8_t c = i >= bpp ? prev[i - bpp] : 0;
+        uint8_t x = row[i];
+        cost[0] += FilterMagnitude(x);
+        cost[1] += FilterMagnitude((uint8_t)(x - a));
+        cost[2] += FilterMagnitude((uint8_t)(x - b));
+        cost[3] += FilterMagnitude((uint8_t)(x - ((a + b) >> 1)));
+        cost[4] += FilterMagnitude((uint8_t)(x - Paeth(a, b, c)));
+    }
+}
+
+static inline uint8_t LowestCost(const uint64_t cost[5]) {
+    uint8_t best = 0;
+    for (uint8_t f = 1; f < 5; ++f) {
+        if (cost[f] < cost[best]) best = f;
+    }
+    return best;
+}
+
+// One 3- or 4-byte pixel in the low lanes; the rest of the load is zero.
+template <size_t Bpp>
+static inline uint32_t LoadPixelBits(const uint8_t* p) {
+    uint32_t v = 0;
+    memcpy(&v, p, Bpp);
+    return v;
+}
+
+// ----------------------------- SSE2 -----------------------------
+
+#ifdef PICLAB_HAVE_SSE2
+
+template <size_t Bpp>
+static inline __m128i LoadPixel(const uint8_t* p) {
+    return _mm_cvtsi32_si128((int)LoadPixelBits<Bpp>(p));
+}
+
+template <size_t Bpp>
+static inline void StorePixel(uint8_t* p, __m128i v) {
+    uint32_t bits = (uint32_t)_mm_cvtsi128_si32(v);
+    memcpy(p, &bits, Bpp);
+}
+
+static inline __m128i Abs16(__m128i v) {
+    return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+static inline __m128i Select(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void UpSse2(uint8_t* row, const uint8_t* prev, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+        _mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+    }
+    for (; i < len; ++i) row[i] = (uint8_t)(row[i] + prev[i]);
+}
+
+// Four RGB pixels (12 bytes) per step. Bytes 12..15 of each load are written back unchanged.
+static void Sub3Sse2(uint8_t* row, size_t len) {
+    const __m128i low12 = _mm_setr_epi32(-1, -1, -1, 0);
+    const __m128i low3 = _mm_setr_epi32(0xFFFFFF, 0, 0, 0);
+    __m128i a = _mm_setzero_si128(); // last output pixel, repeated over bytes 0..11
+    size_t i = 0;
+    for (; i + 16 <= len; i += 12) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i x = _mm_add_epi8(in, _mm_slli_si128(in, 3));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+        x = _mm_add_epi8(x, a);
+        _mm_storeu_si128((__m128i*)(row + i), Select(low12, x, in));
+        __m128i last = _mm_and_si128(_mm_srli_si128(x, 9), low3);
+        a = _mm_or_si128(last, _mm_slli_si128(last, 3));
+        a = _mm_or_si128(a, _mm_slli_si128(a, 6));
+    }
+    for (; i + 3 <= len; i += 3) {
+        a = _mm_add_epi8(a, LoadPixel<3>(row + i));
+        StorePixel<3>(row + i, a);
+    }
+}
+
+static void Sub4Sse2(uint8_t* row, size_t len) {
+    __m128i a = _mm_setzero_si128(); // last output pixel in every lane
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi8(x, a);
+        _mm_storeu_si128((__m128i*)(row + i), x);
+        a = _mm_shuffle_epi32(x, 0xFF);
+    }
+    for (; i + 4 <= len; i += 4) {
+        a = _mm_add_epi8(a, LoadPixel<4>(row + i));
+        StorePixel<4>(row + i, a);
+    }
+}
+
+// Selects the first Bpp bytes. 3-byte pixels are moved 4 bytes at a time wherever the row has room;
+// the prediction is masked so the extra byte is stored back unchanged.
+template <size_t Bpp>
+static inline __m128i PixelMask() {
+    return _mm_cvtsi32_si128(Bpp == 3 ? 0xFFFFFF : -1);
+}
+
+// floor((a + b) / 2) from the rounding-up average.
+static inline __m128i AvgPixel(__m128i x, __m128i a, __m128i b, __m128i mask) {
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+    return _mm_add_epi8(x, _mm_and_si128(avg, mask));
+}
+
+template <size_t Bpp>
+static void AvgSse2(uint8_t* row, const uint8_t* prev, size_t len) {
+    const __m128i mask = PixelMask<Bpp>();
+    __m128i a = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= len; i += Bpp) {
+        a = AvgPixel(LoadPixel<4>(row + i), a, LoadPixel<4>(prev + i), mask);
+        StorePixel<4>(row + i, a);
+    }
+    for (; i + Bpp <= len; i += Bpp) {
+        a = AvgPixel(LoadPixel<Bpp>(row + i), a, LoadPixel<Bpp>(prev + i), mask);
+        StorePixel<Bpp>(row + i, a);
+    }
+}
+
+// a, b and c are 16-bit lanes.
+static inline __m128i PaethPixel(__m128i x, __m128i a, __m128i b, __m128i c, __m128i mask) {
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = Abs16(_mm_add_epi16(pa, pb));
+    pa = Abs16(pa);
+    pb = Abs16(pb);
+    __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    __m128i pred = Select(_mm_cmpeq_epi16(pa, smallest), a, Select(_mm_cmpeq_epi16(pb, smallest), b, c));
+    return _mm_add_epi8(x, _mm_and_si128(_mm_packus_epi16(pred, pred), mask));
+}
+
+template <size_t Bpp>
+static void PaethSse2(uint8_t* row, const uint8_t* prev, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = PixelMask<Bpp>();
+    __m128i a = zero, c = zero; // left and upper-left pixel, 16-bit lanes
+    size_t i = 0;
+    for (; i + 4 <= len; i += Bpp) {
+        __m128i b = _mm_unpacklo_epi8(LoadPixel<4>(prev + i), zero);
+        __m128i x = PaethPixel(LoadPixel<4>(row + i), a, b, c, mask);
+        StorePixel<4>(row + i, x);
+        a = _mm_unpacklo_epi8(x, zero);
+        c = b;
+    }
+    for (; i + Bpp <= len; i += Bpp) {
+        __m128i b = _mm_unpacklo_epi8(LoadPixel<Bpp>(prev + i), zero);
+        __m128i x = PaethPixel(LoadPixel<Bpp>(row + i), a, b, c, mask);
+        StorePixel<Bpp>(row + i, x);
+        a = _mm_unpacklo_epi8(x, zero);
+        c = b;
+    }
+}
+
+static bool UnfilterRowSse2(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    if (filter == 2 && prev) {
+        UpSse2(row, prev, len);
+        return true;
+    }
+    if (bpp != 3 && bpp != 4) return UnfilterRowReference(filter, row, prev, len, bpp);
+    // Paeth on the first row predicts from the left pixel only, which is Sub.
+    if (filter == 1 || (filter == 4 && !prev)) {
+        if (bpp == 3) Sub3Sse2(row, len);
+        else Sub4Sse2(row, len);
+        return true;
+    }
+    if (filter == 3 && prev) {
+        if (bpp == 3) AvgSse2<3>(row, prev, len);
+        else AvgSse2<4>(row, prev, len);
+        return true;
+    }
+    if (filter == 4) {
+        if (bpp == 3) PaethSse2<3>(row, prev, len);
+        else PaethSse2<4>(row, prev, len);
+        return true;
+    }
+    return UnfilterRowReference(filter, row, prev, len, bpp);
+}
+
+static inline __m128i AbsDiff8(__m128i x, __m128i y) {
+    return _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+}
+
+// (a + b) >> 1 without widening: pavgb rounds up, so take the carried-in low bit back off.
+static inline __m128i AvgPredict(__m128i a, __m128i b) {
+    return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+static inline __m128i PaethPredict(__m128i a, __m128i b, __m128i c) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i pa = AbsDiff8(b, c), pb = AbsDiff8(a, c);
+    __m128i cLo = _mm_unpacklo_epi8(c, zero), cHi = _mm_unpackhi_epi8(c, zero);
+    __m128i pcLo = Abs16(_mm_sub_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+                                       _mm_add_epi16(cLo, cLo)));
+    __m128i pcHi = Abs16(_mm_sub_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+                                       _mm_add_epi16(cHi, cHi)));
+    __m128i pc = _mm_packus_epi16(pcLo, pcHi);
+    __m128i useA = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(pa, pb), pa), _mm_cmpeq_epi8(_mm_min_epu8(pa, pc), pa));
+    __m128i useB = _mm_cmpeq_epi8(_mm_min_epu8(pb, pc), pb);
+    return Select(useA, a, Select(useB, b, c));
+}
+
+template <int Filter>
+static inline __m128i Residual(__m128i x, __m128i a, __m128i b, __m128i c) {
+    switch (Filter) {
+    case 1: return _mm_sub_epi8(x, a);
+    case 2: return _mm_sub_epi8(x, b);
+    case 3: return _mm_sub_epi8(x, AvgPredict(a, b));
+    default: return _mm_sub_epi8(x, PaethPredict(a, b, c));
+    }
+}
+
+// Sum of FilterMagnitude over 16 bytes, in two 64-bit lanes.
+static inline __m128i Magnitudes(__m128i r) {
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_sad_epu8(_mm_min_epu8(r, _mm_sub_epi8(zero, r)), zero);
+}
+
+static inline uint64_t SumLanes(__m128i v) {
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128((__m128i*)lanes, v);
+    return lanes[0] + lanes[1];
+}
+
+template <int Filter>
+static void FilterSse2(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp, uint8_t* o) {
+    size_t i = std::min(bpp, len);
+    FilterBytes(Filter, row, prev, 0, i, bpp, o);
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+        __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+        __m128i c = _mm_loadu_si128((const __m128i*)(prev + i - bpp));
+        _mm_storeu_si128((__m128i*)(o + i), Residual<Filter>(x, a, b, c));
+    }
+    FilterBytes(Filter, row, prev, i, len, bpp, o);
+}
+
+static void FilterRowSse2(uint8_t filter, const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp,
+                          uint8_t* out) {
+    if (!prev || filter == 0 || filter > 4) return FilterRowReference(filter, row, prev, len, bpp, out);
+    out[0] = filter;
+    switch (filter) {
+    case 1: FilterSse2<1>(row, prev, len, bpp, out + 1); break;
+    case 2: FilterSse2<2>(row, prev, len, bpp, out + 1); break;
+    case 3: FilterSse2<3>(row, prev, len, bpp, out + 1); break;
+    case 4: FilterSse2<4>(row, prev, len, bpp, out + 1); break;
+    }
+}
+
+static uint8_t SelectFilterSse2(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    if (!prev) return SelectFilterReference(row, prev, len, bpp);
+    uint64_t cost[5] = {};
+    size_t i = std::min(bpp, len);
+    AddCosts(row, prev, 0, i, bpp, cost);
+    __m128i none = _mm_setzero_si128(), sub = none, up = none, avg = none, paeth = none;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+        __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+        __m128i c = _mm_loadu_si128((const __m128i*)(prev + i - bpp));
+        none = _mm_add_epi64(none, Magnitudes(x));
+        sub = _mm_add_epi64(sub, Magnitudes(Residual<1>(x, a, b, c)));
+        up = _mm_add_epi64(up, Magnitudes(Residual<2>(x, a, b, c)));
+        avg = _mm_add_epi64(avg, Magnitudes(Residual<3>(x, a, b, c)));
+        paeth = _mm_add_epi64(paeth, Magnitudes(Residual<4>(x, a, b, c)));
+    }
+    AddCosts(row, prev, i, len, bpp, cost);
+    cost[0] += SumLanes(none);
+    cost[1] += SumLanes(sub);
+    cost[2] += SumLanes(up);
+    cost[3] += SumLanes(avg);
+    cost[4] += SumLanes(paeth);
+    return LowestCost(cost);
+}
+
+#endif
+
+// ----------------------------- NEON -----------------------------
+
+#ifdef PICLAB_HAVE_NEON
+
+template <size_t Bpp>
+static inline uint8x8_t LoadPixelNeon(const uint8_t* p) {
+    return vreinterpret_u8_u32(vdup_n_u32(LoadPixelBits<Bpp>(p)));
+}
+
+template <size_t Bpp>
+static inline void StorePixelNeon(uint8_t* p, uint8x8_t v) {
+    uint32_t bits = vget_lane_u32(vreinterpret_u32_u8(v), 0);
+    memcpy(p, &bits, Bpp);
+}
+
+static void UpNeon(uint8_t* row, const uint8_t* prev, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) vst1q_u8(row + i, vaddq_u8(vld1q_u8(row + i), vld1q_u8(prev + i)));
+    for (; i < len; ++i) row[i] = (uint8_t)(row[i] + prev[i]);
+}
+
+// Same 4-byte moves for 3-byte pixels as the SSE2 path.
+template <size_t Bpp>
+static inline uint8x8_t PixelMaskNeon() {
+    return vreinterpret_u8_u32(vdup_n_u32(Bpp == 3 ? 0xFFFFFFu : 0xFFFFFFFFu));
+}
+
+static inline uint8x8_t PaethPixelNeon(uint8x8_t x, uint8x8_t a, uint8x8_t b, uint8x8_t c, uint8x8_t mask) {
+    uint16x8_t pa = vabdl_u8(b, c);
+    uint16x8_t pb = vabdl_u8(a, c);
+    uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vshll_n_u8(c, 1));
+    uint8x8_t useA = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+    uint8x8_t useB = vmovn_u16(vcleq_u16(pb, pc));
+    uint8x8_t pred = vbsl_u8(useA, a, vbsl_u8(useB, b, c));
+    return vadd_u8(x, vand_u8(pred, mask));
+}
+
+template <size_t Bpp>
+static void SubNeon(uint8_t* row, size_t len) {
+    const uint8x8_t mask = PixelMaskNeon<Bpp>();
+    uint8x8_t a = vdup_n_u8(0);
+    size_t i = 0;
+    for (; i + 4 <= len; i += Bpp) {
+        a = vadd_u8(LoadPixelNeon<4>(row + i), vand_u8(a, mask));
+        StorePixelNeon<4>(row + i, a);
+    }
+    for (; i + Bpp <= len; i += Bpp) {
+        a = vadd_u8(LoadPixelNeon<Bpp>(row + i), vand_u8(a, mask));
+        StorePixelNeon<Bpp>(row + i, a);
+    }
+}
+
+template <size_t Bpp>
+static void AvgNeon(uint8_t* row, const uint8_t* prev, size_t len) {
+    const uint8x8_t mask = PixelMaskNeon<Bpp>();
+    uint8x8_t a = vdup_n_u8(0);
+    size_t i = 0;
+    for (; i + 4 <= len; i += Bpp) {
+        a = vadd_u8(LoadPixelNeon<4>(row + i), vand_u8(vhadd_u8(a, LoadPixelNeon<4>(prev + i)), mask));
+        StorePixelNeon<4>(row + i, a);
+    }
+    for (; i + Bpp <= len; i += Bpp) {
+        a = vadd_u8(LoadPixelNeon<Bpp>(row + i), vand_u8(vhadd_u8(a, LoadPixelNeon<Bpp>(prev + i)), mask));
+        StorePixelNeon<Bpp>(row + i, a);
+    }
+}
+
+template <size_t Bpp>
+static void PaethNeon(uint8_t* row, const uint8_t* prev, size_t len) {
+    const uint8x8_t mask = PixelMaskNeon<Bpp>();
+    uint8x8_t a = vdup_n_u8(0), c = vdup_n_u8(0);
+    size_t i = 0;
+    for (; i + 4 <= len; i += Bpp) {
+        uint8x8_t b = LoadPixelNeon<4>(prev + i);
+        a = PaethPixelNeon(LoadPixelNeon<4>(row + i), a, b, c, mask);
+        StorePixelNeon<4>(row + i, a);
+        c = b;
+    }
+    for (; i + Bpp <= len; i += Bpp) {
+        uint8x8_t b = LoadPixelNeon<Bpp>(prev + i);
+        a = PaethPixelNeon(LoadPixelNeon<Bpp>(row + i), a, b, c, mask);
+        StorePixelNeon<Bpp>(row + i, a);
+        c = b;
+    }
+}
+
+static bool UnfilterRowNeon(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    if (filter == 2 && prev) {
+        UpNeon(row, prev, len);
+        return true;
+    }
+    if (bpp != 3 && bpp != 4) return UnfilterRowReference(filter, row, prev, len, bpp);
+    if (filter == 1 || (filter == 4 && !prev)) {
+        if (bpp == 3) SubNeon<3>(row, len);
+        else SubNeon<4>(row, len);
+        return true;
+    }
+    if (filter == 3 && prev) {
+        if (bpp == 3) AvgNeon<3>(row, prev, len);
+        else AvgNeon<4>(row, prev, len);
+        return true;
+    }
+    if (filter == 4) {
+        if (bpp == 3) PaethNeon<3>(row, prev, len);
+        else PaethNeon<4>(row, prev, len);
+        return true;
+    }
+    return UnfilterRowReference(filter, row, prev, len, bpp);
+}
+
+static inline uint8x16_t PaethPredictNeon(uint8x16_t a, uint8x16_t b, uint8x16_t c) {
+    uint8x16_t pa = vabdq_u8(b, c), pb = vabdq_u8(a, c);
+    int16x8_t lo = vabsq_s16(vaddq_s16(vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(a), vget_low_u8(c))),
+                                       vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(b), vget_low_u8(c)))));
+    int16x8_t hi = vabsq_s16(vaddq_s16(vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(a), vget_high_u8(c))),
+                                       vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(b), vget_high_u8(c)))));
+    uint8x16_t pc = vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi));
+    uint8x16_t useA = vandq_u8(vcleq_u8(pa, pb), vcleq_u8(pa, pc));
+    uint8x16_t useB = vcleq_u8(pb, pc);
+    return vbslq_u8(useA, a, vbslq_u8(useB, b, c));
+}
+
+template <int Filter>
+static inline uint8x16_t ResidualNeon(uint8x16_t x, uint8x16_t a, uint8x16_t b, uint8x16_t c) {
+    switch (Filter) {
+    case 1: return vsubq_u8(x, a);
+    case 2: return vsubq_u8(x, b);
+    case 3: return vsubq_u8(x, vhaddq_u8(a, b));
+    default: return vsubq_u8(x, PaethPredictNeon(a, b, c));
+    }
+}
+
+// Adds the FilterMagnitude of 16 bytes to two 64-bit lanes.
+static inline uint64x2_t AddMagnitudes(uint64x2_t acc, uint8x16_t r) {
+    uint8x16_t m = vminq_u8(r, vreinterpretq_u8_s8(vnegq_s8(vreinterpretq_s8_u8(r))));
+    return vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(m)));
+}
+
+template <int Filter>
+static void FilterNeon(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp, uint8_t* o) {
+    size_t i = std::min(bpp, len);
+    FilterBytes(Filter, row, prev, 0, i, bpp, o);
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t r = ResidualNeon<Filter>(vld1q_u8(row + i), vld1q_u8(row + i - bpp), vld1q_u8(prev + i),
+                                            vld1q_u8(prev + i - bpp));
+        vst1q_u8(o + i, r);
+    }
+    FilterBytes(Filter, row, prev, i, len, bpp, o);
+}
+
+static void FilterRowNeon(uint8_t filter, const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp,
+                          uint8_t* out) {
+    if (!prev || filter == 0 || filter > 4) return FilterRowReference(filter, row, prev, len, bpp, out);
+    out[0] = filter;
+    switch (filter) {
+    case 1: FilterNeon<1>(row, prev, len, bpp, out + 1); break;
+    case 2: FilterNeon<2>(row, prev, len, bpp, out + 1); break;
+    case 3: FilterNeon<3>(row, prev, len, bpp, out + 1); break;
+    case 4: FilterNeon<4>(row, prev, len, bpp, out + 1); break;
+    }
+}
+
+static uint8_t SelectFilterNeon(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    if (!prev) return SelectFilterReference(row, prev, len, bpp);
+    uint64_t cost[5] = {};
+    size_t i = std::min(bpp, len);
+    AddCosts(row, prev, 0, i, bpp, cost);
+    uint64x2_t none = vdupq_n_u64(0), sub = none, up = none, avg = none, paeth = none;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t x = vld1q_u8(row + i), a = vld1q_u8(row + i - bpp);
+        uint8x16_t b = vld1q_u8(prev + i), c = vld1q_u8(prev + i - bpp);
+        none = AddMagnitudes(none, x);
+        sub = AddMagnitudes(sub, ResidualNeon<1>(x, a, b, c));
+        up = AddMagnitudes(up, ResidualNeon<2>(x, a, b, c));
+        avg = AddMagnitudes(avg, ResidualNeon<3>(x, a, b, c));
+        paeth = AddMagnitudes(paeth, ResidualNeon<4>(x, a, b, c));
+    }
+    AddCosts(row, prev, i, len, bpp, cost);
+    cost[0] += vgetq_lane_u64(none, 0) + vgetq_lane_u64(none, 1);
+    cost[1] += vgetq_lane_u64(sub, 0) + vgetq_lane_u64(sub, 1);
+    cost[2] += vgetq_lane_u64(up, 0) + vgetq_lane_u64(up, 1);
+    cost[3] += vgetq_lane_u64(avg, 0) + vgetq_lane_u64(avg, 1);
+    cost[4] += vgetq_lane_u64(paeth, 0) + vgetq_lane_u64(paeth, 1);
+    return LowestCost(cost);
+}
+
+#endif
+
+// ----------------------------- Dispatch -----------------------------
+
+struct FilterKernels {
+    UnfilterFn unfilter;
+    FilterFn filter;
+    SelectFn select;
+    const char* name;
+};
+
+static FilterKernels SelectKernels() {
+    const CpuFeatures& cpu = GetCpuFeatures();
+    (void)cpu;
+#ifdef PICLAB_HAVE_SSE2
+    if (cpu.sse2) return { UnfilterRowSse2, FilterRowSse2, SelectFilterSse2, "sse2" };
+#endif
+#ifdef PICLAB_HAVE_NEON
+    if (cpu.neon) return { UnfilterRowNeon, FilterRowNeon, SelectFilterNeon, "neon" };
+#endif
+    return { UnfilterRowScalar, FilterRowScalar, SelectFilterScalar, "scalar" };
+}
+
+static const FilterKernels& Kernels() {
+    static const FilterKernels kernels = SelectKernels();
+    return kernels;
+}
+
+bool UnfilterRow(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    return Kernels().unfilter(filter, row, prev, len, bpp);
+}
+
+void FilterRow(uint8_t filter, const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp, uint8_t* out) {
+    Kernels().filter(filter, row, prev, len, bpp, out);
+}
+
+uint8_t SelectFilter(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    return Kernels().select(row, prev, len, bpp);
+}
+
+const char* FilterKernelName() {
+    return Kernels().name;
+}
+
+} // namespace piclab
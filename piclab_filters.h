@@ -0,0 +1,124 @@
+// piclab_filters.h
+// PNG scanline filters (None, Sub, Up, Average, Paeth) in both directions. Every vector path is
+// bit-exact with the scalar reference in this header; runtime dispatch picks the widest one the CPU
+// supports.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+namespace piclab {
+
+static inline uint8_t Paeth(uint8_t a, uint8_t b, uint8_t c) {
+    int p = (int)a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// Reference unfilter: reverses one row's filter in place, byte by byte. prev is the already
+// unfiltered row above, or nullptr for the first row. False for an unknown filter type.
+static inline bool UnfilterRowReference(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    switch (filter) {
+    case 0:
+        return true;
+    case 1:
+        for (size_t i = bpp; i < len; ++i) row[i] = (uint8_t)(row[i] + row[i - bpp]);
+        return true;
+    case 2:
+        if (prev) for (size_t i = 0; i < len; ++i) row[i] = (uint8_t)(row[i] + prev[i]);
+        return true;
+    case 3:
+        for (size_t i = 0; i < len; ++i) {
+            unsigned a = i >= bpp ? row[i - bpp] : 0;
+            unsigned b = prev ? prev[i] : 0;
+            row[i] = (uint8_t)(row[i] + ((a + b) >> 1));
+        }
+        return true;
+    case 4:
+        for (size_t i = 0; i < len; ++i) {
+            uint8_t a = i >= bpp ? row[i - bpp] : 0;
+            uint8_t b = prev ? prev[i] : 0;
+            uint8_t c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+            row[i] = (uint8_t)(row[i] + Paeth(a, b, c));
+        }
+        return true;
+    }
+    return false;
+}
+
+// Reference filter: writes the filter type and then row filtered with it to out (1 + len bytes).
+static inline void FilterRowReference(uint8_t filter, const uint8_t* row, const uint8_t* prev, size_t len,
+                                      size_t bpp, uint8_t* out) {
+    out[0] = filter;
+    uint8_t* o = out + 1;
+    switch (filter) {
+    case 0:
+        for (size_t i = 0; i < len; ++i) o[i] = row[i];
+        break;
+    case 1:
+        for (size_t i = 0; i < len; ++i) o[i] = (uint8_t)(row[i] - (i >= bpp ? row[i - bpp] : 0));
+        break;
+    case 2:
+        for (size_t i = 0; i < len; ++i) o[i] = (uint8_t)(row[i] - (prev ? prev[i] : 0));
+        break;
+    case 3:
+        for (size_t i = 0; i < len; ++i) {
+            unsigned a = i >= bpp ? row[i - bpp] : 0;
+            unsigned b = prev ? prev[i] : 0;
+            o[i] = (uint8_t)(row[i] - ((a + b) >> 1));
+        }
+        break;
+    case 4:
+        for (size_t i = 0; i < len; ++i) {
+            uint8_t a = i >= bpp ? row[i - bpp] : 0;
+            uint8_t b = prev ? prev[i] : 0;
+            uint8_t c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+            o[i] = (uint8_t)(row[i] - Paeth(a, b, c));
+        }
+        break;
+    }
+}
+
+// A filtered byte taken as a signed value, made absolute.
+static inline unsigned FilterMagnitude(uint8_t v) {
+    return v < 128 ? v : 256u - v;
+}
+
+// Reference filter choice, the classic "minimum sum of absolute differences": the type whose output
+// has the smallest sum of FilterMagnitude, the lowest type on ties.
+static inline uint8_t SelectFilterReference(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp) {
+    uint64_t cost[5] = {};
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t a = i >= bpp ? row[i - bpp] : 0;
+        uint8_t b = prev ? prev[i] : 0;
+        uint8_t c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+        uint8_t x = row[i];
+        cost[0] += FilterMagnitude(x);
+        cost[1] += FilterMagnitude((uint8_t)(x - a));
+        cost[2] += FilterMagnitude((uint8_t)(x - b));
+        cost[3] += FilterMagnitude((uint8_t)(x - ((a + b) >> 1)));
+        cost[4] += FilterMagnitude((uint8_t)(x - Paeth(a, b, c)));
+    }
+    uint8_t best = 0;
+    for (uint8_t f = 1; f < 5; ++f) {
+        if (cost[f] < cost[best]) best = f;
+    }
+    return best;
+}
+
+// Dispatched unfilter. Up is vectorized for every pixel size; Sub, Average and Paeth for 3- and
+// 4-byte pixels (8-bit RGB/RGBA, 16-bit gray+alpha). Anything else uses the reference.
+bool UnfilterRow(uint8_t filter, uint8_t* row, const uint8_t* prev, size_t len, size_t bpp);
+
+// Dispatched encoder side, for any pixel size. Filtering has no dependency along the row, so all
+// five candidates are scored 16 bytes at a time in a single pass and only the winner is written.
+void FilterRow(uint8_t filter, const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp, uint8_t* out);
+uint8_t SelectFilter(const uint8_t* row, const uint8_t* prev, size_t len, size_t bpp);
+
+// "sse2", "neon" or "scalar", for both directions.
+const char* FilterKernelName();
+
+} // namespace piclab
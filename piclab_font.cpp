@@ -0,0 +1,430 @@
+// piclab_font.cpp
+// Built-in label font. Glyphs are 1-bit bitmaps of DejaVu Sans Bold rendered at a 28 px em
+// (Bitstream Vera derived, free license); they are scaled with 4x4 supersampling of a bilinear
+// reconstruction, which keeps outlines smooth when labels are much larger than the source size.
+
+#include "piclab_font.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace piclab {
+
+// ----------------------------- Font data -----------------------------
+
+namespace {
+
+struct Glyph {
+    uint8_t  advance;
+    int8_t   left;   // bitmap x offset from the pen
+    int8_t   top;    // bitmap rows above the baseline
+    uint8_t  width;
+    uint8_t  rows;
+    uint16_t offset; // first row in kGlyphRows
+};
+
+const float kSourceEm   = 28.0f;
+const int   kAscent     = 26;
+const int   kLineHeight = 33;
+
+// Printable ASCII 0x20..0x7E.
+const Glyph kGlyphs[95] = {
+    {10,  0,  1,  1,  1,    0}, // ' '
+    {13,  4, 20,  5, 20,    1}, // '!'
+    {15,  3, 20,  9,  8,   21}, // '"'
+    {23,  2, 20, 20, 20,   29}, // '#'
+    {19,  4, 21, 14, 25,   49}, // '$'
+    {28,  1, 20, 26, 20,   74}, // '%'
+    {24,  1, 20, 22, 20,   94}, // '&'
+    { 9,  3, 20,  3,  8,  114}, // '\''
+    {13,  2, 21,  9, 25,  122}, // '('
+    {13,  2, 21,  9, 25,  147}, // ')'
+    {15,  0, 20, 14, 13,  172}, // '*'
+    {23,  3, 17, 17, 17,  185}, // '+'
+    {11,  2,  5,  6,  9,  202}, // ','
+    {12,  2, 10,  9,  4,  211}, // '-'
+    {11,  3,  5,  5,  5,  215}, // '.'
+    {10,  0, 20, 10, 23,  220}, // '/'
+    {19,  1, 20, 17, 20,  243}, // '0'
+    {19,  3, 20, 15, 20,  263}, // '1'
+    {19,  2, 20, 15, 20,  283}, // '2'
+    {19,  2, 20, 15, 20,  303}, // '3'
+    {19,  1, 20, 17, 20,  323}, // '4'
+    {19,  2, 20, 15, 20,  343}, // '5'
+    {19,  2, 20, 16, 20,  363}, // '6'
+    {19,  2, 20, 15, 20,  383}, // '7'
+    {19,  2, 20, 16, 20,  403}, // '8'
+    {19,  2, 20, 16, 20,  423}, // '9'
+    {11,  3, 15,  5, 15,  443}, // ':'
+    {11,  2, 15,  6, 19,  458}, // ';'
+    {23,  3, 17, 18, 16,  477}, // '<'
+    {23,  3, 13, 18,  9,  493}, // '='
+    {23,  3, 17, 18, 16,  502}, // '>'
+    {16,  2, 20, 13, 20,  518}, // '?'
+    {28,  2, 20, 24, 25,  538}, // '@'
+    {22,  0, 20, 21, 20,  563}, // 'A'
+    {21,  3, 20, 17, 20,  583}, // 'B'
+    {21,  1, 20, 17, 20,  603}, // 'C'
+    {23,  3, 20, 19, 20,  623}, // 'D'
+    {19,  3, 20, 15, 20,  643}, // 'E'
+    {19,  3, 20, 14, 20,  663}, // 'F'
+    {23,  1, 20, 20, 20,  683}, // 'G'
+    {23,  3, 20, 18, 20,  703}, // 'H'
+    {10,  3, 20,  5, 20,  723}, // 'I'
+    {10, -1, 20,  9, 26,  743}, // 'J'
+    {22,  3, 20, 20, 20,  769}, // 'K'
+    {18,  3, 20, 15, 20,  789}, // 'L'
+    {28,  3, 20, 23, 20,  809}, // 'M'
+    {23,  3, 20, 18, 20,  829}, // 'N'
+    {24,  1, 20, 21, 20,  849}, // 'O'
+    {21,  3, 20, 17, 20,  869}, // 'P'
+    {24,  1, 20, 21, 24,  889}, // 'Q'
+    {22,  3, 20, 19, 20,  913}, // 'R'
+    {20,  2, 20, 16, 20,  933}, // 'S'
+    {19,  0, 20, 19, 20,  953}, // 'T'
+    {23,  3, 20, 18, 20,  973}, // 'U'
+    {22,  0, 20, 21, 20,  993}, // 'V'
+    {31,  1, 20, 29, 20, 1013}, // 'W'
+    {22,  1, 20, 21, 20, 1033}, // 'X'
+    {20,  0, 20, 21, 20, 1053}, // 'Y'
+    {20,  1, 20, 18, 20, 1073}, // 'Z'
+    {13,  2, 21,  9, 25, 1093}, // '['
+    {10,  0, 20, 10, 23, 1118}, // '\\'
+    {13,  2, 21,  9, 25, 1141}, // ']'
+    {23,  3, 20, 18,  8, 1166}, // '^'
+    {14,  0, -4, 14,  3, 1174}, // '_'
+    {14,  1, 22,  8,  5, 1177}, // '`'
+    {19,  1, 15, 15, 15, 1182}, // 'a'
+    {20,  2, 21, 16, 21, 1197}, // 'b'
+    {17,  1, 15, 14, 15, 1218}, // 'c'
+    {20,  1, 21, 16, 21, 1233}, // 'd'
+    {19,  1, 15, 16, 15, 1254}, // 'e'
+    {12,  1, 21, 12, 21, 1269}, // 'f'
+    {20,  1, 15, 16, 21, 1290}, // 'g'
+    {20,  2, 21, 15, 21, 1311}, // 'h'
+    {10,  2, 21,  5, 21, 1332}, // 'i'
+    {10, -1, 21,  8, 27, 1353}, // 'j'
+    {19,  2, 21, 17, 21, 1380}, // 'k'
+    {10,  2, 21,  5, 21, 1401}, // 'l'
+    {29,  2, 15, 25, 15, 1422}, // 'm'
+    {20,  2, 15, 15, 15, 1437}, // 'n'
+    {19,  1, 15, 17, 15, 1452}, // 'o'
+    {20,  2, 15, 16, 21, 1467}, // 'p'
+    {20,  1, 15, 16, 21, 1488}, // 'q'
+    {14,  2, 15, 11, 15, 1509}, // 'r'
+    {17,  1, 15, 14, 15, 1524}, // 's'
+    {13,  0, 20, 12, 20, 1539}, // 't'
+    {20,  2, 15, 15, 15, 1559}, // 'u'
+    {18,  0, 15, 17, 15, 1574}, // 'v'
+    {26,  1, 15, 24, 15, 1589}, // 'w'
+    {18,  0, 15, 17, 15, 1604}, // 'x'
+    {18,  0, 15, 17, 21, 1619}, // 'y'
+    {16,  1, 15, 14, 15, 1640}, // 'z'
+    {20,  4, 21, 13, 26, 1655}, // '{'
+    {10,  4, 21,  3, 28, 1681}, // '|'
+    {20,  4, 21, 13, 26, 1709}, // '}'
+    {23,  3, 11, 18,  5, 1735}, // '~'
+};
+
+// One word per bitmap row, leftmost pixel in bit 31.
+const uint32_t kGlyphRows[1740] = {
+    0x00000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0x78000000, 0x70000000, 0x00000000, 0x00000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xe3800000, 0xe3800000, 0xe3800000,
+    0xe3800000, 0xe3800000, 0xe3800000, 0xe3800000, 0xe3800000, 0x01e38000, 0x01c38000, 0x01c38000,
+    0x01c78000, 0x03c70000, 0x3ffff000, 0x3ffff000, 0x3ffff000, 0x078e0000, 0x070e0000, 0x070e0000,
+    0x071e0000, 0xffffc000, 0xffffc000, 0xffffc000, 0x0e1c0000, 0x1e380000, 0x1c380000, 0x1c380000,
+    0x1c780000, 0x03000000, 0x03000000, 0x03000000, 0x1ff80000, 0x3ff80000, 0x7ff80000, 0xfb180000,
+    0xf3000000, 0xf3000000, 0xff000000, 0xffc00000, 0x7ff00000, 0x3ff80000, 0x1ffc0000, 0x03fc0000,
+    0x033c0000, 0x033c0000, 0xc33c0000, 0xfff80000, 0xfff00000, 0xffe00000, 0x03000000, 0x03000000,
+    0x03000000, 0x03000000, 0x1f007800, 0x7fc07000, 0x71c0f000, 0xe0e0e000, 0xe0e1c000, 0xe0e3c000,
+    0xe0e38000, 0xe0e70000, 0x71cf0000, 0x7fce3e00, 0x1f1cff80, 0x003ce380, 0x0039c1c0, 0x0079c1c0,
+    0x00f1c1c0, 0x00e1c1c0, 0x01e1c1c0, 0x03c0e380, 0x0380ff80, 0x07803e00, 0x03f80000, 0x0ffe0000,
+    0x0ffe0000, 0x1f8e0000, 0x1f020000, 0x1f000000, 0x0f800000, 0x0fc00000, 0x1fe07800, 0x3ff07800,
+    0x7df8f800, 0xf8fcf000, 0xf87ff000, 0xf83ff000, 0xf81fe000, 0xfc0fc000, 0x7e1fe000, 0x7ffff000,
+    0x1ffff800, 0x07f0fc00, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000,
+    0xe0000000, 0xe0000000, 0x0f800000, 0x1f000000, 0x1f000000, 0x3e000000, 0x3e000000, 0x7c000000,
+    0x7c000000, 0x7c000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0x7c000000, 0x7c000000, 0x7c000000, 0x3e000000, 0x3e000000,
+    0x1f000000, 0x1f000000, 0x0f800000, 0xf8000000, 0x7c000000, 0x7c000000, 0x3e000000, 0x3e000000,
+    0x1f000000, 0x1f000000, 0x1f000000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000,
+    0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x1f000000, 0x1f000000, 0x1f000000, 0x3e000000,
+    0x3e000000, 0x7c000000, 0x7c000000, 0xf8000000, 0x03000000, 0x03000000, 0x43080000, 0xf33c0000,
+    0x7ff80000, 0x1fe00000, 0x07800000, 0x1fe00000, 0x7ff80000, 0xf33c0000, 0x43080000, 0x03000000,
+    0x03000000, 0x01c00000, 0x01c00000, 0x01c00000, 0x01c00000, 0x01c00000, 0x01c00000, 0x01c00000,
+    0xffff8000, 0xffff8000, 0xffff8000, 0x01c00000, 0x01c00000, 0x01c00000, 0x01c00000, 0x01c00000,
+    0x01c00000, 0x01c00000, 0x7c000000, 0x7c000000, 0x7c000000, 0x7c000000, 0x7c000000, 0x78000000,
+    0xf8000000, 0xf0000000, 0xe0000000, 0xff800000, 0xff800000, 0xff800000, 0xff800000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0x01c00000, 0x01c00000, 0x03800000, 0x03800000,
+    0x03800000, 0x07000000, 0x07000000, 0x07000000, 0x0e000000, 0x0e000000, 0x0e000000, 0x0c000000,
+    0x1c000000, 0x1c000000, 0x1c000000, 0x38000000, 0x38000000, 0x38000000, 0x70000000, 0x70000000,
+    0x70000000, 0xe0000000, 0xe0000000, 0x07f00000, 0x1ffc0000, 0x3ffe0000, 0x3ffe0000, 0x7e3f0000,
+    0x7c1f0000, 0xf80f8000, 0xf80f8000, 0xf80f8000, 0xf80f8000, 0xf80f8000, 0xf80f8000, 0xf80f8000,
+    0xf80f8000, 0x7c1f0000, 0x7e3f0000, 0x3ffe0000, 0x3ffe0000, 0x1ffc0000, 0x07f00000, 0x3fc00000,
+    0xffc00000, 0xffc00000, 0xffc00000, 0xe7c00000, 0x07c00000, 0x07c00000, 0x07c00000, 0x07c00000,
+    0x07c00000, 0x07c00000, 0x07c00000, 0x07c00000, 0x07c00000, 0x07c00000, 0x07c00000, 0xfffe0000,
+    0xfffe0000, 0xfffe0000, 0xfffe0000, 0x3fe00000, 0xfff80000, 0xfffc0000, 0xfffe0000, 0xc07e0000,
+    0x003e0000, 0x003e0000, 0x003e0000, 0x007e0000, 0x00fc0000, 0x01fc0000, 0x03f80000, 0x0ff00000,
+    0x1fe00000, 0x3fc00000, 0x7f800000, 0xfffe0000, 0xfffe0000, 0xfffe0000, 0xfffe0000, 0x1fe00000,
+    0x7ff80000, 0x7ffc0000, 0x7ffe0000, 0x607e0000, 0x003e0000, 0x003e0000, 0x007c0000, 0x0ff80000,
+    0x0fe00000, 0x0ff80000, 0x0ffc0000, 0x007e0000, 0x003e0000, 0x003e0000, 0xc07e0000, 0xfffe0000,
+    0xfffc0000, 0xfff80000, 0x3fe00000, 0x00fc0000, 0x01fc0000, 0x03fc0000, 0x03fc0000, 0x07fc0000,
+    0x0f7c0000, 0x0e7c0000, 0x1e7c0000, 0x3c7c0000, 0x387c0000, 0x707c0000, 0xf07c0000, 0xffff8000,
+    0xffff8000, 0xffff8000, 0xffff8000, 0x007c0000, 0x007c0000, 0x007c0000, 0x007c0000, 0x7ffc0000,
+    0x7ffc0000, 0x7ffc0000, 0x7ffc0000, 0x78000000, 0x78000000, 0x7fe00000, 0x7ff80000, 0x7ffc0000,
+    0x7ffc0000, 0x60fe0000, 0x003e0000, 0x003e0000, 0x003e0000, 0x003e0000, 0xc0fe0000, 0xfffc0000,
+    0xfff80000, 0xfff00000, 0x3fc00000, 0x03f80000, 0x0ffe0000, 0x1ffe0000, 0x3ffe0000, 0x7e060000,
+    0x7c000000, 0xf9f00000, 0xfffc0000, 0xfffe0000, 0xfffe0000, 0xfc3f0000, 0xf81f0000, 0xf81f0000,
+    0xf81f0000, 0x781f0000, 0x7c3f0000, 0x7ffe0000, 0x3ffc0000, 0x1ff80000, 0x07e00000, 0xfffe0000,
+    0xfffe0000, 0xfffe0000, 0xfffe0000, 0x007c0000, 0x00fc0000, 0x00f80000, 0x01f80000, 0x01f00000,
+    0x01f00000, 0x03f00000, 0x03e00000, 0x07e00000, 0x07c00000, 0x0fc00000, 0x0f800000, 0x1f800000,
+    0x1f000000, 0x3f000000, 0x3e000000, 0x0ff00000, 0x1ff80000, 0x3ffc0000, 0x7ffe0000, 0x7e7e0000,
+    0x7c3e0000, 0x7c3e0000, 0x7e7e0000, 0x3ffc0000, 0x1ff80000, 0x1ff80000, 0x7ffe0000, 0xfc3f0000,
+    0xf81f0000, 0xf81f0000, 0xfc3f0000, 0xffff0000, 0x7ffe0000, 0x3ffc0000, 0x0ff00000, 0x07e00000,
+    0x1ff80000, 0x3ffc0000, 0x7ffe0000, 0xfc3e0000, 0xf81e0000, 0xf81f0000, 0xf81f0000, 0xf81f0000,
+    0xfc3f0000, 0x7fff0000, 0x7fff0000, 0x3fff0000, 0x0f9f0000, 0x003e0000, 0x407e0000, 0x7ffc0000,
+    0x7ff80000, 0x7ff00000, 0x3fc00000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0x7c000000, 0x7c000000, 0x7c000000, 0x7c000000, 0x7c000000, 0x00000000,
+    0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x7c000000, 0x7c000000, 0x7c000000, 0x7c000000,
+    0x7c000000, 0x78000000, 0xf8000000, 0xf0000000, 0xe0000000, 0x00004000, 0x0003c000, 0x001fc000,
+    0x00ffc000, 0x07fe0000, 0x3ff00000, 0xff800000, 0xfc000000, 0xfc000000, 0xff800000, 0x3ff00000,
+    0x07fe0000, 0x00ffc000, 0x001fc000, 0x0003c000, 0x00004000, 0xffffc000, 0xffffc000, 0xffffc000,
+    0x00000000, 0x00000000, 0x00000000, 0xffffc000, 0xffffc000, 0xffffc000, 0x80000000, 0xf0000000,
+    0xfe000000, 0xffc00000, 0x1ff80000, 0x03ff0000, 0x007fc000, 0x000fc000, 0x000fc000, 0x007fc000,
+    0x03ff0000, 0x1ff80000, 0xffc00000, 0xfe000000, 0xf0000000, 0x80000000, 0xffc00000, 0xfff00000,
+    0xfff00000, 0xc1f80000, 0x00f80000, 0x00f80000, 0x01f80000, 0x03f00000, 0x07e00000, 0x0fc00000,
+    0x1f800000, 0x1f000000, 0x1f000000, 0x00000000, 0x00000000, 0x1f000000, 0x1f000000, 0x1f000000,
+    0x1f000000, 0x1f000000, 0x007f0000, 0x03ffc000, 0x07fff000, 0x0f81f800, 0x1e007c00, 0x3c001c00,
+    0x7879ce00, 0x70ffce00, 0x71ffc700, 0xe3c3c700, 0xe381c700, 0xe381c700, 0xe381c700, 0xe381c700,
+    0xe381ce00, 0xe3c3de00, 0x71fffc00, 0x70fff800, 0x7879e000, 0x3c000000, 0x1e002000, 0x0f80f000,
+    0x07ffe000, 0x03ffc000, 0x007e0000, 0x01fc0000, 0x01fc0000, 0x03fe0000, 0x03fe0000, 0x03fe0000,
+    0x07ff0000, 0x07df0000, 0x07df0000, 0x0fdf8000, 0x0f8f8000, 0x0f8f8000, 0x1f07c000, 0x1fffc000,
+    0x3fffe000, 0x3fffe000, 0x3fffe000, 0x7e03f000, 0x7c01f000, 0x7c01f000, 0xfc01f800, 0xfff00000,
+    0xfffc0000, 0xfffe0000, 0xffff0000, 0xf83f0000, 0xf81f0000, 0xf81f0000, 0xf83f0000, 0xfffe0000,
+    0xfffc0000, 0xfffe0000, 0xffff0000, 0xf81f8000, 0xf80f8000, 0xf80f8000, 0xf81f8000, 0xffff8000,
+    0xffff0000, 0xfffe0000, 0xfff80000, 0x01fc0000, 0x07ff8000, 0x1fff8000, 0x3fff8000, 0x7f038000,
+    0x7e008000, 0xfc000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xfc000000, 0x7e008000, 0x7f038000, 0x3fff8000, 0x1fff8000, 0x0fff8000, 0x01fc0000, 0xfff00000,
+    0xfffc0000, 0xffff0000, 0xffff8000, 0xf83fc000, 0xf80fc000, 0xf807c000, 0xf803e000, 0xf803e000,
+    0xf803e000, 0xf803e000, 0xf803e000, 0xf803e000, 0xf807c000, 0xf80fc000, 0xf83fc000, 0xffff8000,
+    0xffff0000, 0xfffc0000, 0xffe00000, 0xfffe0000, 0xfffe0000, 0xfffe0000, 0xfffe0000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xfffc0000, 0xfffc0000, 0xfffc0000, 0xfffc0000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xfffe0000, 0xfffe0000, 0xfffe0000, 0xfffe0000, 0xfffc0000,
+    0xfffc0000, 0xfffc0000, 0xfffc0000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xfff80000,
+    0xfff80000, 0xfff80000, 0xfff80000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0x01ff0000, 0x07ffe000, 0x1fffe000, 0x3fffe000, 0x7f81e000,
+    0x7e002000, 0x7c000000, 0xf8000000, 0xf8000000, 0xf80ff000, 0xf80ff000, 0xf80ff000, 0xf80ff000,
+    0x7c01f000, 0x7e01f000, 0x7f81f000, 0x3ffff000, 0x1ffff000, 0x07ffe000, 0x01ff0000, 0xf807c000,
+    0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000, 0xffffc000,
+    0xffffc000, 0xffffc000, 0xffffc000, 0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000,
+    0xf807c000, 0xf807c000, 0xf807c000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0x0f800000,
+    0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000,
+    0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000,
+    0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x1f800000, 0xff000000, 0xff000000, 0xfe000000,
+    0xf8000000, 0xf80fc000, 0xf81f8000, 0xf83f0000, 0xf87e0000, 0xf8fc0000, 0xf9f80000, 0xfbf00000,
+    0xffe00000, 0xffc00000, 0xff800000, 0xffc00000, 0xffe00000, 0xfff00000, 0xfbf80000, 0xf9fc0000,
+    0xf87e0000, 0xf83f0000, 0xf81f8000, 0xf80fc000, 0xf807e000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xfffe0000, 0xfffe0000, 0xfffe0000,
+    0xfffe0000, 0xfc007e00, 0xfe00fe00, 0xfe00fe00, 0xfe00fe00, 0xff01fe00, 0xff01fe00, 0xfb83be00,
+    0xfb83be00, 0xfbc7be00, 0xf9c73e00, 0xf9ef3e00, 0xf8ee3e00, 0xf8fe3e00, 0xf87c3e00, 0xf87c3e00,
+    0xf8383e00, 0xf8003e00, 0xf8003e00, 0xf8003e00, 0xf8003e00, 0xfc07c000, 0xfe07c000, 0xfe07c000,
+    0xff07c000, 0xff07c000, 0xff07c000, 0xfb87c000, 0xfb87c000, 0xf9c7c000, 0xf9c7c000, 0xf8e7c000,
+    0xf8e7c000, 0xf877c000, 0xf877c000, 0xf87fc000, 0xf83fc000, 0xf83fc000, 0xf81fc000, 0xf81fc000,
+    0xf80fc000, 0x01fc0000, 0x0fff8000, 0x1fffc000, 0x3fffe000, 0x7f07f000, 0x7e03f000, 0xfc01f800,
+    0xf800f800, 0xf800f800, 0xf800f800, 0xf800f800, 0xf800f800, 0xf800f800, 0xfc01f800, 0x7e03f000,
+    0x7f07f000, 0x3fffe000, 0x1fffc000, 0x0fff8000, 0x01fc0000, 0xfff80000, 0xfffe0000, 0xffff0000,
+    0xffff0000, 0xf81f8000, 0xf80f8000, 0xf80f8000, 0xf80f8000, 0xf81f8000, 0xffff0000, 0xffff0000,
+    0xfffe0000, 0xfff80000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0x01fc0000, 0x0fff8000, 0x1fffc000, 0x3fffe000, 0x7f07f000, 0x7e03f000, 0xfc01f800,
+    0xf800f800, 0xf800f800, 0xf800f800, 0xf800f800, 0xf800f800, 0xf800f800, 0xfc01f800, 0x7c03f000,
+    0x7f07f000, 0x3fffe000, 0x1fffc000, 0x0fff8000, 0x01ff0000, 0x001f8000, 0x000fc000, 0x0007c000,
+    0x0003e000, 0xfff00000, 0xfffc0000, 0xfffe0000, 0xffff0000, 0xf83f0000, 0xf81f0000, 0xf81f0000,
+    0xf81f0000, 0xf83e0000, 0xfffe0000, 0xfff80000, 0xfff80000, 0xfffc0000, 0xf87e0000, 0xf83f0000,
+    0xf83f0000, 0xf81f8000, 0xf80f8000, 0xf80fc000, 0xf807e000, 0x0ff80000, 0x3ffe0000, 0x7ffe0000,
+    0xfffe0000, 0xfc0e0000, 0xf8020000, 0xf8000000, 0xfc000000, 0x7fc00000, 0x7ff80000, 0x1ffe0000,
+    0x03fe0000, 0x003f0000, 0x001f0000, 0x801f0000, 0xf03f0000, 0xffff0000, 0xfffe0000, 0xfffc0000,
+    0x1ff00000, 0xffffe000, 0xffffe000, 0xffffe000, 0xffffe000, 0x01f00000, 0x01f00000, 0x01f00000,
+    0x01f00000, 0x01f00000, 0x01f00000, 0x01f00000, 0x01f00000, 0x01f00000, 0x01f00000, 0x01f00000,
+    0x01f00000, 0x01f00000, 0x01f00000, 0x01f00000, 0x01f00000, 0xf807c000, 0xf807c000, 0xf807c000,
+    0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000, 0xf807c000,
+    0xf807c000, 0xf807c000, 0xf807c000, 0xfc0fc000, 0x7e1f8000, 0x7fff8000, 0x3fff0000, 0x1ffe0000,
+    0x07f80000, 0xfc01f800, 0x7c01f000, 0x7c01f000, 0x7e03f000, 0x3e03e000, 0x3e03e000, 0x3f07e000,
+    0x1f07c000, 0x1f0fc000, 0x0f8f8000, 0x0f8f8000, 0x0fdf8000, 0x07df0000, 0x07df0000, 0x07ff0000,
+    0x03fe0000, 0x03fe0000, 0x03fe0000, 0x01fc0000, 0x01fc0000, 0xf80f80f8, 0xfc0f81f8, 0x7c1fc1f0,
+    0x7c1dc1f0, 0x7c1dc1f0, 0x7c1dc1f0, 0x3e3ce3e0, 0x3e38e3e0, 0x3e38e3e0, 0x3e38e3e0, 0x1f78f7c0,
+    0x1f7077c0, 0x1f7077c0, 0x1f7077c0, 0x1ff07fc0, 0x0fe03f80, 0x0fe03f80, 0x0fe03f80, 0x0fe03f80,
+    0x07c01f00, 0xfe03f800, 0x7e03f000, 0x3f07e000, 0x1f8fc000, 0x1fdfc000, 0x0fdf8000, 0x07ff0000,
+    0x07ff0000, 0x03fe0000, 0x01fc0000, 0x01fc0000, 0x03fe0000, 0x07ff0000, 0x07ff0000, 0x0fdf8000,
+    0x1f8fc000, 0x3f8fe000, 0x3f07e000, 0x7e03f000, 0xfc01f800, 0xfc01f800, 0x7e03f000, 0x3f07e000,
+    0x3f0fe000, 0x1f8fc000, 0x0fdf8000, 0x0fff8000, 0x07ff0000, 0x03fe0000, 0x01fc0000, 0x01fc0000,
+    0x00f80000, 0x00f80000, 0x00f80000, 0x00f80000, 0x00f80000, 0x00f80000, 0x00f80000, 0x00f80000,
+    0x00f80000, 0xffffc000, 0xffffc000, 0xffffc000, 0xffffc000, 0x003f8000, 0x007f0000, 0x00fe0000,
+    0x00fc0000, 0x01f80000, 0x03f80000, 0x07f00000, 0x0fe00000, 0x0fc00000, 0x1f800000, 0x3f000000,
+    0x7f000000, 0xffffc000, 0xffffc000, 0xffffc000, 0xffffc000, 0xff800000, 0xff800000, 0xff800000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xff800000, 0xff800000, 0xff800000, 0xe0000000, 0xe0000000,
+    0x70000000, 0x70000000, 0x70000000, 0x38000000, 0x38000000, 0x38000000, 0x1c000000, 0x1c000000,
+    0x1c000000, 0x0c000000, 0x0e000000, 0x0e000000, 0x0e000000, 0x07000000, 0x07000000, 0x07000000,
+    0x03800000, 0x03800000, 0x03800000, 0x01c00000, 0x01c00000, 0xff800000, 0xff800000, 0xff800000,
+    0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000,
+    0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000,
+    0x0f800000, 0x0f800000, 0x0f800000, 0xff800000, 0xff800000, 0xff800000, 0x01e00000, 0x03f00000,
+    0x07f80000, 0x0ffc0000, 0x1f3e0000, 0x3e1f0000, 0x78078000, 0xf003c000, 0xfffc0000, 0xfffc0000,
+    0xfffc0000, 0x70000000, 0x38000000, 0x1c000000, 0x0e000000, 0x07000000, 0x1fe00000, 0x7ff80000,
+    0x7ffc0000, 0x407e0000, 0x003e0000, 0x1ffe0000, 0x7ffe0000, 0x7ffe0000, 0xfc3e0000, 0xf83e0000,
+    0xf83e0000, 0xfc7e0000, 0x7ffe0000, 0x7fbe0000, 0x1e3e0000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8f00000, 0xfbfc0000, 0xfffe0000, 0xfc3e0000, 0xfc3f0000,
+    0xf81f0000, 0xf81f0000, 0xf81f0000, 0xf81f0000, 0xf81f0000, 0xfc3f0000, 0xfc3e0000, 0xfffe0000,
+    0xfbfc0000, 0xf9f00000, 0x07f80000, 0x1ffc0000, 0x3ffc0000, 0x7e040000, 0x7c000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0x7c000000, 0x7e040000, 0x3ffc0000, 0x1ffc0000,
+    0x07f80000, 0x001f0000, 0x001f0000, 0x001f0000, 0x001f0000, 0x001f0000, 0x001f0000, 0x0f1f0000,
+    0x3fdf0000, 0x7fff0000, 0x7c3f0000, 0xfc3f0000, 0xf81f0000, 0xf81f0000, 0xf81f0000, 0xf81f0000,
+    0xf81f0000, 0xfc3f0000, 0x7c3f0000, 0x7fff0000, 0x3fdf0000, 0x0f9f0000, 0x07e00000, 0x1ff80000,
+    0x3ffc0000, 0x7c3e0000, 0xfc1e0000, 0xf81f0000, 0xffff0000, 0xffff0000, 0xffff0000, 0xf8000000,
+    0xfc000000, 0x7e060000, 0x3ffe0000, 0x1ffe0000, 0x07f80000, 0x07f00000, 0x1ff00000, 0x3ff00000,
+    0x3e000000, 0x3e000000, 0x3e000000, 0xffe00000, 0xffe00000, 0xffe00000, 0x3e000000, 0x3e000000,
+    0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000,
+    0x3e000000, 0x3e000000, 0x0f1f0000, 0x3fdf0000, 0x7fff0000, 0x7c3f0000, 0xfc3f0000, 0xf81f0000,
+    0xf81f0000, 0xf81f0000, 0xf81f0000, 0xf81f0000, 0xfc3f0000, 0x7c3f0000, 0x7fff0000, 0x3fdf0000,
+    0x0f9f0000, 0x001f0000, 0x003e0000, 0x207e0000, 0x3ffc0000, 0x3ff80000, 0x1fe00000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8f00000, 0xfbfc0000, 0xfffc0000,
+    0xfc7e0000, 0xfc3e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000,
+    0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0x00000000, 0x00000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x00000000, 0x00000000, 0x1f000000,
+    0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000,
+    0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000, 0x1f000000,
+    0x3f000000, 0xfe000000, 0xfc000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf83e0000, 0xf87c0000, 0xf8f80000, 0xf9f00000, 0xfbe00000, 0xffc00000,
+    0xff800000, 0xff800000, 0xffc00000, 0xfbe00000, 0xf9f00000, 0xf8f80000, 0xf87c0000, 0xf83e0000,
+    0xf81f8000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8f07c00, 0xfbf8ff00,
+    0xfffdff00, 0xfc7f1f80, 0xfc3f0f80, 0xf83e0f80, 0xf83e0f80, 0xf83e0f80, 0xf83e0f80, 0xf83e0f80,
+    0xf83e0f80, 0xf83e0f80, 0xf83e0f80, 0xf83e0f80, 0xf83e0f80, 0xf8f00000, 0xfbfc0000, 0xfffc0000,
+    0xfc7e0000, 0xfc3e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000,
+    0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0x07f00000, 0x1ffc0000, 0x3ffe0000, 0x7e3f0000,
+    0xfc1f0000, 0xf80f8000, 0xf80f8000, 0xf80f8000, 0xf80f8000, 0xf80f8000, 0x7c1f0000, 0x7e3f0000,
+    0x3ffe0000, 0x1ffc0000, 0x07f00000, 0xf8f00000, 0xfbfc0000, 0xfffe0000, 0xfc3e0000, 0xfc3f0000,
+    0xf81f0000, 0xf81f0000, 0xf81f0000, 0xf81f0000, 0xf81f0000, 0xfc3f0000, 0xfc3e0000, 0xfffe0000,
+    0xfbfc0000, 0xf9f00000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0x0f1f0000, 0x3fdf0000, 0x7fff0000, 0x7c3f0000, 0xfc3f0000, 0xf81f0000, 0xf81f0000, 0xf81f0000,
+    0xf81f0000, 0xf81f0000, 0xfc3f0000, 0x7c3f0000, 0x7fff0000, 0x3fdf0000, 0x0f9f0000, 0x001f0000,
+    0x001f0000, 0x001f0000, 0x001f0000, 0x001f0000, 0x001f0000, 0xf9e00000, 0xfbe00000, 0xffe00000,
+    0xffe00000, 0xfe200000, 0xfc000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000,
+    0xf8000000, 0xf8000000, 0xf8000000, 0xf8000000, 0x1fe00000, 0x7ff80000, 0xfff80000, 0xfc180000,
+    0xf8000000, 0xf8000000, 0xff000000, 0x7ff00000, 0x1ff80000, 0x00fc0000, 0x007c0000, 0xc0fc0000,
+    0xfff80000, 0xfff80000, 0x3fe00000, 0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000,
+    0xfff00000, 0xfff00000, 0xfff00000, 0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000,
+    0x3e000000, 0x3e000000, 0x3e000000, 0x3e000000, 0x3ff00000, 0x1ff00000, 0x0ff00000, 0xf83e0000,
+    0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000, 0xf83e0000,
+    0xf83e0000, 0xf87e0000, 0xfc7e0000, 0x7ffe0000, 0x7fbe0000, 0x1e3e0000, 0xfc1f8000, 0x7c1f0000,
+    0x7c1f0000, 0x7e3f0000, 0x3e3e0000, 0x3f7e0000, 0x1f7c0000, 0x1f7c0000, 0x1ffc0000, 0x0ff80000,
+    0x0ff80000, 0x0ff00000, 0x07f00000, 0x07f00000, 0x03e00000, 0xf83c1f00, 0xfc3c3f00, 0x7c7e3e00,
+    0x7c7e3e00, 0x7c7e3e00, 0x7e7e7e00, 0x3ee77c00, 0x3ee77c00, 0x3ee77c00, 0x1fe7f800, 0x1fc3f800,
+    0x1fc3f800, 0x1fc3f800, 0x0fc3f000, 0x0f81f000, 0xfe3f8000, 0x7e3f0000, 0x3f7e0000, 0x1ffc0000,
+    0x1ffc0000, 0x0ff80000, 0x07f00000, 0x03f00000, 0x07f00000, 0x0ff80000, 0x1ffc0000, 0x1ffc0000,
+    0x3f7e0000, 0x7e3f0000, 0xfe3f8000, 0xfc1f8000, 0x7c1f0000, 0x7c1f0000, 0x7e3f0000, 0x3e3e0000,
+    0x3f3e0000, 0x1f7e0000, 0x1ffc0000, 0x0ffc0000, 0x0ff80000, 0x0ff80000, 0x07f80000, 0x07f00000,
+    0x03f00000, 0x03f00000, 0x03e00000, 0x07e00000, 0x07c00000, 0x3fc00000, 0x3f800000, 0x3f000000,
+    0xfffc0000, 0xfffc0000, 0xfffc0000, 0x01fc0000, 0x03f80000, 0x07f00000, 0x07e00000, 0x0fc00000,
+    0x1fc00000, 0x3f800000, 0x7f000000, 0xfe000000, 0xfffc0000, 0xfffc0000, 0xfffc0000, 0x01f80000,
+    0x07f80000, 0x0ff80000, 0x0fc00000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000,
+    0x0f800000, 0x0f800000, 0x1f800000, 0xff000000, 0xfc000000, 0xff000000, 0x1f800000, 0x0f800000,
+    0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0fc00000, 0x0ff80000, 0x07f80000,
+    0x01f80000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000,
+    0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000,
+    0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000,
+    0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xe0000000, 0xfc000000, 0xff000000, 0xff000000,
+    0x1f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000, 0x0f800000,
+    0x0fc00000, 0x07f80000, 0x01f80000, 0x07f80000, 0x0fc00000, 0x0f800000, 0x0f800000, 0x0f800000,
+    0x0f800000, 0x0f800000, 0x0f800000, 0x1f800000, 0xff800000, 0xff000000, 0xfc000000, 0x1f004000,
+    0x7fe1c000, 0xffffc000, 0xe1ff8000, 0x803e0000,
+};
+
+} // namespace
+
+// ----------------------------- Rasterizer -----------------------------
+
+static const Glyph& GlyphFor(wchar_t c) {
+    if (c < 0x20 || c > 0x7E) c = L'?';
+    return kGlyphs[c - 0x20];
+}
+
+static inline float GlyphBit(const Glyph& g, int x, int y) {
+    if (x < 0 || y < 0 || x >= g.width || y >= g.rows) return 0.0f;
+    return (kGlyphRows[g.offset + y] >> (31 - x)) & 1u ? 1.0f : 0.0f;
+}
+
+// Bilinear reconstruction of the 1-bit glyph at glyph-local source coordinates.
+static inline float SampleGlyph(const Glyph& g, float sx, float sy) {
+    float fx = sx - 0.5f, fy = sy - 0.5f;
+    int x0 = (int)std::floor(fx), y0 = (int)std::floor(fy);
+    float tx = fx - (float)x0, ty = fy - (float)y0;
+    float top = GlyphBit(g, x0, y0)     * (1 - tx) + GlyphBit(g, x0 + 1, y0)     * tx;
+    float bot = GlyphBit(g, x0, y0 + 1) * (1 - tx) + GlyphBit(g, x0 + 1, y0 + 1) * tx;
+    return top * (1 - ty) + bot * ty;
+}
+
+static int Advance(const std::wstring& text) {
+    int w = 0;
+    for (wchar_t c : text) w += GlyphFor(c).advance;
+    return w;
+}
+
+void RasterizeBuiltinText(const std::wstring& text, float fontPx, uint32_t maxWidth, CoverageMask& out) {
+    const float scale = std::max(fontPx, 1.0f) / kSourceEm;
+
+    std::wstring line = text;
+    if ((float)Advance(line) * scale > (float)maxWidth) {
+        const std::wstring ellipsis = L"...";
+        while (!line.empty() && (float)(Advance(line) + Advance(ellipsis)) * scale > (float)maxWidth) {
+            line.pop_back();
+        }
+        line += ellipsis;
+        while (!line.empty() && (float)Advance(line) * scale > (float)maxWidth) line.pop_back();
+    }
+
+    out.width  = (uint32_t)std::ceil((float)Advance(line) * scale) + 1;
+    out.height = (uint32_t)std::ceil((float)kLineHeight * scale);
+    out.data.assign((size_t)out.width * out.height, 0);
+
+    const int kSub = 4;
+    float pen = 0;
+    for (wchar_t c : line) {
+        const Glyph& g = GlyphFor(c);
+        float gx = pen + g.left;          // glyph bitmap origin in source units
+        float gy = (float)(kAscent - g.top);
+        pen += g.advance;
+        if (g.width == 0 || g.rows == 0) continue;
+
+        int ox0 = std::max(0, (int)std::floor(gx * scale) - 1);
+        int oy0 = std::max(0, (int)std::floor(gy * scale) - 1);
+        int ox1 = std::min<int>((int)out.width,  (int)std::ceil((gx + g.width) * scale) + 1);
+        int oy1 = std::min<int>((int)out.height, (int)std::ceil((gy + g.rows)  * scale) + 1);
+
+        for (int oy = oy0; oy < oy1; ++oy) {
+            uint8_t* row = out.data.data() + (size_t)oy * out.width;
+            for (int ox = ox0; ox < ox1; ++ox) {
+                int hits = 0;
+                for (int sy = 0; sy < kSub; ++sy) {
+                    float srcY = ((float)oy + (sy + 0.5f) / kSub) / scale - gy;
+                    for (int sx = 0; sx < kSub; ++sx) {
+                        float srcX = ((float)ox + (sx + 0.5f) / kSub) / scale - gx;
+                        if (SampleGlyph(g, srcX, srcY) >= 0.5f) ++hits;
+                    }
+                }
+                uint8_t cov = (uint8_t)((hits * 255 + kSub * kSub / 2) / (kSub * kSub));
+                row[ox] = std::max(row[ox], cov);
+            }
+        }
+    }
+}
+
+} // namespace piclab
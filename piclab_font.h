@@ -0,0 +1,14 @@
+// piclab_font.h
+// Built-in bitmap font (DejaVu Sans Bold, 28 px em) so the core can render labels without an OS font stack.
+
+#pragma once
+
+#include "piclab_core.h"
+
+namespace piclab {
+
+// Rasterizes one line of printable ASCII (other characters become '?'), scaled to fontPx and
+// trimmed with "..." when wider than maxWidth. The mask height is the font's line height.
+void RasterizeBuiltinText(const std::wstring& text, float fontPx, uint32_t maxWidth, CoverageMask& out);
+
+} // namespace piclab
@@ -0,0 +1,262 @@
+// piclab_gdiplus.cpp
+// GDI+ backend (Windows only): decode anything GDI+ can read, encode PNG, and render labels with
+// Segoe UI / Arial. Compositing itself is done by the core on the decoded pixels.
+
+#include "piclab_core.h"
+#include "piclab_codecs.h"
+#include "piclab_io.h"
+#include "piclab_png.h"
+
+#define NOMINMAX
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <string>
+#include <utility>
+#include <windows.h>
+#include <gdiplus.h>
+#include <shlwapi.h>
+#include <vector>
+
+#pragma comment(lib, "gdiplus.lib")
+#pragma comment(lib, "shlwapi.lib")
+
+using namespace Gdiplus;
+
+namespace piclab {
+
+// GDI+ always decodes whole images; PNGs whose pixels would exceed this go through the streaming codec.
+const uint64_t kStreamAboveBytes = 256ull << 20;
+// GDI+'s PNG encoder runs on one thread; larger images use the portable encoder, which compresses
+// in parallel on the batch pool.
+const uint64_t kParallelEncodeAboveBytes = 16ull << 20;
+
+// GDI+'s encoder list, fetched once per process on first use (GDI+ must be started by then) and
+// never changed afterwards; callers look up by MIME type from the codec registry.
+static const std::vector<std::pair<std::wstring, CLSID>>& EncoderList() {
+    static const std::vector<std::pair<std::wstring, CLSID>> list = [] {
+        std::vector<std::pair<std::wstring, CLSID>> out;
+        UINT num = 0, size = 0;
+        GetImageEncodersSize(&num, &size);
+        if (size == 0) return out;
+        std::vector<BYTE> mem(size);
+        ImageCodecInfo* enc = reinterpret_cast<ImageCodecInfo*>(mem.data());
+        if (GetImageEncoders(num, size, enc) != Ok) return out;
+        for (UINT j = 0; j < num; ++j) out.push_back({ enc[j].MimeType, enc[j].Clsid });
+        return out;
+    }();
+    return list;
+}
+
+static bool GetEncoderClsid(ImageFormat format, CLSID* pClsid) {
+    const CodecInfo* codec = FindCodec(format);
+    if (!codec) return false;
+    for (const auto& e : EncoderList()) {
+        if (e.first == codec->mime) {
+            *pClsid = e.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Converts whatever GDI+ can read to RGB8 or RGBA8.
+static bool DecodeStream(IStream* stream, Image& out, std::wstring& outError) {
+    Bitmap* bmp = Bitmap::FromStream(stream, FALSE);
+    if (!bmp || bmp->GetLastStatus() != Ok) {
+        outError = L"Failed to load image. Is it a valid PNG?";
+        delete bmp;
+        return false;
+    }
+
+    UINT w = bmp->GetWidth(), h = bmp->GetHeight();
+    Rect r(0, 0, (INT)w, (INT)h);
+    BitmapData bd{};
+    if (bmp->LockBits(&r, ImageLockModeRead, PixelFormat32bppARGB, &bd) != Ok) {
+        outError = L"Failed to read image pixels.";
+        delete bmp;
+        return false;
+    }
+
+    out.width = w;
+    out.height = h;
+    out.channels = IsAlphaPixelFormat(bmp->GetPixelFormat()) ? 4 : 3;
+    out.pixels.resize(out.Stride() * h);
+    for (UINT y = 0; y < h; ++y) {
+        const BYTE* src = static_cast<const BYTE*>(bd.Scan0) + (size_t)y * bd.Stride;
+        uint8_t* dst = out.Row(y);
+        for (UINT x = 0; x < w; ++x, src += 4, dst += out.channels) {
+            dst[0] = src[2]; dst[1] = src[1]; dst[2] = src[0];
+            if (out.channels == 4) dst[3] = src[3];
+        }
+    }
+    bmp->UnlockBits(&bd);
+    delete bmp;
+    return true;
+}
+
+class GdiplusBackend : public Backend {
+public:
+    ~GdiplusBackend() override {
+        if (token_) GdiplusShutdown(token_);
+    }
+
+    bool Start(std::wstring& outError) {
+        GdiplusStartupInput gsi;
+        if (GdiplusStartup(&token_, &gsi, nullptr) != Ok) {
+            token_ = 0;
+            outError = L"GDI+ startup failed.";
+            return false;
+        }
+        // The encoder list is enumerated once per process, not once per saved image.
+        if (!GetEncoderClsid(ImageFormat::kPng, &pngClsid_)) {
+            outError = L"PNG encoder not found (GDI+).";
+            return false;
+        }
+        // Installed fonts do not change under a running labeler; ask once instead of per label.
+        FontFamily segoe(L"Segoe UI");
+        fontFamily_ = segoe.IsAvailable() ? L"Segoe UI" : L"Arial";
+        return true;
+    }
+
+    const wchar_t* Name() const override { return L"gdiplus"; }
+
+    bool Decode(const std::wstring& path, Image& out, std::wstring& outError) override {
+        // The file is read once and closed before GDI+ sees it; GDI+ decodes from a memory stream,
+        // so nothing keeps the original locked while it is labeled and replaced.
+        IStream* stream = nullptr;
+        {
+            MappedFile file;
+            if (!file.Open(path, outError)) return false;
+            // Formats GDI+ does not know (QOI, PAM) are read by the portable codecs.
+            const CodecInfo* codec = FindCodec(DetectFormat(file.Data(), file.Size()));
+            if (codec && codec->decode && codec->format != ImageFormat::kPng && codec->format != ImageFormat::kJpeg) {
+                return codec->decode(file.Data(), file.Size(), out, outError);
+            }
+            if (file.Size() > UINT_MAX) {
+                outError = L"Image file is too large for GDI+.";
+                return false;
+            }
+            stream = SHCreateMemStream(file.Data(), (UINT)file.Size());
+        }
+        if (!stream) {
+            outError = L"Out of memory.";
+            return false;
+        }
+        bool ok = DecodeStream(stream, out, outError);
+        stream->Release();
+        return ok;
+    }
+
+    bool Encode(const Image& img, const std::wstring& path, const CompressOptions& compress,
+                std::wstring& outError) override {
+        // GDI+ has no compression settings, so anything but the default goes to the portable encoder.
+        if (img.pixels.size() > kParallelEncodeAboveBytes || !compress.IsDefault()) {
+            return EncodePng(img, path, compress, outError);
+        }
+        PixelFormat fmt = img.channels == 4 ? PixelFormat32bppARGB : PixelFormat24bppRGB;
+        Bitmap bmp((INT)img.width, (INT)img.height, fmt);
+        Rect r(0, 0, (INT)img.width, (INT)img.height);
+        BitmapData bd{};
+        if (bmp.LockBits(&r, ImageLockModeWrite, fmt, &bd) != Ok) {
+            outError = L"Failed to allocate output bitmap.";
+            return false;
+        }
+        const UINT outPx = img.channels == 4 ? 4 : 3;
+        for (UINT y = 0; y < img.height; ++y) {
+            const uint8_t* src = img.Row(y);
+            BYTE* dst = static_cast<BYTE*>(bd.Scan0) + (size_t)y * bd.Stride;
+            for (UINT x = 0; x < img.width; ++x, src += img.channels, dst += outPx) {
+                dst[0] = src[2]; dst[1] = src[1]; dst[2] = src[0];
+                if (outPx == 4) dst[3] = src[3];
+            }
+        }
+        bmp.UnlockBits(&bd);
+
+        Status s = bmp.Save(path.c_str(), &pngClsid_, nullptr);
+        if (s != Ok) {
+            outError = L"status " + std::to_wstring(s);
+            return false;
+        }
+        return true;
+    }
+
+    std::unique_ptr<RowReader> OpenRowReader(const std::wstring& path, std::wstring& outError) override {
+        std::vector<uint8_t> head;
+        uint32_t w = 0, h = 0;
+        if (!ReadFileHead(path, 32, head) || !ReadPngSize(head.data(), head.size(), w, h)) return nullptr;
+        if ((uint64_t)w * h * 4 <= kStreamAboveBytes) return nullptr;
+        return OpenPngRowReader(path, outError);
+    }
+
+    std::unique_ptr<RowWriter> CreateRowWriter(const std::wstring& path, uint32_t width, uint32_t height,
+                                               uint32_t channels, const CompressOptions& compress,
+                                               std::wstring& outError) override {
+        return CreatePngRowWriter(path, width, height, channels, compress, outError);
+    }
+
+    std::unique_ptr<RowWriter> CreateSpliceWriter(RowReader& src, uint32_t keepRows, const std::wstring& path,
+                                                  const CompressOptions& compress, std::wstring& outError) override {
+        return CreatePngSpliceWriter(src, keepRows, path, compress, outError);
+    }
+
+    bool RasterizeText(const std::wstring& text, float fontPx, uint32_t maxWidth,
+                       CoverageMask& out, std::wstring& outError) override {
+        Font font(fontFamily_, (REAL)fontPx, FontStyleBold, UnitPixel);
+
+        StringFormat sf(StringFormatFlagsNoClip);
+        sf.SetAlignment(StringAlignmentNear);
+        sf.SetLineAlignment(StringAlignmentNear);
+        sf.SetTrimming(StringTrimmingEllipsisCharacter);
+
+        RectF bounds{};
+        {
+            Bitmap probe(1, 1, PixelFormat32bppARGB);
+            Graphics mg(&probe);
+            RectF layoutRect(0, 0, (REAL)maxWidth, 1000);
+            mg.MeasureString(text.c_str(), (INT)text.size(), &font, layoutRect, &sf, &bounds);
+        }
+        UINT mw = std::min<UINT>(maxWidth, std::max<UINT>(1, (UINT)std::ceil(bounds.Width)));
+        UINT mh = std::max<UINT>(1, (UINT)std::ceil(bounds.Height));
+
+        // Coverage comes from the alpha channel, so grayscale AA rather than ClearType.
+        Bitmap canvas((INT)mw, (INT)mh, PixelFormat32bppARGB);
+        {
+            Graphics g(&canvas);
+            g.Clear(Color(0, 0, 0, 0));
+            g.SetTextRenderingHint(TextRenderingHintAntiAliasGridFit);
+            SolidBrush white(Color(255, 255, 255, 255));
+            RectF textRect(0, 0, (REAL)mw, (REAL)mh);
+            g.DrawString(text.c_str(), (INT)text.size(), &font, textRect, &sf, &white);
+        }
+
+        Rect r(0, 0, (INT)mw, (INT)mh);
+        BitmapData bd{};
+        if (canvas.LockBits(&r, ImageLockModeRead, PixelFormat32bppARGB, &bd) != Ok) {
+            outError = L"Failed to rasterize label.";
+            return false;
+        }
+        out.width = mw;
+        out.height = mh;
+        out.data.resize((size_t)mw * mh);
+        for (UINT y = 0; y < mh; ++y) {
+            const BYTE* src = static_cast<const BYTE*>(bd.Scan0) + (size_t)y * bd.Stride;
+            for (UINT x = 0; x < mw; ++x) out.data[(size_t)y * mw + x] = src[4 * x + 3];
+        }
+        canvas.UnlockBits(&bd);
+        return true;
+    }
+
+private:
+    ULONG_PTR token_{};
+    CLSID pngClsid_{};
+    const WCHAR* fontFamily_{L"Arial"};
+};
+
+std::unique_ptr<Backend> CreateGdiplusBackend(std::wstring& outError) {
+    std::unique_ptr<GdiplusBackend> be(new GdiplusBackend());
+    if (!be->Start(outError)) return nullptr;
+    return std::unique_ptr<Backend>(be.release());
+}
+
+} // namespace piclab
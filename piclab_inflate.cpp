@@ -0,0 +1,639 @@
+// piclab_inflate.cpp
+// Parallel inflate. The decoder here is a plain table-driven inflate with two output modes: 16-bit
+// symbols, where 256 + i stands for byte i of the unknown window before the piece, and bytes.
+// A speculative piece switches to bytes once 32 KB have gone by without a marker, since no later
+// back-reference can reach one; in practice only the first few kilobytes of a piece are 16-bit.
+
+#include "piclab_inflate.h"
+#include "piclab_checksum.h"
+#include "piclab_pool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace piclab {
+
+static const size_t kWindow = 32768;
+static const size_t kPieceBytes = (size_t)1 << 20; // compressed bytes per piece
+static const unsigned kFastBits = 10;
+
+// ----------------------------- Source -----------------------------
+
+void DeflateSource::Add(size_t offset, uint32_t len) {
+    if (!len) return;
+    segments_.push_back({ offset, len });
+    starts_.push_back(size_);
+    size_ += len;
+}
+
+size_t DeflateSource::Read(uint64_t pos, uint8_t* dst, size_t n) const {
+    if (pos >= size_) return 0;
+    size_t s = (size_t)(std::upper_bound(starts_.begin(), starts_.end(), pos) - starts_.begin()) - 1;
+    size_t done = 0;
+    for (; s < segments_.size() && done < n; ++s) {
+        uint64_t skip = pos + done - starts_[s];
+        size_t k = (size_t)std::min<uint64_t>(segments_[s].second - skip, n - done);
+        memcpy(dst + done, base_ + segments_[s].first + skip, k);
+        done += k;
+    }
+    return done;
+}
+
+// ----------------------------- Bits -----------------------------
+
+namespace {
+
+// LSB-first bit reader over a DeflateSource, refilled 64 KB at a time. Reads past the end return
+// zero bits; Overrun() tells whether any of them were consumed.
+class BitReader {
+public:
+    explicit BitReader(const DeflateSource& src) : src_(src), buf_(1 << 16) {}
+
+    void Seek(uint64_t bit) {
+        if (bit / 8 >= bufStart_ && bit / 8 < bufStart_ + len_) {
+            next_ = (size_t)(bit / 8 - bufStart_);
+        } else {
+            bufStart_ = bit / 8;
+            len_ = src_.Read(bufStart_, buf_.data(), buf_.size());
+            next_ = 0;
+        }
+        bits_ = 0;
+        count_ = 0;
+        padBits_ = 0;
+        Fill();
+        Drop((unsigned)(bit & 7));
+    }
+
+    uint64_t Tell() const { return (bufStart_ + next_) * 8 + padBits_ - count_; }
+    bool Overrun() const { return Tell() > src_.Size() * 8; }
+    // Cheap per-symbol test that decoding has run well into the zero padding.
+    bool PastEnd() const { return padBits_ > 128; }
+
+    // At least 56 bits buffered afterwards.
+    void Fill() {
+        if (len_ - next_ >= 8) {
+            uint64_t v;
+            memcpy(&v, buf_.data() + next_, 8); // little-endian load; the extra bytes are loaded again later
+            bits_ |= v << count_;
+            next_ += (63 - count_) >> 3;
+            count_ |= 56;
+            return;
+        }
+        while (count_ <= 56) {
+            if (next_ == len_) {
+                bufStart_ += len_;
+                len_ = src_.Read(bufStart_, buf_.data(), buf_.size());
+                next_ = 0;
+                if (len_ == 0) {
+                    padBits_ += 8;
+                    count_ += 8;
+                    continue;
+                }
+                if (len_ >= 8) {
+                    Fill();
+                    return;
+                }
+            }
+            bits_ |= (uint64_t)buf_[next_++] << count_;
+            count_ += 8;
+        }
+    }
+
+    // Copies n whole bytes; the reader must be on a byte boundary.
+    void ReadBytes(uint8_t* dst, size_t n) {
+        size_t k = 0;
+        while (k < n && count_ >= 8) dst[k++] = (uint8_t)Take(8);
+        if (k == n) return;
+        const uint64_t pos = Tell() / 8;
+        size_t got = src_.Read(pos, dst + k, n - k);
+        if (got < n - k) memset(dst + k + got, 0, n - k - got);
+        Seek((pos + n - k) * 8);
+    }
+
+    uint32_t Peek(unsigned n) const { return (uint32_t)(bits_ & ((1ull << n) - 1)); }
+    void Drop(unsigned n) {
+        bits_ >>= n;
+        count_ -= n;
+    }
+    uint32_t Take(unsigned n) {
+        uint32_t v = Peek(n);
+        Drop(n);
+        return v;
+    }
+
+private:
+    const DeflateSource& src_;
+    std::vector<uint8_t> buf_;
+    uint64_t bufStart_{0}; // stream offset of buf_[0]
+    size_t len_{0};
+    size_t next_{0};
+    uint64_t bits_{0};
+    unsigned count_{0};
+    uint64_t padBits_{0};
+};
+
+// ----------------------------- Huffman -----------------------------
+
+struct Huffman {
+    uint16_t fast[1 << kFastBits]; // (length << 9) | symbol; 0 = longer code, decoded bit by bit
+    uint16_t count[16];
+    uint16_t symbol[320];
+
+    // Accepts complete codes, a single one-bit code and (for distances) no codes at all.
+    bool Build(const uint8_t* lengths, unsigned n) {
+        memset(count, 0, sizeof(count));
+        for (unsigned i = 0; i < n; ++i) ++count[lengths[i]];
+        count[0] = 0;
+        unsigned codes = n;
+        for (unsigned i = 0; i < n; ++i) codes -= lengths[i] == 0;
+        int left = 1;
+        for (int len = 1; len < 16; ++len) {
+            left = (left << 1) - count[len];
+            if (left < 0) return false;
+        }
+        if (left != 0 && codes > 1) return false;
+
+        uint16_t offs[16];
+        offs[1] = 0;
+        for (int len = 1; len < 15; ++len) offs[len + 1] = (uint16_t)(offs[len] + count[len]);
+        for (unsigned i = 0; i < n; ++i) {
+            if (lengths[i]) symbol[offs[lengths[i]]++] = (uint16_t)i;
+        }
+
+        memset(fast, 0, sizeof(fast));
+        unsigned code = 0, index = 0;
+        for (unsigned len = 1; len <= kFastBits; ++len) {
+            for (unsigned k = 0; k < count[len]; ++k, ++code, ++index) {
+                unsigned rev = 0;
+                for (unsigned b = 0; b < len; ++b) rev |= ((code >> b) & 1) << (len - 1 - b);
+                for (unsigned j = rev; j < (1u << kFastBits); j += 1u << len) {
+                    fast[j] = (uint16_t)((len << 9) | symbol[index]);
+                }
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    // Canonical decode one bit at a time, for codes longer than kFastBits.
+    int DecodeSlow(BitReader& br) const {
+        uint32_t bits = br.Peek(15);
+        int code = 0, first = 0, index = 0;
+        for (unsigned len = 1; len < 16; ++len) {
+            code |= (int)((bits >> (len - 1)) & 1);
+            int n = count[len];
+            if (code - n < first) {
+                br.Drop(len);
+                return symbol[index + (code - first)];
+            }
+            index += n;
+            first = (first + n) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    int Decode(BitReader& br) const {
+        uint16_t e = fast[br.Peek(kFastBits)];
+        if (e) {
+            br.Drop(e >> 9);
+            return e & 511;
+        }
+        return DecodeSlow(br);
+    }
+};
+
+const uint16_t kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                   35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                   3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t kDistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                 8193, 12289, 16385, 24577 };
+const uint8_t kDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+struct FixedCodes {
+    Huffman lit, dist;
+    FixedCodes() {
+        uint8_t l[288];
+        for (int i = 0; i < 288; ++i) l[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        lit.Build(l, 288);
+        uint8_t d[32]; // 30 and 31 complete the code but are invalid
+        memset(d, 5, sizeof(d));
+        dist.Build(d, 32);
+    }
+};
+
+const FixedCodes& Fixed() {
+    static const FixedCodes codes;
+    return codes;
+}
+
+// Reads a dynamic block's code lengths and builds its codes. This is also the test for whether a
+// bit position could be the start of a block, so everything zlib would reject is rejected.
+bool ReadDynamicCodes(BitReader& br, Huffman& lit, Huffman& dist) {
+    static const uint8_t kOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    br.Fill();
+    unsigned nlit = br.Take(5) + 257, ndist = br.Take(5) + 1, nclen = br.Take(4) + 4;
+    if (nlit > 286 || ndist > 30) return false;
+    uint8_t lengths[320] = {};
+    for (unsigned i = 0; i < nclen; ++i) {
+        if (i % 8 == 0) br.Fill();
+        lengths[kOrder[i]] = (uint8_t)br.Take(3);
+    }
+    Huffman clc;
+    unsigned clcCodes = 0;
+    for (int i = 0; i < 19; ++i) clcCodes += lengths[i] != 0;
+    if (!clc.Build(lengths, 19) || clcCodes < 2) return false;
+
+    memset(lengths, 0, sizeof(lengths));
+    for (unsigned i = 0; i < nlit + ndist;) {
+        br.Fill();
+        int sym = clc.Decode(br);
+        if (sym < 0) return false;
+        if (sym < 16) {
+            lengths[i++] = (uint8_t)sym;
+            continue;
+        }
+        uint8_t value = 0;
+        unsigned repeat;
+        if (sym == 16) {
+            if (i == 0) return false;
+            value = lengths[i - 1];
+            repeat = 3 + br.Take(2);
+        } else if (sym == 17) {
+            repeat = 3 + br.Take(3);
+        } else {
+            repeat = 11 + br.Take(7);
+        }
+        if (i + repeat > nlit + ndist) return false;
+        while (repeat--) lengths[i++] = value;
+    }
+    if (lengths[256] == 0) return false;
+    return lit.Build(lengths, nlit) && dist.Build(lengths + nlit, ndist);
+}
+
+// ----------------------------- Blocks -----------------------------
+
+enum class BlockEnd { kOk, kError };
+
+// Output of one decode run: head holds 16-bit symbols with window markers, body plain bytes.
+// body starts with bodySkip bytes of known window that are not part of the output.
+struct PieceOutput {
+    std::vector<uint16_t> head;
+    size_t headLen{0};
+    std::vector<uint8_t> body;
+    size_t bodyLen{0};
+    size_t bodySkip{0};
+    size_t lastMarker{0}; // head position just past the newest marker
+    bool markers{false};  // still writing head
+    uLong bodyAdler{1};   // Adler-32 of the body output, computed by the worker
+
+    size_t Size() const { return headLen + bodyLen - bodySkip; }
+};
+
+template <typename T>
+static inline void Reserve(std::vector<T>& v, size_t len, size_t more) {
+    if (v.size() - len < more) v.resize(std::max(v.size() * 2, len + more + 65536));
+}
+
+// One Huffman-coded block into T output. Back-references before the start of out become markers
+// when T is 16-bit and are errors otherwise.
+template <typename T>
+static bool DecodeHuffman(BitReader& br, const Huffman& lit, const Huffman& dist,
+                          std::vector<T>& out, size_t& len, size_t& lastMarker) {
+    for (;;) {
+        br.Fill();
+        if (br.PastEnd()) return false;
+        int sym = lit.Decode(br);
+        if (sym < 256) {
+            if (sym < 0) return false;
+            Reserve(out, len, 1);
+            out[len++] = (T)sym;
+            continue;
+        }
+        if (sym == 256) return true;
+        sym -= 257;
+        if (sym >= 29) return false;
+        size_t length = kLengthBase[sym] + br.Take(kLengthExtra[sym]);
+        int ds = dist.Decode(br);
+        if (ds < 0 || ds >= 30) return false;
+        size_t distance = kDistBase[ds] + br.Take(kDistExtra[ds]);
+
+        Reserve(out, len, length + 16);
+        T* dst = out.data() + len;
+        if (distance <= len) {
+            const T* src = dst - distance;
+            if (distance >= 16 / sizeof(T)) {
+                // 16-byte steps may overshoot by up to 15 bytes, which Reserve left room for
+                for (size_t k = 0; k < length; k += 16 / sizeof(T)) memcpy(dst + k, src + k, 16);
+            } else if (distance == 1 && sizeof(T) == 1) {
+                memset(dst, (int)src[0], length);
+            } else {
+                for (size_t k = 0; k < length; ++k) dst[k] = src[k];
+            }
+            if (sizeof(T) == 2 && lastMarker + distance > len) {
+                for (size_t k = 0; k < length; ++k) {
+                    if (dst[k] >= 256) lastMarker = len + k + 1;
+                }
+            }
+        } else {
+            if (sizeof(T) == 1 || distance - len > kWindow) return false;
+            for (size_t k = 0; k < length; ++k) {
+                size_t at = len + k;
+                dst[k] = at >= distance ? out[at - distance] : (T)(256 + kWindow + at - distance);
+                if (dst[k] >= 256) lastMarker = at + 1;
+            }
+        }
+        len += length;
+    }
+}
+
+template <typename T>
+static bool DecodeStored(BitReader& br, std::vector<T>& out, size_t& len) {
+    br.Drop((unsigned)((8 - br.Tell() % 8) % 8));
+    br.Fill();
+    uint32_t n = br.Take(16), nn = br.Take(16);
+    if (n != (~nn & 0xFFFF)) return false;
+    Reserve(out, len, n);
+    if (sizeof(T) == 1) {
+        br.ReadBytes(reinterpret_cast<uint8_t*>(out.data() + len), n);
+    } else {
+        std::vector<uint8_t> bytes(n);
+        br.ReadBytes(bytes.data(), n);
+        std::copy(bytes.begin(), bytes.end(), out.begin() + len);
+    }
+    len += n;
+    return true;
+}
+
+// Moves a marker-free head over to byte output: its last 32 KB become the start of body.
+static void SwitchToBytes(PieceOutput& o) {
+    size_t keep = std::min(o.headLen, kWindow);
+    o.body.resize(std::max<size_t>(keep + 65536, kPieceBytes * 4));
+    for (size_t k = 0; k < keep; ++k) o.body[k] = (uint8_t)o.head[o.headLen - keep + k];
+    o.bodyLen = keep;
+    o.bodySkip = 0;
+    o.headLen -= keep;
+    o.markers = false;
+}
+
+struct PieceResult {
+    bool ok{false};
+    bool final{false};
+    bool truncated{false}; // failed by running out of input
+    uint64_t startBit{0};
+    uint64_t endBit{0};
+    PieceOutput out;
+    std::vector<std::pair<uint64_t, size_t>> blocks;
+};
+
+// Decodes whole blocks from the reader's position until the final block or the first block boundary
+// at or past stopBit.
+static bool DecodeBlocks(BitReader& br, uint64_t stopBit, PieceResult& r) {
+    PieceOutput& o = r.out;
+    r.startBit = br.Tell();
+    Huffman lit, dist;
+    for (;;) {
+        r.blocks.push_back({ br.Tell(), o.Size() });
+        br.Fill();
+        bool last = br.Take(1) != 0;
+        unsigned type = br.Take(2);
+        bool ok;
+        if (type == 0) {
+            ok = o.markers ? DecodeStored(br, o.head, o.headLen) : DecodeStored(br, o.body, o.bodyLen);
+        } else if (type == 1 || type == 2) {
+            const Huffman* l = &Fixed().lit;
+            const Huffman* d = &Fixed().dist;
+            if (type == 2) {
+                if (!ReadDynamicCodes(br, lit, dist)) return false;
+                l = &lit;
+                d = &dist;
+            }
+            ok = o.markers ? DecodeHuffman(br, *l, *d, o.head, o.headLen, o.lastMarker)
+                           : DecodeHuffman(br, *l, *d, o.body, o.bodyLen, o.lastMarker);
+        } else {
+            return false;
+        }
+        if (!ok || br.Overrun()) return false;
+        if (last) {
+            r.final = true;
+            break;
+        }
+        if (br.Tell() >= stopBit) break;
+        if (o.markers && o.headLen >= o.lastMarker + kWindow) SwitchToBytes(o);
+    }
+    r.endBit = br.Tell();
+    o.bodyAdler = Adler32(1, o.body.data() + o.bodySkip, o.bodyLen - o.bodySkip);
+    r.ok = true;
+    return true;
+}
+
+// Known window: decode straight to bytes.
+static bool DecodeFrom(const DeflateSource& src, uint64_t bit, uint64_t stopBit,
+                       const std::vector<uint8_t>& window, PieceResult& r) {
+    BitReader br(src);
+    br.Seek(bit);
+    r.out.body.resize(window.size() + kPieceBytes * 4);
+    std::copy(window.begin(), window.end(), r.out.body.begin());
+    r.out.bodyLen = r.out.bodySkip = window.size();
+    if (DecodeBlocks(br, stopBit, r)) return true;
+    r.truncated = br.Overrun();
+    return false;
+}
+
+// Unknown window: try every bit of [fromBit, toBit) that passes for a block header until one decodes
+// cleanly up to stopBit. Only stored and dynamic blocks are looked for; encoders use fixed codes for
+// tiny blocks only, and a piece that finds nothing is decoded again in order anyway.
+static bool DecodeSpeculative(const DeflateSource& src, uint64_t fromBit, uint64_t toBit, uint64_t stopBit,
+                              PieceResult& r) {
+    BitReader br(src);
+    Huffman lit, dist;
+    r.out.head.resize(kPieceBytes * 4);
+    for (uint64_t bit = fromBit; bit < toBit; ++bit) {
+        br.Seek(bit);
+        unsigned type = br.Peek(3) >> 1;
+        if (type == 2) {
+            br.Drop(3);
+            if (!ReadDynamicCodes(br, lit, dist)) continue;
+        } else if (type == 0) {
+            br.Drop(3);
+            br.Drop((unsigned)((8 - br.Tell() % 8) % 8));
+            uint32_t v = br.Peek(32);
+            if ((v & 0xFFFF) != (~v >> 16)) continue;
+        } else {
+            continue;
+        }
+        // Keep the buffers of the last failed candidate; most of them fail within a few symbols.
+        r.blocks.clear();
+        r.out.headLen = r.out.bodyLen = r.out.bodySkip = r.out.lastMarker = 0;
+        r.out.markers = true;
+        r.ok = r.final = false;
+        br.Seek(bit);
+        if (!DecodeBlocks(br, stopBit, r)) continue;
+        // Only the Adler-32 follows a final block. A bit or more before a stored header, a data bit
+        // read as BFINAL 1 and the header byte read as part of LEN can still pass for one block.
+        if (!r.final || (r.endBit + 7) / 8 + 4 >= src.Size()) return true;
+    }
+    r = PieceResult();
+    return false;
+}
+
+// Whether a piece decoded from bit found holds the same first block as one decoded from expected.
+// The bit just before a stored block's header that does not start a byte reads as a stored header
+// too (the data bit before it, then BFINAL 0 and BTYPE's low 0), and being earlier it is the
+// candidate DecodeSpeculative finds. Both pad to the same byte, so when they agree on BFINAL they
+// read the same LEN and decode the same block.
+static bool SameStoredStart(const DeflateSource& src, uint64_t found, uint64_t expected) {
+    if ((found + 3 + 7) / 8 != (expected + 3 + 7) / 8) return false;
+    BitReader br(src);
+    br.Seek(found);
+    const unsigned a = br.Peek(3);
+    br.Seek(expected);
+    const unsigned b = br.Peek(3);
+    return (a >> 1) == 0 && a == b;
+}
+
+} // namespace
+
+struct InflateJob {
+    uint64_t index{0};
+    PieceResult result;
+    TaskGroup group;
+};
+
+// ----------------------------- Inflater -----------------------------
+
+ParallelInflater::ParallelInflater(const DeflateSource& src, WorkPool& pool) : src_(src), pool_(pool) {
+    lookahead_ = std::max(1u, std::min(pool.Size(), 16u));
+}
+
+ParallelInflater::~ParallelInflater() {
+    for (const std::shared_ptr<InflateJob>& job : jobs_) pool_.Wait(job->group);
+    for (const std::shared_ptr<InflateJob>& job : skipped_) pool_.Wait(job->group);
+}
+
+void ParallelInflater::SubmitAhead() {
+    while (jobs_.size() < lookahead_ && nextPiece_ * kPieceBytes < src_.Size()) {
+        std::shared_ptr<InflateJob> job = std::make_shared<InflateJob>();
+        job->index = nextPiece_++;
+        const DeflateSource& src = src_;
+        pool_.Submit([job, &src] {
+            const uint64_t from = job->index * kPieceBytes * 8;
+            const uint64_t stop = from + kPieceBytes * 8;
+            if (job->index == 0) {
+                DecodeFrom(src, 16, stop, std::vector<uint8_t>(), job->result);
+            } else {
+                DecodeSpeculative(src, from, std::min(stop, src.Size() * 8), stop, job->result);
+            }
+        }, kPieceBytes, &job->group);
+        jobs_.push_back(job);
+    }
+}
+
+bool ParallelInflater::Next(InflatedPiece& out, std::wstring& outError) {
+    if (done_) {
+        outError = L"Read past the end of the compressed data.";
+        return false;
+    }
+    if (!started_) {
+        uint8_t hdr[2];
+        if (src_.Read(0, hdr, 2) != 2) {
+            outError = L"PNG image data is truncated.";
+            return false;
+        }
+        if ((hdr[0] & 0x0F) != 8 || (hdr[0] >> 4) > 7 || ((hdr[0] << 8) | hdr[1]) % 31 || (hdr[1] & 0x20)) {
+            outError = L"PNG image data is corrupt.";
+            return false;
+        }
+        started_ = true;
+    }
+
+    // The piece whose range holds expectBit_ stops at the first boundary past that range. A block
+    // longer than a piece skips pieces; their jobs are dropped and never submitted.
+    const uint64_t piece = expectBit_ / 8 / kPieceBytes;
+    nextPiece_ = std::max(nextPiece_, piece);
+    SubmitAhead();
+    std::shared_ptr<InflateJob> job;
+    while (!jobs_.empty() && jobs_.front()->index <= piece) {
+        if (job) skipped_.push_back(job);
+        job = jobs_.front();
+        jobs_.pop_front();
+    }
+    if (job && job->index != piece) skipped_.push_back(job);
+    skipped_.erase(std::remove_if(skipped_.begin(), skipped_.end(),
+                                  [](const std::shared_ptr<InflateJob>& j) { return j->group.Pending() == 0; }),
+                   skipped_.end());
+    SubmitAhead();
+    PieceResult redo;
+    PieceResult* r = nullptr;
+    if (job && job->index == piece) {
+        pool_.Wait(job->group);
+        PieceResult& spec = job->result;
+        if (spec.ok && spec.startBit != expectBit_ && SameStoredStart(src_, spec.startBit, expectBit_)) {
+            spec.startBit = spec.blocks.front().first = expectBit_;
+        }
+        if (spec.ok && spec.startBit == expectBit_) r = &spec;
+    }
+    if (!r) {
+        if (!DecodeFrom(src_, expectBit_, (piece + 1) * kPieceBytes * 8, window_, redo)) {
+            outError = redo.truncated ? L"PNG image data is truncated." : L"PNG image data is corrupt.";
+            return false;
+        }
+        r = &redo;
+        ++redecoded_;
+    }
+
+    // Fill in the window markers and join head and body.
+    PieceOutput& o = r->out;
+    out.data.resize(o.Size());
+    const size_t missing = kWindow - window_.size(); // the stream has not produced 32 KB yet
+    for (size_t k = 0; k < o.headLen; ++k) {
+        uint16_t v = o.head[k];
+        if (v >= 256) {
+            if (v - 256u < missing) {
+                outError = L"PNG image data is corrupt.";
+                return false;
+            }
+            v = window_[v - 256 - missing];
+        }
+        out.data[k] = (uint8_t)v;
+    }
+    if (o.bodyLen > o.bodySkip) memcpy(out.data.data() + o.headLen, o.body.data() + o.bodySkip, o.bodyLen - o.bodySkip);
+
+    out.startBit = r->startBit;
+    out.blocks = std::move(r->blocks);
+    out.adlerBefore = adler_;
+    out.last = r->final;
+    adler_ = (uint32_t)adler32_combine(Adler32(adler_, out.data.data(), o.headLen), o.bodyAdler,
+                                       (z_off_t)(o.bodyLen - o.bodySkip));
+    total_ += out.data.size();
+    expectBit_ = r->endBit;
+
+    const size_t n = out.data.size();
+    if (n >= kWindow) {
+        window_.assign(out.data.end() - kWindow, out.data.end());
+    } else {
+        window_.insert(window_.end(), out.data.begin(), out.data.end());
+        if (window_.size() > kWindow) window_.erase(window_.begin(), window_.end() - kWindow);
+    }
+
+    if (r->final) {
+        done_ = true;
+        uint8_t trailer[4];
+        if (src_.Read((expectBit_ + 7) / 8, trailer, 4) != 4) {
+            outError = L"PNG image data is truncated.";
+            return false;
+        }
+        uint32_t check = ((uint32_t)trailer[0] << 24) | ((uint32_t)trailer[1] << 16) | ((uint32_t)trailer[2] << 8) | trailer[3];
+        if (check != adler_) {
+            outError = L"PNG image data is corrupt.";
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace piclab
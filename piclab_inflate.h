@@ -0,0 +1,88 @@
+// piclab_inflate.h
+// Speculative parallel inflate for very large zlib streams, in the style of rapidgzip.
+//
+// The compressed stream is cut into fixed-size pieces. A pool worker decodes each piece from the
+// first bit in it that parses as the start of a deflate block; back-references into the unknown
+// 32 KB before that point are written as markers. Pieces are then taken in order: a piece is used
+// when it starts exactly where its predecessor stopped, with the markers filled in from the
+// predecessor's last 32 KB, and is decoded again from the right bit otherwise.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace piclab {
+
+class WorkPool;
+
+// Streams of this many compressed bytes or more are worth inflating in parallel.
+const uint64_t kParallelInflateAbove = 32ull << 20;
+
+// A zlib stream stored as several ranges of one buffer, e.g. the IDAT bodies of a mapped PNG.
+class DeflateSource {
+public:
+    explicit DeflateSource(const uint8_t* base = nullptr) : base_(base) {}
+    void Add(size_t offset, uint32_t len);
+    uint64_t Size() const { return size_; }
+    // Offset and length of each range, in stream order.
+    const std::vector<std::pair<size_t, uint32_t>>& Segments() const { return segments_; }
+    // Copies up to n bytes from stream offset pos; fewer at the end of the stream.
+    size_t Read(uint64_t pos, uint8_t* dst, size_t n) const;
+
+private:
+    const uint8_t* base_;
+    std::vector<std::pair<size_t, uint32_t>> segments_;
+    std::vector<uint64_t> starts_; // stream offset of each segment
+    uint64_t size_{0};
+};
+
+// Consecutive output of the stream, in order.
+struct InflatedPiece {
+    std::vector<uint8_t> data;
+    uint64_t startBit{0};   // stream bit where the piece's first block starts, zlib header included
+    uint32_t adlerBefore{1}; // Adler-32 of all output before data
+    std::vector<std::pair<uint64_t, size_t>> blocks; // stream bit and data offset of each block start
+    bool last{false};       // the stream ends here and its Adler-32 has been checked
+};
+
+struct InflateJob;
+
+class ParallelInflater {
+public:
+    // src must stay valid and unchanged while the inflater exists.
+    ParallelInflater(const DeflateSource& src, WorkPool& pool);
+    ~ParallelInflater();
+
+    ParallelInflater(const ParallelInflater&) = delete;
+    ParallelInflater& operator=(const ParallelInflater&) = delete;
+
+    // The next piece of output. False with outError set on corrupt or truncated data.
+    bool Next(InflatedPiece& out, std::wstring& outError);
+    // Pieces handed out so far that had to be decoded again because the speculative one missed.
+    uint64_t Redecoded() const { return redecoded_; }
+
+private:
+    void SubmitAhead();
+
+    const DeflateSource& src_;
+    WorkPool& pool_;
+    std::deque<std::shared_ptr<InflateJob>> jobs_;
+    std::vector<std::shared_ptr<InflateJob>> skipped_; // still running, but their output is not needed
+    uint64_t nextPiece_{0};  // index of the next piece to submit
+    unsigned lookahead_{1};
+    uint64_t expectBit_{16}; // where the next piece has to start
+    uint64_t total_{0};      // output bytes so far
+    uint32_t adler_{1};
+    uint64_t redecoded_{0};
+    std::vector<uint8_t> window_; // the last 32 KB of output
+    bool started_{false};
+    bool done_{false};
+};
+
+} // namespace piclab
@@ -0,0 +1,113 @@
+// piclab_instance.cpp
+// Hand-over protocol, one connection per follower:
+//   follower -> leader  { "items", <path>, <label>, <path>, <label>, ... }
+//   leader -> follower  { "taken" }
+// A follower that gets no "taken" (the leader was closing) starts over and may lead itself.
+
+#include "piclab_instance.h"
+#include "piclab_io.h"
+#include "piclab_ipc.h"
+
+#include <algorithm>
+
+namespace piclab {
+
+// Attempts to either join or lead before giving up; each failed round means another launch won a
+// race in between (listened first, or closed its group as we connected).
+static const int kJoinAttempts = 20;
+
+LaunchGatherer::LaunchGatherer() = default;
+
+LaunchGatherer::~LaunchGatherer() {
+    if (collector_.joinable()) Finish(0);
+}
+
+static bool HandOver(IpcChannel& ch, const std::vector<BatchItem>& items, const std::wstring& cwd) {
+    std::vector<std::wstring> frame = { L"items" };
+    for (const BatchItem& it : items) {
+        frame.push_back(ResolvePath(cwd, it.path));
+        frame.push_back(it.label);
+    }
+    std::vector<std::wstring> reply;
+    return WriteFrame(ch, frame) && ReadFrame(ch, reply) && reply.size() == 1 && reply[0] == L"taken";
+}
+
+bool LaunchGatherer::Join(const std::wstring& role, const std::vector<BatchItem>& items, std::wstring& outError) {
+    endpoint_ = LocalEndpoint(role);
+    const std::wstring cwd = CurrentDirectory();
+    for (int attempt = 0; attempt < kJoinAttempts; ++attempt) {
+        std::wstring err;
+        if (std::unique_ptr<IpcChannel> ch = ConnectLocal(endpoint_, err)) {
+            if (HandOver(*ch, items, cwd)) {
+                outError.clear();
+                return false;
+            }
+            continue;
+        }
+        listener_ = ListenLocal(endpoint_, outError);
+        if (listener_) {
+            items_ = items;
+            start_ = last_ = std::chrono::steady_clock::now();
+            collector_ = std::thread([this] { Collect(); });
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+void LaunchGatherer::Collect() {
+    for (;;) {
+        std::wstring err;
+        std::unique_ptr<IpcChannel> ch = listener_->Accept(err);
+        if (!ch) {
+            if (err.empty()) continue;
+            break; // Finish interrupted us, or listening broke; lead with what has arrived so far
+        }
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (closing_) break;
+            reading_ = ch.get(); // a launch that stalls before its frame is cut off by Finish
+        }
+        std::vector<std::wstring> frame;
+        const bool ok = ReadFrame(*ch, frame) && !frame.empty() && frame[0] == L"items" && frame.size() % 2 == 1;
+        std::lock_guard<std::mutex> lk(mu_);
+        reading_ = nullptr;
+        // Anyone served after Finish began gets no "taken" and starts a group of their own.
+        if (closing_) break;
+        if (!ok) continue; // not a launch, e.g. another process probing whether we listen
+        const size_t before = items_.size();
+        for (size_t i = 1; i < frame.size(); i += 2) items_.push_back({ frame[i], frame[i + 1] });
+        if (!WriteFrame(*ch, { L"taken" })) {
+            items_.resize(before); // it will hand them to someone else
+            continue;
+        }
+        last_ = std::chrono::steady_clock::now();
+        arrived_.notify_all();
+    }
+    std::lock_guard<std::mutex> lk(mu_);
+    collectorDone_ = true;
+    arrived_.notify_all();
+}
+
+std::vector<BatchItem> LaunchGatherer::Finish(unsigned quietMs) {
+    if (!collector_.joinable()) return items_;
+    {
+        std::unique_lock<std::mutex> lk(mu_);
+        const auto limit = start_ + std::chrono::milliseconds(kGatherMaxMs);
+        for (;;) {
+            const auto deadline = std::min(last_ + std::chrono::milliseconds(quietMs), limit);
+            if (collectorDone_ || std::chrono::steady_clock::now() >= deadline) break;
+            arrived_.wait_until(lk, deadline);
+        }
+        closing_ = true;
+        if (reading_) reading_->Interrupt();
+    }
+    // Through the listener itself: connecting by name could reach someone else's socket, or none.
+    listener_->Interrupt();
+    collector_.join();
+    listener_.reset();
+    return items_;
+}
+
+} // namespace piclab
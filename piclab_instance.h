@@ -0,0 +1,61 @@
+// piclab_instance.h
+// Single-instance coordination for launches that arrive together, such as Explorer starting one
+// piclab per selected file: the first launch leads and collects the images of the others over
+// local IPC (piclab_ipc.*), so the label is asked for once and the whole set is one batch.
+
+#pragma once
+
+#include "piclab_core.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace piclab {
+
+class IpcChannel;
+class IpcListener;
+
+// How long the leader keeps collecting after the last launch arrived, and in all.
+const unsigned kGatherQuietMs = 300;
+const unsigned kGatherMaxMs = 10000;
+
+class LaunchGatherer {
+public:
+    LaunchGatherer();
+    ~LaunchGatherer();
+    LaunchGatherer(const LaunchGatherer&) = delete;
+    LaunchGatherer& operator=(const LaunchGatherer&) = delete;
+
+    // Joins the group for role (launches with a different role are never merged). The first to
+    // join listens and leads, collecting in the background from here on; any later one hands its
+    // items over and gets false with outError empty, after which it should exit. A hand-over
+    // is acknowledged, so items offered while a leader is closing its group are never lost: that
+    // launch leads a new group instead. False with outError set when neither was possible.
+    bool Join(const std::wstring& role, const std::vector<BatchItem>& items, std::wstring& outError);
+
+    // Leader only: waits until no launch has arrived for quietMs (and at most kGatherMaxMs after
+    // Join), stops listening and returns the leader's own items followed by everyone else's.
+    // Relative paths from other launches arrive resolved against their working directory.
+    std::vector<BatchItem> Finish(unsigned quietMs = kGatherQuietMs);
+
+private:
+    void Collect();
+
+    std::wstring endpoint_;
+    std::unique_ptr<IpcListener> listener_;
+    IpcChannel* reading_{nullptr}; // the launch Collect is reading from, guarded by mu_
+    std::thread collector_;
+    std::mutex mu_;
+    std::condition_variable arrived_;
+    std::vector<BatchItem> items_;
+    std::chrono::steady_clock::time_point start_, last_;
+    bool closing_{false};
+    bool collectorDone_{false};
+};
+
+} // namespace piclab
@@ -0,0 +1,478 @@
+// piclab_io.cpp
+// File and path helpers. Win32 and POSIX implementations live side by side behind _WIN32.
+
+#include "piclab_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <shlwapi.h>
+#pragma comment(lib, "shlwapi.lib")
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace piclab {
+
+// Part of every GetTempSiblingPath name.
+static const wchar_t* const kTempSiblingMarker = L"_label_tmp_";
+
+// ----------------------------- Strings -----------------------------
+
+#ifdef _WIN32
+
+std::string ToUtf8(const std::wstring& s) {
+    if (s.empty()) return {};
+    int n = WideCharToMultiByte(CP_UTF8, 0, s.c_str(), (int)s.size(), nullptr, 0, nullptr, nullptr);
+    std::string out(n, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, s.c_str(), (int)s.size(), &out[0], n, nullptr, nullptr);
+    return out;
+}
+
+std::wstring FromUtf8(const std::string& s) {
+    if (s.empty()) return {};
+    int n = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), nullptr, 0);
+    std::wstring out(n, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), &out[0], n);
+    return out;
+}
+
+#else
+
+std::string ToUtf8(const std::wstring& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (wchar_t wc : s) {
+        uint32_t c = (uint32_t)wc;
+        if (c < 0x80) {
+            out += (char)c;
+        } else if (c < 0x800) {
+            out += (char)(0xC0 | (c >> 6));
+            out += (char)(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out += (char)(0xE0 | (c >> 12));
+            out += (char)(0x80 | ((c >> 6) & 0x3F));
+            out += (char)(0x80 | (c & 0x3F));
+        } else {
+            out += (char)(0xF0 | (c >> 18));
+            out += (char)(0x80 | ((c >> 12) & 0x3F));
+            out += (char)(0x80 | ((c >> 6) & 0x3F));
+            out += (char)(0x80 | (c & 0x3F));
+        }
+    }
+    return out;
+}
+
+std::wstring FromUtf8(const std::string& s) {
+    std::wstring out;
+    out.reserve(s.size());
+    size_t i = 0;
+    while (i < s.size()) {
+        uint8_t b = (uint8_t)s[i];
+        uint32_t c;
+        size_t extra;
+        if (b < 0x80)      { c = b;        extra = 0; }
+        else if (b < 0xE0) { c = b & 0x1F; extra = 1; }
+        else if (b < 0xF0) { c = b & 0x0F; extra = 2; }
+        else               { c = b & 0x07; extra = 3; }
+        if (i + extra >= s.size()) { out += L'?'; break; }
+        for (size_t k = 1; k <= extra; ++k) c = (c << 6) | ((uint8_t)s[i + k] & 0x3F);
+        out += (wchar_t)c;
+        i += extra + 1;
+    }
+    return out;
+}
+
+#endif
+
+// ----------------------------- Errors -----------------------------
+
+#ifdef _WIN32
+
+unsigned long LastSystemError() { return GetLastError(); }
+
+std::wstring SystemErrorText(unsigned long err) {
+    LPWSTR buf = nullptr;
+    DWORD flags = FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS;
+    FormatMessageW(flags, nullptr, (DWORD)err, 0, (LPWSTR)&buf, 0, nullptr);
+    std::wstring s = buf ? buf : L"";
+    if (buf) LocalFree(buf);
+    return s;
+}
+
+#else
+
+unsigned long LastSystemError() { return (unsigned long)errno; }
+
+std::wstring SystemErrorText(unsigned long err) {
+    return FromUtf8(strerror((int)err));
+}
+
+#endif
+
+// ----------------------------- Files -----------------------------
+
+#ifdef _WIN32
+
+FILE* OpenFile(const std::wstring& path, const wchar_t* mode) {
+    FILE* f = nullptr;
+    if (_wfopen_s(&f, path.c_str(), mode) != 0) return nullptr;
+    return f;
+}
+
+bool FileExists(const std::wstring& path) {
+    return PathFileExistsW(path.c_str()) != FALSE;
+}
+
+bool DeleteFilePath(const std::wstring& path) {
+    return DeleteFileW(path.c_str()) != FALSE;
+}
+
+std::wstring GetTempSiblingPath(const std::wstring& original) {
+    static std::atomic<unsigned> counter{0};
+    WCHAR drive[_MAX_DRIVE]{}, dir[_MAX_DIR]{}, fname[_MAX_FNAME]{}, ext[_MAX_EXT]{};
+    _wsplitpath_s(original.c_str(), drive, _MAX_DRIVE, dir, _MAX_DIR, fname, _MAX_FNAME, ext, _MAX_EXT);
+    WCHAR folder[MAX_PATH]{};
+    _wmakepath_s(folder, drive, dir, L"", L"");
+    WCHAR tmp[MAX_PATH];
+    swprintf_s(tmp, L"%s%s%s%lu_%u.png", folder, fname, kTempSiblingMarker, GetCurrentProcessId(), counter++);
+    return std::wstring(tmp);
+}
+
+bool ReplaceFileWith(const std::wstring& tmp, const std::wstring& dst, std::wstring& outError) {
+    // tmp is a sibling of dst, so this is always a rename on one volume and never a copy.
+    if (MoveFileExW(tmp.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING)) return true;
+    DWORD e = GetLastError();
+    DeleteFileW(tmp.c_str());
+    outError = L"Replace original failed. Win32 error " + std::to_wstring(e) + L": " + SystemErrorText(e);
+    return false;
+}
+
+#else
+
+FILE* OpenFile(const std::wstring& path, const wchar_t* mode) {
+    return fopen(ToUtf8(path).c_str(), ToUtf8(mode).c_str());
+}
+
+bool FileExists(const std::wstring& path) {
+    struct stat st;
+    return stat(ToUtf8(path).c_str(), &st) == 0;
+}
+
+bool DeleteFilePath(const std::wstring& path) {
+    return unlink(ToUtf8(path).c_str()) == 0;
+}
+
+std::wstring GetTempSiblingPath(const std::wstring& original) {
+    static std::atomic<unsigned> counter{0};
+    size_t slash = original.find_last_of(L'/');
+    std::wstring folder = slash == std::wstring::npos ? L"" : original.substr(0, slash + 1);
+    std::wstring fname = slash == std::wstring::npos ? original : original.substr(slash + 1);
+    size_t dot = fname.find_last_of(L'.');
+    if (dot != std::wstring::npos) fname.erase(dot);
+    return folder + fname + kTempSiblingMarker + std::to_wstring((unsigned)getpid()) + L"_" +
+           std::to_wstring(counter++) + L".png";
+}
+
+bool ReplaceFileWith(const std::wstring& tmp, const std::wstring& dst, std::wstring& outError) {
+    if (rename(ToUtf8(tmp).c_str(), ToUtf8(dst).c_str()) == 0) return true;
+    int e = errno;
+    unlink(ToUtf8(tmp).c_str());
+    outError = L"Replace original failed. errno " + std::to_wstring(e) + L": " + SystemErrorText((unsigned long)e);
+    return false;
+}
+
+#endif
+
+// ----------------------------- Directories -----------------------------
+
+#ifdef _WIN32
+
+bool IsDirectory(const std::wstring& path) {
+    const DWORD attrs = GetFileAttributesW(path.c_str());
+    return attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+bool ListDirectoryFiles(const std::wstring& dir, std::vector<std::wstring>& outNames, std::wstring& outError) {
+    outNames.clear();
+    WIN32_FIND_DATAW fd;
+    HANDLE h = FindFirstFileW((dir + L"\\*").c_str(), &fd);
+    if (h == INVALID_HANDLE_VALUE) {
+        const DWORD e = GetLastError();
+        if (e == ERROR_FILE_NOT_FOUND) return true;
+        outError = L"Cannot list " + dir + L": " + SystemErrorText(e);
+        return false;
+    }
+    do {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) outNames.push_back(fd.cFileName);
+    } while (FindNextFileW(h, &fd));
+    FindClose(h);
+    return true;
+}
+
+#else
+
+bool IsDirectory(const std::wstring& path) {
+    struct stat st;
+    return stat(ToUtf8(path).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool ListDirectoryFiles(const std::wstring& dir, std::vector<std::wstring>& outNames, std::wstring& outError) {
+    outNames.clear();
+    const std::string base = ToUtf8(dir);
+    DIR* d = opendir(base.c_str());
+    if (!d) {
+        outError = L"Cannot list " + dir + L": " + SystemErrorText(LastSystemError());
+        return false;
+    }
+    while (struct dirent* e = readdir(d)) {
+        struct stat st;
+        if (stat((base + "/" + e->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            outNames.push_back(FromUtf8(e->d_name));
+        }
+    }
+    closedir(d);
+    return true;
+}
+
+#endif
+
+bool IsTempSiblingPath(const std::wstring& path) {
+    const size_t slash = path.find_last_of(L"\\/");
+    return path.find(kTempSiblingMarker, slash == std::wstring::npos ? 0 : slash + 1) != std::wstring::npos;
+}
+
+bool SeekFile(FILE* f, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+bool ReadFileBytes(const std::wstring& path, std::vector<uint8_t>& out, std::wstring& outError) {
+    FILE* f = OpenFile(path, L"rb");
+    if (!f) {
+        outError = L"Cannot open file: " + SystemErrorText(LastSystemError());
+        return false;
+    }
+    out.clear();
+    uint8_t buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+    bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) outError = L"Read error.";
+    return ok;
+}
+
+bool ReadFileHead(const std::wstring& path, size_t maxBytes, std::vector<uint8_t>& out) {
+    FILE* f = OpenFile(path, L"rb");
+    if (!f) return false;
+    out.resize(maxBytes);
+    out.resize(fread(out.data(), 1, maxBytes, f));
+    fclose(f);
+    return true;
+}
+
+// ----------------------------- Mapped files -----------------------------
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::wstring& path, std::wstring& outError) {
+    Close();
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        outError = L"Cannot open file: " + SystemErrorText(GetLastError());
+        return false;
+    }
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size) || (uint64_t)size.QuadPart > (uint64_t)SIZE_MAX) {
+        DWORD e = GetLastError();
+        CloseHandle(file);
+        outError = L"Cannot size file: " + SystemErrorText(e);
+        return false;
+    }
+    if (size.QuadPart == 0) {
+        CloseHandle(file);
+        return true;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (mapping) CloseHandle(mapping);
+    if (view) {
+        CloseHandle(file);
+        data_ = static_cast<const uint8_t*>(view);
+        size_ = (size_t)size.QuadPart;
+        mapped_ = true;
+        return true;
+    }
+    // No mapping (e.g. some network redirectors): read it once instead.
+    buffer_.resize((size_t)size.QuadPart);
+    size_t got = 0;
+    while (got < buffer_.size()) {
+        DWORD n = 0, want = (DWORD)std::min<size_t>(buffer_.size() - got, 1u << 30);
+        if (!ReadFile(file, buffer_.data() + got, want, &n, nullptr) || n == 0) break;
+        got += n;
+    }
+    DWORD e = GetLastError();
+    CloseHandle(file);
+    if (got != buffer_.size()) {
+        buffer_.clear();
+        outError = L"Read error: " + SystemErrorText(e);
+        return false;
+    }
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+}
+
+void MappedFile::Close() {
+    if (mapped_) UnmapViewOfFile(data_);
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    buffer_.clear();
+}
+
+#else
+
+bool MappedFile::Open(const std::wstring& path, std::wstring& outError) {
+    Close();
+    int fd = open(ToUtf8(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        outError = L"Cannot open file: " + SystemErrorText(LastSystemError());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int e = errno;
+        close(fd);
+        outError = L"Cannot size file: " + SystemErrorText((unsigned long)e);
+        return false;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+            data_ = static_cast<const uint8_t*>(p);
+            size_ = (size_t)st.st_size;
+            mapped_ = true;
+            return true;
+        }
+    }
+    // Pipes and other unmappable files: read it once instead.
+    uint8_t buf[1 << 16];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) buffer_.insert(buffer_.end(), buf, buf + n);
+    int e = errno;
+    close(fd);
+    if (n < 0) {
+        buffer_.clear();
+        outError = L"Read error: " + SystemErrorText((unsigned long)e);
+        return false;
+    }
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+}
+
+void MappedFile::Close() {
+    if (mapped_) munmap(const_cast<uint8_t*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    buffer_.clear();
+}
+
+#endif
+
+uint64_t FileSizeOf(const std::wstring& path) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &fad)) return 0;
+    return ((uint64_t)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+#else
+    struct stat st;
+    return stat(ToUtf8(path).c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+#endif
+}
+
+bool GetFileStamp(const std::wstring& path, FileStamp& out) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &fad)) return false;
+    out.size = ((uint64_t)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+    out.modified = (int64_t)(((uint64_t)fad.ftLastWriteTime.dwHighDateTime << 32) | fad.ftLastWriteTime.dwLowDateTime);
+#else
+    struct stat st;
+    if (stat(ToUtf8(path).c_str(), &st) != 0) return false;
+    out.size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    out.modified = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    out.modified = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+    return true;
+}
+
+std::wstring PathWithSuffixBeforeExt(const std::wstring& path, const std::wstring& suffix) {
+    size_t dot = path.find_last_of(L'.');
+    size_t slash = path.find_last_of(L"\\/");
+
+    if (dot == std::wstring::npos || (slash != std::wstring::npos && dot < slash)) {
+        return path + suffix; // no extension
+    }
+    std::wstring out = path;
+    out.insert(dot, suffix);
+    return out;
+}
+
+std::wstring CurrentDirectory() {
+#ifdef _WIN32
+    DWORD n = GetCurrentDirectoryW(0, nullptr);
+    std::wstring dir(n, L'\0');
+    dir.resize(GetCurrentDirectoryW(n, &dir[0]));
+#else
+    std::wstring dir;
+    if (char* cwd = getcwd(nullptr, 0)) {
+        dir = FromUtf8(cwd);
+        free(cwd);
+    }
+#endif
+    while (dir.size() > 1 && (dir.back() == L'/' || dir.back() == L'\\')) dir.pop_back();
+    return dir;
+}
+
+std::wstring ResolvePath(const std::wstring& base, const std::wstring& path) {
+    if (base.empty() || path.empty()) return path;
+#ifdef _WIN32
+    if (!PathIsRelativeW(path.c_str())) return path;
+    return base + L"\\" + path;
+#else
+    if (path[0] == L'/') return path;
+    return base + (base.back() == L'/' ? L"" : L"/") + path;
+#endif
+}
+
+std::wstring PathWithExtension(const std::wstring& path, const std::wstring& ext) {
+    size_t dot = path.find_last_of(L'.');
+    size_t slash = path.find_last_of(L"\\/");
+    if (dot == std::wstring::npos || (slash != std::wstring::npos && dot < slash)) return path + L"." + ext;
+    return path.substr(0, dot + 1) + ext;
+}
+
+} // namespace piclab
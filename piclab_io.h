@@ -0,0 +1,82 @@
+// piclab_io.h
+// File and path helpers shared by the labeling core and both front ends.
+// Paths and messages are std::wstring everywhere; on POSIX they are converted to UTF-8 at the syscall.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace piclab {
+
+std::string ToUtf8(const std::wstring& s);
+std::wstring FromUtf8(const std::string& s);
+
+// Text of the last OS error (GetLastError on Windows, errno elsewhere).
+std::wstring SystemErrorText(unsigned long err);
+unsigned long LastSystemError();
+
+FILE* OpenFile(const std::wstring& path, const wchar_t* mode);
+// Absolute seek that works past 2 GB on every platform.
+bool SeekFile(FILE* f, uint64_t offset);
+bool FileExists(const std::wstring& path);
+bool ReadFileBytes(const std::wstring& path, std::vector<uint8_t>& out, std::wstring& outError);
+// Reads at most maxBytes from the start of the file; false if it cannot be opened.
+bool ReadFileHead(const std::wstring& path, size_t maxBytes, std::vector<uint8_t>& out);
+uint64_t FileSizeOf(const std::wstring& path);
+
+// Size and last-write time, enough to tell whether a file changed since it was last looked at.
+struct FileStamp {
+    uint64_t size{};
+    int64_t modified{}; // nanoseconds on POSIX, 100 ns ticks on Windows
+
+    bool operator==(const FileStamp& o) const { return size == o.size && modified == o.modified; }
+    bool operator!=(const FileStamp& o) const { return !(*this == o); }
+};
+bool GetFileStamp(const std::wstring& path, FileStamp& out);
+bool DeleteFilePath(const std::wstring& path);
+
+// Read-only view of a whole file. The file is memory-mapped when possible and read once into a
+// buffer otherwise; either way the OS handle is closed before Open returns. On Windows a live view
+// still blocks replacing the file, so drop the MappedFile before ReplaceFileWith.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::wstring& path, std::wstring& outError);
+    void Close();
+
+    const uint8_t* Data() const { return data_; }
+    size_t Size() const { return size_; }
+
+private:
+    const uint8_t* data_{};
+    size_t size_{};
+    bool mapped_{false};
+    std::vector<uint8_t> buffer_;
+};
+
+std::wstring PathWithSuffixBeforeExt(const std::wstring& path, const std::wstring& suffix);
+// path with its extension replaced by ext (no dot), or ext appended when it has none.
+std::wstring PathWithExtension(const std::wstring& path, const std::wstring& ext);
+std::wstring GetTempSiblingPath(const std::wstring& original);
+// Whether path is named like a GetTempSiblingPath result, of this or any other process.
+bool IsTempSiblingPath(const std::wstring& path);
+// Working directory of this process, without a trailing separator.
+std::wstring CurrentDirectory();
+// path unchanged when absolute (or base is empty), else base joined with path.
+std::wstring ResolvePath(const std::wstring& base, const std::wstring& path);
+
+bool IsDirectory(const std::wstring& path);
+// Names (not paths) of the regular files directly in dir.
+bool ListDirectoryFiles(const std::wstring& dir, std::vector<std::wstring>& outNames, std::wstring& outError);
+
+// Moves tmp over dst, replacing it. On failure tmp is removed and outError is filled.
+bool ReplaceFileWith(const std::wstring& tmp, const std::wstring& dst, std::wstring& outError);
+
+} // namespace piclab
@@ -0,0 +1,478 @@
+// piclab_ipc.cpp
+// Local IPC. Win32 named pipes and POSIX Unix domain sockets live side by side behind _WIN32.
+
+#include "piclab_ipc.h"
+#include "piclab_io.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace piclab {
+
+// Frames larger than this are treated as garbage rather than allocated.
+static const uint32_t kMaxFields = 1u << 20;
+static const uint32_t kMaxFieldBytes = 1u << 26;
+
+#ifdef _WIN32
+
+// ----------------------------- Named pipes -----------------------------
+
+namespace {
+
+// Server ends are opened for overlapped I/O so that Accept and the transfers can be interrupted;
+// each call still waits for its own completion, and on a client's synchronous handle it simply
+// completes inline.
+class PipeChannel : public IpcChannel {
+public:
+    PipeChannel(HANDLE h, bool server)
+        : h_(h), server_(server), done_(CreateEventW(nullptr, TRUE, FALSE, nullptr)),
+          stop_(CreateEventW(nullptr, TRUE, FALSE, nullptr)) {}
+    ~PipeChannel() override {
+        if (server_) {
+            FlushFileBuffers(h_);
+            DisconnectNamedPipe(h_);
+        }
+        CloseHandle(h_);
+        if (done_) CloseHandle(done_);
+        if (stop_) CloseHandle(stop_);
+    }
+
+    bool Read(void* data, size_t size) override {
+        uint8_t* p = static_cast<uint8_t*>(data);
+        while (size) {
+            DWORD got = 0;
+            if (!Transfer(false, p, (DWORD)std::min<size_t>(size, 1u << 20), got) || got == 0) return false;
+            p += got;
+            size -= got;
+        }
+        return true;
+    }
+
+    bool Write(const void* data, size_t size) override {
+        uint8_t* p = static_cast<uint8_t*>(const_cast<void*>(data));
+        while (size) {
+            DWORD put = 0;
+            if (!Transfer(true, p, (DWORD)std::min<size_t>(size, 1u << 20), put) || put == 0) return false;
+            p += put;
+            size -= put;
+        }
+        return true;
+    }
+
+    void Interrupt() override { SetEvent(stop_); }
+
+private:
+    bool Transfer(bool write, uint8_t* p, DWORD n, DWORD& moved) {
+        if (!done_ || !stop_ || WaitForSingleObject(stop_, 0) == WAIT_OBJECT_0) return false;
+        OVERLAPPED ov{};
+        ov.hEvent = done_;
+        ResetEvent(done_);
+        const BOOL ok = write ? WriteFile(h_, p, n, &moved, &ov) : ReadFile(h_, p, n, &moved, &ov);
+        if (ok) return true;
+        if (GetLastError() != ERROR_IO_PENDING) return false;
+        const HANDLE waits[2] = { done_, stop_ };
+        if (WaitForMultipleObjects(2, waits, FALSE, INFINITE) != WAIT_OBJECT_0) {
+            CancelIo(h_);
+            GetOverlappedResult(h_, &ov, &moved, TRUE); // ov must outlive the cancel
+            return false;
+        }
+        return GetOverlappedResult(h_, &ov, &moved, FALSE) != 0;
+    }
+
+    HANDLE h_;
+    bool server_;
+    HANDLE done_;
+    HANDLE stop_;
+};
+
+class PipeListener : public IpcListener {
+public:
+    PipeListener()
+        : stop_(CreateEventW(nullptr, TRUE, FALSE, nullptr)), connected_(CreateEventW(nullptr, TRUE, FALSE, nullptr)) {}
+    ~PipeListener() override {
+        if (pending_ != INVALID_HANDLE_VALUE) CloseHandle(pending_);
+        if (stop_) CloseHandle(stop_);
+        if (connected_) CloseHandle(connected_);
+    }
+
+    // The first instance is created with FILE_FLAG_FIRST_PIPE_INSTANCE, so a second listener on the
+    // same name fails here instead of sharing clients with the first.
+    bool Open(const std::wstring& name, std::wstring& outError) {
+        name_ = name;
+        if (!stop_ || !connected_) {
+            outError = L"Cannot create events: " + SystemErrorText(GetLastError());
+            return false;
+        }
+        pending_ = CreateInstance(true);
+        if (pending_ != INVALID_HANDLE_VALUE) return true;
+        DWORD e = GetLastError();
+        outError = e == ERROR_ACCESS_DENIED ? L"Another piclab process is already listening on " + name + L"."
+                                            : L"Cannot create pipe " + name + L": " + SystemErrorText(e);
+        return false;
+    }
+
+    std::unique_ptr<IpcChannel> Accept(std::wstring& outError) override {
+        if (WaitForSingleObject(stop_, 0) == WAIT_OBJECT_0) {
+            outError = L"Listener interrupted.";
+            return nullptr;
+        }
+        if (pending_ == INVALID_HANDLE_VALUE) pending_ = CreateInstance(false);
+        if (pending_ == INVALID_HANDLE_VALUE) {
+            outError = L"Cannot create pipe " + name_ + L": " + SystemErrorText(GetLastError());
+            return nullptr;
+        }
+        OVERLAPPED ov{};
+        ov.hEvent = connected_;
+        ResetEvent(connected_);
+        if (!ConnectNamedPipe(pending_, &ov)) {
+            DWORD e = GetLastError();
+            if (e == ERROR_IO_PENDING) {
+                const HANDLE waits[2] = { connected_, stop_ };
+                DWORD unused = 0;
+                if (WaitForMultipleObjects(2, waits, FALSE, INFINITE) != WAIT_OBJECT_0) {
+                    CancelIo(pending_);
+                    GetOverlappedResult(pending_, &ov, &unused, TRUE); // ov must outlive the cancel
+                    outError = L"Listener interrupted.";
+                    return nullptr;
+                }
+                if (!GetOverlappedResult(pending_, &ov, &unused, FALSE)) e = GetLastError();
+                else e = ERROR_PIPE_CONNECTED;
+            }
+            if (e != ERROR_PIPE_CONNECTED) {
+                // The client gave up between connecting and being accepted; reuse the instance.
+                DisconnectNamedPipe(pending_);
+                return nullptr;
+            }
+        }
+        HANDLE connected = pending_;
+        // The next instance exists before this client is served, so later clients never find the
+        // name missing. Should creating it fail, the next Accept tries again and reports.
+        pending_ = CreateInstance(false);
+        return std::unique_ptr<IpcChannel>(new PipeChannel(connected, true));
+    }
+
+    void Interrupt() override { SetEvent(stop_); }
+
+private:
+    HANDLE CreateInstance(bool first) {
+        const DWORD mode = PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS;
+        const DWORD open = PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0);
+        return CreateNamedPipeW(name_.c_str(), open, mode, PIPE_UNLIMITED_INSTANCES, 1u << 16, 1u << 16, 0, nullptr);
+    }
+
+    std::wstring name_;
+    HANDLE pending_{INVALID_HANDLE_VALUE};
+    HANDLE stop_;
+    HANDLE connected_;
+};
+
+} // namespace
+
+std::wstring LocalEndpoint(const std::wstring& role) {
+    WCHAR user[257]{};
+    DWORD len = 257;
+    if (!GetUserNameW(user, &len)) user[0] = 0;
+    return L"\\\\.\\pipe\\piclab-" + std::wstring(user) + L"-" + role;
+}
+
+std::unique_ptr<IpcListener> ListenLocal(const std::wstring& endpoint, std::wstring& outError) {
+    std::unique_ptr<PipeListener> l(new PipeListener());
+    if (!l->Open(endpoint, outError)) return nullptr;
+    return std::unique_ptr<IpcListener>(l.release());
+}
+
+std::unique_ptr<IpcChannel> ConnectLocal(const std::wstring& endpoint, std::wstring& outError) {
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        HANDLE h = CreateFileW(endpoint.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (h != INVALID_HANDLE_VALUE) return std::unique_ptr<IpcChannel>(new PipeChannel(h, false));
+        DWORD e = GetLastError();
+        // Every instance is busy for the moment the listener takes to create the next one.
+        if (e != ERROR_PIPE_BUSY || !WaitNamedPipeW(endpoint.c_str(), 2000)) {
+            outError = SystemErrorText(e);
+            return nullptr;
+        }
+    }
+    outError = L"Pipe stayed busy.";
+    return nullptr;
+}
+
+#else
+
+// ----------------------------- Unix sockets -----------------------------
+
+namespace {
+
+class SocketChannel : public IpcChannel {
+public:
+    explicit SocketChannel(int fd) : fd_(fd) {}
+    ~SocketChannel() override { close(fd_); }
+
+    bool Read(void* data, size_t size) override {
+        uint8_t* p = static_cast<uint8_t*>(data);
+        while (size) {
+            ssize_t got = recv(fd_, p, size, 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            p += got;
+            size -= (size_t)got;
+        }
+        return true;
+    }
+
+    bool Write(const void* data, size_t size) override {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        while (size) {
+            // A peer that went away must fail the write, not kill this process with SIGPIPE.
+#ifdef MSG_NOSIGNAL
+            ssize_t put = send(fd_, p, size, MSG_NOSIGNAL);
+#else
+            ssize_t put = send(fd_, p, size, 0);
+#endif
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) return false;
+            p += put;
+            size -= (size_t)put;
+        }
+        return true;
+    }
+
+    void Interrupt() override { shutdown(fd_, SHUT_RDWR); }
+
+private:
+    int fd_;
+};
+
+// Owns the socket file and its lock; the file is removed while the lock is still held, so the
+// next listener never unlinks a socket that is in use. Interrupt writes to a pipe that Accept
+// polls beside the socket.
+class SocketListener : public IpcListener {
+public:
+    SocketListener(int fd, const std::string& path, int lockFd) : fd_(fd), path_(path), lockFd_(lockFd) {
+        if (pipe(wake_) == 0) {
+            fcntl(wake_[0], F_SETFD, FD_CLOEXEC);
+            fcntl(wake_[1], F_SETFD, FD_CLOEXEC);
+        } else {
+            wake_[0] = wake_[1] = -1;
+        }
+        // Non-blocking, so a client that drops between poll and accept cannot leave accept stuck
+        // where Interrupt no longer reaches it.
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+    }
+    ~SocketListener() override {
+        close(fd_);
+        unlink(path_.c_str());
+        close(lockFd_);
+        if (wake_[0] >= 0) close(wake_[0]);
+        if (wake_[1] >= 0) close(wake_[1]);
+    }
+
+    std::unique_ptr<IpcChannel> Accept(std::wstring& outError) override {
+        if (wake_[0] < 0) {
+            outError = L"Cannot create the listener's wake-up pipe.";
+            return nullptr;
+        }
+        for (;;) {
+            pollfd fds[2] = { { fd_, POLLIN, 0 }, { wake_[0], POLLIN, 0 } };
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                outError = L"poll failed: " + SystemErrorText(LastSystemError());
+                return nullptr;
+            }
+            if (fds[1].revents) {
+                outError = L"Listener interrupted.";
+                return nullptr;
+            }
+            int c = accept(fd_, nullptr, nullptr);
+            if (c >= 0) {
+                // Some systems hand the listener's O_NONBLOCK down to the accepted socket.
+                fcntl(c, F_SETFL, fcntl(c, F_GETFL) & ~O_NONBLOCK);
+                return std::unique_ptr<IpcChannel>(new SocketChannel(Prepare(c)));
+            }
+            if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+            outError = L"accept failed: " + SystemErrorText(LastSystemError());
+            return nullptr;
+        }
+    }
+
+    void Interrupt() override {
+        // The byte is never read, so the pipe stays readable for every later Accept too.
+        const char b = 0;
+        if (wake_[1] >= 0) (void)!write(wake_[1], &b, 1);
+    }
+
+    static int Prepare(int fd) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        return fd;
+    }
+
+private:
+    int fd_;
+    std::string path_;
+    int lockFd_;
+    int wake_[2];
+};
+
+// The socket's directory must belong to us and be closed to everyone else; otherwise another user
+// could listen in our place and read the paths we send.
+static bool PrepareSocketDir(const std::string& path, bool create, std::wstring& outError) {
+    const std::string dir = path.substr(0, path.find_last_of('/'));
+    if (create) mkdir(dir.c_str(), 0700);
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0) {
+        outError = FromUtf8(dir) + L": " + SystemErrorText(LastSystemError());
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+        outError = L"Socket directory " + FromUtf8(dir) + L" is not private to this user.";
+        return false;
+    }
+    return true;
+}
+
+static bool SocketAddress(const std::string& path, sockaddr_un& addr, std::wstring& outError) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        outError = L"Socket path is too long: " + FromUtf8(path);
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+static int ConnectSocket(const sockaddr_un& addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return SocketListener::Prepare(fd);
+}
+
+} // namespace
+
+std::wstring LocalEndpoint(const std::wstring& role) {
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) return FromUtf8(runtime) + L"/piclab-" + role + L".sock";
+    return L"/tmp/piclab-" + std::to_wstring((unsigned long)getuid()) + L"/" + role + L".sock";
+}
+
+std::unique_ptr<IpcListener> ListenLocal(const std::wstring& endpoint, std::wstring& outError) {
+    const std::string path = ToUtf8(endpoint);
+    sockaddr_un addr;
+    if (!SocketAddress(path, addr, outError) || !PrepareSocketDir(path, true, outError)) return nullptr;
+
+    // Probing, removing a stale socket and binding happen under an exclusive lock on "<path>.lock",
+    // held for as long as we listen. Without it two starters could both find the name dead, and
+    // the second would unlink the socket the first had just bound, orphaning it.
+    const std::string lockPath = path + ".lock";
+    int lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lockFd < 0) {
+        outError = FromUtf8(lockPath) + L": " + SystemErrorText(LastSystemError());
+        return nullptr;
+    }
+    if (flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+        const unsigned long e = LastSystemError();
+        close(lockFd);
+        outError = e == EWOULDBLOCK ? L"Another piclab process is already listening on " + endpoint + L"."
+                                    : FromUtf8(lockPath) + L": " + SystemErrorText(e);
+        return nullptr;
+    }
+
+    int probe = ConnectSocket(addr);
+    if (probe >= 0) {
+        close(probe);
+        close(lockFd);
+        outError = L"Another piclab process is already listening on " + endpoint + L".";
+        return nullptr;
+    }
+    unlink(path.c_str()); // nobody answered, so any socket file there is stale
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        outError = L"Cannot listen on " + endpoint + L": " + SystemErrorText(LastSystemError());
+        if (fd >= 0) close(fd);
+        close(lockFd);
+        return nullptr;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return std::unique_ptr<IpcListener>(new SocketListener(fd, path, lockFd));
+}
+
+std::unique_ptr<IpcChannel> ConnectLocal(const std::wstring& endpoint, std::wstring& outError) {
+    const std::string path = ToUtf8(endpoint);
+    sockaddr_un addr;
+    if (!SocketAddress(path, addr, outError) || !PrepareSocketDir(path, false, outError)) return nullptr;
+    int fd = ConnectSocket(addr);
+    if (fd < 0) {
+        outError = SystemErrorText(LastSystemError());
+        return nullptr;
+    }
+    return std::unique_ptr<IpcChannel>(new SocketChannel(fd));
+}
+
+#endif
+
+// ----------------------------- Frames -----------------------------
+
+static void PutLE32(std::string& out, uint32_t v) {
+    const char b[4] = { (char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24) };
+    out.append(b, 4);
+}
+
+static bool GetLE32(IpcChannel& ch, uint32_t& v) {
+    uint8_t b[4];
+    if (!ch.Read(b, 4)) return false;
+    v = (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+    return true;
+}
+
+bool WriteFrame(IpcChannel& ch, const std::vector<std::wstring>& fields) {
+    // One write per frame, so a frame is never interleaved with another writer's on a pipe.
+    std::string buf;
+    PutLE32(buf, (uint32_t)fields.size());
+    for (const std::wstring& f : fields) {
+        const std::string u = ToUtf8(f);
+        PutLE32(buf, (uint32_t)u.size());
+        buf += u;
+    }
+    return ch.Write(buf.data(), buf.size());
+}
+
+bool ReadFrame(IpcChannel& ch, std::vector<std::wstring>& fields) {
+    fields.clear();
+    uint32_t count = 0;
+    if (!GetLE32(ch, count) || count > kMaxFields) return false;
+    std::string u;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t len = 0;
+        if (!GetLE32(ch, len) || len > kMaxFieldBytes) return false;
+        u.resize(len);
+        if (len && !ch.Read(&u[0], len)) return false;
+        fields.push_back(FromUtf8(u));
+    }
+    return true;
+}
+
+} // namespace piclab
@@ -0,0 +1,50 @@
+// piclab_ipc.h
+// Local IPC between piclab processes of one user: a Unix domain socket on POSIX, a named pipe on
+// Windows. Messages are frames of string fields, so callers never deal with byte layout.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace piclab {
+
+// One connected byte stream. Not thread-safe; serialize writers yourself.
+class IpcChannel {
+public:
+    virtual ~IpcChannel() = default;
+    virtual bool Read(void* data, size_t size) = 0;  // all of it, or false on EOF/error
+    virtual bool Write(const void* data, size_t size) = 0;
+    // Makes a blocked Read or Write on a channel from Accept, and every later one, fail. The only
+    // call that is safe from another thread while one of them runs.
+    virtual void Interrupt() = 0;
+};
+
+class IpcListener {
+public:
+    virtual ~IpcListener() = default;
+    // Blocks for the next client. Null with outError empty when a client dropped before it was
+    // served (call again); with outError set when listening itself broke.
+    virtual std::unique_ptr<IpcChannel> Accept(std::wstring& outError) = 0;
+    // Makes a blocked Accept, and every later one, return null with outError set. Safe to call
+    // from another thread; it works on the listener itself, so no client has to connect.
+    virtual void Interrupt() = 0;
+};
+
+// Per-user endpoint for a role such as "service": $XDG_RUNTIME_DIR/piclab-<role>.sock or
+// /tmp/piclab-<uid>/<role>.sock on POSIX, \\.\pipe\piclab-<user>-<role> on Windows.
+std::wstring LocalEndpoint(const std::wstring& role);
+
+// Fails with outError set when another process already listens on the endpoint; a stale socket
+// left by a crashed listener is removed. On POSIX the listener holds a lock on "<socket>.lock"
+// until it is destroyed, so of two processes starting at once exactly one listens.
+std::unique_ptr<IpcListener> ListenLocal(const std::wstring& endpoint, std::wstring& outError);
+// Null without delay when nobody listens; outError says why.
+std::unique_ptr<IpcChannel> ConnectLocal(const std::wstring& endpoint, std::wstring& outError);
+
+// Frame: field count, then length and UTF-8 bytes per field, all lengths 32-bit little-endian.
+bool WriteFrame(IpcChannel& ch, const std::vector<std::wstring>& fields);
+bool ReadFrame(IpcChannel& ch, std::vector<std::wstring>& fields);
+
+} // namespace piclab
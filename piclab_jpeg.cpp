@@ -0,0 +1,354 @@
+// piclab_jpeg.cpp
+// JPEG strip labeling on the coefficient level, after jpegtran. libjpeg reports errors through
+// longjmp, so every call into it happens in a function that owns the setjmp and keeps its C++
+// state in members or in objects created before the setjmp.
+
+#include "piclab_jpeg.h"
+#include "piclab_io.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <jpeglib.h>
+
+namespace piclab {
+
+bool IsJpeg(const uint8_t* data, size_t size) {
+    return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+bool IsJpegFile(const std::wstring& path) {
+    std::vector<uint8_t> head;
+    return ReadFileHead(path, 3, head) && IsJpeg(head.data(), head.size());
+}
+
+namespace {
+
+struct JpegError {
+    jpeg_error_mgr pub; // first, so libjpeg's pointer to it is a pointer to the whole struct
+    jmp_buf jump;
+    bool corrupt{false}; // libjpeg warned and went on past bad or missing data
+};
+
+void ErrorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<JpegError*>(cinfo->err)->jump, 1);
+}
+
+void EmitMessage(j_common_ptr cinfo, int level) {
+    if (level < 0) reinterpret_cast<JpegError*>(cinfo->err)->corrupt = true;
+}
+
+jpeg_error_mgr* InitError(JpegError& err) {
+    jpeg_std_error(&err.pub);
+    err.pub.error_exit = ErrorExit;
+    err.pub.emit_message = EmitMessage;
+    return &err.pub;
+}
+
+std::wstring JpegMessage(j_common_ptr cinfo) {
+    char buf[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, buf);
+    return L"JPEG: " + FromUtf8(buf);
+}
+
+// One labeling run. The decompressors and compressors live as members so that a longjmp out of
+// libjpeg leaves nothing to unwind; the destructor releases whatever was created.
+class StripLabeler {
+public:
+    StripLabeler() {
+        src_.err = pix_.err = stripIn_.err = InitError(err_);
+        crop_.err = stripOut_.err = out_.err = &err_.pub;
+    }
+    ~StripLabeler() {
+        if (outCreated_) jpeg_destroy_compress(&out_);
+        if (stripInCreated_) jpeg_destroy_decompress(&stripIn_);
+        if (stripOutCreated_) jpeg_destroy_compress(&stripOut_);
+        if (pixCreated_) jpeg_destroy_decompress(&pix_);
+        if (cropCreated_) jpeg_destroy_compress(&crop_);
+        if (srcCreated_) jpeg_destroy_decompress(&src_);
+        free(cropBuf_);
+        free(stripBuf_);
+        if (file_) fclose(file_);
+    }
+    StripLabeler(const StripLabeler&) = delete;
+    StripLabeler& operator=(const StripLabeler&) = delete;
+
+    bool Run(const std::wstring& src, const std::wstring& dst, const JpegStripPlan& plan,
+             const JpegStripEdit& edit, std::wstring& outError);
+
+private:
+    bool ReadSource(const JpegStripPlan& plan, std::wstring& outError);
+    void CropStrip();
+    void DecodeStrip();
+    void EncodeStrip();
+    void ReplaceStripBlocks();
+    bool WriteOutput(const std::wstring& dst, std::wstring& outError);
+    JDIMENSION StripFirstBlockRow(const jpeg_component_info& comp) const {
+        return stripTop_ / DCTSIZE * comp.v_samp_factor / src_.max_v_samp_factor;
+    }
+
+    JpegError err_;
+    MappedFile in_;
+    jpeg_decompress_struct src_{};      // the source, read as coefficients
+    jpeg_compress_struct crop_{};       // its MCU rows from stripTop_ down, as a JPEG of their own
+    jpeg_decompress_struct pix_{};      // that crop, decoded to pixels
+    jpeg_compress_struct stripOut_{};   // the labeled strip, encoded with the source's tables
+    jpeg_decompress_struct stripIn_{};  // that encoding, read back as coefficients
+    jpeg_compress_struct out_{};
+    bool srcCreated_{false}, cropCreated_{false}, pixCreated_{false};
+    bool stripOutCreated_{false}, stripInCreated_{false}, outCreated_{false};
+    jvirt_barray_ptr* coefs_{};
+    jvirt_barray_ptr cropCoefs_[MAX_COMPONENTS]{};
+    unsigned char* cropBuf_{};
+    unsigned long cropSize_{};
+    unsigned char* stripBuf_{};
+    unsigned long stripSize_{};
+    FILE* file_{};
+    uint32_t stripTop_{};
+    Image strip_;
+};
+
+bool StripLabeler::Run(const std::wstring& src, const std::wstring& dst, const JpegStripPlan& plan,
+                       const JpegStripEdit& edit, std::wstring& outError) {
+    if (!in_.Open(src, outError)) return false;
+    if (setjmp(err_.jump)) {
+        outError = JpegMessage(reinterpret_cast<j_common_ptr>(&src_));
+        return false;
+    }
+    if (!ReadSource(plan, outError)) return false;
+    CropStrip();
+    DecodeStrip();
+    edit(strip_, stripTop_);
+    EncodeStrip();
+    ReplaceStripBlocks();
+    return WriteOutput(dst, outError);
+}
+
+bool StripLabeler::ReadSource(const JpegStripPlan& plan, std::wstring& outError) {
+    jpeg_create_decompress(&src_);
+    srcCreated_ = true;
+    jpeg_mem_src(&src_, const_cast<unsigned char*>(in_.Data()), (unsigned long)in_.Size());
+    jpeg_save_markers(&src_, JPEG_COM, 0xFFFF);
+    for (int m = 0; m < 16; ++m) jpeg_save_markers(&src_, JPEG_APP0 + m, 0xFFFF);
+    jpeg_read_header(&src_, TRUE);
+    if (src_.jpeg_color_space != JCS_YCbCr && src_.jpeg_color_space != JCS_GRAYSCALE &&
+        src_.jpeg_color_space != JCS_RGB) {
+        outError = L"Only YCbCr, grayscale and RGB JPEGs can be labeled.";
+        return false;
+    }
+
+    uint32_t top = 0;
+    if (!plan(src_.image_width, src_.image_height, top, outError)) return false;
+    // Whole MCU rows only: the strip is encoded on its own and its blocks must line up with the source's.
+    const uint32_t mcuRows = (uint32_t)src_.max_v_samp_factor * DCTSIZE;
+    stripTop_ = std::min(top, (uint32_t)src_.image_height - 1) / mcuRows * mcuRows;
+
+    // Room for the crop's coefficients; it has to be requested before the source is read.
+    for (int c = 0; c < src_.num_components; ++c) {
+        const jpeg_component_info& comp = src_.comp_info[c];
+        const JDIMENSION rows = comp.height_in_blocks - StripFirstBlockRow(comp);
+        cropCoefs_[c] = (*src_.mem->request_virt_barray)(
+            reinterpret_cast<j_common_ptr>(&src_), JPOOL_IMAGE, TRUE, comp.width_in_blocks,
+            (rows + comp.v_samp_factor - 1) / comp.v_samp_factor * comp.v_samp_factor, comp.v_samp_factor);
+    }
+    coefs_ = jpeg_read_coefficients(&src_);
+    if (err_.corrupt) {
+        // libjpeg would fill the gap with grey, and that must not end up over the original.
+        outError = L"JPEG data is corrupt or truncated.";
+        return false;
+    }
+#if JPEG_LIB_VERSION >= 70
+    if (src_.min_DCT_v_scaled_size != DCTSIZE || src_.min_DCT_h_scaled_size != DCTSIZE) {
+        outError = L"JPEGs with scaled DCT blocks cannot be labeled.";
+        return false;
+    }
+#endif
+    return true;
+}
+
+// Copies the strip's blocks into a JPEG of their own, so that only it has to be decoded to pixels.
+void StripLabeler::CropStrip() {
+    for (int c = 0; c < src_.num_components; ++c) {
+        const jpeg_component_info& comp = src_.comp_info[c];
+        const JDIMENSION first = StripFirstBlockRow(comp);
+        for (JDIMENSION r = 0; first + r < comp.height_in_blocks; ++r) {
+            JBLOCKARRAY from = (*src_.mem->access_virt_barray)(
+                reinterpret_cast<j_common_ptr>(&src_), coefs_[c], first + r, 1, FALSE);
+            JBLOCKARRAY to = (*src_.mem->access_virt_barray)(
+                reinterpret_cast<j_common_ptr>(&src_), cropCoefs_[c], r, 1, TRUE);
+            memcpy(to[0], from[0], comp.width_in_blocks * sizeof(JBLOCK));
+        }
+    }
+    jpeg_create_compress(&crop_);
+    cropCreated_ = true;
+    jpeg_copy_critical_parameters(&src_, &crop_);
+    crop_.image_height = src_.image_height - stripTop_;
+    jpeg_mem_dest(&crop_, &cropBuf_, &cropSize_);
+    jpeg_write_coefficients(&crop_, cropCoefs_);
+    jpeg_finish_compress(&crop_);
+}
+
+void StripLabeler::DecodeStrip() {
+    jpeg_create_decompress(&pix_);
+    pixCreated_ = true;
+    jpeg_mem_src(&pix_, cropBuf_, cropSize_);
+    jpeg_read_header(&pix_, TRUE);
+    pix_.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&pix_);
+
+    strip_.width = pix_.output_width;
+    strip_.height = pix_.output_height;
+    strip_.channels = 3;
+    strip_.pixels.resize(strip_.Stride() * strip_.height);
+    for (uint32_t y = 0; y < strip_.height; ++y) {
+        JSAMPROW row = strip_.Row(y);
+        jpeg_read_scanlines(&pix_, &row, 1);
+    }
+    jpeg_finish_decompress(&pix_);
+}
+
+void StripLabeler::EncodeStrip() {
+    jpeg_create_compress(&stripOut_);
+    stripOutCreated_ = true;
+    // Same quantization tables, component ids and sampling as the source, so its blocks drop in.
+    jpeg_copy_critical_parameters(&src_, &stripOut_);
+    stripOut_.image_height = strip_.height;
+    stripOut_.in_color_space = JCS_RGB;
+    stripOut_.input_components = 3;
+    stripOut_.optimize_coding = FALSE;
+    jpeg_mem_dest(&stripOut_, &stripBuf_, &stripSize_);
+    jpeg_start_compress(&stripOut_, TRUE);
+    for (uint32_t y = 0; y < strip_.height; ++y) {
+        JSAMPROW row = strip_.Row(y);
+        jpeg_write_scanlines(&stripOut_, &row, 1);
+    }
+    jpeg_finish_compress(&stripOut_);
+
+    jpeg_create_decompress(&stripIn_);
+    stripInCreated_ = true;
+    jpeg_mem_src(&stripIn_, stripBuf_, stripSize_);
+    jpeg_read_header(&stripIn_, TRUE);
+}
+
+void StripLabeler::ReplaceStripBlocks() {
+    jvirt_barray_ptr* stripCoefs = jpeg_read_coefficients(&stripIn_);
+    for (int c = 0; c < src_.num_components; ++c) {
+        const jpeg_component_info& dstComp = src_.comp_info[c];
+        const jpeg_component_info& srcComp = stripIn_.comp_info[c];
+        const JDIMENSION first = StripFirstBlockRow(dstComp);
+        const JDIMENSION rows = std::min<JDIMENSION>(srcComp.height_in_blocks, dstComp.height_in_blocks - first);
+        const JDIMENSION cols = std::min<JDIMENSION>(srcComp.width_in_blocks, dstComp.width_in_blocks);
+        for (JDIMENSION r = 0; r < rows; ++r) {
+            JBLOCKARRAY from = (*stripIn_.mem->access_virt_barray)(
+                reinterpret_cast<j_common_ptr>(&stripIn_), stripCoefs[c], r, 1, FALSE);
+            JBLOCKARRAY to = (*src_.mem->access_virt_barray)(
+                reinterpret_cast<j_common_ptr>(&src_), coefs_[c], first + r, 1, TRUE);
+            memcpy(to[0], from[0], cols * sizeof(JBLOCK));
+        }
+    }
+}
+
+bool StripLabeler::WriteOutput(const std::wstring& dst, std::wstring& outError) {
+    jpeg_create_compress(&out_);
+    outCreated_ = true;
+    jpeg_copy_critical_parameters(&src_, &out_);
+    // Standard Huffman tables, as jpegtran writes by default: optimizing them is a second pass over
+    // every block and would cost more than everything else here.
+    out_.optimize_coding = FALSE;
+    if (jpeg_has_multiple_scans(&src_)) jpeg_simple_progression(&out_);
+
+    file_ = OpenFile(dst, L"wb");
+    if (!file_) {
+        outError = L"Cannot create output file.";
+        return false;
+    }
+    jpeg_stdio_dest(&out_, file_);
+    jpeg_write_coefficients(&out_, coefs_);
+    // Markers go out as they came, except the JFIF and Adobe headers libjpeg has just written itself.
+    for (jpeg_saved_marker_ptr m = src_.marker_list; m; m = m->next) {
+        if (out_.write_JFIF_header && m->marker == JPEG_APP0 && m->data_length >= 5 &&
+            memcmp(m->data, "JFIF", 5) == 0) continue;
+        if (out_.write_Adobe_marker && m->marker == JPEG_APP0 + 14 && m->data_length >= 5 &&
+            memcmp(m->data, "Adobe", 5) == 0) continue;
+        jpeg_write_marker(&out_, m->marker, m->data, m->data_length);
+    }
+    jpeg_finish_compress(&out_);
+
+    bool ok = !ferror(file_);
+    if (fclose(file_) != 0) ok = false;
+    file_ = nullptr;
+    if (!ok) outError = L"Write failed (disk full?).";
+    return ok;
+}
+
+} // namespace
+
+bool DecodeJpeg(const uint8_t* data, size_t size, Image& out, std::wstring& outError) {
+    JpegError err;
+    jpeg_decompress_struct cinfo{};
+    cinfo.err = InitError(err);
+    jpeg_create_decompress(&cinfo);
+    if (setjmp(err.jump)) {
+        outError = JpegMessage(reinterpret_cast<j_common_ptr>(&cinfo));
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data), (unsigned long)size);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    out.width = cinfo.output_width;
+    out.height = cinfo.output_height;
+    out.channels = 3;
+    out.pixels.resize(out.Stride() * out.height);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = out.Row(cinfo.output_scanline);
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    if (err.corrupt) {
+        outError = L"JPEG data is corrupt or truncated.";
+        return false;
+    }
+    return true;
+}
+
+bool LabelJpegStrip(const std::wstring& src, const std::wstring& dst, const JpegStripPlan& plan,
+                    const JpegStripEdit& edit, std::wstring& outError) {
+    StripLabeler labeler;
+    return labeler.Run(src, dst, plan, edit, outError);
+}
+
+bool VerifyJpegFile(const std::wstring& path, std::wstring& outError) {
+    MappedFile file;
+    if (!file.Open(path, outError)) return false;
+    if (!IsJpeg(file.Data(), file.Size())) {
+        outError = L"Not a JPEG file.";
+        return false;
+    }
+    JpegError err;
+    jpeg_decompress_struct cinfo{};
+    cinfo.err = InitError(err);
+    jpeg_create_decompress(&cinfo);
+    if (setjmp(err.jump)) {
+        outError = JpegMessage(reinterpret_cast<j_common_ptr>(&cinfo));
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(file.Data()), (unsigned long)file.Size());
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_read_coefficients(&cinfo);
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    if (err.corrupt) {
+        outError = L"JPEG data is corrupt or truncated.";
+        return false;
+    }
+    return true;
+}
+
+} // namespace piclab
@@ -0,0 +1,39 @@
+// piclab_jpeg.h
+// Lossless JPEG labeling in the manner of jpegtran (libjpeg or libjpeg-turbo; build with
+// PICLAB_HAVE_LIBJPEG). The quantized DCT coefficients of every MCU row above the label are copied
+// to the output as they are; only the MCU rows from the label down are decoded, labeled and
+// encoded again, with the source's quantization tables and sampling factors.
+
+#pragma once
+
+#include "piclab_core.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace piclab {
+
+bool IsJpeg(const uint8_t* data, size_t size);
+bool IsJpegFile(const std::wstring& path);
+// Whole-image decode to RGB8, for when a JPEG is written in another format.
+bool DecodeJpeg(const uint8_t* data, size_t size, Image& out, std::wstring& outError);
+
+// Called once the image size is known; sets top to the first row the label touches.
+using JpegStripPlan = std::function<bool(uint32_t width, uint32_t height, uint32_t& top, std::wstring& outError)>;
+// Called with the RGB rows from stripTop down to the bottom. stripTop is the start of the MCU row
+// holding the planned top, so it may be a few rows above it.
+using JpegStripEdit = std::function<void(Image& strip, uint32_t stripTop)>;
+
+// Writes src to dst with only the bottom MCU rows re-encoded after edit has changed them. Markers
+// (EXIF, ICC, comments) and progressive mode are kept; baseline output uses the standard Huffman
+// tables. YCbCr, grayscale and RGB JPEGs are supported, CMYK is not.
+bool LabelJpegStrip(const std::wstring& src, const std::wstring& dst, const JpegStripPlan& plan,
+                    const JpegStripEdit& edit, std::wstring& outError);
+
+// Structural check of a written JPEG: headers parse and every scan entropy-decodes to the end
+// without libjpeg reporting corrupt or missing data. No IDCT, no pixels.
+bool VerifyJpegFile(const std::wstring& path, std::wstring& outError);
+
+} // namespace piclab
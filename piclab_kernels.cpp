@@ -0,0 +1,205 @@
+// piclab_kernels.cpp
+// Scrim kernel: out = round(c * (255 - alpha) / 255) per color byte, evaluated 16-bit wide as
+// mulhi(c * inv + 128, 257), which equals Div255 exactly for every input.
+
+#include "piclab_kernels.h"
+#include "piclab_cpu.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PICLAB_HAVE_SSE2 1
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define PICLAB_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define PICLAB_TARGET_AVX2
+#else
+#define PICLAB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace piclab {
+
+typedef void (*ScrimFn)(uint8_t* row, uint32_t width, uint32_t channels, uint8_t alpha);
+
+static void ScrimRowScalar(uint8_t* row, uint32_t width, uint32_t channels, uint8_t alpha) {
+    ScrimRowReference(row, width, channels, alpha);
+}
+
+// Finishes a row from byte offset i. RGB rows are scaled bytewise by the vector loops, so their
+// tail need not start on a pixel boundary.
+static void ScrimTail(uint8_t* row, size_t i, size_t bytes, uint32_t channels, uint8_t alpha) {
+    if (channels == 3) {
+        const uint32_t inv = 255u - alpha;
+        for (; i < bytes; ++i) row[i] = Div255(row[i] * inv);
+    } else {
+        ScrimRowReference(row + i, (uint32_t)((bytes - i) / 4), 4, alpha);
+    }
+}
+
+// ----------------------------- SSE2 / AVX2 -----------------------------
+
+#ifdef PICLAB_HAVE_SSE2
+
+static inline __m128i ScaleBytes128(__m128i v, __m128i inv) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i m257 = _mm_set1_epi16(257);
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    lo = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(lo, inv), bias), m257);
+    hi = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(hi, inv), bias), m257);
+    return _mm_packus_epi16(lo, hi);
+}
+
+static void ScrimRowSse2(uint8_t* row, uint32_t width, uint32_t channels, uint8_t alpha) {
+    const __m128i inv = _mm_set1_epi16((short)(255 - alpha));
+    const size_t bytes = (size_t)width * channels;
+    size_t i = 0;
+    if (channels == 3) {
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+            _mm_storeu_si128((__m128i*)(row + i), ScaleBytes128(v, inv));
+        }
+    } else {
+        const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000u);
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+            __m128i opaque = _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(-1)), alphaMask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(opaque, alphaMask)) != 0xFFFF) {
+                ScrimRowReference(row + i, 4, 4, alpha);
+                continue;
+            }
+            __m128i s = ScaleBytes128(v, inv);
+            _mm_storeu_si128((__m128i*)(row + i), _mm_or_si128(_mm_andnot_si128(alphaMask, s), alphaMask));
+        }
+    }
+    ScrimTail(row, i, bytes, channels, alpha);
+}
+
+PICLAB_TARGET_AVX2
+static void ScrimRowAvx2(uint8_t* row, uint32_t width, uint32_t channels, uint8_t alpha) {
+    const __m256i inv  = _mm256_set1_epi16((short)(255 - alpha));
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i m257 = _mm256_set1_epi16(257);
+    const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000u);
+    const size_t bytes = (size_t)width * channels;
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(row + i));
+        if (channels == 4) {
+            __m256i opaque = _mm256_and_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(-1)), alphaMask);
+            if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(opaque, alphaMask)) != 0xFFFFFFFFu) {
+                ScrimRowReference(row + i, 8, 4, alpha);
+                continue;
+            }
+        }
+        // unpack works within 128-bit lanes; packus undoes it in the same lane order.
+        __m256i lo = _mm256_unpacklo_epi8(v, zero);
+        __m256i hi = _mm256_unpackhi_epi8(v, zero);
+        lo = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(lo, inv), bias), m257);
+        hi = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(hi, inv), bias), m257);
+        __m256i s = _mm256_packus_epi16(lo, hi);
+        if (channels == 4) s = _mm256_or_si256(_mm256_andnot_si256(alphaMask, s), alphaMask);
+        _mm256_storeu_si256((__m256i*)(row + i), s);
+    }
+    ScrimTail(row, i, bytes, channels, alpha);
+}
+
+#endif
+
+// ----------------------------- NEON -----------------------------
+
+#ifdef PICLAB_HAVE_NEON
+
+static inline uint8x8_t ScaleBytesNeon(uint8x8_t v, uint8x8_t inv) {
+    uint16x8_t t = vaddq_u16(vmull_u8(v, inv), vdupq_n_u16(128));
+    return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+}
+
+static void ScrimRowNeon(uint8_t* row, uint32_t width, uint32_t channels, uint8_t alpha) {
+    const uint8x8_t inv = vdup_n_u8((uint8_t)(255 - alpha));
+    size_t x = 0;
+    if (channels == 3) {
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x3_t v = vld3q_u8(row + 3 * x);
+            for (int c = 0; c < 3; ++c) {
+                v.val[c] = vcombine_u8(ScaleBytesNeon(vget_low_u8(v.val[c]), inv),
+                                       ScaleBytesNeon(vget_high_u8(v.val[c]), inv));
+            }
+            vst3q_u8(row + 3 * x, v);
+        }
+    } else {
+        for (; x + 16 <= width; x += 16) {
+            uint8x16x4_t v = vld4q_u8(row + 4 * x);
+            if (vminvq_u8(v.val[3]) != 255) {
+                ScrimRowReference(row + 4 * x, 16, 4, alpha);
+                continue;
+            }
+            for (int c = 0; c < 3; ++c) {
+                v.val[c] = vcombine_u8(ScaleBytesNeon(vget_low_u8(v.val[c]), inv),
+                                       ScaleBytesNeon(vget_high_u8(v.val[c]), inv));
+            }
+            vst4q_u8(row + 4 * x, v);
+        }
+    }
+    ScrimRowReference(row + (size_t)x * channels, width - (uint32_t)x, channels, alpha);
+}
+
+#endif
+
+// ----------------------------- Label text -----------------------------
+
+void LabelRow(uint8_t* px, uint32_t count, uint32_t channels,
+              const uint8_t* fill, const uint8_t* shadow, uint8_t shadowAlpha) {
+    for (uint32_t i = 0; i < count; ++i, px += channels) {
+        uint8_t f = fill[i], s = shadow[i];
+        if (f == 255) {
+            // Full fill coverage hides the shadow entirely: opaque white either way.
+            px[0] = px[1] = px[2] = 255;
+            if (channels == 4) px[3] = 255;
+            continue;
+        }
+        if (s) BlendPixel(px, channels, 0, 0, 0, Div255((uint32_t)s * shadowAlpha));
+        if (f) BlendPixel(px, channels, 255, 255, 255, f);
+    }
+}
+
+// ----------------------------- Dispatch -----------------------------
+
+struct ScrimImpl {
+    ScrimFn fn;
+    const char* name;
+};
+
+static ScrimImpl SelectScrim() {
+    const CpuFeatures& cpu = GetCpuFeatures();
+    (void)cpu;
+#ifdef PICLAB_HAVE_SSE2
+    if (cpu.avx2) return { ScrimRowAvx2, "avx2" };
+    if (cpu.sse2) return { ScrimRowSse2, "sse2" };
+#endif
+#ifdef PICLAB_HAVE_NEON
+    if (cpu.neon) return { ScrimRowNeon, "neon" };
+#endif
+    return { ScrimRowScalar, "scalar" };
+}
+
+static const ScrimImpl& Scrim() {
+    static const ScrimImpl impl = SelectScrim();
+    return impl;
+}
+
+void ScrimRow(uint8_t* row, uint32_t width, uint32_t channels, uint8_t alpha) {
+    if (alpha == 0) return;
+    Scrim().fn(row, width, channels, alpha);
+}
+
+const char* ScrimKernelName() {
+    return Scrim().name;
+}
+
+} // namespace piclab
@@ -0,0 +1,57 @@
+// piclab_kernels.h
+// Pixel kernels for the compositing stage. Every vector path is bit-exact with the scalar
+// reference in this header; runtime dispatch picks the widest one the CPU supports.
+
+#pragma once
+
+#include <cstdint>
+
+namespace piclab {
+
+// Exact round(x / 255) for x in [0, 255*255].
+static inline uint8_t Div255(uint32_t x) {
+    x += 128;
+    return (uint8_t)((x + (x >> 8)) >> 8);
+}
+
+// Source-over of a solid color with coverage alpha onto one straight-alpha pixel.
+static inline void BlendPixel(uint8_t* px, uint32_t channels,
+                              uint8_t r, uint8_t g, uint8_t b, uint8_t alpha) {
+    if (alpha == 0) return;
+    uint32_t inv = 255u - alpha;
+    if (channels == 3 || px[3] == 255) {
+        px[0] = Div255(r * alpha + px[0] * inv);
+        px[1] = Div255(g * alpha + px[1] * inv);
+        px[2] = Div255(b * alpha + px[2] * inv);
+        return;
+    }
+    // den/255 is the resulting alpha; colors are weighted by their share of it.
+    uint32_t da  = px[3];
+    uint32_t den = 255u * alpha + da * inv;
+    if (den == 0) return;
+    const uint8_t src[3] = { r, g, b };
+    for (int c = 0; c < 3; ++c) {
+        uint32_t num = 255u * src[c] * alpha + px[c] * da * inv;
+        px[c] = (uint8_t)((num + den / 2) / den);
+    }
+    px[3] = Div255(den);
+}
+
+// Reference scrim: black at alpha over every pixel of the row.
+static inline void ScrimRowReference(uint8_t* row, uint32_t width, uint32_t channels, uint8_t alpha) {
+    for (uint32_t x = 0; x < width; ++x, row += channels) BlendPixel(row, channels, 0, 0, 0, alpha);
+}
+
+// Dispatched scrim kernel. Opaque pixels take the vector path; translucent RGBA pixels fall
+// back to BlendPixel so the result always matches ScrimRowReference.
+void ScrimRow(uint8_t* row, uint32_t width, uint32_t channels, uint8_t alpha);
+
+// "avx2", "sse2", "neon" or "scalar".
+const char* ScrimKernelName();
+
+// Label text in one pass: per pixel, black at shadow[i]*shadowAlpha, then white at fill[i].
+// Same result as blending the whole shadow layer and then the whole fill layer.
+void LabelRow(uint8_t* px, uint32_t count, uint32_t channels,
+              const uint8_t* fill, const uint8_t* shadow, uint8_t shadowAlpha);
+
+} // namespace piclab
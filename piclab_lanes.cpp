@@ -0,0 +1,123 @@
+// piclab_lanes.cpp
+// Lane scheduler: one mutex, one condition variable and a FIFO of tickets per lane.
+
+#include "piclab_lanes.h"
+#include "piclab_pool.h"
+
+#include <chrono>
+
+namespace piclab {
+
+const wchar_t* LaneName(Lane lane) {
+    switch (lane) {
+    case Lane::kInteractive: return L"interactive";
+    case Lane::kBatch:       return L"batch";
+    case Lane::kBackground:  return L"background";
+    }
+    return L"?";
+}
+
+bool ParseLane(const std::wstring& name, Lane& out) {
+    for (size_t i = 0; i < kLaneCount; ++i) {
+        if (name == LaneName((Lane)i)) {
+            out = (Lane)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+double WaitPercentileMs(const LaneStats& stats, double p) {
+    uint64_t total = 0;
+    for (uint64_t n : stats.waitHistogram) total += n;
+    if (!total) return 0;
+    const uint64_t rank = (uint64_t)(p * (double)(total - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < kWaitBuckets; ++b) {
+        seen += stats.waitHistogram[b];
+        if (seen >= rank) return b + 1 < kWaitBuckets ? (double)(1u << b) : stats.maxWaitMs;
+    }
+    return stats.maxWaitMs;
+}
+
+LaneScheduler::LaneScheduler(unsigned slots) : slots_(slots ? slots : WorkPool::HardwareThreads()) {}
+
+bool LaneScheduler::HigherLaneWaiting(Lane lane) const {
+    for (size_t l = 0; l < (size_t)lane; ++l) {
+        if (!waiting_[l].empty()) return true;
+    }
+    return false;
+}
+
+void LaneScheduler::WaitForSlot(std::unique_lock<std::mutex>& lk, Lane lane, bool resume) {
+    std::deque<uint64_t>& queue = waiting_[(size_t)lane];
+    LaneStats& st = stats_[(size_t)lane];
+    const uint64_t ticket = nextTicket_++;
+    // An image that yielded has done part of its work; it goes ahead of the ones not yet started.
+    if (resume) queue.push_front(ticket);
+    else queue.push_back(ticket);
+    st.queued = queue.size();
+    if (st.queued > st.peakQueued) st.peakQueued = st.queued;
+
+    changed_.wait(lk, [&] { return busy_ < slots_ && queue.front() == ticket && !HigherLaneWaiting(lane); });
+    queue.pop_front();
+    st.queued = queue.size();
+    ++busy_;
+    ++st.running;
+    // The next in line (this lane or a lower one) may fit into another free slot.
+    changed_.notify_all();
+}
+
+void LaneScheduler::Acquire(Lane lane) {
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lk(mu_);
+    WaitForSlot(lk, lane, false);
+    LaneStats& st = stats_[(size_t)lane];
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    size_t b = 0;
+    while (b + 1 < kWaitBuckets && ms >= (double)(1u << b)) ++b;
+    ++st.waitHistogram[b];
+    if (ms > st.maxWaitMs) st.maxWaitMs = ms;
+    ++st.started;
+}
+
+void LaneScheduler::Release(Lane lane) {
+    std::lock_guard<std::mutex> lk(mu_);
+    --busy_;
+    --stats_[(size_t)lane].running;
+    changed_.notify_all();
+}
+
+void LaneScheduler::Yield(Lane lane) {
+    std::unique_lock<std::mutex> lk(mu_);
+    if (!HigherLaneWaiting(lane)) return;
+    LaneStats& st = stats_[(size_t)lane];
+    --busy_;
+    --st.running;
+    ++st.yields;
+    changed_.notify_all();
+    WaitForSlot(lk, lane, true);
+}
+
+LaneStats LaneScheduler::Stats(Lane lane) const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return stats_[(size_t)lane];
+}
+
+// Images entered on this thread and not yet left; the thread holds a slot while this is nonzero.
+static thread_local unsigned tlsEntered = 0;
+
+void LaneGate::Enter() {
+    if (tlsEntered++ == 0) scheduler_.Acquire(lane_);
+}
+
+void LaneGate::Leave() {
+    if (--tlsEntered == 0) scheduler_.Release(lane_);
+}
+
+void LaneGate::Checkpoint(SaveStage stage) {
+    (void)stage; // every boundary is a chance to step aside
+    if (lane_ != Lane::kInteractive) scheduler_.Yield(lane_);
+}
+
+} // namespace piclab
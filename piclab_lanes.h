@@ -0,0 +1,91 @@
+// piclab_lanes.h
+// Priority lanes for the service: every image of every client takes one of a fixed number of run
+// slots, granted to the interactive lane first, then batch, then background. A running image of a
+// lower lane gives its slot up at each stage boundary (after decode, composite and encode) when a
+// higher lane is waiting, so a relabel from the dialog waits for one stage of a bulk job, not for
+// the job.
+
+#pragma once
+
+#include "piclab_core.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace piclab {
+
+enum class Lane {
+    kInteractive, // someone is waiting on the result
+    kBatch,       // bulk runs and backfills
+    kBackground,  // re-optimizing already labeled files; runs only when nothing else wants a slot
+};
+const size_t kLaneCount = 3;
+
+const wchar_t* LaneName(Lane lane);
+// "interactive", "batch" or "background".
+bool ParseLane(const std::wstring& name, Lane& out);
+
+// Admission waits in powers of two: bucket b counts waits under 2^b ms, the last one the rest.
+const size_t kWaitBuckets = 18;
+
+struct LaneStats {
+    uint64_t queued{};     // images waiting for a slot now
+    uint64_t peakQueued{};
+    uint64_t running{};    // images holding a slot now
+    uint64_t started{};
+    uint64_t yields{};     // slots given up to a higher lane
+    uint64_t waitHistogram[kWaitBuckets]{};
+    double maxWaitMs{};
+};
+
+// Upper edge in ms of the histogram bucket holding the p-th fraction (0..1) of admission waits;
+// 0 when nothing has started yet.
+double WaitPercentileMs(const LaneStats& stats, double p);
+
+class LaneScheduler {
+public:
+    // slots == 0 uses every hardware thread.
+    explicit LaneScheduler(unsigned slots = 0);
+
+    // Blocks until an image of lane may start: a slot is free, no higher lane is waiting and it is
+    // first in its own lane. The wait goes into the lane's histogram.
+    void Acquire(Lane lane);
+    void Release(Lane lane);
+    // At a stage boundary: hands the slot to any waiting image of a higher lane and waits to get
+    // one back, ahead of everything still queued in its own lane. Free when nobody higher waits.
+    void Yield(Lane lane);
+
+    unsigned Slots() const { return slots_; }
+    LaneStats Stats(Lane lane) const;
+
+private:
+    void WaitForSlot(std::unique_lock<std::mutex>& lk, Lane lane, bool resume);
+    bool HigherLaneWaiting(Lane lane) const;
+
+    unsigned slots_;
+    unsigned busy_{0};
+    uint64_t nextTicket_{0};
+    mutable std::mutex mu_;
+    std::condition_variable changed_;
+    std::deque<uint64_t> waiting_[kLaneCount];
+    LaneStats stats_[kLaneCount];
+};
+
+// Runs every save of a batch in one lane. A pool thread waiting inside one image may pick up
+// another image of the same batch; that one runs on the slot the thread already holds.
+class LaneGate : public SaveGate {
+public:
+    LaneGate(LaneScheduler& scheduler, Lane lane) : scheduler_(scheduler), lane_(lane) {}
+    void Enter() override;
+    void Checkpoint(SaveStage stage) override;
+    void Leave() override;
+
+private:
+    LaneScheduler& scheduler_;
+    Lane lane_;
+};
+
+} // namespace piclab
@@ -0,0 +1,25 @@
+// piclab_main.cpp
+// Headless entry point for non-Windows builds: same labeling core and command line, no dialogs.
+// See piclab_cli.cpp for options.
+//
+// Build:
+//   g++ -O2 -std=c++17 piclab_main.cpp piclab_cli.cpp piclab_core.cpp piclab_png.cpp
+//       piclab_font.cpp piclab_io.cpp piclab_pool.cpp piclab_inflate.cpp piclab_deflate.cpp
+//       piclab_checksum.cpp piclab_kernels.cpp piclab_filters.cpp piclab_bench.cpp piclab_cpu.cpp
+//       piclab_codecs.cpp piclab_qoi.cpp piclab_pam.cpp piclab_ipc.cpp piclab_service.cpp
+//       piclab_instance.cpp piclab_lanes.cpp piclab_cache.cpp piclab_watch.cpp -lz -pthread -o piclab
+//   Optional lossless JPEG labeling: add -DPICLAB_HAVE_LIBJPEG piclab_jpeg.cpp -ljpeg
+
+#include "piclab_cli.h"
+#include "piclab_io.h"
+
+#include <clocale>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+    setlocale(LC_ALL, "");
+    std::vector<std::wstring> args;
+    for (int i = 1; i < argc; ++i) args.push_back(piclab::FromUtf8(argv[i]));
+    return piclab::RunHeadless(args, nullptr);
+}
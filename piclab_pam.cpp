@@ -0,0 +1,169 @@
+// piclab_pam.cpp
+// PAM reader and writer (netpbm.sourceforge.net/doc/pam.html), 8-bit samples only.
+
+#include "piclab_pam.h"
+#include "piclab_io.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace piclab {
+
+bool IsPam(const uint8_t* data, size_t size) {
+    return size >= 3 && data[0] == 'P' && data[1] == '7' && (data[2] == '\n' || data[2] == '\r' || data[2] == ' ');
+}
+
+struct PamHeader {
+    uint32_t width{}, height{}, depth{}, maxval{};
+    size_t dataOffset{};
+};
+
+// Parses "KEY value" lines up to ENDHDR. Comments start with '#'; TUPLTYPE is implied by DEPTH.
+static bool ParsePamHeader(const uint8_t* data, size_t size, PamHeader& h, std::wstring& outError) {
+    if (!IsPam(data, size)) {
+        outError = L"Not a PAM file.";
+        return false;
+    }
+    size_t pos = 3;
+    bool ended = false;
+    while (pos < size && !ended) {
+        size_t eol = pos;
+        while (eol < size && data[eol] != '\n') ++eol;
+        std::string line(reinterpret_cast<const char*>(data + pos), eol - pos);
+        pos = eol + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        const size_t sp = line.find(' ');
+        const std::string key = line.substr(0, sp);
+        const uint32_t value = sp == std::string::npos ? 0 : (uint32_t)strtoul(line.c_str() + sp + 1, nullptr, 10);
+        if (key == "ENDHDR") ended = true;
+        else if (key == "WIDTH") h.width = value;
+        else if (key == "HEIGHT") h.height = value;
+        else if (key == "DEPTH") h.depth = value;
+        else if (key == "MAXVAL") h.maxval = value;
+    }
+    if (!ended || h.width == 0 || h.height == 0 || h.depth < 1 || h.depth > 4) {
+        outError = L"Unsupported PAM header.";
+        return false;
+    }
+    if (h.maxval != 255) {
+        outError = L"Only 8-bit PAM files are supported.";
+        return false;
+    }
+    h.dataOffset = pos;
+    if ((uint64_t)(size - std::min(size, pos)) < (uint64_t)h.width * h.height * h.depth) {
+        outError = L"PAM data is truncated.";
+        return false;
+    }
+    return true;
+}
+
+bool DecodePam(const uint8_t* data, size_t size, Image& out, std::wstring& outError) {
+    PamHeader h;
+    if (!ParsePamHeader(data, size, h, outError)) return false;
+    const bool alpha = h.depth == 2 || h.depth == 4;
+    const bool gray = h.depth <= 2;
+    out.width = h.width;
+    out.height = h.height;
+    out.channels = alpha ? 4 : 3;
+    out.pixels.resize(out.Stride() * out.height);
+    const uint8_t* src = data + h.dataOffset;
+    if (h.depth == out.channels) {
+        memcpy(out.pixels.data(), src, out.pixels.size());
+        return true;
+    }
+    uint8_t* dst = out.pixels.data();
+    for (uint64_t i = 0, n = (uint64_t)h.width * h.height; i < n; ++i, src += h.depth, dst += out.channels) {
+        dst[0] = src[0];
+        dst[1] = gray ? src[0] : src[1];
+        dst[2] = gray ? src[0] : src[2];
+        if (alpha) dst[3] = src[h.depth - 1];
+    }
+    return true;
+}
+
+bool VerifyPamFile(const std::wstring& path, std::wstring& outError) {
+    MappedFile file;
+    if (!file.Open(path, outError)) return false;
+    PamHeader h;
+    if (!ParsePamHeader(file.Data(), file.Size(), h, outError)) return false;
+    if (file.Size() - h.dataOffset != (uint64_t)h.width * h.height * h.depth) {
+        outError = L"PAM has data after the last row.";
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+class PamRowWriter : public RowWriter {
+public:
+    ~PamRowWriter() override {
+        if (f_) fclose(f_);
+    }
+
+    bool Open(const std::wstring& path, uint32_t width, uint32_t height, uint32_t channels, std::wstring& outError) {
+        if (channels != 3 && channels != 4) {
+            outError = L"PAM output needs RGB or RGBA rows.";
+            return false;
+        }
+        f_ = OpenFile(path, L"wb");
+        if (!f_) {
+            outError = L"Cannot create output file.";
+            return false;
+        }
+        setvbuf(f_, nullptr, _IOFBF, (size_t)1 << 20);
+        rowBytes_ = (size_t)width * channels;
+        height_ = height;
+        char header[160];
+        int n = snprintf(header, sizeof(header), "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %u\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                         width, height, channels, channels == 4 ? "RGB_ALPHA" : "RGB");
+        return Put(header, (size_t)n, outError);
+    }
+
+    bool WriteRow(const uint8_t* row, std::wstring& outError) override {
+        if (y_ == height_) {
+            outError = L"Too many rows for the PAM header.";
+            return false;
+        }
+        ++y_;
+        return Put(row, rowBytes_, outError);
+    }
+
+    bool Finish(std::wstring& outError) override {
+        if (y_ != height_) {
+            outError = L"Too few rows for the PAM header.";
+            return false;
+        }
+        bool ok = fclose(f_) == 0;
+        f_ = nullptr;
+        if (!ok) outError = L"Write error.";
+        return ok;
+    }
+
+private:
+    bool Put(const void* p, size_t n, std::wstring& outError) {
+        if (fwrite(p, 1, n, f_) == n) return true;
+        outError = L"Write error.";
+        return false;
+    }
+
+    FILE* f_{};
+    size_t rowBytes_{};
+    uint32_t height_{}, y_{};
+};
+
+} // namespace
+
+std::unique_ptr<RowWriter> CreatePamRowWriter(const std::wstring& path, uint32_t width, uint32_t height,
+                                              uint32_t channels, std::wstring& outError) {
+    std::unique_ptr<PamRowWriter> w(new PamRowWriter());
+    if (!w->Open(path, width, height, channels, outError)) return nullptr;
+    return std::unique_ptr<RowWriter>(w.release());
+}
+
+} // namespace piclab
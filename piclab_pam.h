@@ -0,0 +1,25 @@
+// piclab_pam.h
+// Netpbm PAM (P7) with MAXVAL 255: a short text header followed by the raw rows. Nothing to
+// compress, so it is the cheapest way to hand pixels to another tool.
+
+#pragma once
+
+#include "piclab_core.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace piclab {
+
+bool IsPam(const uint8_t* data, size_t size);
+// Reads DEPTH 1-4 (GRAYSCALE, GRAYSCALE_ALPHA, RGB, RGB_ALPHA); output is RGB8 or RGBA8.
+bool DecodePam(const uint8_t* data, size_t size, Image& out, std::wstring& outError);
+// Writes TUPLTYPE RGB or RGB_ALPHA for 3 or 4 channels.
+std::unique_ptr<RowWriter> CreatePamRowWriter(const std::wstring& path, uint32_t width, uint32_t height,
+                                              uint32_t channels, std::wstring& outError);
+// Header parses and the file holds exactly the rows it announces.
+bool VerifyPamFile(const std::wstring& path, std::wstring& outError);
+
+} // namespace piclab
@@ -0,0 +1,1496 @@
+// piclab_png.cpp
+// PNG decode/encode for the portable backend.
+
+#include "piclab_png.h"
+#include "piclab_checksum.h"
+#include "piclab_deflate.h"
+#include "piclab_filters.h"
+#include "piclab_inflate.h"
+#include "piclab_io.h"
+#include "piclab_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+namespace piclab {
+
+static const uint8_t kSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+// ----------------------------- Helpers -----------------------------
+
+static uint32_t ReadBE32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void WriteBE32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+struct PngHeader {
+    uint32_t width{};
+    uint32_t height{};
+    uint8_t bitDepth{};
+    uint8_t colorType{};
+    uint8_t interlace{};
+};
+
+static uint32_t SamplesPerPixel(uint8_t colorType) {
+    switch (colorType) {
+    case 0: return 1; // gray
+    case 2: return 3; // RGB
+    case 3: return 1; // palette
+    case 4: return 2; // gray + alpha
+    case 6: return 4; // RGBA
+    }
+    return 0;
+}
+
+static size_t RowBytes(const PngHeader& h, uint32_t width) {
+    return ((size_t)width * SamplesPerPixel(h.colorType) * h.bitDepth + 7) / 8;
+}
+
+// Byte distance to the "left" pixel used by the filters.
+static size_t FilterBpp(const PngHeader& h) {
+    return std::max<size_t>(1, SamplesPerPixel(h.colorType) * h.bitDepth / 8);
+}
+
+static bool ValidHeader(const PngHeader& h) {
+    if (h.width == 0 || h.height == 0 || h.width > 0x7FFFFFFFu || h.height > 0x7FFFFFFFu) return false;
+    if (h.interlace > 1) return false;
+    switch (h.colorType) {
+    case 0: return h.bitDepth == 1 || h.bitDepth == 2 || h.bitDepth == 4 || h.bitDepth == 8 || h.bitDepth == 16;
+    case 3: return h.bitDepth == 1 || h.bitDepth == 2 || h.bitDepth == 4 || h.bitDepth == 8;
+    case 2: case 4: case 6: return h.bitDepth == 8 || h.bitDepth == 16;
+    }
+    return false;
+}
+
+// ----------------------------- Decode -----------------------------
+
+struct PngPalette {
+    uint8_t rgba[256][4];
+    uint32_t count{};
+    bool hasTrns{};
+    uint16_t trnsGray{};
+    uint16_t trnsRgb[3]{};
+};
+
+static inline uint32_t Sample(const uint8_t* src, size_t i, uint8_t bitDepth) {
+    switch (bitDepth) {
+    case 8:  return src[i];
+    case 16: return ((uint32_t)src[2 * i] << 8) | src[2 * i + 1];
+    default: {
+        size_t bit = i * bitDepth;
+        uint32_t shift = 8 - bitDepth - (uint32_t)(bit & 7);
+        return (src[bit >> 3] >> shift) & ((1u << bitDepth) - 1);
+    }
+    }
+}
+
+static inline uint8_t To8(uint32_t v, uint8_t bitDepth) {
+    switch (bitDepth) {
+    case 1:  return (uint8_t)(v * 255);
+    case 2:  return (uint8_t)(v * 85);
+    case 4:  return (uint8_t)(v * 17);
+    case 16: return (uint8_t)(v >> 8);
+    default: return (uint8_t)v;
+    }
+}
+
+// Expands one unfiltered row of width pixels to RGB8/RGBA8, writing every xstep-th output pixel.
+static void ConvertRow(const PngHeader& h, const PngPalette& pal, const uint8_t* src, uint32_t width,
+                       uint8_t* dst, uint32_t channels, uint32_t xstep) {
+    const uint8_t bd = h.bitDepth;
+    const size_t step = (size_t)channels * xstep;
+    for (uint32_t x = 0; x < width; ++x, dst += step) {
+        uint8_t r, g, b, a = 255;
+        switch (h.colorType) {
+        case 0: {
+            uint32_t v = Sample(src, x, bd);
+            r = g = b = To8(v, bd);
+            if (pal.hasTrns && v == pal.trnsGray) a = 0;
+            break;
+        }
+        case 2: {
+            uint32_t vr = Sample(src, 3 * (size_t)x, bd), vg = Sample(src, 3 * (size_t)x + 1, bd),
+                     vb = Sample(src, 3 * (size_t)x + 2, bd);
+            r = To8(vr, bd); g = To8(vg, bd); b = To8(vb, bd);
+            if (pal.hasTrns && vr == pal.trnsRgb[0] && vg == pal.trnsRgb[1] && vb == pal.trnsRgb[2]) a = 0;
+            break;
+        }
+        case 3: {
+            uint32_t idx = Sample(src, x, bd);
+            const uint8_t* e = pal.rgba[idx];
+            r = e[0]; g = e[1]; b = e[2]; a = e[3];
+            break;
+        }
+        case 4:
+            r = g = b = To8(Sample(src, 2 * (size_t)x, bd), bd);
+            a = To8(Sample(src, 2 * (size_t)x + 1, bd), bd);
+            break;
+        default:
+            r = To8(Sample(src, 4 * (size_t)x, bd), bd);
+            g = To8(Sample(src, 4 * (size_t)x + 1, bd), bd);
+            b = To8(Sample(src, 4 * (size_t)x + 2, bd), bd);
+            a = To8(Sample(src, 4 * (size_t)x + 3, bd), bd);
+            break;
+        }
+        dst[0] = r; dst[1] = g; dst[2] = b;
+        if (channels == 4) dst[3] = a;
+    }
+}
+
+struct PassInfo { uint32_t x0, y0, dx, dy; };
+static const PassInfo kAdam7[7] = {
+    { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+    { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 },
+};
+static const PassInfo kNoInterlace = { 0, 0, 1, 1 };
+
+static uint32_t PassExtent(uint32_t size, uint32_t start, uint32_t step) {
+    return size > start ? (size - start + step - 1) / step : 0;
+}
+
+static void ResetPalette(PngPalette& pal) {
+    pal = PngPalette{};
+    for (int i = 0; i < 256; ++i) { pal.rgba[i][0] = pal.rgba[i][1] = pal.rgba[i][2] = 0; pal.rgba[i][3] = 255; }
+}
+
+static uint32_t OutputChannels(const PngHeader& h, const PngPalette& pal) {
+    return (h.colorType == 4 || h.colorType == 6 || pal.hasTrns) ? 4 : 3;
+}
+
+// IHDR, PLTE and tRNS: the chunks ahead of IDAT that decide how rows are expanded.
+static bool IsInfoChunk(const uint8_t* type) {
+    return memcmp(type, "IHDR", 4) == 0 || memcmp(type, "PLTE", 4) == 0 || memcmp(type, "tRNS", 4) == 0;
+}
+
+static bool ReadInfoChunk(const uint8_t* type, const uint8_t* body, uint32_t len,
+                          PngHeader& h, PngPalette& pal, bool& haveHeader, std::wstring& outError) {
+    if (memcmp(type, "IHDR", 4) == 0) {
+        if (len != 13) {
+            outError = L"Unsupported PNG header.";
+            return false;
+        }
+        h.width = ReadBE32(body);
+        h.height = ReadBE32(body + 4);
+        h.bitDepth = body[8];
+        h.colorType = body[9];
+        h.interlace = body[12];
+        if (body[10] != 0 || body[11] != 0 || !ValidHeader(h)) {
+            outError = L"Unsupported PNG header.";
+            return false;
+        }
+        haveHeader = true;
+    } else if (memcmp(type, "PLTE", 4) == 0) {
+        pal.count = std::min<uint32_t>(256, len / 3);
+        for (uint32_t i = 0; i < pal.count; ++i) {
+            pal.rgba[i][0] = body[3 * i]; pal.rgba[i][1] = body[3 * i + 1]; pal.rgba[i][2] = body[3 * i + 2];
+        }
+    } else if (memcmp(type, "tRNS", 4) == 0) {
+        pal.hasTrns = true;
+        if (h.colorType == 3) {
+            for (uint32_t i = 0; i < std::min<uint32_t>(256, len); ++i) pal.rgba[i][3] = body[i];
+        } else if (h.colorType == 0 && len >= 2) {
+            pal.trnsGray = (uint16_t)((body[0] << 8) | body[1]);
+        } else if (h.colorType == 2 && len >= 6) {
+            for (int c = 0; c < 3; ++c) pal.trnsRgb[c] = (uint16_t)((body[2 * c] << 8) | body[2 * c + 1]);
+        } else {
+            pal.hasTrns = false;
+        }
+    }
+    return true;
+}
+
+bool IsPng(const uint8_t* data, size_t size) {
+    return size >= 8 && memcmp(data, kSignature, 8) == 0;
+}
+
+bool ReadPngSize(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height) {
+    if (size < 24 || !IsPng(data, size) || memcmp(data + 12, "IHDR", 4) != 0) return false;
+    width = ReadBE32(data + 16);
+    height = ReadBE32(data + 20);
+    return true;
+}
+
+// Inflates a large stream on the pool into exactly raw.size() bytes.
+static bool InflateParallel(const DeflateSource& src, WorkPool& pool, std::vector<uint8_t>& raw,
+                            std::wstring& outError) {
+    ParallelInflater inflater(src, pool);
+    InflatedPiece piece;
+    size_t pos = 0;
+    do {
+        if (!inflater.Next(piece, outError)) return false;
+        if (piece.data.size() > raw.size() - pos) {
+            outError = L"PNG image data is corrupt.";
+            return false;
+        }
+        if (!piece.data.empty()) memcpy(raw.data() + pos, piece.data.data(), piece.data.size());
+        pos += piece.data.size();
+    } while (!piece.last);
+    if (pos != raw.size()) {
+        outError = L"PNG image data is truncated.";
+        return false;
+    }
+    return true;
+}
+
+// Parses the chunks and inflates all image data: the still filtered scanlines of every pass.
+static bool InflateImageData(const uint8_t* data, size_t size, PngHeader& h, PngPalette& pal,
+                             std::vector<uint8_t>& raw, std::wstring& outError) {
+    if (!IsPng(data, size)) {
+        outError = L"Not a PNG file.";
+        return false;
+    }
+
+    ResetPalette(pal);
+    bool haveHeader = false, sawIend = false;
+    DeflateSource idat(data);
+
+    size_t pos = 8;
+    while (pos + 12 <= size) {
+        uint32_t len = ReadBE32(data + pos);
+        const uint8_t* type = data + pos + 4;
+        if (len > size - pos - 12) {
+            outError = L"PNG chunk runs past end of file.";
+            return false;
+        }
+        const uint8_t* body = data + pos + 8;
+        uint32_t crc = Crc32(0, type, len + 4);
+        if (crc != ReadBE32(body + len)) {
+            outError = L"PNG chunk CRC mismatch.";
+            return false;
+        }
+        pos += 12 + (size_t)len;
+
+        if (IsInfoChunk(type)) {
+            if (!ReadInfoChunk(type, body, len, h, pal, haveHeader, outError)) return false;
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            idat.Add((size_t)(body - data), len);
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            sawIend = true;
+            break;
+        } else if (!(type[0] & 0x20)) {
+            outError = L"Unknown critical PNG chunk.";
+            return false;
+        }
+    }
+    if (!haveHeader || idat.Size() == 0) {
+        outError = L"PNG is missing IHDR or IDAT.";
+        return false;
+    }
+    (void)sawIend; // tolerate a missing IEND like most decoders
+
+    const PassInfo* passes = h.interlace ? kAdam7 : &kNoInterlace;
+    const int passCount = h.interlace ? 7 : 1;
+    size_t rawSize = 0;
+    for (int p = 0; p < passCount; ++p) {
+        uint32_t pw = PassExtent(h.width, passes[p].x0, passes[p].dx);
+        uint32_t ph = PassExtent(h.height, passes[p].y0, passes[p].dy);
+        if (pw && ph) rawSize += (size_t)ph * (1 + RowBytes(h, pw));
+    }
+
+    raw.resize(rawSize);
+    WorkPool* pool = WorkPool::Current();
+    if (pool && pool->Size() > 1 && idat.Size() >= kParallelInflateAbove) {
+        return InflateParallel(idat, *pool, raw, outError);
+    }
+
+    std::vector<uint8_t> joined((size_t)idat.Size());
+    idat.Read(0, joined.data(), joined.size());
+    z_stream zs{};
+    if (inflateInit(&zs) != Z_OK) {
+        outError = L"zlib init failed.";
+        return false;
+    }
+    // zlib counts in 32 bits, so images past 4 GB are handed over a slice at a time.
+    zs.next_in = joined.data();
+    zs.next_out = raw.data();
+    size_t inLeft = joined.size(), outLeft = raw.size();
+    int zr;
+    do {
+        if (zs.avail_in == 0) {
+            zs.avail_in = (uInt)std::min<size_t>(inLeft, UINT_MAX);
+            inLeft -= zs.avail_in;
+        }
+        if (zs.avail_out == 0) {
+            zs.avail_out = (uInt)std::min<size_t>(outLeft, UINT_MAX);
+            outLeft -= zs.avail_out;
+        }
+        zr = inflate(&zs, Z_NO_FLUSH);
+    } while (zr == Z_OK);
+    inflateEnd(&zs);
+    if (zr != Z_STREAM_END || zs.avail_out != 0 || outLeft != 0) {
+        outError = zr == Z_BUF_ERROR || zr == Z_STREAM_END ? L"PNG image data is truncated."
+                                                           : L"PNG image data is corrupt.";
+        return false;
+    }
+    return true;
+}
+
+bool DecodePng(const uint8_t* data, size_t size, Image& out, std::wstring& outError) {
+    PngHeader h;
+    PngPalette pal;
+    std::vector<uint8_t> raw;
+    if (!InflateImageData(data, size, h, pal, raw, outError)) return false;
+
+    const PassInfo* passes = h.interlace ? kAdam7 : &kNoInterlace;
+    const int passCount = h.interlace ? 7 : 1;
+    out.width = h.width;
+    out.height = h.height;
+    out.channels = OutputChannels(h, pal);
+    out.pixels.assign(out.Stride() * out.height, 0);
+
+    const size_t bpp = FilterBpp(h);
+    uint8_t* cur = raw.data();
+    for (int p = 0; p < passCount; ++p) {
+        const PassInfo& P = passes[p];
+        uint32_t pw = PassExtent(h.width, P.x0, P.dx);
+        uint32_t ph = PassExtent(h.height, P.y0, P.dy);
+        if (!pw || !ph) continue;
+        size_t rb = RowBytes(h, pw);
+        const uint8_t* prev = nullptr;
+        for (uint32_t y = 0; y < ph; ++y) {
+            uint8_t* row = cur + 1;
+            if (!UnfilterRow(cur[0], row, prev, rb, bpp)) {
+                outError = L"PNG row has an invalid filter type.";
+                return false;
+            }
+            uint8_t* dst = out.Row(P.y0 + y * P.dy) + (size_t)P.x0 * out.channels;
+            ConvertRow(h, pal, row, pw, dst, out.channels, P.dx);
+            prev = row;
+            cur += 1 + rb;
+        }
+    }
+    return true;
+}
+
+bool InflatePngScanlines(const uint8_t* data, size_t size, PngScanlines& out, std::wstring& outError) {
+    PngHeader h;
+    PngPalette pal;
+    if (!InflateImageData(data, size, h, pal, out.data, outError)) return false;
+    if (h.interlace) {
+        outError = L"Interlaced PNGs have no plain scanlines.";
+        return false;
+    }
+    out.width = h.width;
+    out.height = h.height;
+    out.rowBytes = RowBytes(h, h.width);
+    out.bpp = FilterBpp(h);
+    return true;
+}
+
+// ----------------------------- Verify -----------------------------
+
+namespace {
+
+// Follows the inflated bytes of every pass and checks the filter type at each scanline start, so
+// row count and row layout are confirmed without unfiltering anything.
+class ScanlineWalk {
+public:
+    explicit ScanlineWalk(const PngHeader& h) {
+        const PassInfo* passes = h.interlace ? kAdam7 : &kNoInterlace;
+        const int passCount = h.interlace ? 7 : 1;
+        for (int p = 0; p < passCount; ++p) {
+            uint32_t pw = PassExtent(h.width, passes[p].x0, passes[p].dx);
+            uint32_t ph = PassExtent(h.height, passes[p].y0, passes[p].dy);
+            if (!pw || !ph) continue;
+            size_t stride = 1 + RowBytes(h, pw);
+            passes_.push_back({ ph, stride });
+            expected_ += (uint64_t)ph * stride;
+        }
+    }
+
+    uint64_t Expected() const { return expected_; }
+    uint64_t Seen() const { return seen_; }
+
+    bool Feed(const uint8_t* p, size_t n, std::wstring& outError) {
+        if (n > expected_ - seen_) {
+            outError = L"PNG image data has more rows than the header.";
+            return false;
+        }
+        while (pass_ < passes_.size() && nextRow_ < seen_ + n) {
+            if (p[nextRow_ - seen_] > 4) {
+                outError = L"PNG scanline has an invalid filter type.";
+                return false;
+            }
+            nextRow_ += passes_[pass_].second;
+            if (++row_ == passes_[pass_].first) {
+                ++pass_;
+                row_ = 0;
+            }
+        }
+        seen_ += n;
+        return true;
+    }
+
+private:
+    std::vector<std::pair<uint32_t, size_t>> passes_; // rows and bytes per row, filter byte included
+    uint64_t expected_{0};
+    uint64_t seen_{0};
+    uint64_t nextRow_{0}; // stream offset of the next filter byte
+    size_t pass_{0};
+    uint32_t row_{0};
+};
+
+} // namespace
+
+bool VerifyPng(const uint8_t* data, size_t size, std::wstring& outError) {
+    if (!IsPng(data, size)) {
+        outError = L"Not a PNG file.";
+        return false;
+    }
+
+    // Stricter than decoding: IHDR first, IDATs in one run and IEND as the very last bytes.
+    PngHeader h;
+    PngPalette pal;
+    bool haveHeader = false, sawIend = false, idatDone = false;
+    DeflateSource idat(data);
+    size_t pos = 8;
+    while (pos < size) {
+        if (size - pos < 12) {
+            outError = L"PNG ends inside a chunk.";
+            return false;
+        }
+        uint32_t len = ReadBE32(data + pos);
+        const uint8_t* type = data + pos + 4;
+        if (len > size - pos - 12) {
+            outError = L"PNG chunk runs past end of file.";
+            return false;
+        }
+        const uint8_t* body = data + pos + 8;
+        if (Crc32(0, type, len + 4) != ReadBE32(body + len)) {
+            outError = L"PNG chunk CRC mismatch.";
+            return false;
+        }
+        pos += 12 + (size_t)len;
+
+        if (!haveHeader && memcmp(type, "IHDR", 4) != 0) {
+            outError = L"PNG does not start with IHDR.";
+            return false;
+        }
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (haveHeader) {
+                outError = L"PNG has more than one IHDR.";
+                return false;
+            }
+            if (!ReadInfoChunk(type, body, len, h, pal, haveHeader, outError)) return false;
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            if (idatDone) {
+                outError = L"PNG image data is split by other chunks.";
+                return false;
+            }
+            idat.Add((size_t)(body - data), len);
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            sawIend = true;
+            break;
+        } else if (!(type[0] & 0x20) && memcmp(type, "PLTE", 4) != 0) {
+            outError = L"Unknown critical PNG chunk.";
+            return false;
+        } else if (idat.Size() != 0) {
+            idatDone = true;
+        }
+    }
+    if (!sawIend || pos != size) {
+        outError = sawIend ? L"PNG has data after IEND." : L"PNG is missing IEND.";
+        return false;
+    }
+    if (idat.Size() == 0) {
+        outError = L"PNG has no image data.";
+        return false;
+    }
+
+    ScanlineWalk walk(h);
+    WorkPool* pool = WorkPool::Current();
+    if (pool && pool->Size() > 1 && idat.Size() >= kParallelInflateAbove) {
+        ParallelInflater inflater(idat, *pool);
+        InflatedPiece piece;
+        do {
+            if (!inflater.Next(piece, outError)) return false;
+            if (!walk.Feed(piece.data.data(), piece.data.size(), outError)) return false;
+        } while (!piece.last);
+    } else {
+        // Inflated into a small buffer that is overwritten as it goes; zlib checks the Adler-32.
+        z_stream zs{};
+        if (inflateInit(&zs) != Z_OK) {
+            outError = L"zlib init failed.";
+            return false;
+        }
+        std::vector<uint8_t> scratch((size_t)1 << 16);
+        const auto& segments = idat.Segments();
+        int zr = Z_OK;
+        bool trailing = false;
+        for (size_t i = 0; i < segments.size() && zr != Z_STREAM_END; ++i) {
+            zs.next_in = const_cast<uint8_t*>(data + segments[i].first);
+            zs.avail_in = segments[i].second;
+            do {
+                zs.next_out = scratch.data();
+                zs.avail_out = (uInt)scratch.size();
+                zr = inflate(&zs, Z_NO_FLUSH);
+                if (zr != Z_OK && zr != Z_STREAM_END && zr != Z_BUF_ERROR) break;
+                if (!walk.Feed(scratch.data(), scratch.size() - zs.avail_out, outError)) {
+                    inflateEnd(&zs);
+                    return false;
+                }
+            } while (zr == Z_OK && (zs.avail_in != 0 || zs.avail_out == 0));
+            if (zr == Z_STREAM_END) trailing = zs.avail_in != 0 || i + 1 < segments.size();
+            if (zr != Z_OK && zr != Z_STREAM_END && zr != Z_BUF_ERROR) break;
+        }
+        inflateEnd(&zs);
+        if (zr != Z_STREAM_END) {
+            outError = zr == Z_OK || zr == Z_BUF_ERROR ? L"PNG image data is truncated."
+                                                       : L"PNG image data is corrupt.";
+            return false;
+        }
+        if (trailing) {
+            outError = L"PNG has data after the end of the image stream.";
+            return false;
+        }
+    }
+    if (walk.Seen() != walk.Expected()) {
+        outError = L"PNG image data is truncated.";
+        return false;
+    }
+    return true;
+}
+
+bool VerifyPngFile(const std::wstring& path, std::wstring& outError) {
+    MappedFile file;
+    if (!file.Open(path, outError)) return false;
+    return VerifyPng(file.Data(), file.Size(), outError);
+}
+
+// ----------------------------- Streaming decode -----------------------------
+
+namespace {
+
+// What a splice writer needs from the reader: where the last deflate block before the kept rows
+// ends, the checksum and window up to there, and the raw bytes between it and the first new row.
+struct PngSplice {
+    std::shared_ptr<MappedFile> source;
+    std::vector<std::pair<size_t, uint32_t>> idat; // offset and length of each IDAT body in source
+    uint64_t keepRawBytes{0}; // filtered bytes of the kept rows, filter bytes included
+    uint64_t bitPos{0};       // compressed bits before the boundary, zlib header included
+    uint64_t rawPos{0};       // raw bytes before the boundary
+    uLong adler{1};           // Adler-32 of those raw bytes
+    uint64_t tailStart{0};    // raw offset of tail[0]
+    std::vector<uint8_t> tail;
+};
+
+// Walks the IDAT chunks of a mapped file and inflates exactly one scanline per ReadRow, so memory
+// stays at a couple of rows plus the zlib window no matter how tall the image is.
+class PngRowReader : public RowReader {
+public:
+    ~PngRowReader() override {
+        if (zInit_) inflateEnd(&zs_);
+        inflater_.reset();
+        if (pool_) pool_->Wait(crcGroup_);
+    }
+
+    bool Open(const std::wstring& path, std::wstring& outError);
+    bool Interlaced() const { return h_.interlace != 0; }
+    // Raw rows are already RGB8/RGBA8.
+    bool RawIsOutput() const {
+        return h_.bitDepth == 8 && (h_.colorType == 6 || (h_.colorType == 2 && !pal_.hasTrns));
+    }
+    // ... and nothing has been read yet.
+    bool CanSplice() const { return RawIsOutput() && y_ == 0; }
+    std::shared_ptr<PngSplice> StartSplice(uint32_t keepRows);
+
+    uint32_t Width() const override { return h_.width; }
+    uint32_t Height() const override { return h_.height; }
+    uint32_t Channels() const override { return channels_; }
+    bool ReadRow(uint8_t* dst, std::wstring& outError) override;
+    int SourceFilter(uint32_t y) const override { return y < filters_.size() ? filters_[y] : -1; }
+
+private:
+    bool StartParallel();
+    bool FinishChunk(std::wstring& outError);
+    bool Refill(std::wstring& outError);
+    bool InflateRow(std::wstring& outError);
+    bool ReadPieces(std::wstring& outError);
+    void Tap(const uint8_t* out, size_t produced, size_t consumed);
+    void TapPiece();
+    void MarkBoundary(uint64_t bitPos, uint64_t rawPos, uLong adler);
+
+    std::shared_ptr<MappedFile> file_;
+    const uint8_t* data_{};
+    size_t size_{0};
+    size_t pos_{0};
+    PngHeader h_;
+    PngPalette pal_;
+    uint32_t channels_{3};
+    z_stream zs_{};
+    bool zInit_{false};
+    uint32_t chunkLeft_{0}; // unread body bytes of the current IDAT
+    uint32_t chunkCrc_{0};
+    size_t rowBytes_{0};
+    size_t bpp_{1};
+    uint32_t y_{0};
+    std::vector<uint8_t> cur_, prev_;
+    std::vector<uint8_t> filters_; // stored filter type of each row read, when raw rows are RGB8/RGBA8
+    std::pair<size_t, uint32_t> firstIdat_;
+    std::shared_ptr<PngSplice> splice_;
+    uint64_t inTotal_{0};  // compressed bytes consumed
+    uint64_t outTotal_{0}; // raw bytes produced
+
+    // Parallel mode: all IDAT bodies at once, inflated in pieces on the pool.
+    WorkPool* pool_{nullptr};
+    DeflateSource idat_;
+    std::unique_ptr<ParallelInflater> inflater_;
+    InflatedPiece piece_;
+    size_t piecePos_{0};
+    TaskGroup crcGroup_;
+    std::atomic<bool> crcBad_{false};
+};
+
+bool PngRowReader::Open(const std::wstring& path, std::wstring& outError) {
+    file_ = std::make_shared<MappedFile>();
+    if (!file_->Open(path, outError)) return false;
+    data_ = file_->Data();
+    size_ = file_->Size();
+    if (!IsPng(data_, size_)) {
+        outError = L"Failed to load image. Is it a valid PNG?";
+        return false;
+    }
+
+    ResetPalette(pal_);
+    bool haveHeader = false;
+    pos_ = 8;
+    for (;;) {
+        if (size_ - pos_ < 12) {
+            outError = L"PNG is missing IHDR or IDAT.";
+            return false;
+        }
+        uint32_t len = ReadBE32(data_ + pos_);
+        const uint8_t* type = data_ + pos_ + 4;
+        // Checked before IDAT too: the first one's length bounds every row read after Open.
+        if (len > size_ - pos_ - 12) {
+            outError = L"PNG chunk runs past end of file.";
+            return false;
+        }
+        if (memcmp(type, "IDAT", 4) == 0) {
+            chunkLeft_ = len;
+            chunkCrc_ = Crc32(0, type, 4);
+            pos_ += 8;
+            firstIdat_ = { pos_, len };
+            break;
+        }
+        if (memcmp(type, "IEND", 4) == 0) {
+            outError = L"PNG is missing IHDR or IDAT.";
+            return false;
+        }
+        const uint8_t* body = type + 4;
+        if (Crc32(0, type, len + 4) != ReadBE32(body + len)) {
+            outError = L"PNG chunk CRC mismatch.";
+            return false;
+        }
+        pos_ += 12 + (size_t)len;
+        if (IsInfoChunk(type)) {
+            if (!ReadInfoChunk(type, body, len, h_, pal_, haveHeader, outError)) return false;
+        } else if (!(type[0] & 0x20)) {
+            outError = L"Unknown critical PNG chunk.";
+            return false;
+        }
+    }
+    if (!haveHeader) {
+        outError = L"PNG is missing IHDR or IDAT.";
+        return false;
+    }
+
+    channels_ = OutputChannels(h_, pal_);
+    rowBytes_ = RowBytes(h_, h_.width);
+    bpp_ = FilterBpp(h_);
+    cur_.resize(1 + rowBytes_);
+    prev_.resize(1 + rowBytes_);
+    if (StartParallel()) return true;
+    if (inflateInit(&zs_) != Z_OK) {
+        outError = L"zlib init failed.";
+        return false;
+    }
+    zInit_ = true;
+    return true;
+}
+
+// A single huge image on a pool with idle workers: inflate it in pieces there (piclab_inflate.h)
+// and check the IDAT CRCs there as well. Left to the serial path unless every IDAT is complete.
+bool PngRowReader::StartParallel() {
+    WorkPool* pool = WorkPool::Current();
+    if (!pool || pool->Size() < 2 || h_.interlace || size_ < kParallelInflateAbove) return false;
+    DeflateSource idat(data_);
+    std::vector<size_t> chunks; // offset of each IDAT's type field
+    size_t p = firstIdat_.first - 8;
+    while (size_ - p >= 12 && memcmp(data_ + p + 4, "IDAT", 4) == 0) {
+        uint32_t len = ReadBE32(data_ + p);
+        if (len > size_ - p - 12) return false;
+        idat.Add(p + 8, len);
+        chunks.push_back(p + 4);
+        p += 12 + (size_t)len;
+    }
+    if (idat.Size() < kParallelInflateAbove) return false;
+
+    pool_ = pool;
+    idat_ = idat;
+    const uint8_t* data = data_;
+    std::atomic<bool>* bad = &crcBad_;
+    for (size_t begin = 0; begin < chunks.size();) {
+        size_t end = begin;
+        uint64_t bytes = 0;
+        while (end < chunks.size() && bytes < (4u << 20)) bytes += ReadBE32(data_ + chunks[end++] - 4) + 8;
+        std::vector<size_t> batch(chunks.begin() + begin, chunks.begin() + end);
+        pool->Submit([data, bad, batch] {
+            for (size_t c : batch) {
+                uint32_t len = ReadBE32(data + c - 4);
+                if (Crc32(0, data + c, len + 4) != ReadBE32(data + c + 4 + len)) *bad = true;
+            }
+        }, bytes, &crcGroup_);
+        begin = end;
+    }
+    inflater_.reset(new ParallelInflater(idat_, *pool));
+    return true;
+}
+
+// Checks the CRC of the IDAT whose body has been consumed.
+bool PngRowReader::FinishChunk(std::wstring& outError) {
+    if (size_ - pos_ < 4) {
+        outError = L"PNG image data is truncated.";
+        return false;
+    }
+    if (chunkCrc_ != ReadBE32(data_ + pos_)) {
+        outError = L"PNG chunk CRC mismatch.";
+        return false;
+    }
+    pos_ += 4;
+    return true;
+}
+
+// Hands inflate the rest of the current IDAT straight from the mapping.
+bool PngRowReader::Refill(std::wstring& outError) {
+    while (chunkLeft_ == 0) {
+        if (!FinishChunk(outError)) return false;
+        if (size_ - pos_ < 8 || memcmp(data_ + pos_ + 4, "IDAT", 4) != 0) {
+            outError = L"PNG image data is truncated.";
+            return false;
+        }
+        chunkLeft_ = ReadBE32(data_ + pos_);
+        chunkCrc_ = Crc32(0, data_ + pos_ + 4, 4);
+        pos_ += 8;
+        if (splice_) splice_->idat.push_back({ pos_, chunkLeft_ });
+    }
+    uint32_t n = (uint32_t)std::min<size_t>(chunkLeft_, size_ - pos_);
+    if (n == 0) {
+        outError = L"PNG image data is truncated.";
+        return false;
+    }
+    chunkCrc_ = Crc32(chunkCrc_, data_ + pos_, n);
+    zs_.next_in = const_cast<uint8_t*>(data_ + pos_);
+    zs_.avail_in = n;
+    pos_ += n;
+    chunkLeft_ -= n;
+    return true;
+}
+
+// Copies the next filtered row out of the inflated pieces.
+bool PngRowReader::ReadPieces(std::wstring& outError) {
+    size_t filled = 0;
+    while (filled < cur_.size()) {
+        if (piecePos_ == piece_.data.size()) {
+            if (piece_.last) {
+                outError = L"PNG image data is truncated.";
+                return false;
+            }
+            if (!inflater_->Next(piece_, outError)) {
+                // A damaged chunk explains damaged data; report it the way the serial path would.
+                pool_->Wait(crcGroup_);
+                if (crcBad_) outError = L"PNG chunk CRC mismatch.";
+                return false;
+            }
+            piecePos_ = 0;
+            if (splice_) TapPiece();
+        }
+        size_t n = std::min(cur_.size() - filled, piece_.data.size() - piecePos_);
+        memcpy(cur_.data() + filled, piece_.data.data() + piecePos_, n);
+        filled += n;
+        piecePos_ += n;
+    }
+    return true;
+}
+
+// Inflates the next filtered row straight from the mapping.
+bool PngRowReader::InflateRow(std::wstring& outError) {
+    zs_.next_out = cur_.data();
+    zs_.avail_out = (uInt)cur_.size();
+    while (zs_.avail_out) {
+        if (zs_.avail_in == 0 && !Refill(outError)) return false;
+        const uint8_t* out = zs_.next_out;
+        uInt availIn = zs_.avail_in, availOut = zs_.avail_out;
+        // Z_BLOCK stops at every deflate block boundary so a splice can record the last one.
+        int zr = inflate(&zs_, splice_ ? Z_BLOCK : Z_NO_FLUSH);
+        if (splice_) Tap(out, availOut - zs_.avail_out, availIn - zs_.avail_in);
+        if (zr == Z_STREAM_END) break;
+        if (zr != Z_OK && zr != Z_BUF_ERROR) {
+            outError = L"PNG image data is corrupt.";
+            return false;
+        }
+    }
+    if (zs_.avail_out) {
+        outError = L"PNG image data is truncated.";
+        return false;
+    }
+    return true;
+}
+
+bool PngRowReader::ReadRow(uint8_t* dst, std::wstring& outError) {
+    if (y_ >= h_.height) {
+        outError = L"Read past the last PNG row.";
+        return false;
+    }
+    if (!(inflater_ ? ReadPieces(outError) : InflateRow(outError))) return false;
+    if (RawIsOutput()) filters_.push_back(cur_[0]);
+    if (!UnfilterRow(cur_[0], cur_.data() + 1, y_ ? prev_.data() + 1 : nullptr, rowBytes_, bpp_)) {
+        outError = L"PNG row has an invalid filter type.";
+        return false;
+    }
+    ConvertRow(h_, pal_, cur_.data() + 1, h_.width, dst, channels_, 1);
+    cur_.swap(prev_);
+    if (++y_ == h_.height && inflater_) {
+        inflater_.reset(); // stops reading the mapping
+        pool_->Wait(crcGroup_);
+        if (crcBad_) {
+            outError = L"PNG chunk CRC mismatch.";
+            return false;
+        }
+        if (!splice_) file_.reset();
+    } else if (y_ == h_.height) {
+        // Check the CRC of the last IDAT as well; anything after it is not needed.
+        if (chunkLeft_ > size_ - pos_) {
+            outError = L"PNG image data is truncated.";
+            return false;
+        }
+        chunkCrc_ = Crc32(chunkCrc_, data_ + pos_, chunkLeft_);
+        pos_ += chunkLeft_;
+        chunkLeft_ = 0;
+        if (!FinishChunk(outError)) return false;
+        if (!splice_) file_.reset(); // release the source as soon as it is no longer read
+    }
+    return true;
+}
+
+std::shared_ptr<PngSplice> PngRowReader::StartSplice(uint32_t keepRows) {
+    splice_ = std::make_shared<PngSplice>();
+    splice_->source = file_;
+    if (inflater_) {
+        splice_->idat = idat_.Segments();
+    } else {
+        splice_->idat.push_back(firstIdat_);
+    }
+    splice_->keepRawBytes = (uint64_t)keepRows * (1 + rowBytes_);
+    return splice_;
+}
+
+// Keeps the raw bytes of the kept rows from 32 KB before the latest usable block boundary onwards.
+void PngRowReader::Tap(const uint8_t* out, size_t produced, size_t consumed) {
+    PngSplice& s = *splice_;
+    const uint64_t start = outTotal_;
+    inTotal_ += consumed;
+    outTotal_ += produced;
+    if (start < s.keepRawBytes) {
+        size_t n = (size_t)std::min<uint64_t>(produced, s.keepRawBytes - start);
+        s.tail.insert(s.tail.end(), out, out + n);
+    }
+    // Bit 128: stopped at a block boundary (unused bits < 8); bit 64: inside the final block.
+    if ((zs_.data_type & 128) && !(zs_.data_type & 64) && outTotal_ <= s.keepRawBytes) {
+        MarkBoundary(inTotal_ * 8 - (uint64_t)(zs_.data_type & 7), outTotal_, zs_.adler);
+    }
+}
+
+// Tap for a parallel piece, which lists its block starts itself.
+void PngRowReader::TapPiece() {
+    PngSplice& s = *splice_;
+    const uint64_t start = outTotal_;
+    outTotal_ += piece_.data.size();
+    if (start >= s.keepRawBytes) return;
+    size_t n = (size_t)std::min<uint64_t>(piece_.data.size(), s.keepRawBytes - start);
+    s.tail.insert(s.tail.end(), piece_.data.begin(), piece_.data.begin() + n);
+    uLong adler = piece_.adlerBefore;
+    size_t at = 0;
+    for (const std::pair<uint64_t, size_t>& block : piece_.blocks) {
+        if (start + block.second > s.keepRawBytes) break;
+        adler = Adler32(adler, piece_.data.data() + at, block.second - at);
+        at = block.second;
+        MarkBoundary(block.first, start + block.second, adler);
+    }
+}
+
+// Records a usable block boundary and drops tail bytes that fell out of its window.
+void PngRowReader::MarkBoundary(uint64_t bitPos, uint64_t rawPos, uLong adler) {
+    PngSplice& s = *splice_;
+    s.bitPos = bitPos;
+    s.rawPos = rawPos;
+    s.adler = adler;
+    uint64_t windowStart = rawPos > 32768 ? rawPos - 32768 : 0;
+    if (windowStart > s.tailStart) {
+        s.tail.erase(s.tail.begin(), s.tail.begin() + (size_t)(windowStart - s.tailStart));
+        s.tailStart = windowStart;
+    }
+}
+
+} // namespace
+
+std::unique_ptr<RowReader> OpenPngRowReader(const std::wstring& path, std::wstring& outError) {
+    std::unique_ptr<PngRowReader> r(new PngRowReader());
+    if (!r->Open(path, outError)) return nullptr;
+    if (r->Interlaced()) return nullptr; // Adam7 rows arrive out of order; decode the whole image
+    return r;
+}
+
+// ----------------------------- Encode -----------------------------
+
+namespace {
+
+class PngFileWriter {
+public:
+    explicit PngFileWriter(FILE* f) : f_(f) {}
+
+    void Chunk(const char* type, const uint8_t* body, size_t len) {
+        uint8_t hdr[8];
+        WriteBE32(hdr, (uint32_t)len);
+        memcpy(hdr + 4, type, 4);
+        uint32_t crc = Crc32(0, hdr + 4, 4);
+        if (len) crc = Crc32(crc, body, len);
+        uint8_t tail[4];
+        WriteBE32(tail, (uint32_t)crc);
+        Put(hdr, 8);
+        if (len) Put(body, len);
+        Put(tail, 4);
+    }
+
+    void Put(const uint8_t* p, size_t n) {
+        if (ok_ && fwrite(p, 1, n, f_) != n) ok_ = false;
+    }
+
+    bool Ok() const { return ok_; }
+
+private:
+    FILE* f_;
+    bool ok_{true};
+};
+
+} // namespace
+
+// Chunked deflate: filtered rows are cut into chunks that are compressed as separate raw deflate
+// streams, each seeded with the 32 KB before it and ended on a byte boundary, so their
+// concatenation is one valid stream (as pigz does it). Pool workers take the chunks of large
+// images; other engines and latency budgets always work this way, on the writing thread when there
+// is no pool.
+static const size_t kDeflateChunk = (size_t)1 << 20;
+static const size_t kParallelDeflateAbove = 4 * kDeflateChunk;
+// Unclassified images are sampled on the rows in their first 4 MB (every other one, at least 16).
+static const size_t kClassifyBytes = (size_t)4 << 20;
+static const uint32_t kClassifyMinRows = 16;
+
+namespace {
+
+struct DeflateJob {
+    CompressOptions compress;
+    std::vector<uint8_t> in;
+    std::vector<uint8_t> dict;
+    int primeBits{0}; // bits of a partial byte the stream has to continue, low bits first
+    int primeValue{0};
+    bool last{false};
+    size_t inSize{0};
+    double ms{0}; // time spent deflating, for the latency budget
+    uLong adler{1};
+    std::vector<uint8_t> out;
+    bool ok{false};
+    TaskGroup group;
+};
+
+void RunDeflateJob(DeflateJob& job) {
+    auto start = std::chrono::steady_clock::now();
+    job.ok = DeflateChunk(job.compress, job.in.data(), job.in.size(), job.dict.data(), job.dict.size(),
+                          job.primeBits, job.primeValue, job.last, job.out);
+    job.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    job.adler = Adler32(1, job.in.data(), job.in.size());
+    job.inSize = job.in.size();
+    job.in = std::vector<uint8_t>();
+    job.dict = std::vector<uint8_t>();
+}
+
+// Filters, deflates and writes one row at a time; only the previous row is kept for the filters.
+// Inside a WorkPool, large images are compressed in parallel chunks instead.
+// With ContentClass::kAuto the first rows to compress wait (up to kClassifyBytes) until enough of
+// the image has been sampled to pick its class.
+// With a latency budget each chunk is compressed with the setting budget_ holds at the time.
+class PngRowWriter : public RowWriter {
+public:
+    ~PngRowWriter() override {
+        for (const std::shared_ptr<DeflateJob>& job : jobs_) pool_->Wait(job->group);
+        if (zInit_) deflateEnd(&zs_);
+        if (f_) fclose(f_);
+    }
+
+    // With a splice, rows [0, keepRows) are taken from the source's compressed stream instead.
+    bool Open(const std::wstring& path, uint32_t width, uint32_t height, uint32_t channels,
+              const CompressOptions& compress, std::wstring& outError, std::shared_ptr<PngSplice> splice = nullptr,
+              uint32_t keepRows = 0);
+    bool WriteRow(const uint8_t* row, std::wstring& outError) override;
+    bool Finish(std::wstring& outError) override;
+    void ReuseFilters(const RowReader& src, uint32_t rows) override {
+        reuse_ = &src;
+        reuseRows_ = rows;
+    }
+    ContentClass Content() const override { return content_; }
+
+private:
+    int StoredFilter(uint32_t y) const { return y < reuseRows_ ? reuse_->SourceFilter(y) : -1; }
+    void EncodeRow(const uint8_t* row, uint32_t y, int stored);
+    void Classify();
+    void Drain(bool force);
+    void Emit(const uint8_t* p, size_t n);
+    void Compress(const uint8_t* p, size_t n);
+    void SubmitChunk(bool last);
+    void EmitOldestChunk();
+    bool StartSplice(std::wstring& outError);
+    bool CheckWrite(std::wstring& outError);
+
+    FILE* f_{};
+    PngFileWriter w_{nullptr};
+    z_stream zs_{};
+    bool zInit_{false};
+    uint32_t height_{0};
+    uint32_t y_{0};
+    size_t stride_{0};
+    size_t bpp_{0};
+    std::vector<uint8_t> prev_, filtered_, zbuf_;
+    std::shared_ptr<PngSplice> splice_;
+    uint32_t keepRows_{0};
+    const RowReader* reuse_{}; // filter types for rows [0, reuseRows_) come from here
+    uint32_t reuseRows_{0};
+    uLong adler_{1}; // spliced and chunked streams are raw deflate, so the zlib trailer is ours to write
+
+    ContentClass content_{ContentClass::kAuto};
+    ContentSample sample_;
+    uint32_t classifyRows_{0};    // rows to sample before deciding
+    std::vector<uint8_t> held_;   // rows to compress that wait for the decision
+    // Their stored filters, looked up on arrival: the reader may be gone by the time they are compressed.
+    std::vector<int8_t> heldFilters_;
+
+    CompressOptions compress_; // the setting for zs_
+    LatencyBudget budget_;
+    bool chunked_{false}; // compressing chunk by chunk rather than through zs_
+    WorkPool* pool_{};    // set when the chunks are compressed in parallel
+    std::vector<uint8_t> chunk_;  // filtered bytes not yet handed to a job
+    std::vector<uint8_t> window_; // the last 32 KB before chunk_
+    std::deque<std::shared_ptr<DeflateJob>> jobs_; // submitted, oldest first
+    int primeBits_{0};
+    int primeValue_{0};
+    bool deflateOk_{true};
+};
+
+bool PngRowWriter::Open(const std::wstring& path, uint32_t width, uint32_t height, uint32_t channels,
+                        const CompressOptions& compress, std::wstring& outError, std::shared_ptr<PngSplice> splice,
+                        uint32_t keepRows) {
+    if (channels != 3 && channels != 4) {
+        outError = L"Unsupported pixel layout.";
+        return false;
+    }
+    f_ = OpenFile(path, L"wb");
+    if (!f_) {
+        outError = L"Cannot create file: " + SystemErrorText(LastSystemError());
+        return false;
+    }
+    w_ = PngFileWriter(f_);
+    w_.Put(kSignature, 8);
+
+    uint8_t ihdr[13];
+    WriteBE32(ihdr, width);
+    WriteBE32(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = channels == 4 ? 6 : 2;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    w_.Chunk("IHDR", ihdr, sizeof(ihdr));
+
+    splice_ = std::move(splice);
+    keepRows_ = keepRows;
+    const uint64_t rawBytes = ((uint64_t)width * channels + 1) * (height - keepRows);
+    WorkPool* pool = WorkPool::Current();
+    if (pool && pool->Size() > 1 && rawBytes >= kParallelDeflateAbove) pool_ = pool;
+    budget_.Start(compress, rawBytes, pool_ ? pool_->Size() : 1);
+    compress_ = budget_.Current();
+    chunked_ = pool_ || compress.latencyBudgetMs || compress_.engine != DeflateEngine::kZlib;
+    if (chunked_) {
+        chunk_.reserve(kDeflateChunk);
+    } else if (!splice_) {
+        if (deflateInit2(&zs_, compress_.level, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            outError = L"zlib init failed.";
+            return false;
+        }
+        zInit_ = true;
+    }
+
+    height_ = height;
+    stride_ = (size_t)width * channels;
+    content_ = compress.content;
+    classifyRows_ = (uint32_t)std::min<uint64_t>(
+        height, std::max<uint64_t>(kClassifyMinRows, kClassifyBytes / std::max<size_t>(stride_, 1)));
+    bpp_ = channels;
+    prev_.resize(stride_);
+    filtered_.resize(stride_ + 1);
+    zbuf_.resize(1 << 16);
+    zs_.next_out = zbuf_.data();
+    zs_.avail_out = (uInt)zbuf_.size();
+    if (chunked_ && !splice_) {
+        uint8_t header[2];
+        ZlibHeader(compress_, header);
+        Emit(header, sizeof(header));
+    }
+    return true;
+}
+
+void PngRowWriter::Drain(bool force) {
+    if (zs_.avail_out == 0 || (force && zs_.avail_out < zbuf_.size())) {
+        w_.Chunk("IDAT", zbuf_.data(), zbuf_.size() - zs_.avail_out);
+        zs_.next_out = zbuf_.data();
+        zs_.avail_out = (uInt)zbuf_.size();
+    }
+}
+
+// Appends already compressed bytes to the IDAT stream.
+void PngRowWriter::Emit(const uint8_t* p, size_t n) {
+    while (n) {
+        size_t k = std::min<size_t>(n, zs_.avail_out);
+        memcpy(zs_.next_out, p, k);
+        zs_.next_out += k;
+        zs_.avail_out -= (uInt)k;
+        p += k;
+        n -= k;
+        Drain(false);
+    }
+}
+
+void PngRowWriter::Compress(const uint8_t* p, size_t n) {
+    if (chunked_) {
+        while (n) {
+            size_t k = std::min(n, kDeflateChunk - chunk_.size());
+            chunk_.insert(chunk_.end(), p, p + k);
+            p += k;
+            n -= k;
+            if (chunk_.size() == kDeflateChunk) SubmitChunk(false);
+        }
+        return;
+    }
+    if (splice_) adler_ = Adler32(adler_, p, n);
+    zs_.next_in = const_cast<uint8_t*>(p);
+    zs_.avail_in = (uInt)n;
+    while (zs_.avail_in) {
+        deflate(&zs_, Z_NO_FLUSH);
+        Drain(false);
+    }
+}
+
+// Hands chunk_ to a pool worker. At most two chunks per thread are in flight; beyond that the
+// oldest is waited for (helping with queued work meanwhile) and written out. Without a pool the
+// chunk is compressed and written right here.
+void PngRowWriter::SubmitChunk(bool last) {
+    std::shared_ptr<DeflateJob> job = std::make_shared<DeflateJob>();
+    job->compress = budget_.Current();
+    job->in.swap(chunk_);
+    job->dict = window_;
+    job->primeBits = primeBits_;
+    job->primeValue = primeValue_;
+    job->last = last;
+    primeBits_ = primeValue_ = 0;
+
+    const std::vector<uint8_t>& in = job->in;
+    if (in.size() >= 32768) {
+        window_.assign(in.end() - 32768, in.end());
+    } else {
+        window_.insert(window_.end(), in.begin(), in.end());
+        if (window_.size() > 32768) window_.erase(window_.begin(), window_.end() - 32768);
+    }
+    chunk_.reserve(kDeflateChunk);
+
+    jobs_.push_back(job);
+    if (!pool_) {
+        RunDeflateJob(*job);
+        EmitOldestChunk();
+        return;
+    }
+    pool_->Submit([job] { RunDeflateJob(*job); }, in.size() + 1, &job->group);
+    while (jobs_.size() > 2 * (size_t)pool_->Size()) EmitOldestChunk();
+}
+
+void PngRowWriter::EmitOldestChunk() {
+    std::shared_ptr<DeflateJob> job = jobs_.front();
+    jobs_.pop_front();
+    if (pool_) pool_->Wait(job->group);
+    if (!job->ok) deflateOk_ = false;
+    budget_.Record(job->compress, job->inSize, job->ms);
+    Emit(job->out.data(), job->out.size());
+    adler_ = adler32_combine(adler_, job->adler, (z_off_t)job->inSize);
+}
+
+bool PngRowWriter::CheckWrite(std::wstring& outError) {
+    if (!deflateOk_) {
+        outError = L"Compression failed.";
+        return false;
+    }
+    if (!w_.Ok()) {
+        outError = L"Write error.";
+        return false;
+    }
+    return true;
+}
+
+// Copies the source's compressed bytes up to the recorded block boundary, then continues the stream
+// with a raw deflater primed with the boundary's leftover bits and the 32 KB window before it.
+bool PngRowWriter::StartSplice(std::wstring& outError) {
+    PngSplice& s = *splice_;
+    const uint64_t wholeBytes = s.bitPos / 8;
+    const int leftoverBits = (int)(s.bitPos & 7);
+    const uint8_t* data = s.source->Data();
+    uint64_t left = wholeBytes;
+    for (size_t c = 0; c < s.idat.size() && left; ++c) {
+        size_t n = (size_t)std::min<uint64_t>(s.idat[c].second, left);
+        Emit(data + s.idat[c].first, n);
+        left -= n;
+    }
+    // The boundary falls inside the next compressed byte, which may open the following IDAT.
+    uint8_t lastByte = 0;
+    left = wholeBytes;
+    for (size_t c = 0; leftoverBits && c < s.idat.size(); ++c) {
+        if (left < s.idat[c].second) {
+            lastByte = data[s.idat[c].first + left];
+            break;
+        }
+        left -= s.idat[c].second;
+    }
+    s.source.reset(); // the original is no longer needed; on Windows this also unlocks it
+
+    size_t windowLen = (size_t)std::min<uint64_t>(s.rawPos - s.tailStart, 32768);
+    const uint8_t* boundary = s.tail.data() + (s.rawPos - s.tailStart);
+    adler_ = s.adler;
+    if (chunked_) {
+        primeBits_ = leftoverBits;
+        primeValue_ = lastByte & ((1 << leftoverBits) - 1);
+        window_.assign(boundary - windowLen, boundary);
+        Compress(boundary, (size_t)(s.keepRawBytes - s.rawPos));
+        s.tail.clear();
+        s.tail.shrink_to_fit();
+        return true;
+    }
+
+    uint8_t* out = zs_.next_out;
+    uInt avail = zs_.avail_out;
+    if (deflateInit2(&zs_, compress_.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        outError = L"zlib init failed.";
+        return false;
+    }
+    zInit_ = true;
+    zs_.next_out = out;
+    zs_.avail_out = avail;
+    if (leftoverBits) deflatePrime(&zs_, leftoverBits, lastByte & ((1 << leftoverBits) - 1));
+    if (windowLen) deflateSetDictionary(&zs_, boundary - windowLen, (uInt)windowLen);
+
+    // Raw bytes between the boundary and the first new row keep their original filtering.
+    Compress(boundary, (size_t)(s.keepRawBytes - s.rawPos));
+    s.tail.clear();
+    s.tail.shrink_to_fit();
+    return true;
+}
+
+bool PngRowWriter::WriteRow(const uint8_t* row, std::wstring& outError) {
+    if (y_ >= height_) {
+        outError = L"Too many rows for the PNG header.";
+        return false;
+    }
+    if (content_ == ContentClass::kAuto && y_ < classifyRows_ && y_ % 2 == 0) {
+        SampleContentRow(sample_, row, (uint32_t)(stride_ / bpp_), (uint32_t)bpp_);
+    }
+    if (y_ < keepRows_) {
+        // Already in the spliced prefix; only needed as the "up" row for the first new one.
+        memcpy(prev_.data(), row, stride_);
+        if (++y_ == keepRows_ && !StartSplice(outError)) return false;
+        return CheckWrite(outError);
+    }
+    if (content_ == ContentClass::kAuto && y_ + 1 < classifyRows_) {
+        held_.insert(held_.end(), row, row + stride_);
+        heldFilters_.push_back((int8_t)StoredFilter(y_));
+        ++y_;
+        return true;
+    }
+    if (content_ == ContentClass::kAuto) Classify();
+    EncodeRow(row, y_, StoredFilter(y_));
+    ++y_;
+    return CheckWrite(outError);
+}
+
+// Decides the class from the rows sampled so far and compresses the rows held back for it.
+void PngRowWriter::Classify() {
+    content_ = ClassifyContent(sample_);
+    sample_ = ContentSample();
+    const uint32_t first = y_ - (uint32_t)(held_.size() / stride_);
+    for (uint32_t y = first; y < y_; ++y) {
+        EncodeRow(held_.data() + (y - first) * stride_, y, heldFilters_[y - first]);
+    }
+    held_ = std::vector<uint8_t>();
+    heldFilters_ = std::vector<int8_t>();
+}
+
+// Filters row y, which follows the one in prev_, and compresses it. stored is the filter the source
+// used for it under --filter reuse, else -1.
+void PngRowWriter::EncodeRow(const uint8_t* row, uint32_t y, int stored) {
+    const uint8_t* prev = y ? prev_.data() : nullptr;
+    uint8_t filter = 0;
+    if (stored >= 0 && stored <= 4) {
+        filter = (uint8_t)stored;
+    } else if (content_ != ContentClass::kFlat) {
+        filter = SelectFilter(row, prev, stride_, bpp_);
+    }
+    FilterRow(filter, row, prev, stride_, bpp_, filtered_.data());
+    Compress(filtered_.data(), stride_ + 1);
+    memcpy(prev_.data(), row, stride_);
+}
+
+bool PngRowWriter::Finish(std::wstring& outError) {
+    if (y_ != height_) {
+        outError = L"Too few rows for the PNG header.";
+        return false;
+    }
+    int zr = Z_STREAM_END;
+    if (chunked_) {
+        SubmitChunk(true);
+        while (!jobs_.empty()) EmitOldestChunk();
+    } else {
+        do {
+            zr = deflate(&zs_, Z_FINISH);
+            Drain(false);
+        } while (zr == Z_OK);
+    }
+    if (splice_ || chunked_) {
+        uint8_t trailer[4];
+        WriteBE32(trailer, (uint32_t)adler_);
+        Emit(trailer, sizeof(trailer));
+    }
+    Drain(true);
+
+    w_.Chunk("IEND", nullptr, 0);
+    bool ok = w_.Ok() && zr == Z_STREAM_END;
+    if (fclose(f_) != 0) ok = false;
+    f_ = nullptr;
+    if (!deflateOk_) {
+        outError = L"Compression failed.";
+        return false;
+    }
+    if (!ok) outError = L"Write error.";
+    return ok;
+}
+
+} // namespace
+
+std::unique_ptr<RowWriter> CreatePngRowWriter(const std::wstring& path, uint32_t width, uint32_t height,
+                                              uint32_t channels, const CompressOptions& compress,
+                                              std::wstring& outError) {
+    std::unique_ptr<PngRowWriter> w(new PngRowWriter());
+    if (!w->Open(path, width, height, channels, compress, outError)) return nullptr;
+    return w;
+}
+
+std::unique_ptr<RowWriter> CreatePngSpliceWriter(RowReader& src, uint32_t keepRows, const std::wstring& path,
+                                                 const CompressOptions& compress, std::wstring& outError) {
+    PngRowReader* reader = dynamic_cast<PngRowReader*>(&src);
+    if (!reader || keepRows == 0 || keepRows > reader->Height() || !reader->CanSplice()) return nullptr;
+    std::unique_ptr<PngRowWriter> w(new PngRowWriter());
+    if (!w->Open(path, reader->Width(), reader->Height(), reader->Channels(), compress, outError,
+                 reader->StartSplice(keepRows), keepRows)) {
+        return nullptr;
+    }
+    return w;
+}
+
+bool EncodePng(const Image& img, const std::wstring& path, const CompressOptions& compress, std::wstring& outError) {
+    // The whole image is at hand, so it is sampled evenly rather than from its top rows.
+    CompressOptions c = compress;
+    if (c.content == ContentClass::kAuto) c.content = ClassifyImage(img);
+    std::unique_ptr<RowWriter> w = CreatePngRowWriter(path, img.width, img.height, img.channels, c, outError);
+    if (!w) return false;
+    for (uint32_t y = 0; y < img.height; ++y) {
+        if (!w->WriteRow(img.Row(y), outError)) return false;
+    }
+    return w->Finish(outError);
+}
+
+// ----------------------------- Text metadata -----------------------------
+
+static bool IsTextChunk(const uint8_t* type) {
+    return memcmp(type, "tEXt", 4) == 0 || memcmp(type, "zTXt", 4) == 0 || memcmp(type, "iTXt", 4) == 0;
+}
+
+bool WritePngText(const std::wstring& src, const std::wstring& dst, const char* keyword,
+                  const std::string& text, std::wstring& outError) {
+    std::unique_ptr<MappedFile> in(new MappedFile());
+    if (!in->Open(src, outError)) return false;
+    const uint8_t* data = in->Data();
+    const size_t size = in->Size();
+    if (!IsPng(data, size)) {
+        outError = L"Metadata-only labels need a PNG input.";
+        return false;
+    }
+    FILE* f = OpenFile(dst, L"wb");
+    if (!f) {
+        outError = L"Cannot create file: " + SystemErrorText(LastSystemError());
+        return false;
+    }
+    PngFileWriter w(f);
+    w.Put(kSignature, 8);
+
+    // iTXt: keyword, NUL, uncompressed, method 0, empty language tag and translated keyword, UTF-8 text.
+    std::vector<uint8_t> itxt(keyword, keyword + strlen(keyword));
+    const uint8_t fields[5] = { 0, 0, 0, 0, 0 };
+    itxt.insert(itxt.end(), fields, fields + 5);
+    itxt.insert(itxt.end(), text.begin(), text.end());
+
+    const size_t keyLen = strlen(keyword);
+    bool inserted = false, sawIend = false;
+    size_t pos = 8;
+    while (!sawIend && size - pos >= 12) {
+        const uint32_t len = ReadBE32(data + pos);
+        const uint8_t* type = data + pos + 4;
+        if (len > size - pos - 12) break;
+        if (!inserted && (memcmp(type, "IDAT", 4) == 0 || memcmp(type, "IEND", 4) == 0)) {
+            w.Chunk("iTXt", itxt.data(), itxt.size());
+            inserted = true;
+        }
+        sawIend = memcmp(type, "IEND", 4) == 0;
+        const uint8_t* body = type + 4;
+        // An older entry under our keyword is dropped; everything else, IDAT included, is copied
+        // byte for byte with its CRC.
+        bool ours = IsTextChunk(type) && len > keyLen && memcmp(body, keyword, keyLen) == 0 && body[keyLen] == 0;
+        if (!ours) w.Put(data + pos, 12 + (size_t)len);
+        pos += 12 + (size_t)len;
+    }
+    const bool truncated = !sawIend && pos != size;
+    in.reset();
+    if (!inserted || truncated) {
+        fclose(f);
+        outError = L"PNG is truncated or has no image data.";
+        return false;
+    }
+    if (!sawIend) w.Chunk("IEND", nullptr, 0);
+    bool ok = w.Ok();
+    if (fclose(f) != 0) ok = false;
+    if (!ok) outError = L"Write error.";
+    return ok;
+}
+
+} // namespace piclab
@@ -0,0 +1,60 @@
+// piclab_png.h
+// PNG decoder/encoder for the portable backend. Inflate/deflate come from zlib.
+// Decode accepts every standard color type, bit depth and Adam7; output is RGB8 or RGBA8.
+// Encode writes 8-bit RGB or RGBA, non-interlaced, filtered by content class (adaptive per row for
+// photos, none for flat content) and compressed with the deflate engine chosen in CompressOptions
+// (see piclab_deflate.h).
+
+#pragma once
+
+#include "piclab_core.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace piclab {
+
+bool IsPng(const uint8_t* data, size_t size);
+// Dimensions from the IHDR at the start of the file; needs the first 24 bytes only.
+bool ReadPngSize(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height);
+bool DecodePng(const uint8_t* data, size_t size, Image& out, std::wstring& outError);
+bool EncodePng(const Image& img, const std::wstring& path, const CompressOptions& compress, std::wstring& outError);
+
+// Inflated but still filtered image data of a non-interlaced PNG: height rows of 1 + rowBytes
+// bytes, each starting with its filter type. For tools that work on scanlines directly.
+struct PngScanlines {
+    uint32_t width{};
+    uint32_t height{};
+    size_t rowBytes{};
+    size_t bpp{}; // byte distance to the left pixel used by the filters
+    std::vector<uint8_t> data;
+};
+bool InflatePngScanlines(const uint8_t* data, size_t size, PngScanlines& out, std::wstring& outError);
+
+// Structural check of a written file without decoding pixels: signature, IHDR first, every chunk
+// CRC, one run of IDAT, IEND last, and an image stream that inflates (Adler-32 included) to exactly
+// the scanlines IHDR asks for, each with a valid filter type. Costs an inflate, no unfiltering.
+bool VerifyPng(const uint8_t* data, size_t size, std::wstring& outError);
+bool VerifyPngFile(const std::wstring& path, std::wstring& outError);
+
+// Row streaming over a file. Interlaced PNGs cannot be read in row order: for those the reader is
+// null with outError left empty, and the caller should use DecodePng instead.
+std::unique_ptr<RowReader> OpenPngRowReader(const std::wstring& path, std::wstring& outError);
+std::unique_ptr<RowWriter> CreatePngRowWriter(const std::wstring& path, uint32_t width, uint32_t height,
+                                              uint32_t channels, const CompressOptions& compress,
+                                              std::wstring& outError);
+// Writer that copies src's deflate stream up to the last block boundary before row keepRows and
+// compresses only the rest, seeded with the preceding 32 KB window. src must come from
+// OpenPngRowReader with no rows read yet; null when the file is not 8-bit RGB/RGBA.
+std::unique_ptr<RowWriter> CreatePngSpliceWriter(RowReader& src, uint32_t keepRows, const std::wstring& path,
+                                                 const CompressOptions& compress, std::wstring& outError);
+
+// Copies the PNG at src to dst chunk by chunk without decoding it, replacing any tEXt/zTXt/iTXt entry
+// for keyword with one iTXt holding text (UTF-8) ahead of the first IDAT.
+bool WritePngText(const std::wstring& src, const std::wstring& dst, const char* keyword,
+                  const std::string& text, std::wstring& outError);
+
+} // namespace piclab
@@ -0,0 +1,166 @@
+// piclab_pool.cpp
+// Work-stealing task pool. Deques are mutex-protected: tasks here are whole images or
+// multi-megabyte chunks, so a lock per pop is noise next to the work itself.
+
+#include "piclab_pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace piclab {
+
+static thread_local WorkPool* tlsPool = nullptr;
+static thread_local int tlsIndex = -1;
+
+unsigned WorkPool::HardwareThreads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+WorkPool* WorkPool::Current() {
+    return tlsPool;
+}
+
+WorkPool::WorkPool(unsigned threads) {
+    if (threads == 0) threads = HardwareThreads();
+    for (unsigned i = 0; i < threads; ++i) queues_.emplace_back(new Queue());
+    for (unsigned i = 0; i < threads; ++i) workers_.emplace_back(&WorkPool::WorkerLoop, this, i);
+}
+
+WorkPool::~WorkPool() {
+    Wait();
+    {
+        std::lock_guard<std::mutex> lk(idleMu_);
+        stop_ = true;
+    }
+    idleCv_.notify_all();
+    for (std::thread& t : workers_) t.join();
+}
+
+void WorkPool::Push(unsigned index, Task task) {
+    Queue& q = *queues_[index];
+    TaskGroup* group = task.group;
+    {
+        std::lock_guard<std::mutex> lk(q.mu);
+        // Keep descending cost; equal costs stay in submission order.
+        auto it = std::upper_bound(q.tasks.begin(), q.tasks.end(), task.cost,
+                                   [](uint64_t c, const Task& t) { return c > t.cost; });
+        q.queuedCost += task.cost;
+        if (group) ++group->queued_;
+        q.tasks.insert(it, std::move(task));
+    }
+    ++queued_;
+    {
+        std::lock_guard<std::mutex> lk(idleMu_);
+    }
+    idleCv_.notify_one();
+    // A worker waiting on the group may be the one to run it.
+    if (group) doneCv_.notify_all();
+}
+
+void WorkPool::Submit(std::function<void()> task, uint64_t cost, TaskGroup* group) {
+    ++pending_;
+    if (group) ++group->pending_;
+    Task t{ std::move(task), cost, group };
+
+    if (tlsPool == this) {
+        Push((unsigned)tlsIndex, std::move(t));
+        return;
+    }
+    unsigned best = 0;
+    uint64_t bestCost = UINT64_MAX;
+    for (unsigned i = 0; i < queues_.size(); ++i) {
+        std::lock_guard<std::mutex> lk(queues_[i]->mu);
+        if (queues_[i]->queuedCost < bestCost) {
+            bestCost = queues_[i]->queuedCost;
+            best = i;
+        }
+    }
+    Push(best, std::move(t));
+}
+
+// Takes the largest task of the deque, or with a group the largest of that group's.
+bool WorkPool::PopOwn(unsigned index, Task& out, const TaskGroup* group) {
+    Queue& q = *queues_[index];
+    std::lock_guard<std::mutex> lk(q.mu);
+    auto it = q.tasks.begin();
+    if (group) {
+        while (it != q.tasks.end() && it->group != group) ++it;
+    }
+    if (it == q.tasks.end()) return false;
+    out = std::move(*it);
+    q.tasks.erase(it);
+    q.queuedCost -= out.cost;
+    if (out.group) --out.group->queued_;
+    --queued_;
+    return true;
+}
+
+// Takes the largest task (of group, when given) out of any other deque.
+bool WorkPool::Steal(int self, Task& out, const TaskGroup* group) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int victim = -1;
+        uint64_t victimCost = 0;
+        for (unsigned i = 0; i < queues_.size(); ++i) {
+            if ((int)i == self) continue;
+            std::lock_guard<std::mutex> lk(queues_[i]->mu);
+            for (const Task& t : queues_[i]->tasks) {
+                if (group && t.group != group) continue;
+                if (victim < 0 || t.cost > victimCost) {
+                    victim = (int)i;
+                    victimCost = t.cost;
+                }
+                break; // descending cost: the first candidate is the deque's largest
+            }
+        }
+        if (victim < 0) return false;
+        if (PopOwn((unsigned)victim, out, group)) return true;
+    }
+    return false;
+}
+
+bool WorkPool::TryRunOne(int self, const TaskGroup* group) {
+    Task t;
+    if (!(PopOwn((unsigned)self, t, group) || Steal(self, t, group))) return false;
+    t.fn();
+    if (t.group) --t.group->pending_;
+    --pending_;
+    {
+        std::lock_guard<std::mutex> lk(idleMu_);
+    }
+    doneCv_.notify_all();
+    return true;
+}
+
+void WorkPool::WorkerLoop(unsigned index) {
+    tlsPool = this;
+    tlsIndex = (int)index;
+    for (;;) {
+        if (TryRunOne((int)index, nullptr)) continue;
+        std::unique_lock<std::mutex> lk(idleMu_);
+        idleCv_.wait(lk, [&] { return stop_ || queued_.load() > 0; });
+        if (stop_ && queued_.load() == 0) return;
+    }
+}
+
+// Only the group's own tasks are run here. Anything else, a whole image above all, would nest
+// inside the task that is waiting and keep its stack and buffers alive until both are done.
+void WorkPool::Wait(TaskGroup& group) {
+    const bool inside = tlsPool == this;
+    while (group.pending_.load() > 0) {
+        if (inside && TryRunOne(tlsIndex, &group)) continue;
+        std::unique_lock<std::mutex> lk(idleMu_);
+        doneCv_.wait_for(lk, std::chrono::milliseconds(10), [&] {
+            return group.pending_.load() == 0 || (inside && group.queued_.load() > 0);
+        });
+    }
+}
+
+// The caller is not a worker, so it only waits: a task it ran would add a thread past the
+// pool's size and would not find the pool through Current().
+void WorkPool::Wait() {
+    std::unique_lock<std::mutex> lk(idleMu_);
+    doneCv_.wait(lk, [&] { return pending_.load() == 0; });
+}
+
+} // namespace piclab
@@ -0,0 +1,88 @@
+// piclab_pool.h
+// Work-stealing task pool used for batch labeling.
+//
+// Every worker owns a deque ordered by task cost, largest at the front. Workers pop the largest
+// task from their own deque; an idle worker steals the largest task at the front of any other
+// deque. Submissions from outside the pool go to the deque with the least queued cost, so a
+// batch submitted largest-first is spread like LPT scheduling and one huge image cannot hold a
+// queue of small ones hostage. Tasks submitted from inside a worker stay on that worker's deque.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace piclab {
+
+// Counts outstanding tasks of one logical job so it can be waited on from inside the pool.
+class TaskGroup {
+public:
+    size_t Pending() const { return pending_.load(); }
+
+private:
+    friend class WorkPool;
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> queued_{0}; // sitting in a deque
+};
+
+class WorkPool {
+public:
+    // threads == 0 uses every hardware thread.
+    explicit WorkPool(unsigned threads = 0);
+    ~WorkPool();
+
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+
+    unsigned Size() const { return (unsigned)workers_.size(); }
+
+    // cost is any monotone estimate of work (e.g. pixel count); it only orders and balances.
+    void Submit(std::function<void()> task, uint64_t cost = 1, TaskGroup* group = nullptr);
+
+    // Blocks until the group has finished. A worker that waits runs the group's queued tasks
+    // meanwhile, and no others, so waiting from inside a task cannot deadlock the pool.
+    void Wait(TaskGroup& group);
+    // Blocks until every submitted task has finished, running none itself; call from outside
+    // the pool only.
+    void Wait();
+
+    static unsigned HardwareThreads();
+    // The pool whose worker is running the calling thread, or null outside any pool.
+    static WorkPool* Current();
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        uint64_t cost;
+        TaskGroup* group;
+    };
+    struct Queue {
+        std::mutex mu;
+        std::deque<Task> tasks; // descending cost
+        uint64_t queuedCost{0};
+    };
+
+    void WorkerLoop(unsigned index);
+    bool TryRunOne(int self, const TaskGroup* group);
+    bool PopOwn(unsigned index, Task& out, const TaskGroup* group = nullptr);
+    bool Steal(int self, Task& out, const TaskGroup* group = nullptr);
+    void Push(unsigned index, Task task);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex idleMu_;
+    std::condition_variable idleCv_;
+    std::condition_variable doneCv_;
+    std::atomic<size_t> pending_{0};   // submitted and not yet finished
+    std::atomic<size_t> queued_{0};    // sitting in a deque
+    bool stop_{false};
+};
+
+} // namespace piclab
@@ -0,0 +1,257 @@
+// piclab_qoi.cpp
+// QOI encoder and decoder, following the qoiformat.org specification (version 1.0).
+
+#include "piclab_qoi.h"
+#include "piclab_io.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace piclab {
+
+static const uint8_t kQoiMagic[4] = { 'q', 'o', 'i', 'f' };
+static const uint8_t kQoiEnd[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+static const size_t kQoiHeaderBytes = 14;
+
+enum : uint8_t {
+    kOpIndex = 0x00, // 00xxxxxx
+    kOpDiff  = 0x40, // 01xxxxxx
+    kOpLuma  = 0x80, // 10xxxxxx
+    kOpRun   = 0xC0, // 11xxxxxx
+    kOpRgb   = 0xFE,
+    kOpRgba  = 0xFF,
+    kOpMask  = 0xC0,
+};
+
+struct QoiPixel {
+    uint8_t r, g, b, a;
+    bool operator==(const QoiPixel& o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
+};
+
+static inline uint32_t QoiHash(const QoiPixel& p) {
+    return (p.r * 3u + p.g * 5u + p.b * 7u + p.a * 11u) & 63;
+}
+
+static uint32_t ReadBE32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void WriteBE32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+bool IsQoi(const uint8_t* data, size_t size) {
+    return size >= kQoiHeaderBytes && memcmp(data, kQoiMagic, 4) == 0;
+}
+
+// Runs the ops of a whole file. With dst null the pixels are only counted, for verification.
+static bool DecodeQoiPixels(const uint8_t* data, size_t size, uint8_t* dst, std::wstring& outError) {
+    if (!IsQoi(data, size)) {
+        outError = L"Not a QOI file.";
+        return false;
+    }
+    const uint32_t width = ReadBE32(data + 4), height = ReadBE32(data + 8);
+    const uint32_t channels = data[12];
+    if (width == 0 || height == 0 || (channels != 3 && channels != 4) || data[13] > 1) {
+        outError = L"Unsupported QOI header.";
+        return false;
+    }
+
+    QoiPixel index[64] = {};
+    QoiPixel px = { 0, 0, 0, 255 };
+    const uint64_t total = (uint64_t)width * height;
+    const uint8_t* p = data + kQoiHeaderBytes;
+    const uint8_t* end = data + size;
+    uint64_t n = 0;
+    uint32_t run = 0;
+    while (n < total) {
+        if (run) {
+            --run;
+        } else {
+            if (p >= end) break;
+            const uint8_t op = *p++;
+            if (op == kOpRgb || op == kOpRgba) {
+                const size_t need = op == kOpRgb ? 3 : 4;
+                if ((size_t)(end - p) < need) break;
+                px.r = p[0]; px.g = p[1]; px.b = p[2];
+                if (op == kOpRgba) px.a = p[3];
+                p += need;
+            } else if ((op & kOpMask) == kOpIndex) {
+                px = index[op];
+            } else if ((op & kOpMask) == kOpDiff) {
+                px.r = (uint8_t)(px.r + ((op >> 4) & 3) - 2);
+                px.g = (uint8_t)(px.g + ((op >> 2) & 3) - 2);
+                px.b = (uint8_t)(px.b + (op & 3) - 2);
+            } else if ((op & kOpMask) == kOpLuma) {
+                if (p >= end) break;
+                const int dg = (op & 0x3F) - 32;
+                const uint8_t b2 = *p++;
+                px.r = (uint8_t)(px.r + dg - 8 + (b2 >> 4));
+                px.g = (uint8_t)(px.g + dg);
+                px.b = (uint8_t)(px.b + dg - 8 + (b2 & 15));
+            } else {
+                run = op & 0x3F; // this pixel plus run more
+            }
+            index[QoiHash(px)] = px;
+        }
+        if (dst) {
+            dst[0] = px.r; dst[1] = px.g; dst[2] = px.b;
+            if (channels == 4) dst[3] = px.a;
+            dst += channels;
+        }
+        ++n;
+    }
+    if (n != total || run) {
+        outError = L"QOI data is truncated.";
+        return false;
+    }
+    if ((size_t)(end - p) < sizeof(kQoiEnd) || memcmp(p, kQoiEnd, sizeof(kQoiEnd)) != 0) {
+        outError = L"QOI end marker is missing.";
+        return false;
+    }
+    return true;
+}
+
+bool DecodeQoi(const uint8_t* data, size_t size, Image& out, std::wstring& outError) {
+    if (!IsQoi(data, size)) {
+        outError = L"Not a QOI file.";
+        return false;
+    }
+    out.width = ReadBE32(data + 4);
+    out.height = ReadBE32(data + 8);
+    out.channels = data[12] == 4 ? 4 : 3;
+    out.pixels.resize(out.Stride() * out.height);
+    return DecodeQoiPixels(data, size, out.pixels.data(), outError);
+}
+
+bool VerifyQoiFile(const std::wstring& path, std::wstring& outError) {
+    MappedFile file;
+    if (!file.Open(path, outError)) return false;
+    return DecodeQoiPixels(file.Data(), file.Size(), nullptr, outError);
+}
+
+namespace {
+
+class QoiRowWriter : public RowWriter {
+public:
+    ~QoiRowWriter() override {
+        if (f_) fclose(f_);
+    }
+
+    bool Open(const std::wstring& path, uint32_t width, uint32_t height, uint32_t channels, std::wstring& outError) {
+        if (width == 0 || height == 0 || (channels != 3 && channels != 4)) {
+            outError = L"QOI needs a non-empty RGB or RGBA image.";
+            return false;
+        }
+        f_ = OpenFile(path, L"wb");
+        if (!f_) {
+            outError = L"Cannot create output file.";
+            return false;
+        }
+        width_ = width;
+        height_ = height;
+        channels_ = channels;
+        buf_.reserve(kFlushBytes + 8 * (size_t)width);
+        uint8_t header[kQoiHeaderBytes];
+        memcpy(header, kQoiMagic, 4);
+        WriteBE32(header + 4, width);
+        WriteBE32(header + 8, height);
+        header[12] = (uint8_t)channels;
+        header[13] = 0; // sRGB with linear alpha
+        buf_.insert(buf_.end(), header, header + sizeof(header));
+        return true;
+    }
+
+    bool WriteRow(const uint8_t* row, std::wstring& outError) override {
+        if (y_ == height_) {
+            outError = L"Too many rows for the QOI header.";
+            return false;
+        }
+        for (uint32_t x = 0; x < width_; ++x, row += channels_) {
+            QoiPixel px = { row[0], row[1], row[2], channels_ == 4 ? row[3] : (uint8_t)255 };
+            if (px == prev_) {
+                if (++run_ == 62) FlushRun();
+                continue;
+            }
+            FlushRun();
+            const uint32_t h = QoiHash(px);
+            if (index_[h] == px) {
+                buf_.push_back((uint8_t)(kOpIndex | h));
+            } else {
+                index_[h] = px;
+                if (px.a == prev_.a) {
+                    const int8_t dr = (int8_t)(px.r - prev_.r);
+                    const int8_t dg = (int8_t)(px.g - prev_.g);
+                    const int8_t db = (int8_t)(px.b - prev_.b);
+                    const int8_t drg = (int8_t)(dr - dg), dbg = (int8_t)(db - dg);
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                        buf_.push_back((uint8_t)(kOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                    } else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 && dbg >= -8 && dbg <= 7) {
+                        buf_.push_back((uint8_t)(kOpLuma | (dg + 32)));
+                        buf_.push_back((uint8_t)((drg + 8) << 4 | (dbg + 8)));
+                    } else {
+                        const uint8_t op[4] = { kOpRgb, px.r, px.g, px.b };
+                        buf_.insert(buf_.end(), op, op + 4);
+                    }
+                } else {
+                    const uint8_t op[5] = { kOpRgba, px.r, px.g, px.b, px.a };
+                    buf_.insert(buf_.end(), op, op + 5);
+                }
+            }
+            prev_ = px;
+        }
+        ++y_;
+        if (buf_.size() >= kFlushBytes) Flush();
+        if (!ok_) {
+            outError = L"Write error.";
+            return false;
+        }
+        return true;
+    }
+
+    bool Finish(std::wstring& outError) override {
+        if (y_ != height_) {
+            outError = L"Too few rows for the QOI header.";
+            return false;
+        }
+        FlushRun();
+        buf_.insert(buf_.end(), kQoiEnd, kQoiEnd + sizeof(kQoiEnd));
+        Flush();
+        if (fclose(f_) != 0) ok_ = false;
+        f_ = nullptr;
+        if (!ok_) outError = L"Write error.";
+        return ok_;
+    }
+
+private:
+    static const size_t kFlushBytes = (size_t)1 << 20;
+
+    void FlushRun() {
+        if (run_) buf_.push_back((uint8_t)(kOpRun | (run_ - 1)));
+        run_ = 0;
+    }
+    void Flush() {
+        if (!buf_.empty() && fwrite(buf_.data(), 1, buf_.size(), f_) != buf_.size()) ok_ = false;
+        buf_.clear();
+    }
+
+    FILE* f_{};
+    uint32_t width_{}, height_{}, channels_{}, y_{};
+    QoiPixel index_[64] = {};
+    QoiPixel prev_ = { 0, 0, 0, 255 };
+    uint32_t run_{};
+    std::vector<uint8_t> buf_;
+    bool ok_{true};
+};
+
+} // namespace
+
+std::unique_ptr<RowWriter> CreateQoiRowWriter(const std::wstring& path, uint32_t width, uint32_t height,
+                                              uint32_t channels, std::wstring& outError) {
+    std::unique_ptr<QoiRowWriter> w(new QoiRowWriter());
+    if (!w->Open(path, width, height, channels, outError)) return nullptr;
+    return std::unique_ptr<RowWriter>(w.release());
+}
+
+} // namespace piclab
@@ -0,0 +1,205 @@
+// piclab_service.cpp
+// Service protocol, one connection per command line:
+//   client -> service  { "run", <working directory>, <arg>... }
+//   service -> client  { "report", <line> } and { "saved", <path> } while it runs, then { "exit", <code> }
+// or, for statistics:
+//   client -> service  { "stats" }
+//   service -> client  { "report", <line> }..., { "exit", "0" }
+
+#include "piclab_service.h"
+#include "piclab_cache.h"
+#include "piclab_core.h"
+#include "piclab_io.h"
+#include "piclab_ipc.h"
+#include "piclab_lanes.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace piclab {
+
+static const wchar_t* kServiceRole = L"service";
+
+static std::mutex logMu;
+
+static void Log(const std::wstring& text) {
+    std::lock_guard<std::mutex> lk(logMu);
+    fputs((ToUtf8(text) + "\n").c_str(), stderr);
+}
+
+// Backends are started once and shared by every client; Backend calls are already made from many
+// pool threads at once within a batch.
+class BackendCache {
+public:
+    explicit BackendCache(const std::wstring& defaultName) : defaultName_(defaultName) {}
+
+    Backend* Get(const std::wstring& name, std::wstring& outError) {
+        const std::wstring key = name.empty() ? defaultName_ : name;
+        std::lock_guard<std::mutex> lk(mu_);
+        std::unique_ptr<Backend>& slot = backends_[key];
+        if (!slot) slot = key.empty() ? CreateDefaultBackend(outError) : CreateBackendByName(key, outError);
+        return slot.get();
+    }
+
+private:
+    std::wstring defaultName_;
+    std::mutex mu_;
+    std::map<std::wstring, std::unique_ptr<Backend>> backends_;
+};
+
+// Per lane "interactive: 0 queued (peak 3), 1 running, 120 started, 0 yields; wait p50 < 1 ms, ..."
+// followed by its non-empty histogram buckets.
+static void ReportLaneStats(IpcChannel& ch, const LaneScheduler& lanes) {
+    for (size_t l = 0; l < kLaneCount; ++l) {
+        const LaneStats st = lanes.Stats((Lane)l);
+        wchar_t buf[256];
+        swprintf(buf, 256,
+                 L"%ls: %llu queued (peak %llu), %llu running, %llu started, %llu yields; "
+                 L"wait p50 < %.0f ms, p99 < %.0f ms, max %.1f ms",
+                 LaneName((Lane)l), (unsigned long long)st.queued, (unsigned long long)st.peakQueued,
+                 (unsigned long long)st.running, (unsigned long long)st.started, (unsigned long long)st.yields,
+                 WaitPercentileMs(st, 0.5), WaitPercentileMs(st, 0.99), st.maxWaitMs);
+        std::wstring hist = L"  wait ms:";
+        for (size_t b = 0; b < kWaitBuckets; ++b) {
+            if (!st.waitHistogram[b]) continue;
+            const std::wstring edge = b + 1 < kWaitBuckets ? L" <" + std::to_wstring(1u << b)
+                                                           : L" >=" + std::to_wstring(1u << (b - 1));
+            hist += edge + L" " + std::to_wstring(st.waitHistogram[b]);
+        }
+        WriteFrame(ch, { L"report", buf });
+        if (st.started) WriteFrame(ch, { L"report", hist });
+    }
+    WriteFrame(ch, { L"report", L"slots: " + std::to_wstring(lanes.Slots()) });
+}
+
+// "cache: 12 hits, 3 misses, 0 evictions; 2 images, 183.1 of 512.0 MB"
+static void ReportCacheStats(IpcChannel& ch, const DecodedImageCache* cache) {
+    if (!cache) {
+        WriteFrame(ch, { L"report", L"cache: off" });
+        return;
+    }
+    const CacheStats st = cache->Stats();
+    wchar_t buf[160];
+    swprintf(buf, 160, L"cache: %llu hits, %llu misses, %llu evictions; %llu image%ls, %.1f of %.1f MB",
+             (unsigned long long)st.hits, (unsigned long long)st.misses, (unsigned long long)st.evictions,
+             (unsigned long long)st.entries, st.entries == 1 ? L"" : L"s", st.bytes / 1048576.0,
+             st.budget / 1048576.0);
+    WriteFrame(ch, { L"report", buf });
+}
+
+static void ServeClient(IpcChannel& ch, BackendCache& backends, LaneScheduler& lanes, DecodedImageCache* cache,
+                        bool quiet) {
+    std::vector<std::wstring> request;
+    if (!ReadFrame(ch, request) || request.empty()) return;
+    if (request[0] == L"stats") {
+        ReportLaneStats(ch, lanes);
+        ReportCacheStats(ch, cache);
+        WriteFrame(ch, { L"exit", L"0" });
+        return;
+    }
+    if (request.size() < 2 || request[0] != L"run") return;
+    const auto start = std::chrono::steady_clock::now();
+
+    // Workers report concurrently; a client that went away stops receiving but the run finishes,
+    // since every save replaces its target in one step.
+    std::mutex sendMu;
+    bool connected = true;
+    auto send = [&](std::vector<std::wstring> fields) {
+        std::lock_guard<std::mutex> lk(sendMu);
+        if (connected && !WriteFrame(ch, fields)) connected = false;
+    };
+
+    HeadlessContext ctx;
+    ctx.baseDir = request[1];
+    ctx.report = [&](const std::wstring& text) { send({ L"report", text }); };
+    ctx.saved = [&](const std::wstring& path) { send({ L"saved", path }); };
+    ctx.backend = [&](const std::wstring& name, std::wstring& outError) { return backends.Get(name, outError); };
+    ctx.lanes = &lanes;
+    ctx.cache = cache;
+    const int rc = RunLabelCommand(std::vector<std::wstring>(request.begin() + 2, request.end()), ctx);
+    send({ L"exit", std::to_wstring(rc) });
+
+    if (!quiet) {
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        wchar_t buf[64];
+        swprintf(buf, 64, L"exit %d in %.0f ms", rc, ms);
+        Log(L"Served " + ctx.baseDir + L": " + buf + (connected ? L"" : L" (client gone)"));
+    }
+}
+
+int RunService(const std::wstring& backendName, uint64_t cacheBytes, bool quiet) {
+    std::wstring err;
+    BackendCache backends(backendName);
+    // Everything a cold start would pay for happens here, once.
+    Backend* warm = backends.Get(L"", err);
+    if (!warm) {
+        Log(err);
+        return backendName.empty() ? kExitFailed : kExitUsage;
+    }
+    const std::wstring endpoint = LocalEndpoint(kServiceRole);
+    std::unique_ptr<IpcListener> listener = ListenLocal(endpoint, err);
+    if (!listener) {
+        Log(err);
+        return kExitFailed;
+    }
+    if (!quiet) Log(L"Labeling service (" + std::wstring(warm->Name()) + L") listening on " + endpoint);
+    LaneScheduler lanes;
+    std::unique_ptr<DecodedImageCache> cache;
+    if (cacheBytes) cache.reset(new DecodedImageCache(cacheBytes));
+
+    for (;;) {
+        std::unique_ptr<IpcChannel> ch = listener->Accept(err);
+        if (!ch) {
+            if (err.empty()) continue;
+            Log(err);
+            return kExitFailed;
+        }
+        std::thread([&backends, &lanes, &cache, quiet](std::unique_ptr<IpcChannel> client) {
+            ServeClient(*client, backends, lanes, cache.get(), quiet);
+        }, std::move(ch)).detach();
+    }
+}
+
+// Passes the service's messages on to ctx until it sends the exit code.
+static bool Relay(IpcChannel& ch, const HeadlessContext& ctx, int& outExitCode) {
+    std::vector<std::wstring> msg;
+    while (ReadFrame(ch, msg)) {
+        if (msg.size() != 2) continue;
+        if (msg[0] == L"report") {
+            ctx.report(msg[1]);
+        } else if (msg[0] == L"saved") {
+            if (ctx.saved) ctx.saved(msg[1]);
+        } else if (msg[0] == L"exit") {
+            outExitCode = (int)wcstol(msg[1].c_str(), nullptr, 10);
+            return true;
+        }
+    }
+    // Some images may have been written already, so running the command here again is not safe.
+    ctx.report(L"Lost the connection to the labeling service.");
+    outExitCode = kExitFailed;
+    return true;
+}
+
+bool ForwardToService(const std::vector<std::wstring>& args, const HeadlessContext& ctx, int& outExitCode) {
+    std::wstring err;
+    std::unique_ptr<IpcChannel> ch = ConnectLocal(LocalEndpoint(kServiceRole), err);
+    if (!ch) return false;
+    std::vector<std::wstring> request = { L"run", CurrentDirectory() };
+    request.insert(request.end(), args.begin(), args.end());
+    if (!WriteFrame(*ch, request)) return false;
+    return Relay(*ch, ctx, outExitCode);
+}
+
+bool QueryServiceStats(const HeadlessContext& ctx, int& outExitCode) {
+    std::wstring err;
+    std::unique_ptr<IpcChannel> ch = ConnectLocal(LocalEndpoint(kServiceRole), err);
+    if (!ch || !WriteFrame(*ch, { L"stats" })) return false;
+    return Relay(*ch, ctx, outExitCode);
+}
+
+} // namespace piclab
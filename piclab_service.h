@@ -0,0 +1,33 @@
+// piclab_service.h
+// Resident labeling service. One long-lived process keeps its backend started (GDI+ runtime, font
+// choice, encoder list) and runs the command lines that later piclab invocations forward to it over
+// local IPC (piclab_ipc.*), so those invocations pay for process start and argument parsing only.
+
+#pragma once
+
+#include "piclab_cli.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace piclab {
+
+// Listens on LocalEndpoint("service") until the process is killed. backendName ("" = default) is
+// started before the first client is accepted; clients asking for another backend get one that is
+// started on first use and then kept as well. Each client is served on its own thread, and the
+// images of all of them share one LaneScheduler with a slot per hardware thread and one
+// DecodedImageCache of cacheBytes (0 = no cache).
+int RunService(const std::wstring& backendName, uint64_t cacheBytes, bool quiet);
+
+// Hands a labeling command line to a running service, with this process's working directory for
+// relative paths, and relays its messages and saved paths to ctx until it reports the exit code.
+// False, with nothing sent, when no service answers.
+bool ForwardToService(const std::vector<std::wstring>& args, const HeadlessContext& ctx, int& outExitCode);
+
+// Asks a running service for its lane statistics (piclab_lanes.h), one report line per lane and
+// one with its wait histogram, then one line on its decoded-image cache. False when no service
+// answers.
+bool QueryServiceStats(const HeadlessContext& ctx, int& outExitCode);
+
+} // namespace piclab
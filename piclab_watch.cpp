@@ -0,0 +1,539 @@
+// piclab_watch.cpp
+// Hot folder: a FolderWatcher per platform reports names that changed, HotFolder decides when each
+// file is complete, finds its label and hands it to the LabelQueue. inotify and
+// ReadDirectoryChangesW live side by side behind __linux__ and _WIN32, with polling for the rest.
+
+#include "piclab_watch.h"
+#include "piclab_cli.h"
+#include "piclab_codecs.h"
+#include "piclab_io.h"
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <climits>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace piclab {
+
+typedef std::chrono::steady_clock Clock;
+
+// Longest wait for changes while nothing is settling; also the polling interval.
+static const unsigned kIdleWaitMs = 1000;
+// Wait while files are settling, so one is picked up soon after it has gone quiet.
+static const unsigned kSettleTickMs = 50;
+
+// ----------------------------- Watchers -----------------------------
+
+enum class ChangeKind {
+    kWritten, // closed after writing, or moved in complete
+    kChanged, // created or modified; may still be written to
+    kRemoved, // deleted or moved away
+    kLost,    // changes were dropped (event queue overflow); the folder must be looked at again
+};
+
+struct Change {
+    ChangeKind kind;
+    std::wstring name; // file name within the folder; empty for kLost
+};
+
+namespace {
+
+class FolderWatcher {
+public:
+    virtual ~FolderWatcher() = default;
+    // Waits up to timeoutMs for changes and appends them to out. False when watching broke.
+    virtual bool Wait(unsigned timeoutMs, std::vector<Change>& out, std::wstring& outError) = 0;
+};
+
+#if defined(_WIN32)
+
+// ----------------------------- ReadDirectoryChangesW -----------------------------
+
+class DirectoryChangesWatcher : public FolderWatcher {
+public:
+    ~DirectoryChangesWatcher() override {
+        if (dir_ != INVALID_HANDLE_VALUE) {
+            DWORD got = 0;
+            CancelIoEx(dir_, &ov_);
+            GetOverlappedResult(dir_, &ov_, &got, TRUE);
+            CloseHandle(dir_);
+        }
+        if (ov_.hEvent) CloseHandle(ov_.hEvent);
+    }
+
+    bool Open(const std::wstring& dir, std::wstring& outError) {
+        dir_ = CreateFileW(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        ov_.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (dir_ == INVALID_HANDLE_VALUE || !ov_.hEvent) {
+            outError = L"Cannot watch " + dir + L": " + SystemErrorText(GetLastError());
+            return false;
+        }
+        buf_.resize(64 * 1024 / sizeof(DWORD)); // the most a network share accepts
+        return Arm(outError);
+    }
+
+    bool Wait(unsigned timeoutMs, std::vector<Change>& out, std::wstring& outError) override {
+        if (WaitForSingleObject(ov_.hEvent, timeoutMs) != WAIT_OBJECT_0) return true;
+        DWORD got = 0;
+        if (!GetOverlappedResult(dir_, &ov_, &got, FALSE)) {
+            const DWORD e = GetLastError();
+            if (e != ERROR_NOTIFY_ENUM_DIR) {
+                outError = L"Watching failed: " + SystemErrorText(e);
+                return false;
+            }
+            got = 0;
+        }
+        if (got == 0) {
+            out.push_back({ ChangeKind::kLost, L"" }); // more changes than the buffer held
+        } else {
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(buf_.data());
+            for (;;) {
+                const FILE_NOTIFY_INFORMATION* fni = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+                std::wstring name(fni->FileName, fni->FileNameLength / sizeof(WCHAR));
+                switch (fni->Action) {
+                case FILE_ACTION_ADDED:
+                case FILE_ACTION_MODIFIED:
+                case FILE_ACTION_RENAMED_NEW_NAME:
+                    out.push_back({ ChangeKind::kChanged, name });
+                    break;
+                case FILE_ACTION_REMOVED:
+                case FILE_ACTION_RENAMED_OLD_NAME:
+                    out.push_back({ ChangeKind::kRemoved, name });
+                    break;
+                }
+                if (!fni->NextEntryOffset) break;
+                p += fni->NextEntryOffset;
+            }
+        }
+        ResetEvent(ov_.hEvent);
+        return Arm(outError);
+    }
+
+private:
+    // There is no close notification; HotFolder settles every file by time and sharing instead.
+    bool Arm(std::wstring& outError) {
+        const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+        if (!ReadDirectoryChangesW(dir_, buf_.data(), (DWORD)(buf_.size() * sizeof(DWORD)), FALSE, filter, nullptr,
+                                   &ov_, nullptr)) {
+            outError = L"Watching failed: " + SystemErrorText(GetLastError());
+            return false;
+        }
+        return true;
+    }
+
+    HANDLE dir_{INVALID_HANDLE_VALUE};
+    OVERLAPPED ov_{};
+    std::vector<DWORD> buf_; // DWORD-aligned, as the notifications require
+};
+
+// A writer that still has the file open keeps others from opening it exclusively.
+static bool NobodyHasOpen(const std::wstring& path) {
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return GetLastError() != ERROR_SHARING_VIOLATION;
+    CloseHandle(h);
+    return true;
+}
+
+#elif defined(__linux__)
+
+// ----------------------------- inotify -----------------------------
+
+class InotifyWatcher : public FolderWatcher {
+public:
+    ~InotifyWatcher() override {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool Open(const std::wstring& dir, std::wstring& outError) {
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        // No IN_MODIFY: it fires for every write, and IN_CREATE already marks a file as in progress.
+        const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF |
+                              IN_MOVE_SELF | IN_ONLYDIR;
+        if (fd_ < 0 || inotify_add_watch(fd_, ToUtf8(dir).c_str(), mask) < 0) {
+            outError = L"Cannot watch " + dir + L": " + SystemErrorText(LastSystemError());
+            return false;
+        }
+        return true;
+    }
+
+    bool Wait(unsigned timeoutMs, std::vector<Change>& out, std::wstring& outError) override {
+        pollfd pfd = { fd_, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)timeoutMs) <= 0) return true;
+        alignas(inotify_event) char buf[64 * 1024];
+        for (;;) {
+            const ssize_t n = read(fd_, buf, sizeof(buf));
+            if (n <= 0) return n == 0 || errno == EAGAIN || errno == EINTR;
+            for (ssize_t at = 0; at < n;) {
+                const inotify_event* ev = reinterpret_cast<const inotify_event*>(buf + at);
+                at += sizeof(inotify_event) + ev->len;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    out.push_back({ ChangeKind::kLost, L"" });
+                    continue;
+                }
+                if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    outError = L"The watched folder was removed or moved.";
+                    return false;
+                }
+                if ((ev->mask & IN_ISDIR) || !ev->len) continue;
+                const std::wstring name = FromUtf8(ev->name);
+                if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    out.push_back({ ChangeKind::kWritten, name });
+                } else if (ev->mask & IN_CREATE) {
+                    out.push_back({ ChangeKind::kChanged, name });
+                } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    out.push_back({ ChangeKind::kRemoved, name });
+                }
+            }
+        }
+    }
+
+private:
+    int fd_{-1};
+};
+
+static bool NobodyHasOpen(const std::wstring& path) {
+    (void)path;
+    return true;
+}
+
+#else
+
+// ----------------------------- Polling -----------------------------
+
+// Lists the folder every interval and reports files whose size or write time moved.
+class PollingWatcher : public FolderWatcher {
+public:
+    bool Open(const std::wstring& dir, std::wstring& outError) {
+        dir_ = dir;
+        std::vector<Change> ignored;
+        return Scan(ignored, outError);
+    }
+
+    bool Wait(unsigned timeoutMs, std::vector<Change>& out, std::wstring& outError) override {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+        return Scan(out, outError);
+    }
+
+private:
+    bool Scan(std::vector<Change>& out, std::wstring& outError) {
+        std::vector<std::wstring> names;
+        if (!ListDirectoryFiles(dir_, names, outError)) return false;
+        std::map<std::wstring, FileStamp> now;
+        for (const std::wstring& name : names) {
+            FileStamp stamp;
+            if (!GetFileStamp(ResolvePath(dir_, name), stamp)) continue;
+            now[name] = stamp;
+            auto it = seen_.find(name);
+            if (it == seen_.end() || it->second != stamp) out.push_back({ ChangeKind::kChanged, name });
+        }
+        for (const auto& old : seen_) {
+            if (!now.count(old.first)) out.push_back({ ChangeKind::kRemoved, old.first });
+        }
+        seen_.swap(now);
+        return true;
+    }
+
+    std::wstring dir_;
+    std::map<std::wstring, FileStamp> seen_;
+};
+
+static bool NobodyHasOpen(const std::wstring& path) {
+    (void)path;
+    return true;
+}
+
+#endif
+
+std::unique_ptr<FolderWatcher> WatchFolder(const std::wstring& dir, std::wstring& outError) {
+#if defined(_WIN32)
+    std::unique_ptr<DirectoryChangesWatcher> w(new DirectoryChangesWatcher());
+#elif defined(__linux__)
+    std::unique_ptr<InotifyWatcher> w(new InotifyWatcher());
+#else
+    std::unique_ptr<PollingWatcher> w(new PollingWatcher());
+#endif
+    if (!w->Open(dir, outError)) return nullptr;
+    return std::unique_ptr<FolderWatcher>(std::move(w));
+}
+
+} // namespace
+
+// ----------------------------- Label rules -----------------------------
+
+bool CheckLabelRule(const LabelRule& rule, std::wstring& outError) {
+    if (rule.pattern.empty()) return true;
+    try {
+        std::wregex re(rule.pattern, std::regex::ECMAScript);
+    } catch (const std::regex_error& e) {
+        outError = L"--label-pattern is not a valid regex: " + FromUtf8(e.what());
+        return false;
+    }
+    return true;
+}
+
+// First line of a sidecar, without a UTF-8 byte order mark and surrounding blanks.
+static std::wstring ReadSidecarLabel(const std::wstring& path) {
+    std::vector<uint8_t> bytes;
+    std::wstring err;
+    if (!ReadFileBytes(path, bytes, err)) return L"";
+    std::string text(bytes.begin(), bytes.end());
+    if (text.compare(0, 3, "\xEF\xBB\xBF") == 0) text.erase(0, 3);
+    text = text.substr(0, text.find_first_of("\r\n"));
+    const size_t first = text.find_first_not_of(" \t");
+    if (first == std::string::npos) return L"";
+    return FromUtf8(text.substr(first, text.find_last_not_of(" \t") + 1 - first));
+}
+
+// ----------------------------- Hot folder -----------------------------
+
+namespace {
+
+class HotFolder {
+public:
+    HotFolder(Backend& backend, const WatchOptions& watch, const SaveOptions& save,
+              const std::function<void(const std::wstring& text)>& report)
+        : backend_(backend), watch_(watch), save_(save), report_(report) {
+        if (!watch_.rule.pattern.empty()) pattern_.reset(new std::wregex(watch_.rule.pattern, std::regex::ECMAScript));
+    }
+
+    int Run();
+
+private:
+    // A file seen changing that has not been handed on yet. Only the watching thread uses these.
+    struct Pending {
+        FileStamp stamp;
+        Clock::time_point changed; // when stamp last moved
+        Clock::time_point complete{}; // when it first counted as written, for the sidecar wait
+        bool closed{false};        // the writer closed it and it has not changed since
+    };
+
+    void Note(const Change& change, Clock::time_point now);
+    void Rescan(Clock::time_point now);
+    void Promote(Clock::time_point now);
+    // False with wait set while the sidecar may still come, else with the label left empty.
+    bool FindLabel(const std::wstring& path, const Pending& p, Clock::time_point now, std::wstring& label,
+                   bool& wait) const;
+    void Done(const BatchItem& item, const BatchResult& r);
+
+    Backend& backend_;
+    WatchOptions watch_;
+    SaveOptions save_;
+    std::function<void(const std::wstring&)> report_;
+    std::unique_ptr<std::wregex> pattern_;
+    std::map<std::wstring, Pending> pending_;
+
+    std::mutex mu_; // the maps below are shared with the workers
+    // Files as they were when labeled, written by us or found not to be images; a change that
+    // leaves a file like this is our own doing or old news.
+    std::map<std::wstring, FileStamp> known_;
+    std::map<std::wstring, std::wstring> outputs_; // image being labeled -> the file it will write
+    std::map<std::wstring, unsigned> busy_;        // sources and outputs of images being labeled
+
+    std::unique_ptr<LabelQueue> queue_; // last: finishes its images while the maps are still there
+};
+
+void HotFolder::Note(const Change& change, Clock::time_point now) {
+    if (change.kind == ChangeKind::kLost) {
+        Rescan(now);
+        return;
+    }
+    const std::wstring path = ResolvePath(watch_.dir, change.name);
+    if (IsTempSiblingPath(path)) return; // an overwrite in progress, ours or another piclab's
+    if (change.kind == ChangeKind::kRemoved) {
+        pending_.erase(path);
+        std::lock_guard<std::mutex> lk(mu_);
+        known_.erase(path);
+        return;
+    }
+    Pending& p = pending_[path];
+    if (!GetFileStamp(path, p.stamp)) {
+        pending_.erase(path); // already gone again
+        return;
+    }
+    p.changed = now;
+    p.closed = change.kind == ChangeKind::kWritten;
+}
+
+// After lost changes every file in the folder is a candidate; the ones that match known_ drop out.
+void HotFolder::Rescan(Clock::time_point now) {
+    std::vector<std::wstring> names;
+    std::wstring err;
+    if (!ListDirectoryFiles(watch_.dir, names, err)) {
+        report_(err);
+        return;
+    }
+    for (const std::wstring& name : names) {
+        if (!pending_.count(ResolvePath(watch_.dir, name))) Note({ ChangeKind::kChanged, name }, now);
+    }
+}
+
+bool HotFolder::FindLabel(const std::wstring& path, const Pending& p, Clock::time_point now, std::wstring& label,
+                          bool& wait) const {
+    wait = false;
+    const LabelRule& rule = watch_.rule;
+    if (!rule.sidecarExt.empty()) {
+        const std::wstring sidecar = PathWithExtension(path, rule.sidecarExt);
+        // A sidecar that is still being written is waited for like an image.
+        if (FileExists(sidecar) && !pending_.count(sidecar)) label = ReadSidecarLabel(sidecar);
+        if (!label.empty()) return true;
+        if (now - p.complete < std::chrono::milliseconds(kSidecarWaitMs)) {
+            wait = true;
+            return false;
+        }
+    }
+    if (pattern_) {
+        const size_t slash = path.find_last_of(L"\\/");
+        const std::wstring name = slash == std::wstring::npos ? path : path.substr(slash + 1);
+        std::wsmatch m;
+        if (std::regex_search(name, m, *pattern_)) label = m.size() > 1 && m[1].matched ? m[1].str() : m[0].str();
+        if (!label.empty()) return true;
+    }
+    label = rule.fixed;
+    return !label.empty();
+}
+
+void HotFolder::Promote(Clock::time_point now) {
+    for (auto it = pending_.begin(); it != pending_.end();) {
+        const std::wstring& path = it->first;
+        Pending& p = it->second;
+        FileStamp stamp;
+        if (!GetFileStamp(path, stamp)) {
+            it = pending_.erase(it);
+            continue;
+        }
+        if (stamp != p.stamp) {
+            p.stamp = stamp;
+            p.changed = now;
+            p.closed = false;
+            ++it;
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            // Being labeled or written by us: look again once that is done.
+            if (busy_.count(path)) {
+                ++it;
+                continue;
+            }
+            auto known = known_.find(path);
+            if (known != known_.end() && known->second == stamp) {
+                it = pending_.erase(it);
+                continue;
+            }
+        }
+        const bool quiet = now - p.changed >= std::chrono::milliseconds(watch_.settleMs);
+        if (!(p.closed || quiet) || !NobodyHasOpen(path)) {
+            ++it;
+            continue;
+        }
+        if (p.complete == Clock::time_point()) p.complete = now;
+
+        std::wstring label;
+        bool wait = false;
+        const bool image = DetectFileFormat(path) != ImageFormat::kUnknown;
+        if (image && !FindLabel(path, p, now, label, wait) && wait) {
+            ++it;
+            continue;
+        }
+        std::lock_guard<std::mutex> lk(mu_);
+        known_[path] = stamp;
+        if (!image) {
+            it = pending_.erase(it); // a sidecar or anything else that is not a picture
+            continue;
+        }
+        if (label.empty()) {
+            report_(L"No label for " + path + L"; left alone.");
+            it = pending_.erase(it);
+            continue;
+        }
+        const std::wstring output = PlannedSavePath(path, save_);
+        outputs_[path] = output;
+        ++busy_[path];
+        if (!output.empty() && output != path) ++busy_[output];
+        queue_->Submit({ path, label });
+        it = pending_.erase(it);
+    }
+}
+
+void HotFolder::Done(const BatchItem& item, const BatchResult& r) {
+    if (r.missing) {
+        report_(L"File not found: " + item.path);
+    } else if (!r.ok) {
+        report_(L"Failed to write image: " + item.path + L": " + r.error);
+    } else if (!watch_.quiet) {
+        report_(L"Saved: " + r.savedPath);
+    }
+    std::lock_guard<std::mutex> lk(mu_);
+    FileStamp stamp;
+    if (r.ok && GetFileStamp(r.savedPath, stamp)) known_[r.savedPath] = stamp;
+    const std::wstring output = outputs_[item.path];
+    outputs_.erase(item.path);
+    for (const std::wstring& p : { item.path, output }) {
+        auto it = busy_.find(p);
+        if (it != busy_.end() && --it->second == 0) busy_.erase(it);
+    }
+}
+
+int HotFolder::Run() {
+    std::wstring err;
+    std::unique_ptr<FolderWatcher> watcher = WatchFolder(watch_.dir, err);
+    if (!watcher) {
+        report_(err);
+        return kExitFailed;
+    }
+    // What is there already is not new; it only gets labeled if it is written again.
+    std::vector<std::wstring> names;
+    if (!ListDirectoryFiles(watch_.dir, names, err)) {
+        report_(err);
+        return kExitFailed;
+    }
+    for (const std::wstring& name : names) {
+        const std::wstring path = ResolvePath(watch_.dir, name);
+        FileStamp stamp;
+        if (GetFileStamp(path, stamp)) known_[path] = stamp;
+    }
+    queue_.reset(new LabelQueue(backend_, save_, watch_.jobs,
+                                [this](const BatchItem& item, const BatchResult& r) { Done(item, r); }));
+    if (!watch_.quiet) report_(L"Watching " + watch_.dir + L" (" + backend_.Name() + L" backend)");
+
+    std::vector<Change> changes;
+    for (;;) {
+        changes.clear();
+        if (!watcher->Wait(pending_.empty() ? kIdleWaitMs : kSettleTickMs, changes, err)) {
+            report_(err);
+            return kExitFailed;
+        }
+        const Clock::time_point now = Clock::now();
+        for (const Change& c : changes) Note(c, now);
+        Promote(now);
+    }
+}
+
+} // namespace
+
+int RunWatch(Backend& backend, const WatchOptions& watch, const SaveOptions& save,
+             const std::function<void(const std::wstring& text)>& report) {
+    if (!IsDirectory(watch.dir)) {
+        report(L"Not a folder: " + watch.dir);
+        return kExitNotFound;
+    }
+    HotFolder folder(backend, watch, save, report);
+    return folder.Run();
+}
+
+} // namespace piclab
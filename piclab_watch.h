@@ -0,0 +1,48 @@
+// piclab_watch.h
+// Hot-folder mode (--watch): images that land in a folder are labeled as soon as they are
+// complete. Arrivals come from inotify on Linux and ReadDirectoryChangesW on Windows; elsewhere the
+// folder is polled. A file is complete when its writer closes it (inotify only) or when its size
+// and write time have stayed the same for the settle time and, on Windows, nobody holds it open.
+// Complete images go straight to a LabelQueue, so a burst is labeled on every core while the
+// watcher keeps taking in further arrivals.
+
+#pragma once
+
+#include "piclab_core.h"
+
+#include <functional>
+#include <string>
+
+namespace piclab {
+
+// Quiet time after which a file that was not seen being closed counts as written.
+const unsigned kDefaultSettleMs = 1000;
+// How long a complete image waits for its sidecar before the other label rules are tried.
+const unsigned kSidecarWaitMs = 5000;
+
+// Where a watched image's label comes from. The rules are tried in this order and the first that
+// yields a non-empty label wins; an image none of them labels is reported and left alone.
+struct LabelRule {
+    std::wstring sidecarExt; // first line of "<name>.<ext>" beside the image, UTF-8
+    std::wstring pattern;    // ECMAScript regex searched in the file name: group 1, else the match
+    std::wstring fixed;      // the same text for every image
+};
+
+// False with outError set when rule.pattern is not a valid regex.
+bool CheckLabelRule(const LabelRule& rule, std::wstring& outError);
+
+struct WatchOptions {
+    std::wstring dir;
+    LabelRule rule;
+    unsigned settleMs{kDefaultSettleMs};
+    unsigned jobs{0}; // worker threads, 0 = all cores
+    bool quiet{false};
+};
+
+// Labels every image written or moved into watch.dir from now on with save, until the process is
+// killed. Files already there are left alone unless they are written again, and so are piclab's
+// own outputs and temp files. Returns an exit code only when the folder cannot be watched.
+int RunWatch(Backend& backend, const WatchOptions& watch, const SaveOptions& save,
+             const std::function<void(const std::wstring& text)>& report);
+
+} // namespace piclab